@@ -84,8 +84,10 @@ namespace SPTAG
             int m_iNumberOfInitialDynamicPivots;
             int m_iNumberOfOtherDynamicPivots;
             int m_iHashTableExp;
+            int m_iBatchSearchBlock;
         public:
             static thread_local std::shared_ptr<COMMON::WorkSpace> m_workspace;
+            static thread_local std::vector<std::shared_ptr<COMMON::WorkSpace>> m_batchWorkspaces;
         public:
             Index()
             {
@@ -152,8 +154,13 @@ namespace SPTAG
             ErrorCode LoadIndexData(const std::vector<std::shared_ptr<Helper::DiskIO>>& p_indexStreams);
             ErrorCode LoadIndexDataFromMemory(const std::vector<ByteArray>& p_indexBlobs);
 
+            ErrorCode SaveIndexDataDelta(const std::vector<std::shared_ptr<Helper::DiskIO>>& p_deltaStreams);
+            ErrorCode LoadIndexDataDelta(const std::vector<std::shared_ptr<Helper::DiskIO>>& p_deltaStreams);
+            ErrorCode MergeIndexDataDelta(const std::vector<std::string>& p_indexFiles, const std::vector<std::string>& p_deltaFiles) const;
+
             ErrorCode BuildIndex(const void* p_data, SizeType p_vectorNum, DimensionType p_dimension, bool p_normalized = false, bool p_shareOwnership = false);
             ErrorCode SearchIndex(QueryResult &p_query, bool p_searchDeleted = false) const;
+            ErrorCode SearchIndexBatch(std::vector<QueryResult*>& p_queries, bool p_searchDeleted = false) const;
             ErrorCode RefineSearchIndex(QueryResult &p_query, bool p_searchDeleted = false) const;
             ErrorCode SearchTree(QueryResult &p_query) const;
             ErrorCode AddIndex(const void* p_data, SizeType p_vectorNum, DimensionType p_dimension, std::shared_ptr<MetadataSet> p_metadataSet, bool p_withMetaIndex = false, bool p_normalized = false);
@@ -175,6 +182,18 @@ namespace SPTAG
 
             template <bool(*notDeleted)(const COMMON::Labelset&, SizeType), bool(*isDup)(COMMON::QueryResultSet<T>&, SizeType, float), bool(*checkFilter)(const std::shared_ptr<MetadataSet>&, SizeType, std::function<bool(const ByteArray&)>)>
             void Search(COMMON::QueryResultSet<T>& p_query, COMMON::WorkSpace& p_space, std::function<bool(const ByteArray&)> filterFunc) const;
+
+            template <bool(*notDeleted)(const COMMON::Labelset&, SizeType), bool(*isDup)(COMMON::QueryResultSet<T>&, SizeType, float)>
+            void SearchBlock(COMMON::QueryResultSet<T>** p_queries, COMMON::WorkSpace** p_spaces, int p_count) const;
+
+            // Expands one popped node of a search, returns false once the search can stop.
+            template <bool(*notDeleted)(const COMMON::Labelset&, SizeType), bool(*isDup)(COMMON::QueryResultSet<T>&, SizeType, float), bool(*checkFilter)(const std::shared_ptr<MetadataSet>&, SizeType, std::function<bool(const ByteArray&)>)>
+            bool SearchStep(COMMON::QueryResultSet<T>& p_query, COMMON::WorkSpace& p_space, const NodeDistPair& gnode, const SizeType* node, std::function<bool(const ByteArray&)> filterFunc) const;
+
+            const SizeType* PrefetchNeighbors(SizeType p_node) const;
+
+            // Puts p_node into the trees and points the graph at any cluster of duplicates the insert moved.
+            void InsertTreeNode(SizeType p_node);
         };
     } // namespace BKT
 } // namespace SPTAG
@@ -15,6 +15,7 @@ DefineBKTParameter(m_pTrees.m_iBKTKmeansK, int, 32L, "BKTKmeansK")
 DefineBKTParameter(m_pTrees.m_iBKTLeafSize, int, 8L, "BKTLeafSize")
 DefineBKTParameter(m_pTrees.m_iSamples, int, 1000L, "Samples")
 DefineBKTParameter(m_pTrees.m_fBalanceFactor, float, 100.0F, "BKTLambdaFactor")
+DefineBKTParameter(m_pTrees.m_bIncrementalInsert, bool, true, "BKTIncrementalInsert") // Insert added samples into the trees instead of rebuilding them
 
 DefineBKTParameter(m_pGraph.m_iTPTNumber, int, 32L, "TPTNumber")
 DefineBKTParameter(m_pGraph.m_iTPTLeafSize, int, 2000L, "TPTLeafSize")
@@ -47,6 +48,7 @@ DefineBKTParameter(m_iThresholdOfNumberOfContinuousNoBetterPropagation, int, 3L,
 DefineBKTParameter(m_iNumberOfInitialDynamicPivots, int, 50L, "NumberOfInitialDynamicPivots")
 DefineBKTParameter(m_iNumberOfOtherDynamicPivots, int, 4L, "NumberOfOtherDynamicPivots")
 DefineBKTParameter(m_iHashTableExp, int, 2L, "HashTableExponent")
+DefineBKTParameter(m_iBatchSearchBlock, int, 8L, "BatchSearchBlock") // Queries SearchIndexBatch walks the graph for together
 DefineBKTParameter(m_iDataBlockSize, int, 1024 * 1024, "DataBlockSize")
 DefineBKTParameter(m_iDataCapacity, int, MaxSize, "DataCapacity")
 DefineBKTParameter(m_iMetaRecordSize, int, 10, "MetaRecordSize")
@@ -50,15 +50,22 @@ namespace SPTAG
             float* weightedCounts;
             float* newWeightedCounts;
             std::function<float(const T*, const T*, DimensionType)> fComputeDistance;
-            const std::shared_ptr<IQuantizer>& m_pQuantizer;
+            std::shared_ptr<IQuantizer> m_pQuantizer;
+            // Assignment computes L2 as |x|^2 - 2x.c + |c|^2 and cosine from x.c, a tile of points by a block of
+            // centers at a time. nullptr for quantized data, which goes through fComputeDistance.
+            DotProductTileCalcReturn fComputeDotTile;
+            std::vector<float> centersT;
+            std::vector<float> centerNorms;
 
             KmeansArgs(int k, DimensionType dim, SizeType datasize, int threadnum, DistCalcMethod distMethod, const std::shared_ptr<IQuantizer>& quantizer = nullptr) : _K(k), _DK(k), _D(dim), _RD(dim), _T(threadnum), _M(distMethod), m_pQuantizer(quantizer){
                 if (m_pQuantizer) {
                     _RD = m_pQuantizer->ReconstructDim();
                     fComputeDistance = m_pQuantizer->DistanceCalcSelector<T>(distMethod);
+                    fComputeDotTile = nullptr;
                 }
                 else {
                     fComputeDistance = COMMON::DistanceCalcSelector<T>(distMethod);
+                    fComputeDotTile = COMMON::DotProductTileCalcSelector();
                 }
 
                 centers = (T*)ALIGN_ALLOC(sizeof(T) * _K * _D);
@@ -223,6 +230,21 @@ namespace SPTAG
             const bool updateCenters, float lambda) {
             float currDist = 0;
             SizeType subsize = (last - first - 1) / args._T + 1;
+            const bool isL2 = (args._M == DistCalcMethod::L2);
+            const float cosineBase = (float)(Utils::GetBase<T>() * Utils::GetBase<T>());
+            // Centers are transposed to dimension-major floats, padded to whole tiles of 16 with zeros.
+            const int centerStride = (args._DK + 15) / 16 * 16;
+            if (args.fComputeDotTile != nullptr) {
+                args.centersT.assign((size_t)args._D * centerStride, 0);
+                args.centerNorms.assign(centerStride, 0);
+                for (int k = 0; k < args._DK; k++) {
+                    const T* center = args.centers + k * args._D;
+                    for (DimensionType j = 0; j < args._D; j++) {
+                        args.centersT[(size_t)j * centerStride + k] = (float)center[j];
+                        args.centerNorms[k] += (float)center[j] * (float)center[j];
+                    }
+                }
+            }
 
 #pragma omp parallel for num_threads(args._T) shared(data, indices) reduction(+:currDist)
             for (int tid = 0; tid < args._T; tid++)
@@ -238,38 +260,84 @@ namespace SPTAG
                 R* reconstructVector = nullptr;
                 if (args.m_pQuantizer) reconstructVector = (R*)ALIGN_ALLOC(args.m_pQuantizer->ReconstructSize());
 
-                for (SizeType i = istart; i < iend; i++) {
-                    int clusterid = 0;
-                    float smallestDist = MaxDist;
-                    for (int k = 0; k < args._DK; k++) {
-                        float dist = args.fComputeDistance(data[indices[i]], args.centers + k*args._D, args._D) + lambda*args.counts[k];
-                        if (dist > -MaxDist && dist < smallestDist) {
-                            clusterid = k; smallestDist = dist;
+                // Points are assigned a tile at a time against blocks of centers that stay in cache while the
+                // whole tile is scored, GEMM style. Tile rows past the end of the range are left zero.
+                const int pointTile = 32, centerTile = 64;
+                int tileLabel[pointTile];
+                float tileDist[pointTile], pointNorms[pointTile];
+                std::vector<float> pointRows, dots;
+                if (args.fComputeDotTile != nullptr) {
+                    pointRows.assign((size_t)pointTile * args._D, 0);
+                    dots.resize(pointTile * centerTile);
+                }
+                for (SizeType tileStart = istart; tileStart < iend; tileStart += pointTile) {
+                    int tileSize = (int)min((SizeType)pointTile, iend - tileStart);
+                    for (int p = 0; p < tileSize; p++) {
+                        tileLabel[p] = 0;
+                        tileDist[p] = MaxDist;
+                        if (args.fComputeDotTile == nullptr) continue;
+                        const T* point = (const T*)data[indices[tileStart + p]];
+                        float* row = pointRows.data() + (size_t)p * args._D;
+                        pointNorms[p] = 0;
+                        for (DimensionType j = 0; j < args._D; j++) {
+                            row[j] = (float)point[j];
+                            pointNorms[p] += row[j] * row[j];
                         }
                     }
-                    args.label[i] = clusterid;
-                    inewCounts[clusterid]++;
-                    iweightedCounts[clusterid] += smallestDist;
-                    idist += smallestDist;
-                    if (updateCenters) {
-                        if (args.m_pQuantizer) {
-                            args.m_pQuantizer->ReconstructVector((const uint8_t*)data[indices[i]], reconstructVector);
+                    int tileRows = (tileSize + 7) / 8 * 8;
+                    if (args.fComputeDotTile != nullptr && tileSize < pointTile) {
+                        std::fill(pointRows.begin() + (size_t)tileSize * args._D, pointRows.begin() + (size_t)tileRows * args._D, 0.0f);
+                    }
+
+                    for (int kStart = 0; kStart < args._DK; kStart += centerTile) {
+                        int kNum = min(centerTile, args._DK - kStart);
+                        int kCols = min(centerTile, centerStride - kStart);
+                        if (args.fComputeDotTile != nullptr) {
+                            args.fComputeDotTile(pointRows.data(), tileRows, args.centersT.data() + kStart, kCols, centerStride, args._D, dots.data());
                         }
-                        else {
-                            reconstructVector = (R*)data[indices[i]];
+                        for (int p = 0; p < tileSize; p++) {
+                            const float* pointDots = dots.data() + p * kCols;
+                            for (int k = 0; k < kNum; k++) {
+                                float dist;
+                                if (args.fComputeDotTile == nullptr) dist = args.fComputeDistance(data[indices[tileStart + p]], args.centers + (kStart + k) * args._D, args._D);
+                                else if (isL2) dist = max(0.0f, pointNorms[p] + args.centerNorms[kStart + k] - 2 * pointDots[k]);
+                                else dist = cosineBase - pointDots[k];
+                                dist += lambda*args.counts[kStart + k];
+                                if (dist > -MaxDist && dist < tileDist[p]) {
+                                    tileLabel[p] = kStart + k; tileDist[p] = dist;
+                                }
+                            }
                         }
-                        float* center = inewCenters + clusterid*args._RD;
-                        for (DimensionType j = 0; j < args._RD; j++) center[j] += reconstructVector[j];
+                    }
 
-                        if (smallestDist > iclusterDist[clusterid]) {
-                            iclusterDist[clusterid] = smallestDist;
-                            iclusterIdx[clusterid] = indices[i];
+                    for (int p = 0; p < tileSize; p++) {
+                        SizeType i = tileStart + p;
+                        int clusterid = tileLabel[p];
+                        float smallestDist = tileDist[p];
+                        args.label[i] = clusterid;
+                        inewCounts[clusterid]++;
+                        iweightedCounts[clusterid] += smallestDist;
+                        idist += smallestDist;
+                        if (updateCenters) {
+                            if (args.m_pQuantizer) {
+                                args.m_pQuantizer->ReconstructVector((const uint8_t*)data[indices[i]], reconstructVector);
+                            }
+                            else {
+                                reconstructVector = (R*)data[indices[i]];
+                            }
+                            float* center = inewCenters + clusterid*args._RD;
+                            for (DimensionType j = 0; j < args._RD; j++) center[j] += reconstructVector[j];
+
+                            if (smallestDist > iclusterDist[clusterid]) {
+                                iclusterDist[clusterid] = smallestDist;
+                                iclusterIdx[clusterid] = indices[i];
+                            }
                         }
-                    }
-                    else {
-                        if (smallestDist <= iclusterDist[clusterid]) {
-                            iclusterDist[clusterid] = smallestDist;
-                            iclusterIdx[clusterid] = indices[i];
+                        else {
+                            if (smallestDist <= iclusterDist[clusterid]) {
+                                iclusterDist[clusterid] = smallestDist;
+                                iclusterIdx[clusterid] = indices[i];
+                            }
                         }
                     }
                 }
@@ -519,9 +587,12 @@ break;
 
             inline SizeType size() const { return (SizeType)m_pTreeRoots.size(); }
             
+            // Samples in the last tree. Its root counts them unless the whole tree is one cluster of duplicates,
+            // node slots are no measure since inserts append theirs behind all the trees.
             inline SizeType sizePerTree() const {
                 std::shared_lock<std::shared_timed_mutex> lock(*m_lock);
-                return (SizeType)m_pTreeRoots.size() - m_pTreeStart.back(); 
+                const BKTNode& root = m_pTreeRoots[m_pTreeStart.back()];
+                return (root.childStart < 0) ? root.childEnd + root.childStart + 1 : root.centerid;
             }
 
             inline const std::unordered_map<SizeType, SizeType>& GetSampleMap() const { return m_pSampleCenterMap; }
@@ -536,6 +607,49 @@ break;
                 m_pTreeRoots.swap(newTrees.m_pTreeRoots);
                 m_pTreeStart.swap(newTrees.m_pTreeStart);
                 m_pSampleCenterMap.swap(newTrees.m_pSampleCenterMap);
+                m_version++;
+            }
+
+            // Puts sample p_id into every tree without a rebuild. It goes down to the closest leaf and joins its
+            // siblings while they number less than BKTKmeansK, otherwise that leaf becomes the parent of p_id. A copy
+            // of a duplicate cluster's center joins that cluster instead. The descent runs under the shared lock and
+            // is only redone under the exclusive one if another insert or a rebuild landed in between, so searches
+            // stall just for the few node writes. p_moved is told the center and new node of every cluster of duplicates
+            // that moved, after the lock is released, so the graph can follow it.
+            template <typename T>
+            void InsertNode(const Dataset<T>& data, SizeType p_id, std::function<float(const T*, const T*, DimensionType)> fComputeDistance,
+                const std::function<void(SizeType, SizeType)>& p_moved = nullptr)
+            {
+                std::vector<std::pair<SizeType, SizeType>> moved;
+                for (int i = 0; i < m_iTreeNumber; i++) {
+                    std::pair<SizeType, SizeType> target;
+                    std::uint64_t version;
+                    {
+                        std::shared_lock<std::shared_timed_mutex> lock(*m_lock);
+                        version = m_version;
+                        target = FindInsertTarget(data, i, p_id, fComputeDistance);
+                    }
+
+                    std::unique_lock<std::shared_timed_mutex> lock(*m_lock);
+                    if (version != m_version) target = FindInsertTarget(data, i, p_id, fComputeDistance);
+                    if (target.first < 0) continue;
+
+                    if (target.second < 0) {
+                        AppendChild(target.first, p_id, moved);
+                        if (m_pTreeRoots[target.first].childStart < 0) m_pSampleCenterMap[p_id] = m_pTreeRoots[target.first].centerid;
+                    }
+                    else {
+                        SizeType start = AllocateChildren(0);
+                        m_pTreeRoots[start] = BKTNode(p_id);
+                        m_pTreeRoots[target.second].childStart = start;
+                        m_pTreeRoots[target.second].childEnd = start + 1;
+                    }
+                    m_pTreeRoots[m_pTreeStart[i]].centerid++;
+                    m_version++;
+                }
+                if (p_moved != nullptr) {
+                    for (auto& move : moved) p_moved(move.first, move.second);
+                }
             }
 
             template <typename T>
@@ -630,6 +744,122 @@ break;
             ErrorCode SaveTrees(std::shared_ptr<Helper::DiskIO> p_out) const
             {
                 std::shared_lock<std::shared_timed_mutex> lock(*m_lock);
+                return WriteTrees(p_out);
+            }
+
+            // The trees are small next to the graph, so a delta is the full trees framed as one record, appended
+            // only when they changed since the last delta (null p_out: since now).
+            ErrorCode SaveTreesDelta(std::shared_ptr<Helper::DiskIO> p_out)
+            {
+                std::shared_lock<std::shared_timed_mutex> lock(*m_lock);
+                if (p_out != nullptr && m_version != m_persistedVersion) {
+                    std::uint64_t bytes = BufferSize();
+                    IOBINARY(p_out, WriteBinary, sizeof(bytes), (char*)&bytes);
+                    ErrorCode ret = WriteTrees(p_out);
+                    if (ret != ErrorCode::Success) return ret;
+                }
+                m_persistedVersion = m_version;
+                return ErrorCode::Success;
+            }
+
+            // The last record wins.
+            ErrorCode LoadTreesDeltas(std::shared_ptr<Helper::DiskIO> p_in)
+            {
+                std::string record;
+                while (p_in != nullptr && ReadDeltaRecord(p_in, record)) {
+                    ErrorCode ret = LoadTrees(&record[0]);
+                    if (ret != ErrorCode::Success) return ret;
+                }
+                m_persistedVersion = m_version;
+                return ErrorCode::Success;
+            }
+
+            static ErrorCode MergeDeltas(const std::string& p_baseFile, const std::string& p_deltaFile)
+            {
+                auto in = f_createIO();
+                if (in == nullptr || !in->Initialize(p_deltaFile.c_str(), std::ios::binary | std::ios::in)) return ErrorCode::FailedOpenFile;
+                std::string record, last;
+                while (ReadDeltaRecord(in, record)) last.swap(record);
+                if (last.empty()) return ErrorCode::Success;
+
+                std::string mergeFile = p_baseFile + ".merge";
+                {
+                    auto out = f_createIO();
+                    if (out == nullptr || !out->Initialize(mergeFile.c_str(), std::ios::binary | std::ios::out)) return ErrorCode::FailedCreateFile;
+                    IOBINARY(out, WriteBinary, last.size(), last.data());
+                }
+                if (!ReplaceDeltaBase(mergeFile, p_baseFile)) return ErrorCode::FailedCreateFile;
+                return ErrorCode::Success;
+            }
+
+        private:
+            // Marks the unused tail of a child range, which the range can grow into in place.
+            static const SizeType FreeSlot = -2;
+
+            // The node whose children p_id joins and, if that node is full, its leaf child that takes p_id instead.
+            // The node is a cluster of duplicates when p_id copies its center, (-1, -1) when the whole tree is one.
+            template <typename T>
+            std::pair<SizeType, SizeType> FindInsertTarget(const Dataset<T>& data, int p_tree, SizeType p_id, std::function<float(const T*, const T*, DimensionType)>& fComputeDistance) const
+            {
+                SizeType parent = m_pTreeStart[p_tree];
+                if (m_pTreeRoots[parent].childStart < 0) return std::make_pair(-1, -1);
+                while (true) {
+                    const BKTNode& node = m_pTreeRoots[parent];
+                    SizeType best = -1;
+                    float bestDist = MaxDist;
+                    for (SizeType begin = node.childStart; begin < node.childEnd; begin++) {
+                        float dist = fComputeDistance(data[p_id], data[m_pTreeRoots[begin].centerid], data.C());
+                        if (dist < bestDist) {
+                            bestDist = dist;
+                            best = begin;
+                        }
+                    }
+                    if (best < 0) return std::make_pair(parent, -1);
+                    if (m_pTreeRoots[best].childStart >= 0) {
+                        parent = best;
+                        continue;
+                    }
+                    // a leaf, or a cluster of duplicates whose members hang off its negated childStart
+                    if (m_pTreeRoots[best].childStart != -1 && bestDist <= Epsilon) return std::make_pair(best, -1);
+                    if (node.childEnd - node.childStart < m_iBKTKmeansK || m_pTreeRoots[best].childStart != -1) return std::make_pair(parent, -1);
+                    return std::make_pair(parent, best);
+                }
+            }
+
+            // Appends room for p_count children plus as much slack, the slack slots are FreeSlot.
+            SizeType AllocateChildren(SizeType p_count)
+            {
+                SizeType start = (SizeType)m_pTreeRoots.size();
+                m_pTreeRoots.resize(m_pTreeRoots.size() + max(p_count * 2, (SizeType)2), BKTNode(FreeSlot));
+                return start;
+            }
+
+            // Moves a full child range to the end first, the old slots are left as they are. A cluster of duplicates
+            // keeps its members behind a negated childStart. A cluster that moves with the range is pointed at by its
+            // entry in the sample map and by the graph, the map follows it here and p_moved gets (center, new node).
+            void AppendChild(SizeType p_parent, SizeType p_id, std::vector<std::pair<SizeType, SizeType>>& p_moved)
+            {
+                bool duplicates = m_pTreeRoots[p_parent].childStart < 0;
+                SizeType begin = duplicates ? -m_pTreeRoots[p_parent].childStart : m_pTreeRoots[p_parent].childStart;
+                SizeType end = m_pTreeRoots[p_parent].childEnd;
+                if (end >= (SizeType)m_pTreeRoots.size() || m_pTreeRoots[end].centerid != FreeSlot) {
+                    SizeType count = end - begin;
+                    SizeType start = AllocateChildren(count + 1);
+                    std::copy(m_pTreeRoots.begin() + begin, m_pTreeRoots.begin() + end, m_pTreeRoots.begin() + start);
+                    m_pTreeRoots[p_parent].childStart = duplicates ? -start : start;
+                    for (SizeType j = start; j < start + count; j++) {
+                        if (m_pTreeRoots[j].childStart >= -1) continue;
+                        m_pSampleCenterMap[-1 - m_pTreeRoots[j].centerid] = j;
+                        p_moved.emplace_back(m_pTreeRoots[j].centerid, j);
+                    }
+                    end = start + count;
+                }
+                m_pTreeRoots[end] = BKTNode(p_id);
+                m_pTreeRoots[p_parent].childEnd = end + 1;
+            }
+
+            ErrorCode WriteTrees(std::shared_ptr<Helper::DiskIO> p_out) const
+            {
                 IOBINARY(p_out, WriteBinary, sizeof(m_iTreeNumber), (char*)&m_iTreeNumber);
                 IOBINARY(p_out, WriteBinary, sizeof(SizeType) * m_iTreeNumber, (char*)m_pTreeStart.data());
                 SizeType treeNodeSize = (SizeType)m_pTreeRoots.size();
@@ -639,6 +869,8 @@ break;
                 return ErrorCode::Success;
             }
 
+        public:
+
             ErrorCode SaveTrees(std::string sTreeFileName) const
             {
                 LOG(Helper::LogLevel::LL_Info, "Save BKT to %s\n", sTreeFileName.c_str());
@@ -784,11 +1016,16 @@ break;
             std::vector<SizeType> m_pTreeStart;
             std::vector<BKTNode> m_pTreeRoots;
             std::unordered_map<SizeType, SizeType> m_pSampleCenterMap;
+            // rebuilds and inserts so far, and as of the last delta
+            std::uint64_t m_version = 0;
+            std::uint64_t m_persistedVersion = 0;
 
         public:
             std::unique_ptr<std::shared_timed_mutex> m_lock;
             int m_iTreeNumber, m_iBKTKmeansK, m_iBKTLeafSize, m_iSamples, m_bfs;
             float m_fBalanceFactor;
+            // InsertNode new samples rather than rebuilding the trees every AddCountForRebuild additions
+            bool m_bIncrementalInsert = true;
             std::shared_ptr<SPTAG::COMMON::IQuantizer> m_pQuantizer;
         };
     }
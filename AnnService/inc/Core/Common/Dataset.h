@@ -4,6 +4,11 @@
 #ifndef _SPTAG_COMMON_DATASET_H_
 #define _SPTAG_COMMON_DATASET_H_
 
+#include "MemoryPolicy.h"
+
+#include <atomic>
+#include <cstdio>
+
 namespace SPTAG
 {
     namespace COMMON
@@ -211,6 +216,44 @@ namespace SPTAG
             }
         };
         */
+        // Reads the next [bytes][payload] record of a delta file into p_record. Returns false at the end
+        // of the file, a record cut short by a crash during its append counts as the end too.
+        inline bool ReadDeltaRecord(std::shared_ptr<Helper::DiskIO> p_in, std::string& p_record)
+        {
+            std::uint64_t bytes = 0;
+            if (p_in->ReadBinary(sizeof(bytes), (char*)&bytes) != sizeof(bytes)) return false;
+            p_record.resize(bytes);
+            if (p_in->ReadBinary(bytes, &p_record[0]) != bytes) {
+                LOG(Helper::LogLevel::LL_Warning, "Ignore the torn delta record at the end of the file (%llu bytes expected)\n", (unsigned long long)bytes);
+                return false;
+            }
+            return true;
+        }
+
+        // Copies p_from into a fresh p_to, used to stage a merge next to the file it replaces.
+        inline bool CopyDeltaBase(const std::string& p_from, const std::string& p_to)
+        {
+            auto in = f_createIO(), out = f_createIO();
+            if (in == nullptr || !in->Initialize(p_from.c_str(), std::ios::binary | std::ios::in)) return false;
+            if (out == nullptr || !out->Initialize(p_to.c_str(), std::ios::binary | std::ios::out)) return false;
+            std::unique_ptr<char[]> buffer(new char[1 << 20]);
+            std::uint64_t readBytes;
+            while ((readBytes = in->ReadBinary(1 << 20, buffer.get())) > 0) {
+                if (out->WriteBinary(readBytes, buffer.get()) != readBytes) return false;
+            }
+            return true;
+        }
+
+        // Atomically puts p_from in place of p_to. A reader that mapped p_to keeps the old contents.
+        inline bool ReplaceDeltaBase(const std::string& p_from, const std::string& p_to)
+        {
+#ifdef _MSC_VER
+            return ::MoveFileExA(p_from.c_str(), p_to.c_str(), MOVEFILE_REPLACE_EXISTING) != 0;
+#else
+            return std::rename(p_from.c_str(), p_to.c_str()) == 0;
+#endif
+        }
+
         template <typename T>
         class Dataset
         {
@@ -229,6 +272,26 @@ namespace SPTAG
             DimensionType colStart = 0;
             DimensionType mycols = 0;
 
+            // policy of the owned buffers, looked up by name on Initialize
+            DatasetMemoryPolicy policy;
+            std::size_t dataBytes = 0;
+            std::size_t blockBytes = 0;
+
+            // one bit per chunk of 2^dirtyChunkEx rows written in place since the last SaveDelta,
+            // rows from persistedRows on are new and always go into the next delta
+            std::shared_ptr<std::vector<std::atomic<std::uint64_t>>> dirtyChunks;
+            int dirtyChunkEx = 0;
+            SizeType persistedRows = 0;
+
+            // Datasets laid out side by side share their appended blocks, which only the one at column 0 allocates.
+            // That one frees them with its policy, the others leave them alone.
+            void ReleaseBlocks()
+            {
+                if (incBlocks == nullptr || colStart != 0) return;
+                for (char* ptr : *incBlocks) policy.Free(ptr, blockBytes);
+                incBlocks->clear();
+            }
+
         public:
             Dataset() {}
 
@@ -238,33 +301,35 @@ namespace SPTAG
             }
             ~Dataset()
             {
-                if (ownData) ALIGN_FREE(data);
-                for (char* ptr : *incBlocks) ALIGN_FREE(ptr);
-                incBlocks->clear();
+                if (ownData) policy.Free(data, dataBytes);
+                ReleaseBlocks();
             }
 
             void Initialize(SizeType rows_, DimensionType cols_, SizeType rowsInBlock_, SizeType capacity_, const void* data_ = nullptr, bool shareOwnership_ = true, std::shared_ptr<std::vector<char*>> incBlocks_ = nullptr, int colStart_ = 0, int rowEnd_ = -1)
             {
                 if (data != nullptr) {
-                    if (ownData) ALIGN_FREE(data);
-                    for (char* ptr : *incBlocks) ALIGN_FREE(ptr);
-                    incBlocks->clear();
+                    if (ownData) policy.Free(data, dataBytes);
+                    ReleaseBlocks();
                 }
 
+                policy = DatasetMemoryPolicy::Get(name);
                 rows = rows_;
                 if (rowEnd_ >= colStart_) cols = rowEnd_;
                 else cols = cols_ * sizeof(T);
                 data = (char*)data_;
+                ownData = false;
                 if (data_ == nullptr || !shareOwnership_)
                 {
                     ownData = true;
-                    data = (char*)ALIGN_ALLOC(((size_t)rows) * cols);
+                    dataBytes = ((size_t)rows) * cols;
+                    data = (char*)policy.Allocate(dataBytes);
                     if (data_ != nullptr) memcpy(data, data_, ((size_t)rows) * cols);
                     else std::memset(data, -1, ((size_t)rows) * cols);
                 }
                 maxRows = capacity_;
                 rowsInBlockEx = static_cast<SizeType>(ceil(log2(rowsInBlock_)));
                 rowsInBlock = (1 << rowsInBlockEx) - 1;
+                blockBytes = ((size_t)rowsInBlock + 1) * cols;
                 incBlocks = incBlocks_;
                 if (incBlocks == nullptr) incBlocks.reset(new std::vector<char*>());
                 incBlocks->reserve((static_cast<std::int64_t>(capacity_) + rowsInBlock) >> rowsInBlockEx);
@@ -331,9 +396,9 @@ namespace SPTAG
                 while (written < num) {
                     SizeType curBlockIdx = ((incRows + written) >> rowsInBlockEx);
                     if (curBlockIdx >= (SizeType)(incBlocks->size())) {
-                        char* newBlock = (char*)ALIGN_ALLOC(((size_t)rowsInBlock + 1) * cols);
+                        char* newBlock = (char*)policy.Allocate(blockBytes);
                         if (newBlock == nullptr) return ErrorCode::MemoryOverFlow;
-                        std::memset(newBlock, -1, ((size_t)rowsInBlock + 1) * cols);
+                        std::memset(newBlock, -1, blockBytes);
                         incBlocks->push_back(newBlock);
                     }
                     SizeType curBlockPos = ((incRows + written) & rowsInBlock);
@@ -408,6 +473,187 @@ namespace SPTAG
                 return ErrorCode::Success;
             }
 
+            // Starts tracking in-place writes from the current contents, chunks are sized to about a page.
+            void EnableDeltas()
+            {
+                dirtyChunkEx = 0;
+                while ((((std::size_t)mycols * sizeof(T)) << dirtyChunkEx) < PageSize) dirtyChunkEx++;
+                std::size_t words = ((((std::size_t)max(maxRows, R())) >> dirtyChunkEx) >> 6) + 1;
+                dirtyChunks.reset(new std::vector<std::atomic<std::uint64_t>>(words));
+                for (auto& word : *dirtyChunks) word.store(0, std::memory_order_relaxed);
+                persistedRows = R();
+            }
+
+            inline bool DeltasEnabled() const { return dirtyChunks != nullptr; }
+
+            // Call after writing row index in place, so that a SaveDelta racing the write picks it up next time at the latest.
+            inline void MarkDirty(SizeType index)
+            {
+                if (dirtyChunks == nullptr) return;
+                SizeType chunk = index >> dirtyChunkEx;
+                (*dirtyChunks)[chunk >> 6].fetch_or(1ULL << (chunk & 63), std::memory_order_relaxed);
+            }
+
+            // Appends one record with the rows written or added since the last SaveDelta, next to p_prefix for the owner.
+            // Record: [bytes][prefix][R][C][range num]{[begin][count][rows]}. Rows must not be added concurrently.
+            // A null p_out drops the pending changes, which is what a full Save of the same rows wants.
+            ErrorCode SaveDelta(std::shared_ptr<Helper::DiskIO> p_out, SizeType p_prefix = 0)
+            {
+                if (dirtyChunks == nullptr) {
+                    if (p_out != nullptr) {
+                        LOG(Helper::LogLevel::LL_Error, "%s has no delta baseline, save it in full first!\n", name.c_str());
+                        return ErrorCode::Fail;
+                    }
+                    EnableDeltas();
+                    return ErrorCode::Success;
+                }
+
+                SizeType CR = R();
+                std::vector<std::pair<std::size_t, std::uint64_t>> taken;
+                std::vector<std::pair<SizeType, SizeType>> ranges;
+                for (std::size_t w = 0; w < dirtyChunks->size(); w++) {
+                    std::uint64_t bits = (*dirtyChunks)[w].exchange(0, std::memory_order_acq_rel);
+                    if (bits == 0) continue;
+                    taken.emplace_back(w, bits);
+                    for (int b = 0; b < 64; b++) {
+                        if ((bits & (1ULL << b)) == 0) continue;
+                        std::int64_t begin = ((std::int64_t)(w << 6) + b) << dirtyChunkEx;
+                        if (begin >= persistedRows) break;
+                        std::int64_t end = begin + (1LL << dirtyChunkEx);
+                        if (end > persistedRows) end = persistedRows;
+                        if (!ranges.empty() && ranges.back().second == (SizeType)begin) ranges.back().second = (SizeType)end;
+                        else ranges.emplace_back((SizeType)begin, (SizeType)end);
+                    }
+                }
+                if (CR > persistedRows) {
+                    if (!ranges.empty() && ranges.back().second == persistedRows) ranges.back().second = CR;
+                    else ranges.emplace_back(persistedRows, CR);
+                }
+
+                if (p_out == nullptr) {
+                    persistedRows = CR;
+                    return ErrorCode::Success;
+                }
+
+                std::size_t rowBytes = sizeof(T) * mycols;
+                std::uint64_t bytes = sizeof(SizeType) * 3 + sizeof(DimensionType);
+                for (auto& range : ranges) bytes += sizeof(SizeType) * 2 + rowBytes * (range.second - range.first);
+
+                std::string record(sizeof(bytes) + bytes, '\0');
+                char* pos = &record[0];
+                SizeType rangeNum = (SizeType)ranges.size();
+                auto put = [&pos](const void* src, std::size_t size) { std::memcpy(pos, src, size); pos += size; };
+                put(&bytes, sizeof(bytes));
+                put(&p_prefix, sizeof(SizeType));
+                put(&CR, sizeof(SizeType));
+                put(&mycols, sizeof(DimensionType));
+                put(&rangeNum, sizeof(SizeType));
+                for (auto& range : ranges) {
+                    SizeType count = range.second - range.first;
+                    put(&range.first, sizeof(SizeType));
+                    put(&count, sizeof(SizeType));
+                    for (SizeType i = range.first; i < range.second; i++) put(At(i), rowBytes);
+                }
+
+                if (p_out->WriteBinary(record.size(), record.data()) != record.size()) {
+                    for (auto& word : taken) (*dirtyChunks)[word.first].fetch_or(word.second, std::memory_order_relaxed);
+                    LOG(Helper::LogLevel::LL_Error, "Fail to append the %s delta!\n", name.c_str());
+                    return ErrorCode::DiskIOFail;
+                }
+                persistedRows = CR;
+                LOG(Helper::LogLevel::LL_Info, "Save %s delta (%d ranges, %llu bytes) Finish!\n", name.c_str(), rangeNum, (unsigned long long)bytes);
+                return ErrorCode::Success;
+            }
+
+            // Replays every record SaveDelta appended to p_in (null for none) and tracks changes from the result on.
+            // p_prefix receives the prefix of the last record, it is left alone when there was none.
+            ErrorCode LoadDeltas(std::shared_ptr<Helper::DiskIO> p_in, SizeType* p_prefix = nullptr)
+            {
+                std::string record;
+                int records = 0;
+                while (p_in != nullptr && ReadDeltaRecord(p_in, record)) {
+                    const char* pos = record.data();
+                    auto get = [&pos](void* dst, std::size_t size) { std::memcpy(dst, pos, size); pos += size; };
+                    SizeType prefix, newR, rangeNum;
+                    DimensionType C;
+                    get(&prefix, sizeof(SizeType));
+                    get(&newR, sizeof(SizeType));
+                    get(&C, sizeof(DimensionType));
+                    get(&rangeNum, sizeof(SizeType));
+                    if (C != mycols) {
+                        LOG(Helper::LogLevel::LL_Error, "%s delta has %d columns instead of %d!\n", name.c_str(), C, mycols);
+                        return ErrorCode::DimensionSizeMismatch;
+                    }
+                    if (newR > R()) {
+                        ErrorCode ret = AddBatch(newR - R());
+                        if (ret != ErrorCode::Success) return ret;
+                    }
+                    for (SizeType r = 0; r < rangeNum; r++) {
+                        SizeType begin, count;
+                        get(&begin, sizeof(SizeType));
+                        get(&count, sizeof(SizeType));
+                        for (SizeType i = begin; i < begin + count; i++) get(At(i), sizeof(T) * mycols);
+                    }
+                    if (p_prefix != nullptr) *p_prefix = prefix;
+                    records++;
+                }
+                EnableDeltas();
+                if (records > 0) LOG(Helper::LogLevel::LL_Info, "Load %s deltas (%d records, %d rows) Finish!\n", name.c_str(), records, R());
+                return ErrorCode::Success;
+            }
+
+            // Folds the records of p_deltaFile into p_baseFile, a file written by Save that is preceded by a SizeType
+            // prefix when p_hasPrefix. The result is built aside and renamed over p_baseFile, so a crash leaves either
+            // file intact and replaying the same deltas again on top of it is harmless.
+            static ErrorCode MergeDeltas(const std::string& p_baseFile, const std::string& p_deltaFile, bool p_hasPrefix)
+            {
+                auto in = f_createIO();
+                if (in == nullptr || !in->Initialize(p_deltaFile.c_str(), std::ios::binary | std::ios::in)) return ErrorCode::FailedOpenFile;
+                std::string mergeFile = p_baseFile + ".merge";
+                if (!CopyDeltaBase(p_baseFile, mergeFile)) return ErrorCode::FailedCreateFile;
+
+                {
+                    auto out = f_createIO();
+                    if (out == nullptr || !out->Initialize(mergeFile.c_str(), std::ios::binary | std::ios::in | std::ios::out)) return ErrorCode::FailedOpenFile;
+                    std::uint64_t headBytes = p_hasPrefix ? sizeof(SizeType) : 0;
+                    SizeType prefix = 0, baseR;
+                    DimensionType baseC;
+                    IOBINARY(out, ReadBinary, sizeof(SizeType), (char*)&baseR, headBytes);
+                    IOBINARY(out, ReadBinary, sizeof(DimensionType), (char*)&baseC);
+                    std::uint64_t rowsOffset = headBytes + sizeof(SizeType) + sizeof(DimensionType);
+
+                    std::string record;
+                    bool hasRecord = false;
+                    while (ReadDeltaRecord(in, record)) {
+                        const char* pos = record.data();
+                        SizeType newR, rangeNum;
+                        DimensionType C;
+                        std::memcpy(&prefix, pos, sizeof(SizeType)); pos += sizeof(SizeType);
+                        std::memcpy(&newR, pos, sizeof(SizeType)); pos += sizeof(SizeType);
+                        std::memcpy(&C, pos, sizeof(DimensionType)); pos += sizeof(DimensionType);
+                        std::memcpy(&rangeNum, pos, sizeof(SizeType)); pos += sizeof(SizeType);
+                        if (C != baseC) return ErrorCode::DimensionSizeMismatch;
+                        std::uint64_t rowBytes = sizeof(T) * C;
+                        for (SizeType r = 0; r < rangeNum; r++) {
+                            SizeType begin, count;
+                            std::memcpy(&begin, pos, sizeof(SizeType)); pos += sizeof(SizeType);
+                            std::memcpy(&count, pos, sizeof(SizeType)); pos += sizeof(SizeType);
+                            IOBINARY(out, WriteBinary, rowBytes * count, pos, rowsOffset + rowBytes * begin);
+                            pos += rowBytes * count;
+                        }
+                        baseR = max(baseR, newR);
+                        hasRecord = true;
+                    }
+                    if (p_hasPrefix && hasRecord) IOBINARY(out, WriteBinary, sizeof(SizeType), (char*)&prefix, 0);
+                    IOBINARY(out, WriteBinary, sizeof(SizeType), (char*)&baseR, headBytes);
+                    out->ShutDown();
+                }
+
+                if (!ReplaceDeltaBase(mergeFile, p_baseFile)) return ErrorCode::FailedCreateFile;
+                LOG(Helper::LogLevel::LL_Info, "Merge %s into %s Finish!\n", p_deltaFile.c_str(), p_baseFile.c_str());
+                return ErrorCode::Success;
+            }
+
             ErrorCode Refine(const std::vector<SizeType>& indices, COMMON::Dataset<T>& dataset) const
             {
                 SizeType newrows = (SizeType)(indices.size());
@@ -452,7 +698,8 @@ namespace SPTAG
             DimensionType totalC = ALIGN_ROUND(sizeof(T) * VC + sizeof(SizeType) * pNeighborhoodSize);
 
             LOG(Helper::LogLevel::LL_Info, "OPT TotalC: %d\n", totalC);
-            char* data = (char*)ALIGN_ALLOC(((size_t)totalC) * VR);
+            // the interleaved layout is placed by the vectors' policy
+            char* data = (char*)DatasetMemoryPolicy::Get(pVectors.Name()).Allocate(((size_t)totalC) * VR);
             std::shared_ptr<std::vector<char*>> incBlocks(new std::vector<char*>());
 
             pVectors.Initialize(VR, VC, blockSize, capacity, data, true, incBlocks, 0, totalC);
@@ -19,6 +19,21 @@ namespace SPTAG
         template<typename T>
         inline DistanceCalcReturn<T> DistanceCalcSelector(SPTAG::DistCalcMethod p_method);
 
+        // Scores count vectors against pX in one call, pY holds their addresses so they can be read in place.
+        template <typename T>
+        using DistanceBatchCalcReturn = void(*)(const T*, const T* const*, int, DimensionType, float*);
+        template<typename T>
+        inline DistanceBatchCalcReturn<T> DistanceBatchCalcSelector(SPTAG::DistCalcMethod p_method);
+
+        // Dot products of xCount row-major vectors with yCount vectors stored transposed (dimension d of vector j at pYT[d * ldY + j]),
+        // out[i * yCount + j]. xCount must be a multiple of 8 and yCount of 16, callers pad with zeros.
+        using DotProductTileCalcReturn = void(*)(const float*, int, const float*, int, int, DimensionType, float*);
+        inline DotProductTileCalcReturn DotProductTileCalcSelector();
+
+        // Scores the 32 codes of a fast-scan block with a quantized lookup table.
+        using FastScanCalcReturn = void(*)(const std::uint8_t*, const std::uint8_t*, DimensionType, std::uint16_t*);
+        inline FastScanCalcReturn FastScanCalcSelector();
+
         class DistanceUtils
         {
         public:
@@ -94,6 +109,39 @@ namespace SPTAG
             static float ComputeCosineDistance_AVX(const float* pX, const float* pY, DimensionType length);
             static float ComputeCosineDistance_AVX512(const float* pX, const float* pY, DimensionType length);
 
+            static void ComputeL2DistanceBatch_AVX(const std::int8_t* pX, const std::int8_t* const* pY, int count, DimensionType length, float* pDist);
+            static void ComputeL2DistanceBatch_AVX512(const std::int8_t* pX, const std::int8_t* const* pY, int count, DimensionType length, float* pDist);
+
+            static void ComputeL2DistanceBatch_AVX(const std::uint8_t* pX, const std::uint8_t* const* pY, int count, DimensionType length, float* pDist);
+            static void ComputeL2DistanceBatch_AVX512(const std::uint8_t* pX, const std::uint8_t* const* pY, int count, DimensionType length, float* pDist);
+
+            static void ComputeL2DistanceBatch_AVX(const std::int16_t* pX, const std::int16_t* const* pY, int count, DimensionType length, float* pDist);
+            static void ComputeL2DistanceBatch_AVX512(const std::int16_t* pX, const std::int16_t* const* pY, int count, DimensionType length, float* pDist);
+
+            static void ComputeL2DistanceBatch_AVX(const float* pX, const float* const* pY, int count, DimensionType length, float* pDist);
+            static void ComputeL2DistanceBatch_AVX512(const float* pX, const float* const* pY, int count, DimensionType length, float* pDist);
+
+            static void ComputeCosineDistanceBatch_AVX(const std::int8_t* pX, const std::int8_t* const* pY, int count, DimensionType length, float* pDist);
+            static void ComputeCosineDistanceBatch_AVX512(const std::int8_t* pX, const std::int8_t* const* pY, int count, DimensionType length, float* pDist);
+
+            static void ComputeCosineDistanceBatch_AVX(const std::uint8_t* pX, const std::uint8_t* const* pY, int count, DimensionType length, float* pDist);
+            static void ComputeCosineDistanceBatch_AVX512(const std::uint8_t* pX, const std::uint8_t* const* pY, int count, DimensionType length, float* pDist);
+
+            static void ComputeCosineDistanceBatch_AVX(const std::int16_t* pX, const std::int16_t* const* pY, int count, DimensionType length, float* pDist);
+            static void ComputeCosineDistanceBatch_AVX512(const std::int16_t* pX, const std::int16_t* const* pY, int count, DimensionType length, float* pDist);
+
+            static void ComputeCosineDistanceBatch_AVX(const float* pX, const float* const* pY, int count, DimensionType length, float* pDist);
+            static void ComputeCosineDistanceBatch_AVX512(const float* pX, const float* const* pY, int count, DimensionType length, float* pDist);
+
+            static void ComputeDotProductTile(const float* pX, int xCount, const float* pYT, int yCount, int ldY, DimensionType length, float* pDot);
+            static void ComputeDotProductTile_AVX(const float* pX, int xCount, const float* pYT, int yCount, int ldY, DimensionType length, float* pDot);
+            static void ComputeDotProductTile_AVX512(const float* pX, int xCount, const float* pYT, int yCount, int ldY, DimensionType length, float* pDot);
+
+            // 4-bit PQ fast-scan: sums the uint8 lookup table entries of 32 codes packed in a block, see PQQuantizer::PackFastScanBlock.
+            static void ComputeFastScanDistances(const std::uint8_t* pTable, const std::uint8_t* pBlock, DimensionType numSubvectors, std::uint16_t* pDist);
+            static void ComputeFastScanDistances_AVX(const std::uint8_t* pTable, const std::uint8_t* pBlock, DimensionType numSubvectors, std::uint16_t* pDist);
+            static void ComputeFastScanDistances_AVX512(const std::uint8_t* pTable, const std::uint8_t* pBlock, DimensionType numSubvectors, std::uint16_t* pDist);
+
 
             template<typename T>
             static inline float ComputeDistance(const T* p1, const T* p2, DimensionType length, SPTAG::DistCalcMethod distCalcMethod)
@@ -161,6 +209,67 @@ namespace SPTAG
             }
             return nullptr;
         }
+
+        template<typename T>
+        inline DistanceBatchCalcReturn<T> DistanceBatchCalcSelector(SPTAG::DistCalcMethod p_method)
+        {
+            switch (p_method)
+            {
+            case SPTAG::DistCalcMethod::InnerProduct:
+            case SPTAG::DistCalcMethod::Cosine:
+                if (InstructionSet::AVX512())
+                {
+                    return &(DistanceUtils::ComputeCosineDistanceBatch_AVX512);
+                }
+                else if (InstructionSet::AVX2())
+                {
+                    return &(DistanceUtils::ComputeCosineDistanceBatch_AVX);
+                }
+                break;
+
+            case SPTAG::DistCalcMethod::L2:
+                if (InstructionSet::AVX512())
+                {
+                    return &(DistanceUtils::ComputeL2DistanceBatch_AVX512);
+                }
+                else if (InstructionSet::AVX2())
+                {
+                    return &(DistanceUtils::ComputeL2DistanceBatch_AVX);
+                }
+                break;
+
+            default:
+                break;
+            }
+            // callers score one vector at a time through DistanceCalcSelector
+            return nullptr;
+        }
+
+        inline DotProductTileCalcReturn DotProductTileCalcSelector()
+        {
+            if (InstructionSet::AVX512())
+            {
+                return &(DistanceUtils::ComputeDotProductTile_AVX512);
+            }
+            else if (InstructionSet::AVX2() || InstructionSet::AVX())
+            {
+                return &(DistanceUtils::ComputeDotProductTile_AVX);
+            }
+            return &(DistanceUtils::ComputeDotProductTile);
+        }
+
+        inline FastScanCalcReturn FastScanCalcSelector()
+        {
+            if (InstructionSet::AVX512())
+            {
+                return &(DistanceUtils::ComputeFastScanDistances_AVX512);
+            }
+            else if (InstructionSet::AVX2())
+            {
+                return &(DistanceUtils::ComputeFastScanDistances_AVX);
+            }
+            return &(DistanceUtils::ComputeFastScanDistances);
+        }
     }
 }
 
@@ -8,6 +8,8 @@
 #include <vector>
 #include <mutex>
 #include <memory>
+#include <atomic>
+#include <thread>
 
 namespace SPTAG
 {
@@ -64,6 +66,115 @@ namespace SPTAG
             static const int PoolSize = 32767;
             std::unique_ptr<std::shared_timed_mutex[]> m_locks;
         };
+
+        // Version counter of a sequence lock, odd while a writer holds the lock.
+        // Readers never block writers: they take a version, read, and retry if the version moved.
+        class SequenceCounter {
+        public:
+            SequenceCounter() : m_seq(0) {}
+
+            std::uint32_t ReadBegin() const {
+                std::uint32_t seq;
+                while ((seq = m_seq.load(std::memory_order_acquire)) & 1) std::this_thread::yield();
+                return seq;
+            }
+
+            bool ReadRetry(std::uint32_t seq) const {
+                std::atomic_thread_fence(std::memory_order_acquire);
+                return m_seq.load(std::memory_order_relaxed) != seq;
+            }
+
+            // Current version without waiting, odd while a writer holds the lock.
+            std::uint32_t Version() const {
+                return m_seq.load(std::memory_order_acquire);
+            }
+
+        protected:
+            std::atomic<std::uint32_t> m_seq;
+        };
+
+        // Writer lock and version counter in one word, for writers that only hold it for a few stores.
+        class SequenceLock : public SequenceCounter {
+        public:
+            void lock() {
+                for (int spins = 0; !try_lock(); spins++) {
+                    if (spins >= 64) std::this_thread::yield();
+                }
+            }
+
+            bool try_lock() {
+                std::uint32_t seq = m_seq.load(std::memory_order_relaxed);
+                if ((seq & 1) || !m_seq.compare_exchange_weak(seq, seq + 1, std::memory_order_acquire)) return false;
+                std::atomic_thread_fence(std::memory_order_release);
+                return true;
+            }
+
+            void unlock() {
+                m_seq.fetch_add(1, std::memory_order_release);
+            }
+        };
+
+        // Version counter with a blocking writer lock, for writers that hold it across I/O.
+        class SequenceMutex : public SequenceCounter {
+        public:
+            void lock() {
+                m_writer.lock();
+                Begin();
+            }
+
+            bool try_lock() {
+                if (!m_writer.try_lock()) return false;
+                Begin();
+                return true;
+            }
+
+            void unlock() {
+                m_seq.fetch_add(1, std::memory_order_release);
+                m_writer.unlock();
+            }
+
+        private:
+            void Begin() {
+                m_seq.fetch_add(1, std::memory_order_relaxed);
+                std::atomic_thread_fence(std::memory_order_release);
+            }
+
+            std::mutex m_writer;
+        };
+
+        // One lock per id instead of a hashed pool, so unrelated ids never contend.
+        // Locks are allocated in chunks on first use.
+        template <typename Lock>
+        class SequenceLockArray {
+        public:
+            SequenceLockArray() {
+                m_chunks.reset(new std::atomic<Lock*>[ChunkNum]);
+                for (int i = 0; i < ChunkNum; i++) m_chunks[i] = nullptr;
+            }
+            ~SequenceLockArray() {
+                for (int i = 0; i < ChunkNum; i++) delete[] m_chunks[i].load();
+            }
+
+            Lock& operator[](SizeType idx) {
+                unsigned chunk = ((unsigned)idx) >> ChunkSizeEx;
+                Lock* locks = m_chunks[chunk].load(std::memory_order_acquire);
+                if (locks == nullptr) {
+                    Lock* newLocks = new Lock[ChunkSize];
+                    if (m_chunks[chunk].compare_exchange_strong(locks, newLocks, std::memory_order_acq_rel)) locks = newLocks;
+                    else delete[] newLocks;
+                }
+                return locks[idx & (ChunkSize - 1)];
+            }
+
+        private:
+            static const int ChunkSizeEx = 16;
+            static const int ChunkSize = 1 << ChunkSizeEx;
+            static const int ChunkNum = 1 << (31 - ChunkSizeEx);
+            std::unique_ptr<std::atomic<Lock*>[]> m_chunks;
+        };
+
+        using SequenceLocks = SequenceLockArray<SequenceLock>;
+        using SequenceMutexes = SequenceLockArray<SequenceMutex>;
     }
 }
 
@@ -40,6 +40,7 @@ namespace SPTAG
             {
                 char oldvalue = InterlockedExchange8((char*)m_data[key], 1);
                 if (oldvalue == 1) return false;
+                m_data.MarkDirty(key);
                 m_inserted++;
                 return true;
             }
@@ -81,6 +82,25 @@ namespace SPTAG
                 return m_data.Load(pmemoryFile + sizeof(SizeType), blockSize, capacity);
             }
 
+            // Appends the labels changed since the last delta (null p_out: since now) to a delta file.
+            inline ErrorCode SaveDelta(std::shared_ptr<Helper::DiskIO> p_out)
+            {
+                return m_data.SaveDelta(p_out, (SizeType)m_inserted.load());
+            }
+
+            inline ErrorCode LoadDeltas(std::shared_ptr<Helper::DiskIO> p_in)
+            {
+                SizeType inserted = m_inserted.load();
+                ErrorCode ret = m_data.LoadDeltas(p_in, &inserted);
+                m_inserted = inserted;
+                return ret;
+            }
+
+            static ErrorCode MergeDeltas(const std::string& p_baseFile, const std::string& p_deltaFile)
+            {
+                return Dataset<std::int8_t>::MergeDeltas(p_baseFile, p_deltaFile, true);
+            }
+
             inline ErrorCode AddBatch(SizeType num)
             {
                 return m_data.AddBatch(num);
@@ -0,0 +1,41 @@
+// Copyright (c) Microsoft Corporation. All rights reserved.
+// Licensed under the MIT License.
+
+#ifndef _SPTAG_COMMON_MEMORYPOLICY_H_
+#define _SPTAG_COMMON_MEMORYPOLICY_H_
+
+#include <cstddef>
+#include <cstdint>
+#include <string>
+
+namespace SPTAG
+{
+    namespace COMMON
+    {
+        // Placement of the buffers a Dataset owns. Policies are registered per dataset name ("Vector", "RNG", "versionLabelID", ...)
+        // and picked up when a dataset with that name allocates, datasets without one keep ALIGN_ALLOC.
+        struct DatasetMemoryPolicy
+        {
+            enum class HugePages : std::uint8_t { None, Transparent, Explicit };
+            enum class NumaPlacement : std::uint8_t { Default, Interleave, Local };
+
+            HugePages m_hugePages = HugePages::None;
+            NumaPlacement m_numa = NumaPlacement::Default;
+
+            inline bool IsDefault() const { return m_hugePages == HugePages::None && m_numa == NumaPlacement::Default; }
+
+            // Explicit hugepages fall back to transparent ones when the pool is empty. p_size must be passed to Free again.
+            void* Allocate(std::size_t p_size) const;
+
+            void Free(void* p_ptr, std::size_t p_size) const;
+
+            // Comma separated name:hugepages[:numa] entries, e.g. "Vector:explicit:interleave,RNG:transparent:local".
+            // hugepages is none, transparent or explicit, numa is default, interleave or local, the name * matches every dataset.
+            static bool Configure(const std::string& p_config);
+
+            static DatasetMemoryPolicy Get(const std::string& p_name);
+        };
+    }
+}
+
+#endif // _SPTAG_COMMON_MEMORYPOLICY_H_
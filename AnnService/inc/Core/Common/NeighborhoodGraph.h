@@ -543,6 +543,7 @@ break;
                 }
                 index->RefineSearchIndex(query, searchDeleted);
                 RebuildNeighbors(index, node, m_pNeighborhoodGraph[node], query.GetResults(), CEF + 1);
+                m_pNeighborhoodGraph.MarkDirty(node);
                 if (rec_query)
                 {
                     ALIGN_FREE(rec_query);
@@ -556,6 +557,7 @@ break;
                         if (item->VID == node) continue;
 
                         InsertNeighbors(index, item->VID, node, item->Dist);
+                        m_pNeighborhoodGraph.MarkDirty(item->VID);
                     }
                 }
             }
@@ -614,6 +616,19 @@ break;
                 return ErrorCode::Success;
             }
 
+            // Appends the rows refined or added since the last delta (null output: since now) to a delta file.
+            ErrorCode SaveGraphDelta(std::shared_ptr<Helper::DiskIO> output)
+            {
+                return m_pNeighborhoodGraph.SaveDelta(output);
+            }
+
+            ErrorCode LoadGraphDeltas(std::shared_ptr<Helper::DiskIO> input)
+            {
+                ErrorCode ret = m_pNeighborhoodGraph.LoadDeltas(input);
+                m_iGraphSize = m_pNeighborhoodGraph.R();
+                return ret;
+            }
+
             inline ErrorCode AddBatch(SizeType num)
             {
                 ErrorCode ret = m_pNeighborhoodGraph.AddBatch(num);
@@ -630,6 +645,7 @@ break;
             void Update(SizeType row, DimensionType col, SizeType val) {
                 std::lock_guard<std::mutex> lock(m_dataUpdateLock[row]);
                 m_pNeighborhoodGraph[row][col] = val;
+                m_pNeighborhoodGraph.MarkDirty(row);
             }
 
             inline void SetR(SizeType rows) {
@@ -13,6 +13,7 @@
 #include <memory>
 #include <cassert>
 #include <cstring>
+#include <vector>
 
 
 namespace SPTAG
@@ -34,6 +35,28 @@ namespace SPTAG
             virtual float CosineDistance(const std::uint8_t* pX, const std::uint8_t* pY) const;
 
             virtual void QuantizeVector(const void* vec, std::uint8_t* vecout) const;
+
+            // Distances from vec to every codeword, the ADC lookup table, whatever GetEnableADC says.
+            void ComputeDistanceTable(const void* vec, float* table) const;
+
+            // L2 distance between the vector of a distance table and a code.
+            float ADCL2Distance(const float* table, const std::uint8_t* code) const;
+
+            // 4-bit fast-scan, available when every subvector has 16 codewords. Codes are packed FastScanBlockCodes
+            // at a time into blocks and scored with a uint8 copy of the distance table kept in SIMD registers.
+            static const int FastScanBlockCodes = 32;
+
+            bool FastScanEnabled() const { return m_KsPerSubvector == 16; }
+
+            SizeType FastScanBlockSize() const { return m_NumSubvectors * 16; }
+
+            // Packs up to FastScanBlockCodes codes, missing ones are scored as code 0.
+            void PackFastScanBlock(const std::uint8_t* const* codes, int count, std::uint8_t* block) const;
+
+            // Rounds a distance table to uint8 entries, a block sum s then stands for bias + s / scale.
+            void QuantizeDistanceTable(const float* table, std::uint8_t* qtable, float& scale, float& bias) const;
+
+            void FastScanL2Distances(const std::uint8_t* qtable, float scale, float bias, const std::uint8_t* block, int count, float* dists) const;
             
             virtual SizeType QuantizeSize() const;
 
@@ -113,11 +136,7 @@ namespace SPTAG
         {
             float out = 0;
             if (GetEnableADC()) {          
-                float* ptr = (float*)pX;
-                for (int i = 0; i < m_NumSubvectors; i++) {
-                    out += ptr[pY[i]];
-                    ptr += m_KsPerSubvector;
-                }
+                out = ADCL2Distance((const float*)pX, pY);
             }
             else {
                 for (int i = 0; i < m_NumSubvectors; i++) {
@@ -140,20 +159,7 @@ namespace SPTAG
         {
             if (GetEnableADC())
             {
-                auto distCalc = DistanceCalcSelector<T>(DistCalcMethod::L2);
-                float* ADCtable = (float*) vecout;
-                T* subcodebooks = m_codebooks.get();
-                T* subvec = (T*)vec;
-                for (int i = 0; i < m_NumSubvectors; i++)
-                {
-                    for (int j = 0; j < m_KsPerSubvector; j++)
-                    {
-                        (*ADCtable) = distCalc(subvec, subcodebooks, m_DimPerSubvector);
-                        ADCtable++;
-                        subcodebooks += m_DimPerSubvector;
-                    }
-                    subvec += m_DimPerSubvector;
-                }
+                ComputeDistanceTable(vec, (float*)vecout);
             }
             else 
             {
@@ -179,6 +185,85 @@ namespace SPTAG
             }           
         }
 
+        template <typename T>
+        void PQQuantizer<T>::ComputeDistanceTable(const void* vec, float* table) const
+        {
+            auto distCalc = DistanceCalcSelector<T>(DistCalcMethod::L2);
+            T* subcodebooks = m_codebooks.get();
+            T* subvec = (T*)vec;
+            for (int i = 0; i < m_NumSubvectors; i++)
+            {
+                for (int j = 0; j < m_KsPerSubvector; j++)
+                {
+                    (*table) = distCalc(subvec, subcodebooks, m_DimPerSubvector);
+                    table++;
+                    subcodebooks += m_DimPerSubvector;
+                }
+                subvec += m_DimPerSubvector;
+            }
+        }
+
+        template <typename T>
+        float PQQuantizer<T>::ADCL2Distance(const float* table, const std::uint8_t* code) const
+        {
+            float out = 0;
+            for (int i = 0; i < m_NumSubvectors; i++) {
+                out += table[code[i]];
+                table += m_KsPerSubvector;
+            }
+            return out;
+        }
+
+        template <typename T>
+        void PQQuantizer<T>::PackFastScanBlock(const std::uint8_t* const* codes, int count, std::uint8_t* block) const
+        {
+            memset(block, 0, FastScanBlockSize());
+            for (int j = 0; j < count; j++) {
+                int shift = (j < 16) ? 0 : 4;
+                std::uint8_t* row = block + (j & 15);
+                for (int i = 0; i < m_NumSubvectors; i++, row += 16) {
+                    *row |= (std::uint8_t)(codes[j][i] << shift);
+                }
+            }
+        }
+
+        template <typename T>
+        void PQQuantizer<T>::QuantizeDistanceTable(const float* table, std::uint8_t* qtable, float& scale, float& bias) const
+        {
+            // every entry relative to its subvector's minimum, one scale for all so that sums stay comparable
+            std::vector<float> mins(m_NumSubvectors);
+            float maxRange = 0;
+            bias = 0;
+            for (int i = 0; i < m_NumSubvectors; i++) {
+                const float* sub = table + i * m_KsPerSubvector;
+                float lo = sub[0], hi = sub[0];
+                for (int j = 1; j < m_KsPerSubvector; j++) {
+                    lo = min(lo, sub[j]);
+                    hi = max(hi, sub[j]);
+                }
+                mins[i] = lo;
+                bias += lo;
+                maxRange = max(maxRange, hi - lo);
+            }
+            // the kernel adds in 16 bits, keep the largest possible sum below saturation
+            float maxEntry = (float)min(255, 65535 / max((int)m_NumSubvectors, 1));
+            scale = (maxRange > 0) ? maxEntry / maxRange : 1.0f;
+            for (int i = 0; i < m_NumSubvectors; i++) {
+                for (int j = 0; j < m_KsPerSubvector; j++, table++, qtable++) {
+                    *qtable = (std::uint8_t)min(maxEntry, (*table - mins[i]) * scale + 0.5f);
+                }
+            }
+        }
+
+        template <typename T>
+        void PQQuantizer<T>::FastScanL2Distances(const std::uint8_t* qtable, float scale, float bias, const std::uint8_t* block, int count, float* dists) const
+        {
+            static const FastScanCalcReturn scan = FastScanCalcSelector();
+            std::uint16_t sums[FastScanBlockCodes];
+            scan(qtable, block, m_NumSubvectors, sums);
+            for (int j = 0; j < count; j++) dists[j] = bias + sums[j] / scale;
+        }
+
         template <typename T>
         SizeType PQQuantizer<T>::QuantizeSize() const
         {
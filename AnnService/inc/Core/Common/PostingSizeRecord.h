@@ -6,6 +6,7 @@
 
 #include <atomic>
 #include "Dataset.h"
+#include "inc/Helper/MappedFile.h"
 
 namespace SPTAG
 {
@@ -14,6 +15,8 @@ namespace SPTAG
         class PostingSizeRecord
         {
         private:
+            // Declared first so that it outlives m_data, which may point into it.
+            std::shared_ptr<Helper::MappedFile> m_mapped;
             Dataset<int> m_data;
             
         public:
@@ -66,6 +69,7 @@ namespace SPTAG
             inline ErrorCode Save(const std::string& filename)
             {
                 LOG(Helper::LogLevel::LL_Info, "Save %s To %s\n", m_data.Name().c_str(), filename.c_str());
+                Helper::MappedFile::PrepareRewrite(filename);
                 auto ptr = f_createIO();
                 if (ptr == nullptr || !ptr->Initialize(filename.c_str(), std::ios::binary | std::ios::out)) return ErrorCode::FailedCreateFile;
                 return Save(ptr);
@@ -86,7 +90,19 @@ namespace SPTAG
 
             inline ErrorCode Load(char* pmemoryFile, SizeType blockSize, SizeType capacity)
             {
-                return m_data.Load(pmemoryFile + sizeof(SizeType), blockSize, capacity);
+                // Save writes the sizes without a leading count, same layout as the stream Load reads
+                return m_data.Load(pmemoryFile, blockSize, capacity);
+            }
+
+            // Loads straight out of a copy-on-write mapping of filename, new postings still go to fresh blocks.
+            inline ErrorCode LoadMapped(const std::string& filename, SizeType blockSize, SizeType capacity, bool prefetch)
+            {
+                LOG(Helper::LogLevel::LL_Info, "Map %s From %s\n", m_data.Name().c_str(), filename.c_str());
+                std::shared_ptr<Helper::MappedFile> mapped(new Helper::MappedFile());
+                if (!mapped->Open(filename, prefetch)) return ErrorCode::FailedOpenFile;
+                ErrorCode ret = Load(mapped->Data(), blockSize, capacity);
+                if (ret == ErrorCode::Success) m_mapped = std::move(mapped);
+                return ret;
             }
 
             inline ErrorCode AddBatch(SizeType num)
@@ -19,6 +19,10 @@ namespace SPTAG
         template<typename T>
         inline SumCalcReturn<T> SumCalcSelector();
 
+        // pKeep[i] = 1 where the bit of pIDs[i] is clear in a bitmap of 32-bit words split into blocks of 2^blockEx bits, returns the count kept
+        using BitFilterCalcReturn = int(*)(const std::uint32_t* const*, int, const SizeType*, int, std::uint8_t*);
+        inline BitFilterCalcReturn BitFilterCalcSelector();
+
         class SIMDUtils
         {
         public:
@@ -47,6 +51,9 @@ namespace SPTAG
             static void ComputeSum_AVX(float* pX, const float* pY, DimensionType length);
             static void ComputeSum_AVX512(float* pX, const float* pY, DimensionType length);
 
+            static int ComputeBitFilter_Naive(const std::uint32_t* const* pBlocks, int blockEx, const SizeType* pIDs, int count, std::uint8_t* pKeep);
+            static int ComputeBitFilter_AVX(const std::uint32_t* const* pBlocks, int blockEx, const SizeType* pIDs, int count, std::uint8_t* pKeep);
+
              template<typename T>
             static inline void ComputeSum(T* p1, const T* p2, DimensionType length)
             {
@@ -73,6 +80,15 @@ namespace SPTAG
             }
             return &(SIMDUtils::ComputeSum_Naive);
         }
+
+        inline BitFilterCalcReturn BitFilterCalcSelector()
+        {
+            if (InstructionSet::AVX2())
+            {
+                return &(SIMDUtils::ComputeBitFilter_AVX);
+            }
+            return &(SIMDUtils::ComputeBitFilter_Naive);
+        }
     }
 }
 
@@ -6,6 +6,8 @@
 
 #include <atomic>
 #include "Dataset.h"
+#include "inc/Helper/MappedFile.h"
+#include "SIMDUtils.h"
 
 namespace SPTAG
 {
@@ -14,19 +16,93 @@ namespace SPTAG
         class VersionLabel
         {
         private:
+            // Declared first so that it outlives m_data, which may point into it.
+            std::shared_ptr<Helper::MappedFile> m_mapped;
             std::atomic<SizeType> m_deleted;
             Dataset<std::uint8_t> m_data;
-            
+
+            // Bit mirror of the deleted labels for bulk filtering, in blocks of 2^BitBlockEx ids that never move once allocated.
+            // The label byte stays authoritative, a delete sets its bit right after the byte.
+            static const int BitBlockEx = 20;
+            std::unique_ptr<std::uint32_t*[]> m_bitBlocks;
+            SizeType m_bitBlockNum = 0;
+            SizeType m_bitBlockCapacity = 0;
+            BitFilterCalcReturn m_bitFilter;
+
+            void InitBits(SizeType capacity)
+            {
+                for (SizeType i = 0; i < m_bitBlockNum; i++) ALIGN_FREE(m_bitBlocks[i]);
+                m_bitBlockNum = 0;
+                m_bitBlockCapacity = (SizeType)((static_cast<std::int64_t>(capacity) + (1 << BitBlockEx) - 1) >> BitBlockEx);
+                m_bitBlocks.reset(new std::uint32_t*[m_bitBlockCapacity]());
+            }
+
+            bool ReserveBits(SizeType size)
+            {
+                SizeType blocks = (SizeType)((static_cast<std::int64_t>(size) + (1 << BitBlockEx) - 1) >> BitBlockEx);
+                if (blocks > m_bitBlockCapacity) return false;
+                while (m_bitBlockNum < blocks) {
+                    std::uint32_t* block = (std::uint32_t*)ALIGN_ALLOC(sizeof(std::uint32_t) << (BitBlockEx - 5));
+                    if (block == nullptr) return false;
+                    std::memset(block, 0, sizeof(std::uint32_t) << (BitBlockEx - 5));
+                    m_bitBlocks[m_bitBlockNum++] = block;
+                }
+                return true;
+            }
+
+            inline std::uint32_t* BitWord(SizeType key) const
+            {
+                return m_bitBlocks[key >> BitBlockEx] + ((key & ((1 << BitBlockEx) - 1)) >> 5);
+            }
+
+            inline void SetBit(SizeType key)
+            {
+                std::uint32_t* word = BitWord(key);
+                while (true) {
+                    std::uint32_t oldWord = *word;
+                    if (oldWord & (1u << (key & 31))) return;
+                    if (InterlockedCompareExchange((unsigned*)word, (unsigned)(oldWord | (1u << (key & 31))), (unsigned)oldWord) == oldWord) return;
+                }
+            }
+
+            inline void ClearBit(SizeType key)
+            {
+                std::uint32_t* word = BitWord(key);
+                while (true) {
+                    std::uint32_t oldWord = *word;
+                    if (!(oldWord & (1u << (key & 31)))) return;
+                    if (InterlockedCompareExchange((unsigned*)word, (unsigned)(oldWord & ~(1u << (key & 31))), (unsigned)oldWord) == oldWord) return;
+                }
+            }
+
+            // rebuild the bits of [begin, end) from the label bytes, a word may be shared with ids Delete is setting
+            void SyncBits(SizeType begin, SizeType end)
+            {
+                for (SizeType key = begin; key < end; key++) {
+                    if (*m_data[key] == 0xfe) SetBit(key);
+                    else ClearBit(key);
+                }
+            }
+
         public:
             VersionLabel() 
             {
                 m_deleted = 0;
                 m_data.SetName("versionLabelID");
+                m_bitFilter = BitFilterCalcSelector();
+            }
+
+            ~VersionLabel()
+            {
+                for (SizeType i = 0; i < m_bitBlockNum; i++) ALIGN_FREE(m_bitBlocks[i]);
             }
 
             void Initialize(SizeType size, SizeType blockSize, SizeType capacity)
             {
                 m_data.Initialize(size, 1, blockSize, capacity);
+                InitBits(max(capacity, size));
+                ReserveBits(size);
+                SyncBits(0, size);
             }
 
             inline size_t Count() const { return m_data.R() - m_deleted.load(); }
@@ -42,10 +118,19 @@ namespace SPTAG
             {
                 uint8_t oldvalue = (uint8_t)InterlockedExchange8((char*)(m_data[key]), (char)0xfe);
                 if (oldvalue == 0xfe) return false;
+                SetBit(key);
+                m_data.MarkDirty(key);
                 m_deleted++;
                 return true;
             }
 
+            // p_keep[i] = 1 for every live id of p_ids, returns the number kept. Reads the bit mirror, so a delete
+            // racing the call may still pass, which a search tolerates the same way as a delete landing right after it.
+            inline int FilterDeleted(const SizeType* p_ids, int p_num, std::uint8_t* p_keep) const
+            {
+                return m_bitFilter(m_bitBlocks.get(), BitBlockEx, p_ids, p_num, p_keep);
+            }
+
             inline uint8_t GetVersion(const SizeType& key)
             {
                 return *m_data[key];
@@ -58,6 +143,7 @@ namespace SPTAG
                     uint8_t oldVersion = GetVersion(key);
                     *newVersion = (oldVersion+1) & 0x7f;
                     if (((uint8_t)InterlockedCompareExchange((char*)m_data[key], (char)*newVersion, (char)oldVersion)) == oldVersion) {
+                        m_data.MarkDirty(key);
                         return true;
                     }
                 }
@@ -78,6 +164,7 @@ namespace SPTAG
             inline ErrorCode Save(const std::string& filename)
             {
                 LOG(Helper::LogLevel::LL_Info, "Save %s To %s\n", m_data.Name().c_str(), filename.c_str());
+                Helper::MappedFile::PrepareRewrite(filename);
                 auto ptr = f_createIO();
                 if (ptr == nullptr || !ptr->Initialize(filename.c_str(), std::ios::binary | std::ios::out)) return ErrorCode::FailedCreateFile;
                 return Save(ptr);
@@ -88,7 +175,12 @@ namespace SPTAG
                 SizeType deleted;
                 IOBINARY(input, ReadBinary, sizeof(SizeType), (char*)&deleted);
                 m_deleted = deleted;
-                return m_data.Load(input, blockSize, capacity);
+                ErrorCode ret = m_data.Load(input, blockSize, capacity);
+                if (ret != ErrorCode::Success) return ret;
+                InitBits(max(capacity, m_data.R()));
+                if (!ReserveBits(m_data.R())) return ErrorCode::MemoryOverFlow;
+                SyncBits(0, m_data.R());
+                return ret;
             }
 
             inline ErrorCode Load(const std::string& filename, SizeType blockSize, SizeType capacity)
@@ -102,11 +194,60 @@ namespace SPTAG
             inline ErrorCode Load(char* pmemoryFile, SizeType blockSize, SizeType capacity)
             {
                 m_deleted = *((SizeType*)pmemoryFile);
-                return m_data.Load(pmemoryFile + sizeof(SizeType), blockSize, capacity);
+                ErrorCode ret = m_data.Load(pmemoryFile + sizeof(SizeType), blockSize, capacity);
+                if (ret != ErrorCode::Success) return ret;
+                InitBits(max(capacity, m_data.R()));
+                if (!ReserveBits(m_data.R())) return ErrorCode::MemoryOverFlow;
+                SyncBits(0, m_data.R());
+                return ret;
+            }
+
+            // Loads straight out of a copy-on-write mapping of filename, new ids still go to fresh blocks.
+            inline ErrorCode LoadMapped(const std::string& filename, SizeType blockSize, SizeType capacity, bool prefetch)
+            {
+                LOG(Helper::LogLevel::LL_Info, "Map %s From %s\n", m_data.Name().c_str(), filename.c_str());
+                std::shared_ptr<Helper::MappedFile> mapped(new Helper::MappedFile());
+                if (!mapped->Open(filename, prefetch)) return ErrorCode::FailedOpenFile;
+                ErrorCode ret = Load(mapped->Data(), blockSize, capacity);
+                if (ret == ErrorCode::Success) m_mapped = std::move(mapped);
+                return ret;
+            }
+
+            // Appends the labels changed since the last delta (null p_out: since now) to a delta file.
+            inline ErrorCode SaveDelta(std::shared_ptr<Helper::DiskIO> p_out)
+            {
+                return m_data.SaveDelta(p_out, (SizeType)m_deleted.load());
+            }
+
+            inline ErrorCode LoadDeltas(std::shared_ptr<Helper::DiskIO> p_in)
+            {
+                SizeType deleted = m_deleted.load();
+                ErrorCode ret = m_data.LoadDeltas(p_in, &deleted);
+                if (ret != ErrorCode::Success) return ret;
+                m_deleted = deleted;
+                if (!ReserveBits(m_data.R())) return ErrorCode::MemoryOverFlow;
+                SyncBits(0, m_data.R());
+                return ret;
+            }
+
+            inline ErrorCode LoadDeltas(const std::string& filename)
+            {
+                if (!fileexists(filename.c_str())) return LoadDeltas(std::shared_ptr<Helper::DiskIO>());
+                LOG(Helper::LogLevel::LL_Info, "Load %s deltas From %s\n", m_data.Name().c_str(), filename.c_str());
+                auto ptr = f_createIO();
+                if (ptr == nullptr || !ptr->Initialize(filename.c_str(), std::ios::binary | std::ios::in)) return ErrorCode::FailedOpenFile;
+                return LoadDeltas(ptr);
+            }
+
+            static ErrorCode MergeDeltas(const std::string& p_baseFile, const std::string& p_deltaFile)
+            {
+                return Dataset<std::uint8_t>::MergeDeltas(p_baseFile, p_deltaFile, true);
             }
 
             inline ErrorCode AddBatch(SizeType num)
             {
+                // the bits exist before the new ids become visible, new labels are never deleted so their bits stay 0
+                if (!ReserveBits(m_data.R() + num)) return ErrorCode::MemoryOverFlow;
                 return m_data.AddBatch(num);
             }
 
@@ -117,7 +258,9 @@ namespace SPTAG
 
             inline void SetR(SizeType num)
             {
+                SizeType old = m_data.R();
                 m_data.SetR(num);
+                if (num > old && ReserveBits(num)) SyncBits(old, num);
             }
         };
     }
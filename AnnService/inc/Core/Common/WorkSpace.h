@@ -138,6 +138,106 @@ namespace SPTAG
             }
         };
 
+        // Dedup set for posting scans, sized by the caller to the ids a query can meet. Every slot carries the epoch
+        // of the query that filled it, so clear() only moves the epoch and a large table costs nothing to reset.
+        class EpochHashSet
+        {
+        private:
+            // (epoch << 32) | id, a slot is taken when its epoch is the current one
+            std::unique_ptr<std::uint64_t[]> m_table;
+            std::uint32_t m_mask = 0;
+            std::uint32_t m_epoch = 1;
+            SizeType m_count = 0;
+
+            static const int m_prefetchBatch = 16;
+
+            inline std::uint32_t Hash(std::uint32_t idx) const
+            {
+                return (idx * 2654435761u) & m_mask;
+            }
+
+            // linear probe from p_slot, returns true if idx was already there
+            inline bool Probe(std::uint32_t p_slot, std::uint32_t idx)
+            {
+                std::uint64_t entry = (((std::uint64_t)m_epoch) << 32) | idx;
+                while (true) {
+                    std::uint64_t cur = m_table[p_slot];
+                    if (cur == entry) return true;
+                    if ((cur >> 32) != m_epoch) {
+                        m_table[p_slot] = entry;
+                        m_count++;
+                        return false;
+                    }
+                    p_slot = (p_slot + 1) & m_mask;
+                }
+            }
+
+            void Grow()
+            {
+                std::unique_ptr<std::uint64_t[]> old(m_table.release());
+                std::uint32_t oldSize = m_mask + 1;
+                m_mask = (oldSize << 1) - 1;
+                m_table.reset(new std::uint64_t[(size_t)m_mask + 1]());
+                m_count = 0;
+                for (std::uint32_t i = 0; i < oldSize; i++) {
+                    if ((old[i] >> 32) == m_epoch) Probe(Hash((std::uint32_t)old[i]), (std::uint32_t)old[i]);
+                }
+            }
+
+        public:
+            // makes room for p_size ids at a load factor of at most one half, keeps what is in the set
+            void Reserve(SizeType p_size)
+            {
+                std::uint64_t need = 16;
+                while (need < ((std::uint64_t)max(p_size, 1) << 1)) need <<= 1;
+                if (m_table && need <= (std::uint64_t)m_mask + 1) return;
+                if (!m_table) {
+                    m_mask = (std::uint32_t)(need - 1);
+                    m_table.reset(new std::uint64_t[need]());
+                    return;
+                }
+                while ((std::uint64_t)m_mask + 1 < need) Grow();
+            }
+
+            void clear()
+            {
+                m_count = 0;
+                if (++m_epoch == 0) {
+                    if (m_table) std::memset(m_table.get(), 0, sizeof(std::uint64_t) * ((size_t)m_mask + 1));
+                    m_epoch = 1;
+                }
+            }
+
+            inline bool CheckAndSet(SizeType idx)
+            {
+                if (((std::uint64_t)m_count + 1) << 1 > (std::uint64_t)m_mask + 1) Reserve(m_count + 1);
+                return Probe(Hash((std::uint32_t)idx), (std::uint32_t)idx);
+            }
+
+            // Clears p_keep[i] for every kept id already in the set, earlier ids of the same call included, and adds the rest.
+            // The slots of a batch are prefetched before any is probed. Returns the number of ids dropped.
+            int CheckAndSetBatch(const SizeType* p_ids, int p_num, std::uint8_t* p_keep)
+            {
+                int dropped = 0;
+                std::uint32_t slots[m_prefetchBatch];
+                for (int begin = 0; begin < p_num; begin += m_prefetchBatch) {
+                    int num = min(m_prefetchBatch, p_num - begin);
+                    if (((std::uint64_t)m_count + num) << 1 > (std::uint64_t)m_mask + 1) Reserve(m_count + num);
+                    for (int i = 0; i < num; i++) {
+                        slots[i] = Hash((std::uint32_t)p_ids[begin + i]);
+                        _mm_prefetch((const char*)(m_table.get() + slots[i]), _MM_HINT_T0);
+                    }
+                    for (int i = 0; i < num; i++) {
+                        if (p_keep[begin + i] && Probe(slots[i], (std::uint32_t)p_ids[begin + i])) {
+                            p_keep[begin + i] = 0;
+                            dropped++;
+                        }
+                    }
+                }
+                return dropped;
+            }
+        };
+
         class DistPriorityQueue {
             int m_size;
             std::unique_ptr<float[]> m_data;
@@ -12,6 +12,9 @@
 #include "inc/Helper/KeyValueIO.h"
 #include "inc/Core/Common/FineGrainedLock.h"
 #include "PersistentBuffer.h"
+#include "PostingCache.h"
+#include "FullVectorStore.h"
+#include "inc/Core/Common/PQQuantizer.h"
 #include "inc/Core/Common/PostingSizeRecord.h"
 #include "ExtraSPDKController.h"
 #include <chrono>
@@ -95,6 +98,7 @@ namespace SPTAG::SPANN {
             ~ReassignAsyncJob() {}
 
             void exec(IAbortOperation* p_abort) override {
+                m_extraIndex->FinishReassignJob(*vectorInfo);
                 m_extraIndex->Reassign(m_index, vectorInfo, HeadPrev);
                 if (m_callback != nullptr) {
                     m_callback();
@@ -102,9 +106,32 @@ namespace SPTAG::SPANN {
             }
         };
 
-        class SPDKThreadPool : public Helper::ThreadPool
+        // Background scheduler: splits first, the most overflowed posting first, then reassigns, then merges.
+        // Jobs of the same kind and weight run in arrival order. Every FairShare-th job goes to the kind whose
+        // next job has waited longest, so a stream of splits cannot hold merges back forever. The FIFO add()
+        // of ThreadPool is hidden, every job needs a kind.
+        class SPDKThreadPool : protected Helper::ThreadPool
         {
         public:
+            enum class JobType : int { Merge = 0, Reassign = 1, Split = 2 };
+
+            ~SPDKThreadPool()
+            {
+                m_abort.SetAbort(true);
+                m_cond.notify_all();
+                for (auto&& t : m_threads) t.join();
+                m_threads.clear();
+
+                // jobs that never ran are still owned by the queues
+                for (auto& queue : m_scheduled) {
+                    while (!queue.empty()) {
+                        delete queue.top().job;
+                        queue.pop();
+                    }
+                }
+                m_scheduledSize = 0;
+            }
+
             void initSPDK(int numberOfThreads, ExtraDynamicSearcher<ValueType>* extraIndex) 
             {
                 m_abort.SetAbort(false);
@@ -115,6 +142,7 @@ namespace SPTAG::SPANN {
                         Job *j;
                         while (get(j))
                         {
+                            extraIndex->ThrottleBackground();
                             try 
                             {
                                 currentJobs++;
@@ -131,6 +159,61 @@ namespace SPTAG::SPANN {
                     });
                 }
             }
+
+            void add(Job* j, JobType p_type, std::int64_t p_weight = 0)
+            {
+                {
+                    std::lock_guard<std::mutex> lock(m_lock);
+                    m_scheduled[(int)p_type].push({ p_weight, m_sequence++, j });
+                    m_scheduledSize++;
+                }
+                m_cond.notify_one();
+            }
+
+            size_t jobsize() { return m_scheduledSize; }
+
+            using Helper::ThreadPool::runningJobs;
+
+            inline bool allClear() { return currentJobs == 0 && jobsize() == 0; }
+
+        private:
+            static const int JobTypeNum = 3;
+            static const std::uint64_t FairShare = 8;
+
+            bool get(Job*& j)
+            {
+                std::unique_lock<std::mutex> lock(m_lock);
+                while (m_scheduledSize == 0 && !m_abort.ShouldAbort()) m_cond.wait(lock);
+                if (m_abort.ShouldAbort()) return false;
+
+                int type = JobTypeNum - 1;
+                while (m_scheduled[type].empty()) type--;
+                if (++m_picks % FairShare == 0) {
+                    for (int t = 0; t < JobTypeNum; t++) {
+                        if (!m_scheduled[t].empty() && m_scheduled[t].top().sequence < m_scheduled[type].top().sequence) type = t;
+                    }
+                }
+                j = m_scheduled[type].top().job;
+                m_scheduled[type].pop();
+                m_scheduledSize--;
+                return true;
+            }
+
+            struct ScheduledJob {
+                std::int64_t weight;
+                std::uint64_t sequence;
+                Job* job;
+
+                bool operator<(const ScheduledJob& other) const {
+                    if (weight != other.weight) return weight < other.weight;
+                    return sequence > other.sequence;
+                }
+            };
+
+            std::priority_queue<ScheduledJob> m_scheduled[JobTypeNum];
+            std::uint64_t m_sequence = 0;
+            std::uint64_t m_picks = 0;
+            std::atomic<size_t> m_scheduledSize{ 0 };
         };
 
     private:
@@ -143,10 +226,16 @@ namespace SPTAG::SPANN {
 
         std::mutex m_mergeLock;
 
-        COMMON::FineGrainedRWLock m_rwLocks;
+        COMMON::SequenceMutexes m_headLocks;
 
         COMMON::PostingSizeRecord m_postingSizes;
 
+        std::unique_ptr<PostingCache> m_postingCache;
+
+        // set when postings keep PQ codes instead of vectors, see LoadPostingQuantizer
+        std::shared_ptr<COMMON::PQQuantizer<ValueType>> m_postingQuantizer;
+        std::shared_ptr<FullVectorStore> m_fullVectors;
+
         std::shared_ptr<SPDKThreadPool> m_splitThreadPool;
         std::shared_ptr<SPDKThreadPool> m_reassignThreadPool;
 
@@ -159,11 +248,18 @@ namespace SPTAG::SPANN {
 
         tbb::concurrent_hash_map<SizeType, SizeType> m_mergeList;
 
+        std::mutex m_reassignLock;
+        std::unordered_map<SizeType, uint8_t> m_reassignList;
+
+        std::atomic<std::int64_t> m_searchLatency{ 0 };
+        std::atomic<std::int64_t> m_lastSearchTime{ 0 };
+
     public:
-        ExtraDynamicSearcher(const char* dbPath, int dim, int postingBlockLimit, bool useDirectIO, float searchLatencyHardLimit, int mergeThreshold, bool useSPDK = false, int batchSize = 64, int bufferLength = 3) {
+        ExtraDynamicSearcher(const char* dbPath, int dim, int postingBlockLimit, bool useDirectIO, float searchLatencyHardLimit, int mergeThreshold, bool useSPDK = false, int batchSize = 64, int bufferLength = 3, int compactionIOBudget = 0, bool enableWAL = false, int checkpointWALSize = 256, int tailCacheSize = 0) {
             if (useSPDK) {
-                db.reset(new SPDKIO(dbPath, 1024 * 1024, MaxSize, postingBlockLimit + bufferLength, 1024, batchSize));
+                db.reset(new SPDKIO(dbPath, 1024 * 1024, MaxSize, postingBlockLimit + bufferLength, 1024, batchSize, 1, compactionIOBudget, enableWAL, checkpointWALSize, tailCacheSize));
                 m_postingSizeLimit = postingBlockLimit * PageSize / (sizeof(ValueType) * dim + sizeof(int) + sizeof(uint8_t));
+                m_appendBatchLimit = bufferLength * PageSize / (sizeof(ValueType) * dim + sizeof(int) + sizeof(uint8_t));
             } else {
 #ifdef ROCKSDB
                 db.reset(new RocksDBIO(dbPath, useDirectIO));
@@ -171,7 +267,8 @@ namespace SPTAG::SPANN {
 #endif
             }
             m_metaDataSize = sizeof(int) + sizeof(uint8_t);
-            m_vectorInfoSize = dim * sizeof(ValueType) + m_metaDataSize;
+            m_vectorSize = dim * sizeof(ValueType);
+            m_vectorInfoSize = m_vectorSize + m_metaDataSize;
             m_hardLatencyLimit = std::chrono::microseconds((int)searchLatencyHardLimit * 1000);
             m_mergeThreshold = mergeThreshold;
             LOG(Helper::LogLevel::LL_Info, "Posting size limit: %d, search limit: %f, merge threshold: %d\n", m_postingSizeLimit, searchLatencyHardLimit, m_mergeThreshold);
@@ -223,17 +320,19 @@ namespace SPTAG::SPANN {
             float maxDist;
             float avgDist = 0;
             std::vector<float> distanceSet;
+            std::vector<ValueType> decoded;
             //#pragma omp parallel for num_threads(32)
             for (int j = 0; j < postVectorNum; j++) {
                 uint8_t* vectorId = postingP + j * m_vectorInfoSize;
                 SizeType vid = *(reinterpret_cast<int*>(vectorId));
                 uint8_t version = *(reinterpret_cast<uint8_t*>(vectorId + sizeof(int)));
-                float_t dist = p_index->ComputeDistance(reinterpret_cast<ValueType*>(vectorId + m_metaDataSize), p_index->GetSample(headID));
+                const ValueType* vector = DecodedVector((const char*)vectorId, decoded);
+                float_t dist = p_index->ComputeDistance(vector, p_index->GetSample(headID));
                 // if (dist < Epsilon) LOG(Helper::LogLevel::LL_Info, "head found: vid: %d, head: %d\n", vid, headID);
                 avgDist += dist;
                 distanceSet.push_back(dist);
                 if (m_versionMap->Deleted(vid) || m_versionMap->GetVersion(vid) != version) continue;
-                COMMON::QueryResultSet<ValueType> headCandidates(reinterpret_cast<ValueType*>(vectorId + m_metaDataSize), 64);
+                COMMON::QueryResultSet<ValueType> headCandidates(vector, 64);
                 if (brokenID.find(vid) == brokenID.end() && IsAssumptionBroken(headID, headCandidates, vid)) {
                     /*
                     float_t headDist = p_index->ComputeDistance(headCandidates.GetTarget(), p_index->GetSample(SplitHead));
@@ -328,7 +427,7 @@ namespace SPTAG::SPANN {
             QuantifySplitCaseB(headID, newHeads, SplitHead, split_order, assumptionBrokenNum, brokenID);
         }
 
-        bool CheckIsNeedReassign(VectorIndex* p_index, std::vector<SizeType>& newHeads, ValueType* data, SizeType splitHead, float_t headToSplitHeadDist, float_t currentHeadDist, bool isInSplitHead, SizeType currentHead)
+        bool CheckIsNeedReassign(VectorIndex* p_index, std::vector<SizeType>& newHeads, const ValueType* data, SizeType splitHead, float_t headToSplitHeadDist, float_t currentHeadDist, bool isInSplitHead, SizeType currentHead)
         {
 
             float_t splitHeadDist = p_index->ComputeDistance(data, p_index->GetSample(splitHead));
@@ -348,7 +447,66 @@ namespace SPTAG::SPANN {
         inline void Serialize(char* ptr, SizeType VID, std::uint8_t version, const void* vector) {
             memcpy(ptr, &VID, sizeof(VID));
             memcpy(ptr + sizeof(VID), &version, sizeof(version));
-            memcpy(ptr + m_metaDataSize, vector, m_vectorInfoSize - m_metaDataSize);
+            if (m_postingQuantizer) m_postingQuantizer->QuantizeVector(vector, (std::uint8_t*)(ptr + m_metaDataSize));
+            else memcpy(ptr + m_metaDataSize, vector, m_vectorInfoSize - m_metaDataSize);
+        }
+
+        // With PostingQuantizerFilePath the postings keep a PQ code per vector and the exact vectors are
+        // written once to the full-vector store. Searches score codes with the query's ADC table and rerank
+        // the best candidates exactly; splits cluster exact vectors; reassign screens use decoded codes.
+        bool LoadPostingQuantizer()
+        {
+            if (m_opt->m_postingQuantizerFilePath.empty()) return true;
+            if (!m_postingQuantizer) {
+                auto ptr = SPTAG::f_createIO();
+                if (ptr == nullptr || !ptr->Initialize(m_opt->m_postingQuantizerFilePath.c_str(), std::ios::binary | std::ios::in)) {
+                    LOG(Helper::LogLevel::LL_Error, "Cannot open posting quantizer %s\n", m_opt->m_postingQuantizerFilePath.c_str());
+                    return false;
+                }
+                auto quantizer = COMMON::IQuantizer::LoadIQuantizer(ptr);
+                if (quantizer == nullptr || quantizer->GetQuantizerType() != QuantizerType::PQQuantizer ||
+                    quantizer->GetReconstructType() != GetEnumValueType<ValueType>() || quantizer->ReconstructDim() != m_opt->m_dim) {
+                    LOG(Helper::LogLevel::LL_Error, "Posting quantizer must be a PQQuantizer for %d-dimensional %s vectors\n",
+                        m_opt->m_dim, Helper::Convert::ConvertToString(GetEnumValueType<ValueType>()).c_str());
+                    return false;
+                }
+                m_postingQuantizer = std::dynamic_pointer_cast<COMMON::PQQuantizer<ValueType>>(quantizer);
+                // QuantizeVector encodes, searches build their tables with ComputeDistanceTable
+                m_postingQuantizer->SetEnableADC(false);
+
+                std::string storePath = m_opt->m_fullVectorStorePath.empty() ? m_opt->m_indexDirectory + FolderSep + "FullVectors.bin" : m_opt->m_fullVectorStorePath;
+                m_fullVectors.reset(new FullVectorStore(storePath, m_vectorSize));
+                if (!m_fullVectors->Available()) return false;
+                // a logged posting may only point at full vectors that are on disk, the store keeps them open until its last commit
+                if (db) {
+                    std::shared_ptr<FullVectorStore> fullVectors = m_fullVectors;
+                    db->SetDataSync([fullVectors] {
+                        if (!fullVectors->Sync()) LOG(Helper::LogLevel::LL_Error, "FullVectorStore: fail to sync\n");
+                    });
+                }
+            }
+            m_vectorInfoSize = m_metaDataSize + m_postingQuantizer->GetNumSubvectors();
+            LOG(Helper::LogLevel::LL_Info, "Posting compression: %d-byte codes for %d-byte vectors, rerank %d candidates\n",
+                m_vectorInfoSize - m_metaDataSize, m_vectorSize, m_opt->m_postingRerankNum);
+            return true;
+        }
+
+        // The exact vector of a posting record, from the record itself or from the full-vector store.
+        const ValueType* FullVector(const char* p_vectorInfo, std::vector<ValueType>& p_buffer)
+        {
+            if (!m_postingQuantizer) return reinterpret_cast<const ValueType*>(p_vectorInfo + m_metaDataSize);
+            p_buffer.resize(m_opt->m_dim);
+            if (m_fullVectors->Get(*(reinterpret_cast<const SizeType*>(p_vectorInfo)), p_buffer.data()) != ErrorCode::Success) return nullptr;
+            return p_buffer.data();
+        }
+
+        // The vector of a posting record as far as the posting knows it, compressed records are decoded in memory.
+        const ValueType* DecodedVector(const char* p_vectorInfo, std::vector<ValueType>& p_buffer)
+        {
+            if (!m_postingQuantizer) return reinterpret_cast<const ValueType*>(p_vectorInfo + m_metaDataSize);
+            p_buffer.resize(m_opt->m_dim);
+            m_postingQuantizer->ReconstructVector(reinterpret_cast<const std::uint8_t*>(p_vectorInfo + m_metaDataSize), p_buffer.data());
+            return p_buffer.data();
         }
 
         void CalculatePostingDistribution(VectorIndex* p_index)
@@ -465,7 +623,7 @@ namespace SPTAG::SPANN {
             std::vector<std::string> newPostingLists;
             double elapsedMSeconds;
             {
-                std::unique_lock<std::shared_timed_mutex> lock(m_rwLocks[headID]);
+                std::unique_lock<COMMON::SequenceMutex> lock(m_headLocks[headID]);
 
                 std::string postingList;
                 auto splitGetBegin = std::chrono::high_resolution_clock::now();
@@ -480,7 +638,6 @@ namespace SPTAG::SPANN {
                 auto* postingP = reinterpret_cast<uint8_t*>(&postingList.front());
                 SizeType postVectorNum = (SizeType)(postingList.size() / m_vectorInfoSize);
                
-                COMMON::Dataset<ValueType> smallSample(postVectorNum, m_opt->m_dim, p_index->m_iDataBlockSize, p_index->m_iDataCapacity, (const void*)postingP, true, nullptr, m_metaDataSize, m_vectorInfoSize);
                 //COMMON::Dataset<ValueType> smallSample(0, m_opt->m_dim, p_index->m_iDataBlockSize, p_index->m_iDataCapacity);  // smallSample[i] -> VID
                 //std::vector<int> localIndicesInsert(postVectorNum);  // smallSample[i] = j <-> localindices[j] = i
                 //std::vector<uint8_t> localIndicesInsertVersion(postVectorNum);
@@ -517,6 +674,7 @@ namespace SPTAG::SPANN {
                         LOG(Helper::LogLevel::LL_Info, "Split Fail to write back postings\n");
                         exit(0);
                     }
+                    if (m_postingCache) m_postingCache->Update(headID, postingList);
                     m_stat.m_garbageNum++;
                     auto GCEnd = std::chrono::high_resolution_clock::now();
                     elapsedMSeconds = std::chrono::duration_cast<std::chrono::microseconds>(GCEnd - splitBegin).count();
@@ -532,6 +690,25 @@ namespace SPTAG::SPANN {
                 //LOG(Helper::LogLevel::LL_Info, "Resize\n");
                 localIndices.resize(index);
 
+                // compressed postings are clustered on the exact vectors of their live records
+                std::string fullVectors;
+                if (m_postingQuantizer) {
+                    fullVectors.resize((size_t)postVectorNum * m_vectorSize);
+                    std::vector<SizeType> liveIDs(index);
+                    std::vector<char*> liveRows(index);
+                    for (int j = 0; j < index; j++) {
+                        liveIDs[j] = *((int*)(postingP + (size_t)localIndices[j] * m_vectorInfoSize));
+                        liveRows[j] = &fullVectors[(size_t)localIndices[j] * m_vectorSize];
+                    }
+                    if (m_fullVectors->MultiGet(liveIDs, liveRows) != ErrorCode::Success) {
+                        LOG(Helper::LogLevel::LL_Info, "Split fail to get full vectors\n");
+                        exit(0);
+                    }
+                }
+                COMMON::Dataset<ValueType> smallSample;
+                if (m_postingQuantizer) smallSample.Initialize(postVectorNum, m_opt->m_dim, p_index->m_iDataBlockSize, p_index->m_iDataCapacity, (const void*)fullVectors.data(), true);
+                else smallSample.Initialize(postVectorNum, m_opt->m_dim, p_index->m_iDataBlockSize, p_index->m_iDataCapacity, (const void*)postingP, true, nullptr, m_metaDataSize, m_vectorInfoSize);
+
                 auto clusterBegin = std::chrono::high_resolution_clock::now();
                 // k = 2, maybe we can change the split number, now it is fixed
                 SPTAG::COMMON::KmeansArgs<ValueType> args(2, smallSample.C(), (SizeType)localIndices.size(), 1, p_index->GetDistCalcMethod());
@@ -559,6 +736,7 @@ namespace SPTAG::SPANN {
                         LOG(Helper::LogLevel::LL_Info, "Split fail to override postings cut to limit\n");
                         exit(0);
                     }
+                    if (m_postingCache) m_postingCache->Update(headID, newpostingList);
                     {
                         std::lock_guard<std::mutex> tmplock(m_runningLock);
                         m_splitList.erase(headID);
@@ -589,6 +767,7 @@ namespace SPTAG::SPANN {
                             LOG(Helper::LogLevel::LL_Info, "Fail to override postings\n");
                             exit(0);
                         }
+                        if (!preReassign && m_postingCache) m_postingCache->Update(newHeadVID, newPostingLists[k]);
                         auto splitPutEnd = std::chrono::high_resolution_clock::now();
                         elapsedMSeconds = std::chrono::duration_cast<std::chrono::microseconds>(splitPutEnd - splitPutBegin).count();
                         m_stat.m_putCost += elapsedMSeconds;
@@ -626,6 +805,7 @@ namespace SPTAG::SPANN {
                 if (!theSameHead) {
                     p_index->DeleteIndex(headID);
                     m_postingSizes.UpdateSize(headID, 0);
+                    if (m_postingCache) m_postingCache->Invalidate(headID);
                 }
             }
             {
@@ -655,10 +835,10 @@ namespace SPTAG::SPANN {
             {
                 if (!m_mergeLock.try_lock()) {
                     auto* curJob = new MergeAsyncJob(p_index, this, headID, reassign, nullptr);
-                    m_splitThreadPool->add(curJob);
+                    m_splitThreadPool->add(curJob, SPDKThreadPool::JobType::Merge);
                     return ErrorCode::Success;
                 }
-                std::unique_lock<std::shared_timed_mutex> lock(m_rwLocks[headID]);
+                std::unique_lock<COMMON::SequenceMutex> lock(m_headLocks[headID]);
 
                 if (!p_index->ContainSample(headID)) {
                     m_mergeLock.unlock();
@@ -696,6 +876,7 @@ namespace SPTAG::SPANN {
                         LOG(Helper::LogLevel::LL_Info, "Merge Fail to write back postings\n");
                         exit(0);
                     }
+                    if (m_postingCache) m_postingCache->Update(headID, mergedPostingList);
                     m_mergeList.erase(headID);
                     m_mergeLock.unlock();
                     return ErrorCode::Success;
@@ -714,9 +895,9 @@ namespace SPTAG::SPANN {
                     if (currentLength + nextLength < m_postingSizeLimit && !m_mergeList.find(headIDAccessor, queryResult->VID))
                     {
                         {
-                            std::unique_lock<std::shared_timed_mutex> anotherLock(m_rwLocks[queryResult->VID], std::defer_lock);
+                            std::unique_lock<COMMON::SequenceMutex> anotherLock(m_headLocks[queryResult->VID], std::defer_lock);
                             // LOG(Helper::LogLevel::LL_Info,"Locked: %d, to be lock: %d\n", headID, queryResult->VID);
-                            if (m_rwLocks.hash_func(queryResult->VID) != m_rwLocks.hash_func(headID)) anotherLock.lock();
+                            if (queryResult->VID != headID) anotherLock.lock();
                             if (!p_index->ContainSample(queryResult->VID)) continue;
                             if (db->Get(queryResult->VID, &nextPostingList) != ErrorCode::Success) {
                                 LOG(Helper::LogLevel::LL_Info, "Fail to get to be merged postings: %d\n", queryResult->VID);
@@ -747,6 +928,10 @@ namespace SPTAG::SPANN {
                                 }
                                 m_postingSizes.UpdateSize(queryResult->VID, 0);
                                 m_postingSizes.UpdateSize(headID, totalLength);
+                                if (m_postingCache) {
+                                    m_postingCache->Update(headID, mergedPostingList);
+                                    m_postingCache->Invalidate(queryResult->VID);
+                                }
                             } else
                             {
                                 p_index->DeleteIndex(headID);
@@ -756,8 +941,12 @@ namespace SPTAG::SPANN {
                                 }
                                 m_postingSizes.UpdateSize(queryResult->VID, totalLength);
                                 m_postingSizes.UpdateSize(headID, 0);
+                                if (m_postingCache) {
+                                    m_postingCache->Update(queryResult->VID, mergedPostingList);
+                                    m_postingCache->Invalidate(headID);
+                                }
                             }
-                            if (m_rwLocks.hash_func(queryResult->VID) != m_rwLocks.hash_func(headID)) anotherLock.unlock();
+                            if (queryResult->VID != headID) anotherLock.unlock();
                         }
 
                         // LOG(Helper::LogLevel::LL_Info,"Release: %d, Release: %d\n", headID, queryResult->VID);
@@ -766,6 +955,7 @@ namespace SPTAG::SPANN {
 
                         if (reassign) 
                         {
+                            std::vector<ValueType> decoded;
                             /* ReAssign */
                             if (currentLength > nextLength) 
                             {
@@ -774,7 +964,7 @@ namespace SPTAG::SPANN {
                                 for (int j = 0; j < nextLength; j++) {
                                     uint8_t* vectorId = postingP + j * m_vectorInfoSize;
                                     // SizeType vid = *(reinterpret_cast<SizeType*>(vectorId));
-                                    ValueType* vector = reinterpret_cast<ValueType*>(vectorId + m_metaDataSize);
+                                    const ValueType* vector = DecodedVector((const char*)vectorId, decoded);
                                     float origin_dist = p_index->ComputeDistance(p_index->GetSample(queryResult->VID), vector);
                                     float current_dist = p_index->ComputeDistance(p_index->GetSample(headID), vector);
                                     if (current_dist > origin_dist)
@@ -787,7 +977,7 @@ namespace SPTAG::SPANN {
                                 for (int j = 0; j < currentLength; j++) {
                                     uint8_t* vectorId = postingP + j * m_vectorInfoSize;
                                     // SizeType vid = *(reinterpret_cast<SizeType*>(vectorId));
-                                    ValueType* vector = reinterpret_cast<ValueType*>(vectorId + m_metaDataSize);
+                                    const ValueType* vector = DecodedVector((const char*)vectorId, decoded);
                                     float origin_dist = p_index->ComputeDistance(p_index->GetSample(headID), vector);
                                     float current_dist = p_index->ComputeDistance(p_index->GetSample(queryResult->VID), vector);
                                     if (current_dist > origin_dist)
@@ -807,6 +997,7 @@ namespace SPTAG::SPANN {
                     LOG(Helper::LogLevel::LL_Info, "Merge Fail to write back postings\n");
                     exit(0);
                 }
+                if (m_postingCache) m_postingCache->Update(headID, mergedPostingList);
                 m_mergeList.erase(headID);
                 m_mergeLock.unlock();
             }
@@ -833,7 +1024,7 @@ namespace SPTAG::SPANN {
             }
 
             auto* curJob = new SplitAsyncJob(p_index, this, headID, m_opt->m_disableReassign, p_callback);
-            m_splitThreadPool->add(curJob);
+            m_splitThreadPool->add(curJob, SPDKThreadPool::JobType::Split, (std::int64_t)m_postingSizes.GetSize(headID) - m_postingSizeLimit);
             // LOG(Helper::LogLevel::LL_Info, "Add to thread pool\n");
         }
 
@@ -848,19 +1039,80 @@ namespace SPTAG::SPANN {
             m_mergeList.insert(workPair);
 
             auto* curJob = new MergeAsyncJob(p_index, this, headID, m_opt->m_disableReassign, p_callback);
-            m_splitThreadPool->add(curJob);
+            m_splitThreadPool->add(curJob, SPDKThreadPool::JobType::Merge);
         }
 
         inline void ReassignAsync(VectorIndex* p_index, std::shared_ptr<std::string> vectorInfo, SizeType HeadPrev, std::function<void()> p_callback = nullptr)
         {
+            // a vector already queued with the same version is reassigned once
+            SizeType VID = *((SizeType*)vectorInfo->c_str());
+            uint8_t version = *((uint8_t*)(vectorInfo->c_str() + sizeof(VID)));
+            {
+                std::lock_guard<std::mutex> tmplock(m_reassignLock);
+                auto iter = m_reassignList.find(VID);
+                if (iter != m_reassignList.end() && iter->second == version) {
+                    m_stat.m_reAssignDedup++;
+                    return;
+                }
+                m_reassignList[VID] = version;
+            }
+
             auto* curJob = new ReassignAsyncJob(p_index, this, std::move(vectorInfo), HeadPrev, p_callback);
-            m_splitThreadPool->add(curJob);
+            m_splitThreadPool->add(curJob, SPDKThreadPool::JobType::Reassign);
+        }
+
+        inline void FinishReassignJob(const std::string& vectorInfo)
+        {
+            SizeType VID = *((SizeType*)vectorInfo.c_str());
+            uint8_t version = *((uint8_t*)(vectorInfo.c_str() + sizeof(VID)));
+            std::lock_guard<std::mutex> tmplock(m_reassignLock);
+            auto iter = m_reassignList.find(VID);
+            if (iter != m_reassignList.end() && iter->second == version) m_reassignList.erase(iter);
+        }
+
+        // With BackgroundThrottle, a background worker holds its next job back while recent searches
+        // run past the search latency limit, for at most kMaxBackgroundPause per job.
+        void ThrottleBackground()
+        {
+            if (m_opt == nullptr || !m_opt->m_backgroundThrottle || !SearchOverLatencyLimit()) return;
+            auto pauseBegin = std::chrono::steady_clock::now();
+            while (SearchOverLatencyLimit()) {
+                auto now = std::chrono::steady_clock::now();
+                if (now - pauseBegin >= kMaxBackgroundPause) break;
+                std::this_thread::sleep_for(std::chrono::milliseconds(1));
+            }
+            m_stat.m_backgroundPauseCost += std::chrono::duration_cast<std::chrono::microseconds>(std::chrono::steady_clock::now() - pauseBegin).count();
+        }
+
+        inline bool SearchOverLatencyLimit()
+        {
+            std::int64_t now = std::chrono::duration_cast<std::chrono::microseconds>(std::chrono::steady_clock::now().time_since_epoch()).count();
+            if (now - m_lastSearchTime.load() > kSearchLatencyWindow.count()) return false;
+            return m_searchLatency.load() > m_hardLatencyLimit.count();
+        }
+
+        // moving average of the posting read and scan time of searches
+        inline void RecordSearchLatency(std::int64_t p_latency)
+        {
+            std::int64_t average = m_searchLatency.load();
+            m_searchLatency.store(average + (p_latency - average) / 8);
+            m_lastSearchTime.store(std::chrono::duration_cast<std::chrono::microseconds>(std::chrono::steady_clock::now().time_since_epoch()).count());
+        }
+
+        // With InsertBackPressure, foreground inserts wait while more background jobs than that are queued
+        inline void WaitForBackground()
+        {
+            if (m_opt->m_insertBackPressure <= 0 || m_splitThreadPool == nullptr) return;
+            while (m_splitThreadPool->jobsize() > (size_t)m_opt->m_insertBackPressure) {
+                std::this_thread::sleep_for(std::chrono::milliseconds(1));
+            }
         }
 
         ErrorCode CollectReAssign(VectorIndex* p_index, SizeType headID, std::vector<std::string>& postingLists, std::vector<SizeType>& newHeadsID) {
             auto headVector = reinterpret_cast<const ValueType*>(p_index->GetSample(headID));
             std::vector<float> newHeadsDist;
             std::set<SizeType> reAssignVectorsTopK;
+            std::vector<ValueType> decoded;
             newHeadsDist.push_back(p_index->ComputeDistance(p_index->GetSample(headID), p_index->GetSample(newHeadsID[0])));
             newHeadsDist.push_back(p_index->ComputeDistance(p_index->GetSample(headID), p_index->GetSample(newHeadsID[1])));
             for (int i = 0; i < postingLists.size(); i++) {
@@ -872,7 +1124,7 @@ namespace SPTAG::SPANN {
                     SizeType vid = *(reinterpret_cast<SizeType*>(vectorId));
                     // LOG(Helper::LogLevel::LL_Info, "VID: %d, Head: %d\n", vid, newHeadsID[i]);
                     uint8_t version = *(reinterpret_cast<uint8_t*>(vectorId + sizeof(int)));
-                    ValueType* vector = reinterpret_cast<ValueType*>(vectorId + m_metaDataSize);
+                    const ValueType* vector = DecodedVector((const char*)vectorId, decoded);
                     if (reAssignVectorsTopK.find(vid) == reAssignVectorsTopK.end() && !m_versionMap->Deleted(vid) && m_versionMap->GetVersion(vid) == version) {
                         m_stat.m_reAssignScanNum++;
                         float dist = p_index->ComputeDistance(p_index->GetSample(newHeadsID[i]), vector);
@@ -920,7 +1172,7 @@ namespace SPTAG::SPANN {
                         SizeType vid = *(reinterpret_cast<SizeType*>(vectorId));
                         // LOG(Helper::LogLevel::LL_Info, "%d: VID: %d, Head: %d, size:%d/%d\n", i, vid, HeadPrevTopK[i], postingLists.size(), HeadPrevTopK.size());
                         uint8_t version = *(reinterpret_cast<uint8_t*>(vectorId + sizeof(int)));
-                        ValueType* vector = reinterpret_cast<ValueType*>(vectorId + m_metaDataSize);
+                        const ValueType* vector = DecodedVector((const char*)vectorId, decoded);
                         if (reAssignVectorsTopK.find(vid) == reAssignVectorsTopK.end() && !m_versionMap->Deleted(vid) && m_versionMap->GetVersion(vid) == version) {
                             m_stat.m_reAssignScanNum++;
                             float dist = p_index->ComputeDistance(p_index->GetSample(HeadPrevTopK[i]), vector);
@@ -936,11 +1188,15 @@ namespace SPTAG::SPANN {
             return ErrorCode::Success;
         }
 
-        bool RNGSelection(std::vector<Edge>& selections, ValueType* queryVector, VectorIndex* p_index, SizeType p_fullID, int& replicaCount, int checkHeadID = -1)
+        bool RNGSelection(std::vector<Edge>& selections, const ValueType* queryVector, VectorIndex* p_index, SizeType p_fullID, int& replicaCount, int checkHeadID = -1)
         {
             QueryResult queryResults(queryVector, m_opt->m_internalResultNum, false);
             p_index->SearchIndex(queryResults);
+            return RNGSelection(selections, queryResults, p_index, p_fullID, replicaCount, checkHeadID);
+        }
 
+        bool RNGSelection(std::vector<Edge>& selections, QueryResult& queryResults, VectorIndex* p_index, SizeType p_fullID, int& replicaCount, int checkHeadID = -1)
+        {
             replicaCount = 0;
             for (int i = 0; i < queryResults.GetResultNum() && replicaCount < m_opt->m_replicaCount; ++i)
             {
@@ -1002,8 +1258,8 @@ namespace SPTAG::SPANN {
             }
             double appendIOSeconds = 0;
             {
-                //std::shared_lock<std::shared_timed_mutex> lock(m_rwLocks[headID]); //ROCKSDB
-                std::unique_lock<std::shared_timed_mutex> lock(m_rwLocks[headID]); //SPDK
+                // searches read postings without this lock, it only orders writers of the same head
+                std::unique_lock<COMMON::SequenceMutex> lock(m_headLocks[headID]);
                 if (!p_index->ContainSample(headID)) {
                     goto checkDeleted;
                 }
@@ -1016,6 +1272,7 @@ namespace SPTAG::SPANN {
                 auto appendIOEnd = std::chrono::high_resolution_clock::now();
                 appendIOSeconds = std::chrono::duration_cast<std::chrono::microseconds>(appendIOEnd - appendIOBegin).count();
                 m_postingSizes.IncSize(headID, appendNum);
+                if (m_postingCache) m_postingCache->Append(headID, appendPosting);
             }
             if (m_postingSizes.GetSize(headID) > (m_postingSizeLimit + reassignThreshold)) {
                 // SizeType VID = *(int*)(&appendPosting[0]);
@@ -1058,7 +1315,10 @@ namespace SPTAG::SPANN {
             auto selectBegin = std::chrono::high_resolution_clock::now();
             std::vector<Edge> selections(static_cast<size_t>(m_opt->m_replicaCount));
             int replicaCount;
-            bool isNeedReassign = RNGSelection(selections, (ValueType*)(vectorInfo->c_str() + m_metaDataSize), p_index, VID, replicaCount, HeadPrev);
+            std::vector<ValueType> fullVector;
+            const ValueType* vector = FullVector(vectorInfo->c_str(), fullVector);
+            if (vector == nullptr) return;
+            bool isNeedReassign = RNGSelection(selections, vector, p_index, VID, replicaCount, HeadPrev);
             auto selectEnd = std::chrono::high_resolution_clock::now();
             auto elapsedMSeconds = std::chrono::duration_cast<std::chrono::microseconds>(selectEnd - selectBegin).count();
             m_stat.m_selectCost += elapsedMSeconds;
@@ -1091,11 +1351,19 @@ namespace SPTAG::SPANN {
         bool LoadIndex(Options& p_opt, COMMON::VersionLabel& p_versionMap) override {
             m_versionMap = &p_versionMap;
             m_opt = &p_opt;
+            if (m_opt->m_postingCacheSize > 0 && !m_postingCache) m_postingCache.reset(new PostingCache(((std::size_t)m_opt->m_postingCacheSize) << 20));
+            if (!LoadPostingQuantizer()) return false;
             LOG(Helper::LogLevel::LL_Info, "DataBlockSize: %d, Capacity: %d\n", m_opt->m_datasetRowsInBlock, m_opt->m_datasetCapacity);
 
             if (!m_opt->m_useSPDK) {
-                m_versionMap->Load(m_opt->m_deleteIDFile, m_opt->m_datasetRowsInBlock, m_opt->m_datasetCapacity);
-                m_postingSizes.Load(m_opt->m_ssdInfoFile, m_opt->m_datasetRowsInBlock, m_opt->m_datasetCapacity);
+                if (m_opt->m_mmapIndex) {
+                    m_versionMap->LoadMapped(m_opt->m_deleteIDFile, m_opt->m_datasetRowsInBlock, m_opt->m_datasetCapacity, m_opt->m_mmapPrefetch);
+                    m_postingSizes.LoadMapped(m_opt->m_ssdInfoFile, m_opt->m_datasetRowsInBlock, m_opt->m_datasetCapacity, m_opt->m_mmapPrefetch);
+                }
+                else {
+                    m_versionMap->Load(m_opt->m_deleteIDFile, m_opt->m_datasetRowsInBlock, m_opt->m_datasetCapacity);
+                    m_postingSizes.Load(m_opt->m_ssdInfoFile, m_opt->m_datasetRowsInBlock, m_opt->m_datasetCapacity);
+                }
                 LOG(Helper::LogLevel::LL_Info, "Current vector num: %d.\n", m_versionMap->GetVectorNum());
                 LOG(Helper::LogLevel::LL_Info, "Current posting num: %d.\n", m_postingSizes.GetPostingNum());
             }
@@ -1111,6 +1379,161 @@ namespace SPTAG::SPANN {
             return true;
         }
 
+        // Hands every posting to p_score, cached ones first and the rest as the store returns them.
+        // Only postings read from the store count towards p_diskRead and p_diskIO.
+        // p_skip is asked about each uncached posting, in order, right before its read is submitted and may drop it.
+        void ReadPostings(const std::vector<SizeType>& p_postingIDs, const std::chrono::microseconds& p_timeout,
+            const std::function<void(SizeType, const std::string&)>& p_score, int& p_diskRead, int& p_diskIO,
+            const std::function<bool(SizeType)>& p_skip = nullptr)
+        {
+            // A miss remembers its head version so that a read racing a writer is not cached.
+            const std::vector<SizeType>* readIDs = &p_postingIDs;
+            std::vector<SizeType> missIDs;
+            std::vector<std::uint32_t> missVersions;
+            if (m_postingCache) {
+                for (SizeType curPostingID : p_postingIDs) {
+                    std::shared_ptr<std::string> cached = m_postingCache->Get(curPostingID);
+                    if (cached) {
+                        p_score(curPostingID, *cached);
+                        continue;
+                    }
+                    missVersions.push_back(m_headLocks[curPostingID].Version());
+                    missIDs.push_back(curPostingID);
+                }
+                readIDs = &missIDs;
+            }
+            if (readIDs->empty()) return;
+
+            std::function<bool(size_t)> skip;
+            if (p_skip != nullptr) skip = [&](size_t pi) { return p_skip((*readIDs)[pi]); };
+            std::vector<std::string> postingLists;
+            db->MultiGet(*readIDs, &postingLists, p_timeout, [&](size_t pi) {
+                SizeType curPostingID = (*readIDs)[pi];
+                std::string& postingList = postingLists[pi];
+                p_diskIO += ((postingList.size() + PageSize - 1) >> PageSizeEx);
+                p_diskRead += (int)(postingList.size());
+                p_score(curPostingID, postingList);
+                if (m_postingCache) {
+                    m_postingCache->Admit(curPostingID, std::make_shared<std::string>(std::move(postingList)), m_headLocks[curPostingID], missVersions[pi]);
+                }
+            }, skip);
+        }
+
+        // Reads the probes in the given order as one pipelined batch, so later probes are in flight while earlier ones are scored.
+        // After every scored posting the k-th distance of p_topK is compared with its value p_waveSize * SearchProbePatience
+        // postings earlier, and once it has improved by less than SearchProbeEpsilon the probes not yet submitted are dropped.
+        // Returns the number of probes dropped that way, probes cut off by the timeout are not counted.
+        int ReadPostingWaves(const std::vector<SizeType>& p_postingIDs, size_t p_waveSize, const std::chrono::microseconds& p_timeout, const COMMON::QueryResultSet<ValueType>* p_topK,
+            const std::function<void(SizeType, const std::string&)>& p_score, int& p_diskRead, int& p_diskIO, const std::function<bool(SizeType)>& p_skip)
+        {
+            std::vector<float> window(p_waveSize * max(1, m_opt->m_searchProbePatience), MaxDist);
+            int dropped = 0;
+            size_t scored = 0;
+            bool stop = false;
+            auto score = [&](SizeType postingID, const std::string& postingList) {
+                p_score(postingID, postingList);
+                if (stop) return;
+
+                float dist = p_topK->worstDist();
+                float& lastDist = window[scored++ % window.size()];
+                stop = (dist < MaxDist && lastDist < MaxDist && lastDist - dist <= m_opt->m_searchProbeEpsilon * fabs(lastDist));
+                lastDist = dist;
+            };
+            auto skip = [&](SizeType postingID) {
+                if (stop) {
+                    dropped++;
+                    return true;
+                }
+                return p_skip != nullptr && p_skip(postingID);
+            };
+            ReadPostings(p_postingIDs, p_timeout, score, p_diskRead, p_diskIO, skip);
+            return dropped;
+        }
+
+        // Scores the codes of compressed postings for one query. With 16 codewords per subvector the codes are
+        // gathered into fast-scan blocks, otherwise each is scored through the float ADC table.
+        struct CodeScorer
+        {
+            static const int BlockCodes = COMMON::PQQuantizer<ValueType>::FastScanBlockCodes;
+
+            COMMON::QueryResultSet<ValueType>* candidates = nullptr;
+            const float* table = nullptr;
+            const std::uint8_t* fastScanTable = nullptr;
+            float scale = 1.0f, bias = 0.0f;
+            int ids[BlockCodes];
+            const std::uint8_t* codes[BlockCodes];
+            int num = 0;
+            std::vector<std::uint8_t> block;
+        };
+
+        void InitCodeScorer(CodeScorer& p_scorer, COMMON::QueryResultSet<ValueType>* p_candidates, std::vector<float>& p_table, std::vector<std::uint8_t>& p_fastScanTable)
+        {
+            p_scorer.candidates = p_candidates;
+            p_table.resize((size_t)m_postingQuantizer->GetNumSubvectors() * m_postingQuantizer->GetKsPerSubvector());
+            m_postingQuantizer->ComputeDistanceTable(p_candidates->GetTarget(), p_table.data());
+            p_scorer.table = p_table.data();
+            if (m_postingQuantizer->FastScanEnabled()) {
+                p_fastScanTable.resize(p_table.size());
+                m_postingQuantizer->QuantizeDistanceTable(p_scorer.table, p_fastScanTable.data(), p_scorer.scale, p_scorer.bias);
+                p_scorer.fastScanTable = p_fastScanTable.data();
+                p_scorer.block.resize(m_postingQuantizer->FastScanBlockSize());
+            }
+        }
+
+        // Codes point into the posting being scored, so FlushCodes must run before it goes away.
+        inline void ScoreCode(CodeScorer& p_scorer, int p_vectorID, const char* p_vectorInfo)
+        {
+            const std::uint8_t* code = reinterpret_cast<const std::uint8_t*>(p_vectorInfo + m_metaDataSize);
+            if (p_scorer.fastScanTable == nullptr) {
+                p_scorer.candidates->AddPoint(p_vectorID, m_postingQuantizer->ADCL2Distance(p_scorer.table, code));
+                return;
+            }
+            p_scorer.ids[p_scorer.num] = p_vectorID;
+            p_scorer.codes[p_scorer.num] = code;
+            if (++p_scorer.num == CodeScorer::BlockCodes) FlushCodes(p_scorer);
+        }
+
+        void FlushCodes(CodeScorer& p_scorer)
+        {
+            if (p_scorer.num == 0) return;
+            float dists[CodeScorer::BlockCodes];
+            m_postingQuantizer->PackFastScanBlock(p_scorer.codes, p_scorer.num, p_scorer.block.data());
+            m_postingQuantizer->FastScanL2Distances(p_scorer.fastScanTable, p_scorer.scale, p_scorer.bias, p_scorer.block.data(), p_scorer.num, dists);
+            for (int k = 0; k < p_scorer.num; k++) p_scorer.candidates->AddPoint(p_scorer.ids[k], dists[k]);
+            p_scorer.num = 0;
+        }
+
+        // Exact distances for the code-scored candidates of each query, a vector several queries ask for is read once.
+        // Returns the number of vectors read from the full-vector store.
+        int Rerank(const std::vector<COMMON::QueryResultSet<ValueType>*>& p_candidates, const std::vector<COMMON::QueryResultSet<ValueType>*>& p_results, VectorIndex* p_index)
+        {
+            std::unordered_map<SizeType, int> rows;
+            std::vector<SizeType> vids;
+            for (auto* candidates : p_candidates) {
+                for (int i = 0; i < candidates->GetResultNum(); i++) {
+                    SizeType vid = candidates->GetResult(i)->VID;
+                    if (vid >= 0 && rows.emplace(vid, (int)vids.size()).second) vids.push_back(vid);
+                }
+            }
+            if (vids.empty()) return 0;
+
+            std::string fullVectors((size_t)vids.size() * m_vectorSize, '\0');
+            std::vector<char*> fullRows(vids.size());
+            for (size_t i = 0; i < vids.size(); i++) fullRows[i] = &fullVectors[i * m_vectorSize];
+            bool exact = (m_fullVectors->MultiGet(vids, fullRows) == ErrorCode::Success);
+            if (!exact) LOG(Helper::LogLevel::LL_Error, "Rerank fail to read full vectors, keep code distances\n");
+
+            for (size_t q = 0; q < p_candidates.size(); q++) {
+                for (int i = 0; i < p_candidates[q]->GetResultNum(); i++) {
+                    BasicResult* candidate = p_candidates[q]->GetResult(i);
+                    if (candidate->VID < 0) continue;
+                    float dist = exact ? p_index->ComputeDistance(p_results[q]->GetTarget(), fullRows[rows[candidate->VID]]) : candidate->Dist;
+                    p_results[q]->AddPoint(candidate->VID, dist);
+                }
+            }
+            return exact ? (int)vids.size() : 0;
+        }
+
         virtual void SearchIndex(ExtraWorkSpace* p_exWorkSpace,
             QueryResult& p_queryResults,
             std::shared_ptr<VectorIndex> p_index,
@@ -1120,7 +1543,9 @@ namespace SPTAG::SPANN {
 
             // const auto postingListCount = static_cast<uint32_t>(p_exWorkSpace->m_postingIDs.size());
 
-            p_exWorkSpace->m_deduper.clear();
+            // the dedup set is sized to every vector the probes can hold, so a scan never grows it
+            p_exWorkSpace->m_postingDeduper.Reserve((SizeType)p_exWorkSpace->m_postingIDs.size() * m_postingSizeLimit);
+            p_exWorkSpace->m_postingDeduper.clear();
 
             auto exSetUpEnd = std::chrono::high_resolution_clock::now();
 
@@ -1135,46 +1560,67 @@ namespace SPTAG::SPANN {
             double compLatency = 0;
             double readLatency = 0;
 
-            std::vector<std::string> postingLists;
-
             std::chrono::microseconds remainLimit = m_hardLatencyLimit - std::chrono::microseconds((int)p_stats->m_totalLatency);
 
-            auto readStart = std::chrono::high_resolution_clock::now();
-            db->MultiGet(p_exWorkSpace->m_postingIDs, &postingLists, remainLimit);
-            auto readEnd = std::chrono::high_resolution_clock::now();
-
-            for (uint32_t pi = 0; pi < postingLists.size(); ++pi) {
-                diskIO += ((postingLists[pi].size() + PageSize - 1) >> PageSizeEx);
+            // Score each posting as soon as it lands, in probe order (nearest head first) as far as the device allows.
+            // When the budget runs out the query keeps everything scored so far and reports the covered share of the probes.
+            int coveredPostings = 0;
+            // Quantized heads need the quantizer's distance, everything else goes through the batched kernel.
+            const ValueType* target = reinterpret_cast<const ValueType*>(queryResults.GetQuantizedTarget());
+            COMMON::DistanceBatchCalcReturn<ValueType> batchDistance = (p_index->m_pQuantizer == nullptr) ? COMMON::DistanceBatchCalcSelector<ValueType>(p_index->GetDistCalcMethod()) : nullptr;
+            // Compressed postings are scored on their codes into a longer candidate list, reranked once the reads are done.
+            std::unique_ptr<COMMON::QueryResultSet<ValueType>> candidates;
+            CodeScorer codeScorer;
+            if (m_postingQuantizer) {
+                candidates.reset(new COMMON::QueryResultSet<ValueType>(queryResults.GetTarget(), max(m_opt->m_postingRerankNum, queryResults.GetResultNum())));
+                InitCodeScorer(codeScorer, candidates.get(), p_exWorkSpace->m_distanceTable, p_exWorkSpace->m_fastScanTable);
             }
-
-            readLatency += ((double)std::chrono::duration_cast<std::chrono::microseconds>(readEnd - readStart).count());
-            for (uint32_t pi = 0; pi < postingLists.size(); ++pi) {
-                auto curPostingID = p_exWorkSpace->m_postingIDs[pi];
-                std::string& postingList = postingLists[pi];
+            auto scorePosting = [&](SizeType curPostingID, const std::string& postingList) {
+                auto compStart = std::chrono::high_resolution_clock::now();
 
                 int vectorNum = (int)(postingList.size() / m_vectorInfoSize);
 
                 int realNum = vectorNum;
 
-                diskRead += (int)(postingList.size());
+                coveredPostings++;
                 listElements += vectorNum;
 
-                auto compStart = std::chrono::high_resolution_clock::now();
-                for (int i = 0; i < vectorNum; i++) {
-                    char* vectorInfo = postingList.data() + i * m_vectorInfoSize;
-                    int vectorID = *(reinterpret_cast<int*>(vectorInfo));
-                    if (m_versionMap->Deleted(vectorID)) {
-                        realNum--;
-                        listElements--;
-                        continue;
+                // Filter the ids kScoreBatch at a time, deleted ones through the bit mirror and duplicates through the dedup set,
+                // then score the surviving vectors in place.
+                SizeType chunkIDs[kScoreBatch];
+                std::uint8_t keep[kScoreBatch];
+                int batchIDs[kScoreBatch];
+                const ValueType* batchVectors[kScoreBatch];
+                float batchDists[kScoreBatch];
+                for (int base = 0; base < vectorNum; base += kScoreBatch) {
+                    int chunkNum = min(kScoreBatch, vectorNum - base);
+                    const char* chunk = postingList.data() + (size_t)base * m_vectorInfoSize;
+                    for (int k = 0; k < chunkNum; k++) chunkIDs[k] = *(reinterpret_cast<const int*>(chunk + k * m_vectorInfoSize));
+                    int deleted = chunkNum - m_versionMap->FilterDeleted(chunkIDs, chunkNum, keep);
+                    realNum -= deleted;
+                    listElements -= deleted + p_exWorkSpace->m_postingDeduper.CheckAndSetBatch(chunkIDs, chunkNum, keep);
+
+                    int batchNum = 0;
+                    for (int k = 0; k < chunkNum; k++) {
+                        if (!keep[k]) continue;
+                        const char* vectorInfo = chunk + k * m_vectorInfoSize;
+                        if (candidates) {
+                            ScoreCode(codeScorer, chunkIDs[k], vectorInfo);
+                            continue;
+                        }
+                        batchIDs[batchNum] = chunkIDs[k];
+                        batchVectors[batchNum++] = reinterpret_cast<const ValueType*>(vectorInfo + m_metaDataSize);
                     }
-                    if(p_exWorkSpace->m_deduper.CheckAndSet(vectorID)) {
-                        listElements--;
-                        continue;
+                    if (batchNum == 0) continue;
+                    if (batchDistance != nullptr) {
+                        batchDistance(target, batchVectors, batchNum, m_opt->m_dim, batchDists);
+                    }
+                    else {
+                        for (int k = 0; k < batchNum; k++) batchDists[k] = p_index->ComputeDistance(target, batchVectors[k]);
                     }
-                    auto distance2leaf = p_index->ComputeDistance(queryResults.GetQuantizedTarget(), vectorInfo + m_metaDataSize);
-                    queryResults.AddPoint(vectorID, distance2leaf);
+                    for (int k = 0; k < batchNum; k++) queryResults.AddPoint(batchIDs[k], batchDists[k]);
                 }
+                if (candidates) FlushCodes(codeScorer);
                 auto compEnd = std::chrono::high_resolution_clock::now();
                 if (realNum <= m_mergeThreshold && !m_opt->m_inPlace) MergeAsync(p_index.get(), curPostingID);
 
@@ -1182,12 +1628,55 @@ namespace SPTAG::SPANN {
 
                 if (truth) {
                     for (int i = 0; i < vectorNum; ++i) {
-                        char* vectorInfo = postingList.data() + i * m_vectorInfoSize;
-                        int vectorID = *(reinterpret_cast<int*>(vectorInfo));
+                        const char* vectorInfo = postingList.data() + i * m_vectorInfoSize;
+                        int vectorID = *(reinterpret_cast<const int*>(vectorInfo));
                         if (truth->count(vectorID) != 0)
                             (*found)[curPostingID].insert(vectorID);
                     }
                 }
+            };
+
+            auto readStart = std::chrono::high_resolution_clock::now();
+
+            // Reads go out nearest head first. With L2 and a full top-K, a probe whose head is more than SearchSkipRatio times
+            // the current k-th distance away is dropped right before its read would be submitted.
+            const std::vector<SizeType>& probes = p_exWorkSpace->m_postingIDs;
+            const std::vector<float>& probeDists = p_exWorkSpace->m_postingDists;
+            const COMMON::QueryResultSet<ValueType>* topK = candidates ? candidates.get() : &queryResults;
+            int savedPostings = 0;
+            size_t probeCursor = 0;
+            std::function<bool(SizeType)> skipPosting;
+            if (m_opt->m_searchSkipRatio > 0 && probeDists.size() == probes.size() && p_index->GetDistCalcMethod() == DistCalcMethod::L2) {
+                skipPosting = [&](SizeType postingID) {
+                    // asked in probe order, so the probe is found by walking forward
+                    while (probeCursor < probes.size() && probes[probeCursor] != postingID) probeCursor++;
+                    if (probeCursor == probes.size()) return false;
+                    float kthDist = topK->worstDist();
+                    if (kthDist >= MaxDist || probeDists[probeCursor] <= kthDist * m_opt->m_searchSkipRatio) return false;
+                    savedPostings++;
+                    return true;
+                };
+            }
+
+            // The skip ratio and, with SearchProbeWave, the settle check run as each posting completes, so both see every
+            // posting scored so far across the whole probe set.
+            if (m_opt->m_searchProbeWave <= 0) {
+                ReadPostings(probes, remainLimit, scorePosting, diskRead, diskIO, skipPosting);
+            }
+            else {
+                savedPostings += ReadPostingWaves(probes, m_opt->m_searchProbeWave, remainLimit, topK, scorePosting, diskRead, diskIO, skipPosting);
+            }
+            if (candidates) {
+                int reranked = Rerank({ candidates.get() }, { &queryResults }, p_index.get());
+                diskIO += reranked;
+                diskRead += reranked * m_vectorSize;
+            }
+            auto readEnd = std::chrono::high_resolution_clock::now();
+
+            readLatency += ((double)std::chrono::duration_cast<std::chrono::microseconds>(readEnd - readStart).count()) - compLatency;
+
+            if (m_opt->m_backgroundThrottle) {
+                RecordSearchLatency(std::chrono::duration_cast<std::chrono::microseconds>(std::chrono::high_resolution_clock::now() - exStart).count());
             }
 
             if (p_stats)
@@ -1197,12 +1686,182 @@ namespace SPTAG::SPANN {
                 p_stats->m_totalListElementsCount = listElements;
                 p_stats->m_diskIOCount = diskIO;
                 p_stats->m_diskAccessCount = diskRead / 1024;
+                p_stats->m_postingCount = (int)p_exWorkSpace->m_postingIDs.size();
+                p_stats->m_postingCovered = coveredPostings;
+                p_stats->m_postingSaved = savedPostings;
+            }
+        }
+
+        // Every distinct posting of the batch is read once and scored against all the queries that probe it.
+        // Distances are symmetric, so the batched kernel takes the posting vector as its single side and
+        // scores it against a block of queries that stays hot in cache.
+        void SearchIndexBatch(ExtraWorkSpace* p_exWorkSpace,
+            std::vector<QueryResult*>& p_queryResults,
+            std::vector<std::vector<SizeType>>& p_postingIDs,
+            std::shared_ptr<VectorIndex> p_index,
+            SearchStats* p_stats) override
+        {
+            auto exStart = std::chrono::high_resolution_clock::now();
+            int queryNum = (int)p_queryResults.size();
+
+            while (p_exWorkSpace->m_batchDedupers.size() < queryNum) {
+                p_exWorkSpace->m_batchDedupers.emplace_back(new COMMON::EpochHashSet());
+            }
+
+            std::unordered_map<SizeType, int> postingSlots;
+            std::vector<SizeType> distinctIDs;
+            std::vector<std::vector<int>> probedBy;
+            std::vector<const ValueType*> targets(queryNum);
+            for (int q = 0; q < queryNum; q++) {
+                p_exWorkSpace->m_batchDedupers[q]->Reserve((SizeType)p_postingIDs[q].size() * m_postingSizeLimit);
+                p_exWorkSpace->m_batchDedupers[q]->clear();
+                targets[q] = reinterpret_cast<const ValueType*>(((COMMON::QueryResultSet<ValueType>*)p_queryResults[q])->GetQuantizedTarget());
+                for (SizeType postingID : p_postingIDs[q]) {
+                    auto slot = postingSlots.emplace(postingID, (int)distinctIDs.size());
+                    if (slot.second) {
+                        distinctIDs.push_back(postingID);
+                        probedBy.emplace_back();
+                    }
+                    probedBy[slot.first->second].push_back(q);
+                }
+            }
+
+            COMMON::DistanceBatchCalcReturn<ValueType> batchDistance = (p_index->m_pQuantizer == nullptr) ? COMMON::DistanceBatchCalcSelector<ValueType>(p_index->GetDistCalcMethod()) : nullptr;
+            std::vector<int> batchQueries(queryNum);
+            std::vector<const ValueType*> batchTargets(queryNum);
+            std::vector<float> batchDists(queryNum);
+
+            // compressed postings: per query ADC tables and candidate lists, reranked together at the end
+            std::vector<std::unique_ptr<COMMON::QueryResultSet<ValueType>>> candidates;
+            std::vector<CodeScorer> codeScorers;
+            std::vector<std::vector<float>> distanceTables;
+            std::vector<std::vector<std::uint8_t>> fastScanTables;
+            if (m_postingQuantizer) {
+                candidates.resize(queryNum);
+                codeScorers.resize(queryNum);
+                distanceTables.resize(queryNum);
+                fastScanTables.resize(queryNum);
+                for (int q = 0; q < queryNum; q++) {
+                    auto* queryResults = (COMMON::QueryResultSet<ValueType>*)p_queryResults[q];
+                    candidates[q].reset(new COMMON::QueryResultSet<ValueType>(queryResults->GetTarget(), max(m_opt->m_postingRerankNum, queryResults->GetResultNum())));
+                    InitCodeScorer(codeScorers[q], candidates[q].get(), distanceTables[q], fastScanTables[q]);
+                }
+            }
+
+            std::vector<int> listElements(queryNum, 0), coveredPostings(queryNum, 0), diskIOs(queryNum, 0), diskReads(queryNum, 0);
+            int diskRead = 0, chargedRead = 0;
+            int diskIO = 0, chargedIO = 0;
+            double compLatency = 0;
+            std::vector<std::uint8_t> queryKeep;
+
+            auto scorePosting = [&](SizeType curPostingID, const std::string& postingList) {
+                auto compStart = std::chrono::high_resolution_clock::now();
+                const std::vector<int>& queries = probedBy[postingSlots[curPostingID]];
+
+                int vectorNum = (int)(postingList.size() / m_vectorInfoSize);
+                int realNum = vectorNum;
+                for (int q : queries) coveredPostings[q]++;
+                // a read from the store is charged to the first query that asked for it, cached postings cost nothing
+                diskIOs[queries[0]] += diskIO - chargedIO;
+                diskReads[queries[0]] += diskRead - chargedRead;
+                chargedIO = diskIO;
+                chargedRead = diskRead;
+
+                // Filter the ids kScoreBatch at a time, deleted ones once through the bit mirror and duplicates through
+                // the dedup set of each query, then score every surviving vector against the queries that kept it.
+                SizeType chunkIDs[kScoreBatch];
+                std::uint8_t keep[kScoreBatch];
+                queryKeep.resize(queries.size() * kScoreBatch);
+                for (int i = 0; i < vectorNum; i++) {
+                    if (i % kScoreBatch == 0) {
+                        int chunkNum = min(kScoreBatch, vectorNum - i);
+                        for (int k = 0; k < chunkNum; k++) chunkIDs[k] = *(reinterpret_cast<const int*>(postingList.data() + (size_t)(i + k) * m_vectorInfoSize));
+                        realNum -= chunkNum - m_versionMap->FilterDeleted(chunkIDs, chunkNum, keep);
+                        for (size_t j = 0; j < queries.size(); j++) {
+                            std::uint8_t* mask = queryKeep.data() + j * kScoreBatch;
+                            memcpy(mask, keep, chunkNum);
+                            p_exWorkSpace->m_batchDedupers[queries[j]]->CheckAndSetBatch(chunkIDs, chunkNum, mask);
+                        }
+                    }
+                    if (!keep[i % kScoreBatch]) continue;
+                    const char* vectorInfo = postingList.data() + i * m_vectorInfoSize;
+                    int vectorID = chunkIDs[i % kScoreBatch];
+                    int batchNum = 0;
+                    for (size_t j = 0; j < queries.size(); j++) {
+                        if (!queryKeep[j * kScoreBatch + i % kScoreBatch]) continue;
+                        batchQueries[batchNum] = queries[j];
+                        batchTargets[batchNum++] = targets[queries[j]];
+                    }
+                    if (batchNum == 0) continue;
+
+                    if (m_postingQuantizer) {
+                        for (int k = 0; k < batchNum; k++) {
+                            ScoreCode(codeScorers[batchQueries[k]], vectorID, vectorInfo);
+                            listElements[batchQueries[k]]++;
+                        }
+                        continue;
+                    }
+                    const ValueType* vector = reinterpret_cast<const ValueType*>(vectorInfo + m_metaDataSize);
+                    if (batchDistance != nullptr) {
+                        batchDistance(vector, batchTargets.data(), batchNum, m_opt->m_dim, batchDists.data());
+                    }
+                    else {
+                        for (int k = 0; k < batchNum; k++) batchDists[k] = p_index->ComputeDistance(batchTargets[k], vector);
+                    }
+                    for (int k = 0; k < batchNum; k++) {
+                        ((COMMON::QueryResultSet<ValueType>*)p_queryResults[batchQueries[k]])->AddPoint(vectorID, batchDists[k]);
+                        listElements[batchQueries[k]]++;
+                    }
+                }
+                if (m_postingQuantizer) for (int q : queries) FlushCodes(codeScorers[q]);
+                if (realNum <= m_mergeThreshold && !m_opt->m_inPlace) MergeAsync(p_index.get(), curPostingID);
+
+                compLatency += ((double)std::chrono::duration_cast<std::chrono::microseconds>(std::chrono::high_resolution_clock::now() - compStart).count());
+            };
+
+            auto readStart = std::chrono::high_resolution_clock::now();
+            ReadPostings(distinctIDs, std::chrono::microseconds::max(), scorePosting, diskRead, diskIO);
+            if (m_postingQuantizer) {
+                std::vector<COMMON::QueryResultSet<ValueType>*> candidateLists(queryNum), resultLists(queryNum);
+                for (int q = 0; q < queryNum; q++) {
+                    candidateLists[q] = candidates[q].get();
+                    resultLists[q] = (COMMON::QueryResultSet<ValueType>*)p_queryResults[q];
+                }
+                // the rerank reads are shared too and charged to the first query of the batch
+                int reranked = Rerank(candidateLists, resultLists, p_index.get());
+                if (queryNum > 0) {
+                    diskIOs[0] += reranked;
+                    diskReads[0] += reranked * m_vectorSize;
+                }
+            }
+            auto readEnd = std::chrono::high_resolution_clock::now();
+            double readLatency = ((double)std::chrono::duration_cast<std::chrono::microseconds>(readEnd - readStart).count()) - compLatency;
+
+            // every query of the batch waits for the whole batch, so its latency is what each of them saw
+            if (m_opt->m_backgroundThrottle && queryNum > 0) {
+                RecordSearchLatency(std::chrono::duration_cast<std::chrono::microseconds>(std::chrono::high_resolution_clock::now() - exStart).count());
+            }
+
+            if (p_stats)
+            {
+                // the batch shares its reads and scoring, each query reports the batch latencies
+                for (int q = 0; q < queryNum; q++) {
+                    p_stats[q].m_exSetUpLatency = ((double)std::chrono::duration_cast<std::chrono::microseconds>(readStart - exStart).count()) / 1000;
+                    p_stats[q].m_compLatency = compLatency / 1000;
+                    p_stats[q].m_diskReadLatency = readLatency / 1000;
+                    p_stats[q].m_totalListElementsCount = listElements[q];
+                    p_stats[q].m_diskIOCount = diskIOs[q];
+                    p_stats[q].m_diskAccessCount = diskReads[q] / 1024;
+                    p_stats[q].m_postingCount = (int)p_postingIDs[q].size();
+                    p_stats[q].m_postingCovered = coveredPostings[q];
+                }
             }
         }
 
         bool BuildIndex(std::shared_ptr<Helper::VectorSetReader>& p_reader, std::shared_ptr<VectorIndex> p_headIndex, Options& p_opt, COMMON::VersionLabel& p_versionMap, SizeType upperBound = -1) override {
             m_versionMap = &p_versionMap;
             m_opt = &p_opt;
+            if (m_opt->m_postingCacheSize > 0 && !m_postingCache) m_postingCache.reset(new PostingCache(((std::size_t)m_opt->m_postingCacheSize) << 20));
 
             int numThreads = m_opt->m_iSSDNumberOfThreads;
             int candidateNum = m_opt->m_internalResultNum;
@@ -1228,21 +1887,22 @@ namespace SPTAG::SPANN {
                 LOG(Helper::LogLevel::LL_Info, "Loaded %u Vector IDs\n", static_cast<uint32_t>(headVectorIDS.size()));
             }
 
-            SizeType fullCount = 0;
-            {
-                auto fullVectors = p_reader->GetVectorSet();
-                fullCount = fullVectors->Count();
-                m_vectorInfoSize = fullVectors->PerVectorDataSize() + m_metaDataSize;
-            }
+            // only the header and the first row are read here, the vectors come in batches below
+            SizeType fullCount = p_reader->GetVectorCount();
+            SizeType perVectorDataSize = p_reader->GetVectorSet(0, 1)->PerVectorDataSize();
+            m_vectorInfoSize = perVectorDataSize + m_metaDataSize;
             if (upperBound > 0) fullCount = upperBound;
 
             // m_metaDataSize = sizeof(int) + sizeof(uint8_t) + sizeof(float);
             m_metaDataSize = sizeof(int) + sizeof(uint8_t);
+            if (!LoadPostingQuantizer()) return false;
 
             LOG(Helper::LogLevel::LL_Info, "Build SSD Index.\n");
 
             Selection selections(static_cast<size_t>(fullCount) * m_opt->m_replicaCount, m_opt->m_tmpdir);
             LOG(Helper::LogLevel::LL_Info, "Full vector count:%d Edge bytes:%llu selection size:%zu, capacity size:%zu\n", fullCount, sizeof(Edge), selections.m_selections.size(), selections.m_selections.capacity());
+            std::unique_ptr<PostingSpill> spill;
+            if (m_opt->m_streamingBuild) spill.reset(new PostingSpill(m_opt->m_tmpdir, perVectorDataSize, p_headIndex->GetNumSamples(), selections.m_totalsize, ((size_t)m_opt->m_streamingSpillBufferMB) << 20));
             std::vector<std::atomic_int> replicaCount(fullCount);
             std::vector<std::atomic_int> postingListSize(p_headIndex->GetNumSamples());
             for (auto& pls : postingListSize) pls = 0;
@@ -1307,10 +1967,16 @@ namespace SPTAG::SPANN {
                                 ++postingListSize[selections[vecOffset + resNum].node];
                                 selections[vecOffset + resNum].tonode = j;
                                 ++replicaCount[j];
+                                if (spill && spill->Append(selections[vecOffset + resNum], fullVectors->GetVector(j - start)) != ErrorCode::Success) return false;
                             }
                         }
                     }
 
+                    if (spill && m_fullVectors) {
+#pragma omp parallel for schedule(static, 4096)
+                        for (SizeType j = start; j < end; j++) m_fullVectors->Put(j, fullVectors->GetVector(j - start));
+                    }
+
                     if (p_opt.m_batches > 1)
                     {
                         if (selections.SaveBatch() != ErrorCode::Success)
@@ -1333,6 +1999,7 @@ namespace SPTAG::SPANN {
 
             // Sort results either in CPU or GPU
             VectorIndex::SortSelections(&selections.m_selections);
+            if (spill && spill->Merge(selections.m_selections) != ErrorCode::Success) return false;
 
             auto t3 = std::chrono::high_resolution_clock::now();
             LOG(Helper::LogLevel::LL_Info, "Time to sort selections:%.2lf sec.\n", ((double)std::chrono::duration_cast<std::chrono::seconds>(t3 - t2).count()) + ((double)std::chrono::duration_cast<std::chrono::milliseconds>(t3 - t2).count()) / 1000);
@@ -1340,7 +2007,8 @@ namespace SPTAG::SPANN {
             auto postingSizeLimit = m_postingSizeLimit;
             if (m_opt->m_postingPageLimit > 0)
             {
-                postingSizeLimit = static_cast<int>(m_opt->m_postingPageLimit * PageSize / m_vectorInfoSize);
+                // counted in uncompressed records, compressed postings keep the same lengths and take fewer pages
+                postingSizeLimit = static_cast<int>(m_opt->m_postingPageLimit * PageSize / (m_metaDataSize + m_vectorSize));
             }
 
             LOG(Helper::LogLevel::LL_Info, "Posting size limit: %d\n", postingSizeLimit);
@@ -1424,8 +2092,11 @@ namespace SPTAG::SPANN {
             auto t4 = std::chrono::high_resolution_clock::now();
             LOG(SPTAG::Helper::LogLevel::LL_Info, "Time to perform posting cut:%.2lf sec.\n", ((double)std::chrono::duration_cast<std::chrono::seconds>(t4 - t3).count()) + ((double)std::chrono::duration_cast<std::chrono::milliseconds>(t4 - t3).count()) / 1000);
 
-            auto fullVectors = p_reader->GetVectorSet();
-            if (m_opt->m_distCalcMethod == DistCalcMethod::Cosine && !p_reader->IsNormalized()) fullVectors->Normalize(m_opt->m_iSSDNumberOfThreads);
+            std::shared_ptr<VectorSet> fullVectors;
+            if (!spill) {
+                fullVectors = p_reader->GetVectorSet();
+                if (m_opt->m_distCalcMethod == DistCalcMethod::Cosine && !p_reader->IsNormalized()) fullVectors->Normalize(m_opt->m_iSSDNumberOfThreads);
+            }
 
             LOG(Helper::LogLevel::LL_Info, "SPFresh: initialize versionMap\n");
             m_versionMap->Initialize(fullCount, p_headIndex->m_iDataBlockSize, p_headIndex->m_iDataCapacity);
@@ -1434,7 +2105,7 @@ namespace SPTAG::SPANN {
 
             std::vector<int> postingListSize_int(postingListSize.begin(), postingListSize.end());
 
-            WriteDownAllPostingToDB(postingListSize_int, selections, fullVectors);
+            WriteDownAllPostingToDB(postingListSize_int, selections, fullVectors, spill.get());
 
             m_postingSizes.Initialize((SizeType)(postingListSize.size()), p_headIndex->m_iDataBlockSize, p_headIndex->m_iDataCapacity);
             for (int i = 0; i < postingListSize.size(); i++) {
@@ -1451,7 +2122,13 @@ namespace SPTAG::SPANN {
             return true;
         }
 
-        void WriteDownAllPostingToDB(const std::vector<int>& p_postingListSizes, Selection& p_postingSelections, std::shared_ptr<VectorSet> p_fullVectors) {
+        // Without p_fullVectors the posting vectors come from p_spill, whose rows follow the sorted selections.
+        void WriteDownAllPostingToDB(const std::vector<int>& p_postingListSizes, Selection& p_postingSelections, std::shared_ptr<VectorSet> p_fullVectors, const PostingSpill* p_spill = nullptr) {
+            if (m_fullVectors && p_fullVectors) {
+                LOG(Helper::LogLevel::LL_Info, "SPFresh: Writing full vectors\n");
+#pragma omp parallel for schedule(static, 4096)
+                for (SizeType i = 0; i < p_fullVectors->Count(); i++) m_fullVectors->Put(i, p_fullVectors->GetVector(i));
+            }
     // #pragma omp parallel for num_threads(10)
             std::vector<std::thread> threads;
             std::atomic_size_t vectorsSent(0);
@@ -1471,11 +2148,12 @@ namespace SPTAG::SPANN {
                                 LOG(Helper::LogLevel::LL_Error, "Selection ID NOT MATCH\n");
                                 exit(1);
                             }
+                            const void* vector = p_spill ? p_spill->GetVector(selectIdx) : p_fullVectors->GetVector(p_postingSelections[selectIdx].tonode);
                             SizeType fullID = p_postingSelections[selectIdx++].tonode;
                             // if (id == 0) LOG(Helper::LogLevel::LL_Info, "ID: %d\n", fullID);
                             uint8_t version = m_versionMap->GetVersion(fullID);
                             // First Vector ID, then version, then Vector
-                            Serialize(ptr, fullID, version, p_fullVectors->GetVector(fullID));
+                            Serialize(ptr, fullID, version, vector);
                             ptr += m_vectorInfoSize;
                         }
                         db->Put(index, postinglist);
@@ -1495,6 +2173,9 @@ namespace SPTAG::SPANN {
         ErrorCode AddIndex(std::shared_ptr<VectorSet>& p_vectorSet,
             std::shared_ptr<VectorIndex> p_index, SizeType begin) override {
 
+            WaitForBackground();
+            if (p_vectorSet->Count() > 1) return AddIndexBatch(p_vectorSet, p_index, begin);
+
             for (int v = 0; v < p_vectorSet->Count(); v++) {
                 SizeType VID = begin + v;
                 std::vector<Edge> selections(static_cast<size_t>(m_opt->m_replicaCount));
@@ -1502,6 +2183,7 @@ namespace SPTAG::SPANN {
                 RNGSelection(selections, (ValueType*)(p_vectorSet->GetVector(v)), p_index.get(), VID, replicaCount);
 
                 uint8_t version = m_versionMap->GetVersion(VID);
+                if (m_fullVectors) m_fullVectors->Put(VID, p_vectorSet->GetVector(v));
                 std::string appendPosting(m_vectorInfoSize, '\0');
                 Serialize((char*)(appendPosting.c_str()), VID, version, p_vectorSet->GetVector(v));
                 for (int i = 0; i < replicaCount; i++)
@@ -1513,6 +2195,96 @@ namespace SPTAG::SPANN {
             return ErrorCode::Success;
         }
 
+        // Batch ingest: search the heads of all vectors in parallel, group the replicas by head
+        // and append each group with one Merge, so a head is locked and written once per batch.
+        ErrorCode AddIndexBatch(std::shared_ptr<VectorSet>& p_vectorSet,
+            std::shared_ptr<VectorIndex> p_index, SizeType begin) {
+
+            SizeType vectorNum = p_vectorSet->Count();
+            std::vector<std::vector<Edge>> selections(vectorNum, std::vector<Edge>(static_cast<size_t>(m_opt->m_replicaCount)));
+            std::vector<int> replicaCounts(vectorNum);
+            // each thread searches the heads of a chunk of vectors together
+            const SizeType chunkSize = 64;
+#pragma omp parallel for schedule(dynamic)
+            for (SizeType chunkBegin = 0; chunkBegin < vectorNum; chunkBegin += chunkSize) {
+                SizeType chunkEnd = min(chunkBegin + chunkSize, vectorNum);
+                std::vector<QueryResult> queryResults;
+                std::vector<QueryResult*> batch;
+                queryResults.reserve(chunkEnd - chunkBegin);
+                for (SizeType v = chunkBegin; v < chunkEnd; v++) {
+                    queryResults.emplace_back(p_vectorSet->GetVector(v), m_opt->m_internalResultNum, false);
+                    batch.push_back(&queryResults.back());
+                }
+                p_index->SearchIndexBatch(batch);
+                for (SizeType v = chunkBegin; v < chunkEnd; v++) {
+                    RNGSelection(selections[v], queryResults[v - chunkBegin], p_index.get(), begin + v, replicaCounts[v]);
+                }
+            }
+
+            std::unordered_map<SizeType, std::pair<int, std::string>> appendPostings;
+            for (SizeType v = 0; v < vectorNum; v++) {
+                SizeType VID = begin + v;
+                uint8_t version = m_versionMap->GetVersion(VID);
+                if (m_fullVectors) m_fullVectors->Put(VID, p_vectorSet->GetVector(v));
+                for (int i = 0; i < replicaCounts[v]; i++) {
+                    auto& appendPosting = appendPostings[selections[v][i].node];
+                    size_t offset = appendPosting.second.size();
+                    appendPosting.second.resize(offset + m_vectorInfoSize);
+                    Serialize((char*)(appendPosting.second.data() + offset), VID, version, p_vectorSet->GetVector(v));
+                    appendPosting.first++;
+                }
+            }
+
+            // Append only queues a split, so a group may not push a posting past its spare blocks: a chunk takes at most
+            // the room left above the split threshold. A head without room gets its split queued on the background pool
+            // and the rest of its group waits for a later pass, after every other group has been appended. The insert
+            // thread only blocks once nothing but such groups is left, until the splits they wait for have run.
+            int appendLimit = std::max(1, m_appendBatchLimit);
+            std::vector<std::pair<SizeType, int>> groups, waiting;
+            for (auto& appendPosting : appendPostings) groups.emplace_back(appendPosting.first, 0);
+            std::string chunk;
+            while (!groups.empty()) {
+                for (auto& group : groups) {
+                    SizeType headID = group.first;
+                    int appendNum = appendPostings[headID].first;
+                    std::string& posting = appendPostings[headID].second;
+                    for (int start = group.second; start < appendNum;) {
+                        std::int64_t room = (std::int64_t)m_postingSizeLimit + appendLimit - m_postingSizes.GetSize(headID);
+                        if (room <= 0 && p_index->ContainSample(headID)) {
+                            if (m_splitThreadPool == nullptr) {
+                                Split(p_index.get(), headID, !m_opt->m_disableReassign);
+                                continue;
+                            }
+                            SplitAsync(p_index.get(), headID);
+                            waiting.emplace_back(headID, start);
+                            break;
+                        }
+                        int num = (int)std::min<std::int64_t>({ appendLimit, appendNum - start, std::max<std::int64_t>(room, 1) });
+                        if (num == appendNum) {
+                            Append(p_index.get(), headID, num, posting);
+                        }
+                        else {
+                            chunk.assign(posting, (size_t)start * m_vectorInfoSize, (size_t)num * m_vectorInfoSize);
+                            Append(p_index.get(), headID, num, chunk);
+                        }
+                        start += num;
+                    }
+                }
+                for (auto& group : waiting) {
+                    while (true) {
+                        {
+                            std::lock_guard<std::mutex> tmplock(m_runningLock);
+                            if (m_splitList.find(group.first) == m_splitList.end()) break;
+                        }
+                        std::this_thread::sleep_for(std::chrono::milliseconds(1));
+                    }
+                }
+                groups.swap(waiting);
+                waiting.clear();
+            }
+            return ErrorCode::Success;
+        }
+
         SizeType SearchVector(std::shared_ptr<VectorSet>& p_vectorSet,
             std::shared_ptr<VectorIndex> p_index, int testNum = 64, SizeType VID = -1) override {
             
@@ -1521,6 +2293,7 @@ namespace SPTAG::SPANN {
             
             std::set<SizeType> checked;
             std::string postingList;
+            std::vector<ValueType> fullVector;
             for (int i = 0; i < queryResults.GetResultNum(); ++i)
             {
                 db->Get(queryResults.GetResult(i)->VID, &postingList);
@@ -1534,7 +2307,9 @@ namespace SPTAG::SPANN {
                     }
                     checked.insert(vectorID);
                     if (VID != -1 && VID == vectorID) LOG(Helper::LogLevel::LL_Info, "Find %d in %dth posting\n", VID, i);
-                    auto distance2leaf = p_index->ComputeDistance(queryResults.GetQuantizedTarget(), vectorInfo + m_metaDataSize);
+                    const ValueType* vector = FullVector(vectorInfo, fullVector);
+                    if (vector == nullptr) continue;
+                    auto distance2leaf = p_index->ComputeDistance(queryResults.GetQuantizedTarget(), vector);
                     if (distance2leaf < 1e-6) return vectorID;
                 }
             }
@@ -1550,8 +2325,10 @@ namespace SPTAG::SPANN {
 
         bool AllFinished() { return m_splitThreadPool->allClear() && m_reassignThreadPool->allClear(); }
         void ForceCompaction() override { db->ForceCompaction(); }
+        bool SyncData() override { return m_fullVectors == nullptr || m_fullVectors->Sync(); }
         void GetDBStats() override { 
             db->GetStat();
+            if (m_postingCache) m_postingCache->GetStat();
             LOG(Helper::LogLevel::LL_Info, "remain splitJobs: %d, reassignJobs: %d, running split: %d, running reassign: %d\n", m_splitThreadPool->jobsize(), m_reassignThreadPool->jobsize(), m_splitThreadPool->runningJobs(), m_reassignThreadPool->runningJobs());
         }
 
@@ -1569,10 +2346,25 @@ namespace SPTAG::SPANN {
             return db->ExitBlockController();
         }
 
+        // Writes take uncompressed records, with posting compression their vectors go to the full-vector store
+        // and the posting is stored with codes.
         void GetWritePosting(SizeType pid, std::string& posting, bool write = false) override { 
             if (write) {
+                if (m_postingQuantizer) {
+                    int fullInfoSize = m_metaDataSize + m_vectorSize;
+                    int vectorNum = (int)(posting.size() / fullInfoSize);
+                    std::string compressed((size_t)vectorNum * m_vectorInfoSize, '\0');
+                    for (int i = 0; i < vectorNum; i++) {
+                        const char* vectorInfo = posting.data() + (size_t)i * fullInfoSize;
+                        SizeType VID = *(reinterpret_cast<const int*>(vectorInfo));
+                        m_fullVectors->Put(VID, vectorInfo + m_metaDataSize);
+                        Serialize(&compressed[(size_t)i * m_vectorInfoSize], VID, *(reinterpret_cast<const uint8_t*>(vectorInfo + sizeof(int))), vectorInfo + m_metaDataSize);
+                    }
+                    posting.swap(compressed);
+                }
                 db->Put(pid, posting);
                 m_postingSizes.UpdateSize(pid, posting.size() / m_vectorInfoSize);
+                if (m_postingCache) m_postingCache->Update(pid, posting);
                 // LOG(Helper::LogLevel::LL_Info, "PostingSize: %d\n", m_postingSizes.GetSize(pid));
                 // exit(1);
             } else {
@@ -1590,8 +2382,18 @@ namespace SPTAG::SPANN {
         
         int m_vectorInfoSize = 0;
 
+        int m_vectorSize = 0;
+
         int m_postingSizeLimit = INT_MAX;
 
+        int m_appendBatchLimit = INT_MAX;
+
+        static constexpr int kScoreBatch = 16;
+
+        static constexpr std::chrono::milliseconds kMaxBackgroundPause{ 20 };
+
+        static constexpr std::chrono::milliseconds kSearchLatencyWindow{ 100 };
+
         std::chrono::microseconds m_hardLatencyLimit = std::chrono::microseconds(2000);
 
         int m_mergeThreshold = 10;
@@ -6,14 +6,24 @@
 
 #include "inc/Helper/KeyValueIO.h"
 #include "inc/Core/Common/Dataset.h"
+#include "inc/Core/Common/FineGrainedLock.h"
 #include "inc/Core/VectorIndex.h"
 #include "inc/Helper/ThreadPool.h"
 #include <cstdlib>
 #include <memory>
 #include <atomic>
 #include <mutex>
+#include <condition_variable>
+#include <thread>
+#include <functional>
+#include <unordered_set>
+#include <unordered_map>
+#include <deque>
+#include <map>
+#include <set>
 #include <tbb/concurrent_queue.h>
 #include <tbb/concurrent_hash_map.h>
+#include <linux/io_uring.h>
 
 extern "C" {
 #include "spdk/env.h"
@@ -39,8 +49,32 @@ namespace SPTAG::SPANN
             static constexpr const char* kSpdkBdevNameEnv = "SPFRESH_SPDK_BDEV";
             static constexpr const char* kSpdkIoDepth = "SPFRESH_SPDK_IO_DEPTH";
             static constexpr int kSsdSpdkDefaultIoDepth = 1024;
+            static constexpr const char* kUseUringImplEnv = "SPFRESH_SPDK_USE_URING_IMPL";
+            static constexpr const char* kUringFilePathEnv = "SPFRESH_URING_FILE";
+            static constexpr AddressType kUringImplDefaultNumBlocks = (1ULL << 36) >> PageSizeEx; // 64GB sparse file
+            static constexpr const char* kUringFileBlocksEnv = "SPFRESH_URING_FILE_BLOCKS"; // blocks a smaller image file is grown to
+            // largest run of contiguous blocks moved by one device command, sub I/O buffers are sized to it
+            static constexpr int kMaxIoBlocks = 8;
+            struct Extent {
+                AddressType offset;
+                AddressType length;
+            };
+            // free runs of blocks by start offset, neighbours are merged on release, and by (length, offset) for best fit
+            std::map<AddressType, AddressType> m_freeExtents;
+            std::set<std::pair<AddressType, AddressType>> m_freeBySize;
+            std::mutex m_extentLock;
+            std::condition_variable m_extentReleased;
+            std::atomic<std::int64_t> m_freeBlocks{ 0 };
+
+            // m_extentLock held: add a free run, merged with the free runs right before and after it
+            void PushExtent(AddressType p_offset, AddressType p_length);
+
+            // m_extentLock held: pop the shortest extent of at least p_need blocks, or the longest one if none is that long
+            bool PopExtent(AddressType p_need, Extent& p_extent);
 
-            tbb::concurrent_queue<AddressType> m_blockAddresses;
+            void PushAllBlocks(AddressType p_numBlocks);
+
+            void ClearBlocks();
 
             bool m_useSsdImpl = false;
             const char* m_ssdSpdkBdevName = nullptr;
@@ -58,10 +92,12 @@ namespace SPTAG::SPANN
                 void* app_buff;
                 void* dma_buff;
                 AddressType real_size;
+                AddressType length;
                 AddressType offset;
                 bool is_read;
                 BlockController* ctrl;
                 int posting_id;
+                int buf_index;
             };
             tbb::concurrent_queue<SubIoRequest *> m_submittedSubIoRequests;
             struct IoContext {
@@ -74,6 +110,53 @@ namespace SPTAG::SPANN
 
             static int m_ssdInflight;
 
+            // io_uring backend: one ring per thread, registered page buffers and the device registered as fixed file 0
+            bool m_useUringImpl = false;
+            int m_uringFd = -1;
+            struct UringContext {
+                int ring_fd = -1;
+                bool fixed = false;
+                unsigned* sq_head = nullptr;
+                unsigned* sq_tail = nullptr;
+                unsigned* sq_mask = nullptr;
+                unsigned* sq_array = nullptr;
+                struct io_uring_sqe* sqes = nullptr;
+                unsigned* cq_head = nullptr;
+                unsigned* cq_tail = nullptr;
+                unsigned* cq_mask = nullptr;
+                struct io_uring_cqe* cqes = nullptr;
+                void* sq_ring = nullptr;
+                size_t sq_ring_size = 0;
+                void* cq_ring = nullptr;
+                size_t cq_ring_size = 0;
+                size_t sqes_size = 0;
+                char* buffers = nullptr;
+                std::vector<SubIoRequest> sub_io_requests;
+                std::vector<SubIoRequest *> free_sub_io_requests;
+                int to_submit = 0;
+                int in_flight = 0;
+            };
+            static thread_local struct UringContext m_currUringContext;
+
+            bool UringSetup(int depth);
+
+            void UringTeardown();
+
+            void UringPrepare(SubIoRequest* currSubIo);
+
+            SubIoRequest* UringComplete(bool wait, int& p_result);
+
+            // split a posting into sub I/Os, one per run of at most kMaxIoBlocks contiguous blocks
+            static void BuildSubIoRequests(AddressType* p_blocks, AddressType p_bytes, char* p_buff, bool p_isRead, int p_postingId, std::vector<SubIoRequest>& p_requests);
+
+            // true if sub I/O p_idx belongs to a posting p_skip dropped. p_skip is asked once per posting, when its first sub I/O is due
+            static bool SkipSubIo(const std::vector<SubIoRequest>& p_requests, size_t p_idx, std::vector<char>& p_dropped, const std::function<bool(int)>& p_skip);
+
+            // run a list of sub I/Os through the calling thread's ring, returns false on timeout or error.
+            // p_ready is called with a posting id as soon as its last pending sub I/O completes,
+            // postings p_skip drops before submission stay pending
+            bool UringRun(std::vector<SubIoRequest>& p_requests, std::vector<int>* p_pending, const std::chrono::microseconds &timeout, const std::function<void(int)>& p_ready = nullptr, const std::function<bool(int)>& p_skip = nullptr);
+
             bool m_useMemImpl = false;
             static std::unique_ptr<char[]> m_memBuffer;
 
@@ -82,6 +165,8 @@ namespace SPTAG::SPANN
 
             int m_batchSize;
             static int m_ioCompleteCount;
+            static int m_ioCompleteBlocks;
+            int m_preIOCompleteBlocks = 0;
             int m_preIOCompleteCount = 0;
             std::chrono::time_point<std::chrono::high_resolution_clock> m_preTime = std::chrono::high_resolution_clock::now();
 
@@ -99,30 +184,99 @@ namespace SPTAG::SPANN
         public:
             bool Initialize(int batchSize);
 
-            // get p_size blocks from front, and fill in p_data array
+            // get p_size blocks, as few contiguous runs as the free extents allow, and fill in p_data array.
+            // Waits for ReleaseBlocks while fewer than p_size blocks are free.
             bool GetBlocks(AddressType* p_data, int p_size);
 
-            // release p_size blocks, put them at the end of the queue
+            // get at most p_size blocks from front without waiting, return the number of blocks got
+            int TryGetBlocks(AddressType* p_data, int p_size);
+
+            // release p_size blocks, wakes GetBlocks calls waiting for free space
             bool ReleaseBlocks(AddressType* p_data, int p_size);
 
+            // take p_size given blocks out of the free space, returns how many of them were free
+            int ReserveBlocks(const AddressType* p_data, int p_size);
+
             // read a posting list. p_data[0] is the total data size, 
             // p_data[1], p_data[2], ..., p_data[((p_data[0] + PageSize - 1) >> PageSizeEx)] are the addresses of the blocks
             // concat all the block contents together into p_value string.
             bool ReadBlocks(AddressType* p_data, std::string* p_value, const std::chrono::microseconds &timeout = std::chrono::microseconds::max());
 
-            // parallel read a list of posting lists.
-            bool ReadBlocks(std::vector<AddressType*>& p_data, std::vector<std::string>* p_values, const std::chrono::microseconds &timeout = std::chrono::microseconds::max());
+            // parallel read a list of posting lists. p_ready gets the index of every posting read completely, in completion order,
+            // while the rest are still in flight. Postings not read before the timeout are left empty and never reported.
+            // p_skip is asked about each posting right before its first I/O goes out, the ones it drops are treated like timed out.
+            bool ReadBlocks(std::vector<AddressType*>& p_data, std::vector<std::string>* p_values, const std::chrono::microseconds &timeout = std::chrono::microseconds::max(), const std::function<void(int)>& p_ready = nullptr, const std::function<bool(int)>& p_skip = nullptr);
 
             // write p_value into p_size blocks start from p_data
             bool WriteBlocks(AddressType* p_data, int p_size, const std::string& p_value);
 
             bool IOStatistics();
 
+            // make completed block writes durable before the mapping that references them
+            bool Sync();
+
             bool ShutDown();
 
             int RemainBlocks() {
-                return m_blockAddresses.unsafe_size();
+                return (int)m_freeBlocks.load();
+            }
+        };
+
+        // Append-only redo log of block mapping rows. Every record is a full row image so replay is idempotent.
+        // Appends are buffered in memory; Commit makes them durable with one fdatasync per group of writers.
+        class MappingLog {
+        private:
+            static constexpr std::uint32_t kRecordMagic = 0x4c415753; // "SWAL"
+
+            struct RecordHeader {
+                std::uint32_t magic;
+                std::uint32_t count;
+                SizeType key;
+                std::uint32_t checksum;
+            };
+
+            std::string m_path;
+            int m_fd = -1;
+            std::uint64_t m_size = 0;
+            std::mutex m_lock;
+            std::condition_variable m_cond;
+            std::string m_pending;
+            std::uint64_t m_appendLSN = 0;
+            std::uint64_t m_durableLSN = 0;
+            bool m_flushing = false;
+            std::unordered_set<SizeType> m_dirty;
+            std::function<void()> m_syncData;
+            std::atomic_uint64_t m_groupCommits{ 0 };
+
+            static std::uint32_t Checksum(SizeType p_key, const AddressType* p_row, std::uint32_t p_count);
+
+            bool WriteAll(const std::string& p_data);
+
+        public:
+            ~MappingLog() { Close(); }
+
+            bool Open(const std::string& p_path, std::function<void()> p_syncData);
+
+            void Close();
+
+            // buffer the row image of p_key, return its log sequence number
+            std::uint64_t Append(SizeType p_key, const AddressType* p_row, std::uint32_t p_count);
+
+            // wait until p_lsn is on disk, flushing the pending group if nobody else is
+            bool Commit(std::uint64_t p_lsn);
+
+            // flush and seal the current log as p_sealedPath, start a new one and hand over the keys it covers
+            bool Rotate(const std::string& p_sealedPath, std::unordered_set<SizeType>& p_dirty);
+
+            std::uint64_t Size() {
+                std::lock_guard<std::mutex> lock(m_lock);
+                return m_size + m_pending.size();
             }
+
+            std::uint64_t GroupCommits() { return m_groupCommits.load(); }
+
+            // apply every intact record of p_path in order, stop at the first torn one
+            static std::uint64_t Replay(const std::string& p_path, std::function<void(SizeType, AddressType*, std::uint32_t)> p_apply);
         };
 
         class CompactionJob : public Helper::ThreadPool::Job
@@ -136,28 +290,77 @@ namespace SPTAG::SPANN
             ~CompactionJob() {}
 
             inline void exec(IAbortOperation* p_abort) override {
-                m_spdkIO->ForceCompaction();
+                m_spdkIO->Compact(p_abort);
+                m_spdkIO->m_compactionScheduled = false;
+            }
+        };
+
+        class CompactionThreadPool : public Helper::ThreadPool
+        {
+        public:
+            void initSPDK(int numberOfThreads, SPDKIO* spdkIO)
+            {
+                m_abort.SetAbort(false);
+                for (int i = 0; i < numberOfThreads; i++)
+                {
+                    m_threads.emplace_back([this, spdkIO] {
+                        spdkIO->Initialize();
+                        Job *j;
+                        while (get(j))
+                        {
+                            try
+                            {
+                                currentJobs++;
+                                j->exec(&m_abort);
+                                currentJobs--;
+                            }
+                            catch (std::exception& e) {
+                                LOG(Helper::LogLevel::LL_Error, "ThreadPool: exception in %s %s\n", typeid(*j).name(), e.what());
+                            }
+
+                            delete j;
+                        }
+                        spdkIO->ExitBlockController();
+                    });
+                }
             }
         };
 
     public:
-        SPDKIO(const char* filePath, SizeType blockSize, SizeType capacity, SizeType postingBlocks, SizeType bufferSize = 1024, int batchSize = 64, int compactionThreads = 1)
+        SPDKIO(const char* filePath, SizeType blockSize, SizeType capacity, SizeType postingBlocks, SizeType bufferSize = 1024, int batchSize = 64, int compactionThreads = 1, int compactionIOBudget = 0, bool enableWAL = false, int checkpointWALSize = 256, int tailCacheSize = 0)
         {
             m_mappingPath = std::string(filePath);
             m_blockLimit = postingBlocks + 1;
             m_bufferLimit = bufferSize;
+            m_compactionIOBudget = compactionIOBudget;
+            m_enableWAL = enableWAL;
+            m_checkpointWALBytes = ((std::uint64_t)checkpointWALSize) << 20;
+            m_tailCacheBudget = ((std::uint64_t)tailCacheSize) << 20;
             if (fileexists(m_mappingPath.c_str())) {
                 Load(m_mappingPath, blockSize, capacity);
             }
             else {
                 m_pBlockMapping.Initialize(0, 1, blockSize, capacity);
             }
+            if (m_enableWAL) Recover();
             for (int i = 0; i < bufferSize; i++) {
                 m_buffer.push((uintptr_t)(new AddressType[m_blockLimit]));
             }
-            m_compactionThreadPool = std::make_shared<Helper::ThreadPool>();
-            m_compactionThreadPool->init(compactionThreads);
             m_pBlockController.Initialize(batchSize);
+            if (m_pBlockMapping.R() > 0) ReserveMappedBlocks();
+            if (m_enableWAL) {
+                if (!m_log.Open(m_mappingPath + kWALSuffix, [this] { m_pBlockController.Sync(); if (m_dataSync) m_dataSync(); })) {
+                    LOG(Helper::LogLevel::LL_Error, "Fail to open mapping log %s%s, mapping changes are not logged\n", m_mappingPath.c_str(), kWALSuffix);
+                    m_enableWAL = false;
+                }
+                else {
+                    m_checkpointThread = std::thread([this] { CheckpointLoop(); });
+                }
+            }
+            if (m_compactionIOBudget > 0) {
+                m_compactionThreadPool = std::make_shared<CompactionThreadPool>();
+                m_compactionThreadPool->initSPDK(compactionThreads, this);
+            }
             m_shutdownCalled = false;
         }
 
@@ -169,7 +372,22 @@ namespace SPTAG::SPANN
             if (m_shutdownCalled) {
                 return;
             }
-            Save(m_mappingPath);
+            m_compactionThreadPool.reset();
+            FlushTails(true);
+            Reclaim(true);
+            if (m_checkpointThread.joinable()) {
+                {
+                    std::lock_guard<std::mutex> lock(m_checkpointSignalLock);
+                    m_checkpointStop = true;
+                }
+                m_checkpointCond.notify_all();
+                m_checkpointThread.join();
+            }
+            m_log.Close();
+            if (Save(m_mappingPath) == ErrorCode::Success && m_enableWAL) {
+                remove((m_mappingPath + kWALSuffix).c_str());
+                remove((m_mappingPath + kSealedWALSuffix).c_str());
+            }
             for (int i = 0; i < m_pBlockMapping.R(); i++) {
                 if (At(i) != 0xffffffffffffffff) delete[]((AddressType*)At(i));
             }
@@ -185,23 +403,56 @@ namespace SPTAG::SPANN
             return *(m_pBlockMapping[key]);
         }
 
+        // Lock free: rows and blocks replaced by writers stay valid until every reader that could see them has left,
+        // and the key version tells whether the posting and its tail were read from the same state.
         ErrorCode Get(SizeType key, std::string* value) override {
             if (key >= m_pBlockMapping.R()) return ErrorCode::Fail;
 
-            if (m_pBlockController.ReadBlocks((AddressType*)At(key), value)) return ErrorCode::Success;
-            return ErrorCode::Fail;
+            ReadEpoch epoch(this);
+            while (true) {
+                std::uint32_t version = m_keyVersions[key].ReadBegin();
+                if (!m_pBlockController.ReadBlocks((AddressType*)At(key), value)) return ErrorCode::Fail;
+                if (m_tailCacheBudget > 0) AppendTail(key, value);
+                if (!m_keyVersions[key].ReadRetry(version)) return ErrorCode::Success;
+            }
         }
 
-        ErrorCode MultiGet(const std::vector<SizeType>& keys, std::vector<std::string>* values, const std::chrono::microseconds &timeout = std::chrono::microseconds::max()) {
+        ErrorCode MultiGet(const std::vector<SizeType>& keys, std::vector<std::string>* values, const std::chrono::microseconds &timeout = std::chrono::microseconds::max()) override {
+            return MultiGet(keys, values, timeout, nullptr);
+        }
+
+        // p_ready runs as each posting lands, tail included, while the rest of the batch is still being read.
+        // A posting whose version moved during the batch is read again and reported after the batch.
+        ErrorCode MultiGet(const std::vector<SizeType>& keys, std::vector<std::string>* values, const std::chrono::microseconds &timeout, const std::function<void(size_t)>& p_ready, const std::function<bool(size_t)>& p_skip = nullptr) override {
             std::vector<AddressType*> blocks;
+            std::vector<SizeType> readKeys;
+            std::vector<std::uint32_t> versions;
+            ReadEpoch epoch(this);
             for (SizeType key : keys) {
-                if (key < m_pBlockMapping.R()) blocks.push_back((AddressType*)At(key));
+                if (key < m_pBlockMapping.R()) {
+                    versions.push_back(m_keyVersions[key].ReadBegin());
+                    blocks.push_back((AddressType*)At(key));
+                    readKeys.push_back(key);
+                }
                 else {
                     LOG(Helper::LogLevel::LL_Error, "Fail to read key:%d total key number:%d\n", key, m_pBlockMapping.R());
                 }
             }
-            if (m_pBlockController.ReadBlocks(blocks, values, timeout)) return ErrorCode::Success;
-            return ErrorCode::Fail; 
+            std::vector<int> stale;
+            auto ready = [&](int i) {
+                if (m_tailCacheBudget > 0) AppendTail(readKeys[i], &((*values)[i]));
+                // a writer replaced the posting while the batch was in flight, fetch it again afterwards
+                if (m_keyVersions[readKeys[i]].ReadRetry(versions[i])) stale.push_back(i);
+                else if (p_ready != nullptr) p_ready(i);
+            };
+            std::function<bool(int)> skip;
+            if (p_skip != nullptr) skip = [&](int i) { return p_skip(i); };
+            if (!m_pBlockController.ReadBlocks(blocks, values, timeout, ready, skip)) return ErrorCode::Fail;
+            for (int i : stale) {
+                Get(readKeys[i], &((*values)[i]));
+                if (p_ready != nullptr) p_ready(i);
+            }
+            return ErrorCode::Success;
         }
 
         ErrorCode Put(SizeType key, const std::string& value) override {
@@ -217,35 +468,29 @@ namespace SPTAG::SPANN
                     m_pBlockMapping.AddBatch(delta);
                 }
             }
-            if (At(key) == 0xffffffffffffffff) {
-                if (m_buffer.unsafe_size() > m_bufferLimit) {
-                    uintptr_t tmpblocks;
-                    while (!m_buffer.try_pop(tmpblocks));
-                    At(key) = tmpblocks;
-                }
-                else {
-                    At(key) = (uintptr_t)(new AddressType[m_blockLimit]);
-                }
-                memset((AddressType*)At(key), -1, sizeof(AddressType) * m_blockLimit);
-            }
-            int64_t* postingSize = (int64_t*)At(key);
-            if (*postingSize < 0) {
-                m_pBlockController.GetBlocks(postingSize + 1, blocks);
-                m_pBlockController.WriteBlocks(postingSize + 1, blocks, value);
-                *postingSize = value.size();
+            std::lock_guard<std::mutex> keyLock(m_keyLocks[key]);
+            uintptr_t oldblocks = At(key);
+            uintptr_t tmpblocks;
+            if (oldblocks == 0xffffffffffffffff && m_buffer.unsafe_size() <= m_bufferLimit) {
+                tmpblocks = (uintptr_t)(new AddressType[m_blockLimit]);
             }
             else {
-                uintptr_t tmpblocks;
-                while (!m_buffer.try_pop(tmpblocks));
-                m_pBlockController.GetBlocks((AddressType*)tmpblocks + 1, blocks);
-                m_pBlockController.WriteBlocks((AddressType*)tmpblocks + 1, blocks, value);
-                *((int64_t*)tmpblocks) = value.size();
-
-                m_pBlockController.ReleaseBlocks(postingSize + 1, (*postingSize + PageSize -1) >> PageSizeEx);
-                while (InterlockedCompareExchange(&At(key), tmpblocks, (uintptr_t)postingSize) != (uintptr_t)postingSize) {
-                    postingSize = (int64_t*)At(key);
-                }
-                m_buffer.push((uintptr_t)postingSize);
+                tmpblocks = PopRow();
+            }
+            memset((AddressType*)tmpblocks, -1, sizeof(AddressType) * m_blockLimit);
+            m_pBlockController.GetBlocks((AddressType*)tmpblocks + 1, blocks);
+            m_pBlockController.WriteBlocks((AddressType*)tmpblocks + 1, blocks, value);
+            *((int64_t*)tmpblocks) = value.size();
+            {
+                std::lock_guard<COMMON::SequenceLock> publish(m_keyVersions[key]);
+                if (m_tailCacheBudget > 0) DropTail(key);
+                At(key) = tmpblocks;
+            }
+            // the old blocks may only be reused once the log no longer points at them
+            LogMapping(key);
+            if (oldblocks != 0xffffffffffffffff) {
+                int64_t oldSize = *((int64_t*)oldblocks);
+                Retire(oldblocks, (AddressType*)oldblocks + 1, oldSize > 0 ? (int)((oldSize + PageSize - 1) >> PageSizeEx) : 0);
             }
             return ErrorCode::Success;
         }
@@ -256,6 +501,9 @@ namespace SPTAG::SPANN
                 return ErrorCode::Fail;
             }
 
+            std::lock_guard<std::mutex> keyLock(m_keyLocks[key]);
+            if (m_tailCacheBudget > 0) return MergeTail(key, value);
+
             int64_t* postingSize = (int64_t*)At(key);
             auto newSize = *postingSize + value.size();
             int newblocks = ((newSize + PageSize - 1) >> PageSizeEx);
@@ -274,47 +522,126 @@ namespace SPTAG::SPANN
                 m_pBlockController.ReadBlocks(readreq, &newValue);
                 newValue += value;
 
-                uintptr_t tmpblocks;
-                while (!m_buffer.try_pop(tmpblocks));
+                uintptr_t tmpblocks = PopRow();
                 memcpy((AddressType*)tmpblocks, postingSize, sizeof(AddressType) * (oldblocks + 1));
                 m_pBlockController.GetBlocks((AddressType*)tmpblocks + 1 + oldblocks, allocblocks);
                 m_pBlockController.WriteBlocks((AddressType*)tmpblocks + 1 + oldblocks, allocblocks, newValue);
                 *((int64_t*)tmpblocks) = newSize;
-
-                m_pBlockController.ReleaseBlocks(postingSize + 1 + oldblocks, 1);
-                while (InterlockedCompareExchange(&At(key), tmpblocks, (uintptr_t)postingSize) != (uintptr_t)postingSize) {
-                    postingSize = (int64_t*)At(key);
+                {
+                    std::lock_guard<COMMON::SequenceLock> publish(m_keyVersions[key]);
+                    At(key) = tmpblocks;
                 }
-                m_buffer.push((uintptr_t)postingSize);
+                LogMapping(key);
+                Retire((uintptr_t)postingSize, postingSize + 1 + oldblocks, 1);
             }
             else {
                 m_pBlockController.GetBlocks(postingSize + 1 + oldblocks, allocblocks);
                 m_pBlockController.WriteBlocks(postingSize + 1 + oldblocks, allocblocks, value);
-                *postingSize = newSize;
+                {
+                    std::lock_guard<COMMON::SequenceLock> publish(m_keyVersions[key]);
+                    *postingSize = newSize;
+                }
+                LogMapping(key);
             }
             return ErrorCode::Success;
         }
 
         ErrorCode Delete(SizeType key) override {
             if (key >= m_pBlockMapping.R()) return ErrorCode::Fail;
+            std::lock_guard<std::mutex> keyLock(m_keyLocks[key]);
             int64_t* postingSize = (int64_t*)At(key);
             if (*postingSize < 0) return ErrorCode::Fail;
-
-            int blocks = ((*postingSize + PageSize - 1) >> PageSizeEx);
-            m_pBlockController.ReleaseBlocks(postingSize + 1, blocks);
-            m_buffer.push((uintptr_t)postingSize);
-            At(key) = 0xffffffffffffffff;
+            {
+                std::lock_guard<COMMON::SequenceLock> publish(m_keyVersions[key]);
+                if (m_tailCacheBudget > 0) DropTail(key);
+                At(key) = 0xffffffffffffffff;
+            }
+            LogMapping(key);
+            Retire((uintptr_t)postingSize, postingSize + 1, (int)((*postingSize + PageSize - 1) >> PageSizeEx));
             return ErrorCode::Success;
         }
 
         void ForceCompaction() {
-            Save(m_mappingPath);
+            FlushTails(false);
+            Compact();
+            if (m_enableWAL) Checkpoint();
+            else Save(m_mappingPath);
+        }
+
+        // Rewrite fragmented postings into contiguous block runs, most fragmented first.
+        // Free blocks are pulled from the front of the free queue in bounded windows and sorted to find runs,
+        // the rest of the window goes back to the queue. Read and write traffic is throttled to m_compactionIOBudget MB/s.
+        void Compact(IAbortOperation* p_abort = nullptr) {
+            std::lock_guard<std::mutex> compactionLock(m_compactionMutex);
+            auto compactionBegin = std::chrono::high_resolution_clock::now();
+
+            std::vector<std::pair<int, SizeType>> candidates;
+            for (SizeType key = 0; key < m_pBlockMapping.R(); key++) {
+                if (At(key) == 0xffffffffffffffff) continue;
+                int fragments = Fragments((AddressType*)At(key));
+                if (fragments > 1) candidates.emplace_back(fragments, key);
+            }
+            std::sort(candidates.begin(), candidates.end(), std::greater<std::pair<int, SizeType>>());
+
+            std::vector<AddressType> window;
+            std::vector<AddressType> run;
+            std::string value;
+            std::uint64_t movedPages = 0;
+            int compacted = 0;
+            for (auto& candidate : candidates) {
+                if (p_abort != nullptr && p_abort->ShouldAbort()) break;
+
+                SizeType key = candidate.second;
+                std::lock_guard<std::mutex> keyLock(m_keyLocks[key]);
+                int64_t* postingSize = (int64_t*)At(key);
+                if ((uintptr_t)postingSize == 0xffffffffffffffff || Fragments(postingSize) <= 1) continue;
+
+                int blocks = (int)((*postingSize + PageSize - 1) >> PageSizeEx);
+                if (!TakeRun(window, blocks, run)) break;
+                if (!m_pBlockController.ReadBlocks(postingSize, &value) || value.size() != *postingSize) {
+                    window.insert(window.end(), run.begin(), run.end());
+                    std::sort(window.begin(), window.end());
+                    continue;
+                }
+
+                uintptr_t tmpblocks = PopRow();
+                memcpy((AddressType*)tmpblocks + 1, run.data(), sizeof(AddressType) * blocks);
+                m_pBlockController.WriteBlocks((AddressType*)tmpblocks + 1, blocks, value);
+                *((int64_t*)tmpblocks) = value.size();
+                {
+                    std::lock_guard<COMMON::SequenceLock> publish(m_keyVersions[key]);
+                    At(key) = tmpblocks;
+                }
+                LogMapping(key);
+                Retire((uintptr_t)postingSize, postingSize + 1, blocks, false);
+
+                compacted++;
+                movedPages += blocks;
+                if (m_compactionIOBudget > 0) {
+                    // read + write of every moved page counts against the budget
+                    auto expected = std::chrono::microseconds((std::int64_t)((movedPages << (PageSizeEx + 1)) / m_compactionIOBudget));
+                    auto elapsed = std::chrono::duration_cast<std::chrono::microseconds>(std::chrono::high_resolution_clock::now() - compactionBegin);
+                    if (expected > elapsed) std::this_thread::sleep_for(expected - elapsed);
+                }
+            }
+            if (!window.empty()) m_pBlockController.ReleaseBlocks(window.data(), (int)window.size());
+            Reclaim(false);
+
+            m_compactedPostings += compacted;
+            m_compactedPages += movedPages;
+            auto compactionEnd = std::chrono::high_resolution_clock::now();
+            LOG(Helper::LogLevel::LL_Info, "Compaction: %d/%d fragmented postings rewritten, %llu pages moved, cost %.2lf s\n",
+                compacted, (int)candidates.size(), (unsigned long long)movedPages,
+                std::chrono::duration_cast<std::chrono::milliseconds>(compactionEnd - compactionBegin).count() / 1000.0);
         }
 
         void GetStat() {
             int remainBlocks = m_pBlockController.RemainBlocks();
             int remainGB = remainBlocks >> 20 << 2;
             LOG(Helper::LogLevel::LL_Info, "Remain %d blocks, totally %d GB\n", remainBlocks, remainGB);
+            LOG(Helper::LogLevel::LL_Info, "Compaction rewrote %llu postings, %llu pages\n", (unsigned long long)m_compactedPostings.load(), (unsigned long long)m_compactedPages.load());
+            if (m_tailCacheBudget > 0) LOG(Helper::LogLevel::LL_Info, "Tail cache: %llu bytes, %llu appends absorbed, %llu pages flushed\n", (unsigned long long)m_tailCacheBytes.load(), (unsigned long long)m_tailAbsorbed.load(), (unsigned long long)m_tailFlushedPages.load());
+            if (m_enableWAL) LOG(Helper::LogLevel::LL_Info, "Mapping log: %llu bytes, %llu group commits, %llu checkpoints\n", (unsigned long long)m_log.Size(), (unsigned long long)m_log.GroupCommits(), (unsigned long long)m_checkpoints.load());
             m_pBlockController.IOStatistics();
         }
 
@@ -339,26 +666,64 @@ namespace SPTAG::SPANN
         
         ErrorCode Save(std::string path) {
             LOG(Helper::LogLevel::LL_Info, "Save mapping To %s\n", path.c_str());
+            // write aside and rename, so a crash never leaves a half written mapping behind
+            std::string tmpPath = path + ".tmp";
             auto ptr = f_createIO();
-            if (ptr == nullptr || !ptr->Initialize(path.c_str(), std::ios::binary | std::ios::out)) return ErrorCode::FailedCreateFile;
+            if (ptr == nullptr || !ptr->Initialize(tmpPath.c_str(), std::ios::binary | std::ios::out)) return ErrorCode::FailedCreateFile;
 
             SizeType CR = m_pBlockMapping.R();
             IOBINARY(ptr, WriteBinary, sizeof(SizeType), (char*)&CR);
             IOBINARY(ptr, WriteBinary, sizeof(SizeType), (char*)&m_blockLimit);
             std::vector<AddressType> empty(m_blockLimit, 0xffffffffffffffff);
+            std::vector<AddressType> row(m_blockLimit);
             for (int i = 0; i < CR; i++) {
-                if (At(i) == 0xffffffffffffffff) {
-                    IOBINARY(ptr, WriteBinary, sizeof(AddressType) * m_blockLimit, (char*)(empty.data()));
-                }
-                else {
-                    int64_t* postingSize = (int64_t*)At(i);
-                    IOBINARY(ptr, WriteBinary, sizeof(AddressType) * m_blockLimit, (char*)postingSize);
+                {
+                    std::lock_guard<std::mutex> keyLock(m_keyLocks[i]);
+                    if (At(i) == 0xffffffffffffffff) memcpy(row.data(), empty.data(), sizeof(AddressType) * m_blockLimit);
+                    else memcpy(row.data(), (AddressType*)At(i), sizeof(AddressType) * m_blockLimit);
                 }
+                IOBINARY(ptr, WriteBinary, sizeof(AddressType) * m_blockLimit, (char*)(row.data()));
+            }
+            ptr->ShutDown();
+            if (!SyncFile(tmpPath) || rename(tmpPath.c_str(), path.c_str()) != 0 || !SyncFile(path, true)) {
+                LOG(Helper::LogLevel::LL_Error, "Fail to replace mapping %s\n", path.c_str());
+                return ErrorCode::FailedCreateFile;
             }
             LOG(Helper::LogLevel::LL_Info, "Save mapping (%d,%d) Finish!\n", CR, m_blockLimit);
             return ErrorCode::Success;
         }
 
+        // Bound restart time: seal the current log, write only the rows it touched into the mapping file, then drop the sealed log.
+        // Rows changed while the checkpoint runs are covered by the new log, so the mapping file may be ahead of the log but never behind.
+        ErrorCode Checkpoint() {
+            std::lock_guard<std::mutex> checkpointLock(m_checkpointLock);
+            auto begin = std::chrono::high_resolution_clock::now();
+            std::string sealedPath = m_mappingPath + kSealedWALSuffix;
+            if (fileexists(sealedPath.c_str())) {
+                LOG(Helper::LogLevel::LL_Error, "Checkpoint mapping: %s from a failed checkpoint is still pending\n", sealedPath.c_str());
+                return ErrorCode::Fail;
+            }
+            std::unordered_set<SizeType> dirty;
+            if (!m_log.Rotate(sealedPath, dirty)) return ErrorCode::Fail;
+
+            ErrorCode ret = WriteRows(std::vector<SizeType>(dirty.begin(), dirty.end()));
+            if (ret != ErrorCode::Success) return ret;
+            remove(sealedPath.c_str());
+            m_checkpoints++;
+
+            auto end = std::chrono::high_resolution_clock::now();
+            LOG(Helper::LogLevel::LL_Info, "Checkpoint mapping: %d rows, cost %.2lf s\n", (int)dirty.size(),
+                std::chrono::duration_cast<std::chrono::milliseconds>(end - begin).count() / 1000.0);
+            return ErrorCode::Success;
+        }
+
+        void SetDataSync(std::function<void()> p_sync) override {
+            m_dataSync = std::move(p_sync);
+        }
+
+        // Test hook, runs with the key lock held after a posting is written and before its new row is logged
+        std::function<void(SizeType)> m_beforeLogMapping;
+
         bool Initialize(bool debug = false) override {
             if (debug) LOG(Helper::LogLevel::LL_Info, "Initialize SPDK for new threads\n");
             return m_pBlockController.Initialize(64);
@@ -370,6 +735,340 @@ namespace SPTAG::SPANN
         }
 
     private:
+        static constexpr const char* kWALSuffix = ".wal";
+        static constexpr const char* kSealedWALSuffix = ".wal.old";
+
+        // fsync p_path, or the directory containing it so a rename becomes durable
+        static bool SyncFile(const std::string& p_path, bool p_parentDir = false);
+
+        // write p_keys and any rows appended since the last save in place, fall back to a full save if the layout changed
+        ErrorCode WriteRows(std::vector<SizeType> p_keys);
+
+        // replay the sealed and the active log on top of the loaded mapping, then fold them into the mapping file
+        void Recover();
+
+        // remove blocks referenced by the loaded mapping from the free space
+        void ReserveMappedBlocks();
+
+        void CheckpointLoop() {
+            std::unique_lock<std::mutex> lock(m_checkpointSignalLock);
+            while (!m_checkpointStop) {
+                m_checkpointCond.wait(lock, [this] { return m_checkpointStop || m_checkpointRequested; });
+                if (m_checkpointStop) break;
+                m_checkpointRequested = false;
+                lock.unlock();
+                Checkpoint();
+                lock.lock();
+            }
+        }
+
+        // log the current row of key, caller holds the key lock
+        inline void LogMapping(SizeType key) {
+            if (!m_enableWAL) return;
+            if (m_beforeLogMapping) m_beforeLogMapping(key);
+            AddressType* row = (AddressType*)At(key);
+            std::uint64_t lsn;
+            if ((uintptr_t)row == 0xffffffffffffffff || row[0] < 0) {
+                AddressType empty = -1;
+                lsn = m_log.Append(key, &empty, 1);
+            }
+            else {
+                lsn = m_log.Append(key, row, (std::uint32_t)(1 + ((row[0] + PageSize - 1) >> PageSizeEx)));
+            }
+            m_log.Commit(lsn);
+            if (m_log.Size() >= m_checkpointWALBytes) {
+                {
+                    std::lock_guard<std::mutex> lock(m_checkpointSignalLock);
+                    m_checkpointRequested = true;
+                }
+                m_checkpointCond.notify_one();
+            }
+        }
+
+        // In-memory copy of the last partial page of a posting plus the appends not yet on disk.
+        // data starts at the page boundary before the end of the on-disk posting, its first flushed bytes are on disk.
+        struct TailPage {
+            std::string data;
+            size_t flushed = 0;
+        };
+
+        // caller holds the key lock
+        TailPage* FindTail(SizeType key) {
+            std::lock_guard<std::mutex> lock(m_tailLock);
+            auto iter = m_tails.find(key);
+            return iter == m_tails.end() ? nullptr : &(iter->second);
+        }
+
+        // append the unflushed bytes of the tail of key, if any, to p_value
+        inline void AppendTail(SizeType key, std::string* p_value) {
+            std::lock_guard<std::mutex> lock(m_tailLock);
+            auto iter = m_tails.find(key);
+            if (iter != m_tails.end()) p_value->append(iter->second.data, iter->second.flushed, std::string::npos);
+        }
+
+        // caller holds the key lock
+        void DropTail(SizeType key) {
+            std::lock_guard<std::mutex> lock(m_tailLock);
+            auto iter = m_tails.find(key);
+            if (iter == m_tails.end()) return;
+            m_tailCacheBytes -= iter->second.data.size();
+            m_tails.erase(iter);
+        }
+
+        // Write the whole pages of the tail, or with p_all everything including the last partial page.
+        // The partial page on disk, if any, is replaced by a new block. Caller holds the key lock.
+        void FlushTail(SizeType key, TailPage& tail, bool p_all) {
+            size_t bytes = p_all ? tail.data.size() : (tail.data.size() >> PageSizeEx) << PageSizeEx;
+            if (bytes == 0 || (p_all && tail.data.size() == tail.flushed)) return;
+
+            int64_t* postingSize = (int64_t*)At(key);
+            int oldblocks = (int)(*postingSize >> PageSizeEx);
+            int writeblocks = (int)((bytes + PageSize - 1) >> PageSizeEx);
+            std::string value = tail.data.substr(0, bytes);
+            uintptr_t tmpblocks = 0xffffffffffffffff;
+            if (tail.flushed > 0) {
+                tmpblocks = PopRow();
+                memcpy((AddressType*)tmpblocks, postingSize, sizeof(AddressType) * (oldblocks + 1));
+                m_pBlockController.GetBlocks((AddressType*)tmpblocks + 1 + oldblocks, writeblocks);
+                m_pBlockController.WriteBlocks((AddressType*)tmpblocks + 1 + oldblocks, writeblocks, value);
+                *((int64_t*)tmpblocks) = ((std::int64_t)oldblocks << PageSizeEx) + bytes;
+            }
+            else {
+                m_pBlockController.GetBlocks(postingSize + 1 + oldblocks, writeblocks);
+                m_pBlockController.WriteBlocks(postingSize + 1 + oldblocks, writeblocks, value);
+            }
+            m_tailFlushedPages += writeblocks;
+
+            // publish the new posting and keep only what is past the new last page boundary
+            size_t fullBytes = (bytes >> PageSizeEx) << PageSizeEx;
+            {
+                std::lock_guard<COMMON::SequenceLock> publish(m_keyVersions[key]);
+                if (tmpblocks != 0xffffffffffffffff) At(key) = tmpblocks;
+                else *postingSize = ((std::int64_t)oldblocks << PageSizeEx) + bytes;
+
+                std::lock_guard<std::mutex> lock(m_tailLock);
+                tail.data.erase(0, fullBytes);
+                tail.flushed = (bytes == fullBytes) ? 0 : tail.data.size();
+            }
+            m_tailCacheBytes -= fullBytes;
+            LogMapping(key);
+            if (tmpblocks != 0xffffffffffffffff) Retire((uintptr_t)postingSize, postingSize + 1 + oldblocks, 1);
+        }
+
+        // Append through the tail cache: a memcpy unless a page fills up. With the mapping log on,
+        // the tail is written through so acknowledged appends stay durable. Caller holds the key lock.
+        ErrorCode MergeTail(SizeType key, const std::string& value) {
+            int64_t* postingSize = (int64_t*)At(key);
+            TailPage* tail = FindTail(key);
+            if (tail == nullptr) {
+                TailPage newTail;
+                newTail.flushed = (*postingSize) % PageSize;
+                if (newTail.flushed != 0) {
+                    AddressType readreq[] = { (AddressType)newTail.flushed, *(postingSize + 1 + (*postingSize >> PageSizeEx)) };
+                    m_pBlockController.ReadBlocks(readreq, &newTail.data);
+                }
+                m_tailCacheBytes += newTail.data.size();
+                {
+                    std::lock_guard<std::mutex> lock(m_tailLock);
+                    tail = &(m_tails[key] = std::move(newTail));
+                }
+                m_tailQueue.push(key);
+            }
+
+            auto newSize = (((*postingSize) >> PageSizeEx) << PageSizeEx) + tail->data.size() + value.size();
+            if (((newSize + PageSize - 1) >> PageSizeEx) >= m_blockLimit) {
+                LOG(Helper::LogLevel::LL_Error, "Failt to merge key:%d value:%lld since value too long!\n", key, newSize);
+                return ErrorCode::Fail;
+            }
+            {
+                std::lock_guard<std::mutex> lock(m_tailLock);
+                tail->data += value;
+            }
+            m_tailCacheBytes += value.size();
+            m_tailAbsorbed++;
+
+            FlushTail(key, *tail, m_enableWAL);
+            if (m_tailCacheBytes > m_tailCacheBudget) EvictTails(key);
+            return ErrorCode::Success;
+        }
+
+        // flush and drop the oldest tails until under budget, skipping postings that are busy
+        void EvictTails(SizeType p_current) {
+            size_t attempts = m_tailQueue.unsafe_size();
+            SizeType victim;
+            while (m_tailCacheBytes > m_tailCacheBudget && attempts-- > 0 && m_tailQueue.try_pop(victim)) {
+                std::mutex& victimLock = m_keyLocks[victim];
+                if (&victimLock == &m_keyLocks[p_current] || !victimLock.try_lock()) {
+                    m_tailQueue.push(victim);
+                    continue;
+                }
+                TailPage* tail = FindTail(victim);
+                if (tail != nullptr) {
+                    FlushTail(victim, *tail, true);
+                    DropTail(victim);
+                }
+                victimLock.unlock();
+            }
+        }
+
+        // write every unflushed tail to disk, with p_drop also empty the cache
+        void FlushTails(bool p_drop) {
+            if (m_tailCacheBudget == 0) return;
+            std::vector<SizeType> keys;
+            {
+                std::lock_guard<std::mutex> lock(m_tailLock);
+                for (auto& entry : m_tails) keys.push_back(entry.first);
+            }
+            for (SizeType key : keys) {
+                std::lock_guard<std::mutex> keyLock(m_keyLocks[key]);
+                TailPage* tail = FindTail(key);
+                if (tail == nullptr) continue;
+                FlushTail(key, *tail, true);
+                if (p_drop) DropTail(key);
+            }
+            if (p_drop) {
+                SizeType key;
+                while (m_tailQueue.try_pop(key));
+            }
+        }
+
+        // number of contiguous block runs a posting occupies
+        inline int Fragments(AddressType* p_posting) {
+            if (p_posting[0] <= PageSize) return 1;
+            int blocks = (int)((p_posting[0] + PageSize - 1) >> PageSizeEx);
+            int fragments = 1;
+            for (int i = 2; i <= blocks; i++) {
+                if (p_posting[i] != p_posting[i - 1] + 1) fragments++;
+            }
+            return fragments;
+        }
+
+        // carve p_size contiguous blocks out of the sorted free window, growing the window from the free queue if needed
+        bool TakeRun(std::vector<AddressType>& p_window, int p_size, std::vector<AddressType>& p_run) {
+            while (true) {
+                size_t start = 0;
+                for (size_t i = 1; i <= p_window.size(); i++) {
+                    if (i == p_window.size() || p_window[i] != p_window[i - 1] + 1) {
+                        if (i - start >= (size_t)p_size) {
+                            p_run.assign(p_window.begin() + start, p_window.begin() + start + p_size);
+                            p_window.erase(p_window.begin() + start, p_window.begin() + start + p_size);
+                            return true;
+                        }
+                        start = i;
+                    }
+                }
+                if (p_window.size() >= kCompactionMaxWindow) return false;
+
+                size_t oldSize = p_window.size();
+                int toGet = (int)std::min(kCompactionMaxWindow - oldSize, std::max(oldSize, (size_t)p_size * 64));
+                p_window.resize(oldSize + toGet);
+                int got = m_pBlockController.TryGetBlocks(p_window.data() + oldSize, toGet);
+                p_window.resize(oldSize + got);
+                if (got == 0) return false;
+                std::sort(p_window.begin(), p_window.end());
+            }
+        }
+
+        inline void ReleaseBlocks(AddressType* p_data, int p_size) {
+            m_pBlockController.ReleaseBlocks(p_data, p_size);
+            if (m_compactionThreadPool == nullptr) return;
+            if ((m_releasedPages += p_size) >= kCompactionTriggerPages && !m_compactionScheduled.exchange(true)) {
+                m_releasedPages = 0;
+                m_compactionThreadPool->add(new CompactionJob(this));
+            }
+        }
+
+        // Epoch based reclamation for the lock free read path. Readers count themselves in the current epoch,
+        // a replaced row and its blocks are stamped with the epoch they were retired in and recycled only after
+        // the epoch has advanced twice, which needs every reader of the older epochs to have left.
+        class ReadEpoch {
+        public:
+            ReadEpoch(SPDKIO* p_io) {
+                static std::atomic<int> s_nextStripe{ 0 };
+                thread_local int stripe = (s_nextStripe++) % kReaderStripes;
+                while (true) {
+                    std::uint64_t epoch = p_io->m_epoch.load();
+                    m_count = &(p_io->m_readers[epoch & 1][stripe].count);
+                    m_count->fetch_add(1);
+                    if (p_io->m_epoch.load() == epoch) break;
+                    m_count->fetch_sub(1);
+                }
+            }
+            ~ReadEpoch() {
+                m_count->fetch_sub(1, std::memory_order_release);
+            }
+        private:
+            std::atomic<std::int64_t>* m_count;
+        };
+
+        struct RetiredRow {
+            std::uint64_t epoch;
+            uintptr_t row;
+            std::vector<AddressType> blocks;
+            bool countRelease;
+        };
+
+        // hand a row replaced in the mapping and the blocks it no longer shares with the new row to the reclaimer
+        void Retire(uintptr_t p_row, AddressType* p_blocks, int p_size, bool p_countRelease = true) {
+            size_t pending;
+            {
+                std::lock_guard<std::mutex> lock(m_retireLock);
+                m_retired.push_back({ m_epoch.load(), p_row, std::vector<AddressType>(p_blocks, p_blocks + p_size), p_countRelease });
+                pending = m_retired.size();
+            }
+            if (pending >= kReclaimBatch) Reclaim(false);
+        }
+
+        std::int64_t Readers(std::uint64_t p_epoch) {
+            std::int64_t readers = 0;
+            for (int i = 0; i < kReaderStripes; i++) readers += m_readers[p_epoch & 1][i].count.load();
+            return readers;
+        }
+
+        // Advance the epoch as far as readers allow and recycle what no reader can see any more.
+        // With p_wait, wait for readers so everything retired so far is recycled.
+        void Reclaim(bool p_wait) {
+            std::vector<RetiredRow> ready;
+            {
+                std::unique_lock<std::mutex> lock(m_retireLock, std::defer_lock);
+                if (p_wait) lock.lock();
+                else if (!lock.try_lock()) return;
+
+                for (int i = 0; i < 2; i++) {
+                    std::uint64_t epoch = m_epoch.load();
+                    while (Readers(epoch - 1) > 0 && p_wait) std::this_thread::yield();
+                    if (Readers(epoch - 1) > 0) break;
+                    m_epoch.store(epoch + 1);
+                }
+                std::uint64_t safe = m_epoch.load() - 2;
+                while (!m_retired.empty() && m_retired.front().epoch <= safe) {
+                    ready.push_back(std::move(m_retired.front()));
+                    m_retired.pop_front();
+                }
+            }
+            for (auto& retired : ready) {
+                if (!retired.blocks.empty()) {
+                    if (retired.countRelease) ReleaseBlocks(retired.blocks.data(), (int)retired.blocks.size());
+                    else m_pBlockController.ReleaseBlocks(retired.blocks.data(), (int)retired.blocks.size());
+                }
+                if (retired.row != 0xffffffffffffffff) m_buffer.push(retired.row);
+            }
+        }
+
+        // a spare row, allocate one if all spares are still waiting for readers
+        inline uintptr_t PopRow() {
+            uintptr_t row;
+            if (m_buffer.try_pop(row)) return row;
+            Reclaim(false);
+            if (m_buffer.try_pop(row)) return row;
+            return (uintptr_t)(new AddressType[m_blockLimit]);
+        }
+
+        static constexpr size_t kCompactionMaxWindow = 1 << 16;
+        static constexpr std::uint64_t kCompactionTriggerPages = 1 << 18;
+        static constexpr int kReaderStripes = 16;
+        static constexpr size_t kReclaimBatch = 256;
+
         std::string m_mappingPath;
         SizeType m_blockLimit;
         COMMON::Dataset<uintptr_t> m_pBlockMapping;
@@ -377,9 +1076,47 @@ namespace SPTAG::SPANN
         tbb::concurrent_queue<uintptr_t> m_buffer;
         
         //tbb::concurrent_hash_map<SizeType, std::string> *m_pCurrentCache, *m_pNextCache;
-        std::shared_ptr<Helper::ThreadPool> m_compactionThreadPool;
+        std::shared_ptr<CompactionThreadPool> m_compactionThreadPool;
         BlockController m_pBlockController;
 
+        COMMON::FineGrainedLock m_keyLocks;
+        COMMON::SequenceLocks m_keyVersions;
+
+        struct alignas(64) ReaderCount {
+            std::atomic<std::int64_t> count{ 0 };
+        };
+        ReaderCount m_readers[2][kReaderStripes];
+        std::atomic<std::uint64_t> m_epoch{ 2 };
+        std::mutex m_retireLock;
+        std::deque<RetiredRow> m_retired;
+        std::mutex m_compactionMutex;
+        int m_compactionIOBudget;
+        std::atomic_uint64_t m_releasedPages{ 0 };
+        std::atomic_bool m_compactionScheduled{ false };
+        std::atomic_uint64_t m_compactedPostings{ 0 };
+        std::atomic_uint64_t m_compactedPages{ 0 };
+
+        std::uint64_t m_tailCacheBudget;
+        std::mutex m_tailLock;
+        std::unordered_map<SizeType, TailPage> m_tails;
+        tbb::concurrent_queue<SizeType> m_tailQueue;
+        std::atomic_uint64_t m_tailCacheBytes{ 0 };
+        std::atomic_uint64_t m_tailAbsorbed{ 0 };
+        std::atomic_uint64_t m_tailFlushedPages{ 0 };
+
+        bool m_enableWAL;
+        std::uint64_t m_checkpointWALBytes;
+        MappingLog m_log;
+        // data outside the store, synced with every log commit
+        std::function<void()> m_dataSync;
+        std::mutex m_checkpointLock;
+        std::thread m_checkpointThread;
+        std::mutex m_checkpointSignalLock;
+        std::condition_variable m_checkpointCond;
+        bool m_checkpointRequested = false;
+        bool m_checkpointStop = false;
+        std::atomic_uint64_t m_checkpoints{ 0 };
+
         bool m_shutdownCalled;
         std::mutex m_updateMutex;
     };
@@ -6,6 +6,7 @@
 
 #include "inc/Helper/VectorSetReader.h"
 #include "inc/Helper/AsyncFileReader.h"
+#include "inc/Helper/MappedFile.h"
 #include "IExtraSearcher.h"
 #include "inc/Core/Common/TruthSet.h"
 #include "Compressor.h"
@@ -83,6 +84,142 @@ namespace SPTAG
             }
         };
 
+        // Posting vectors of a StreamingBuild. While replicas are assigned batch by batch every edge is appended with
+        // its vector to a run picked by head ID range; Merge sorts each run in the order of the sorted selections, so
+        // row k of the spill is the vector of selection k and the full vector set is never resident.
+        struct PostingSpill {
+            std::string m_file;
+            size_t m_vectorSize;
+            size_t m_recordSize;
+            SizeType m_headCount;
+            std::vector<std::string> m_runFiles;
+            std::vector<std::shared_ptr<Helper::DiskIO>> m_runs;
+            std::vector<std::string> m_runBuffers;
+            std::vector<std::uint64_t> m_runBytes;
+            Helper::MappedFile m_mapped;
+
+            static const size_t c_runFlushBytes = 4 << 20;
+
+            PostingSpill(const std::string& tmpdir, size_t vectorSize, SizeType headCount, size_t totalEdges, size_t bufferBytes) :
+                m_file(tmpdir + FolderSep + "posting_spill_tmp"), m_vectorSize(vectorSize), m_recordSize(sizeof(Edge) + vectorSize), m_headCount(headCount)
+            {
+                size_t runNum = max((size_t)1, (totalEdges * m_recordSize + bufferBytes - 1) / max(bufferBytes, (size_t)1));
+                runNum = min(runNum, (size_t)max(headCount, 1));
+                for (size_t i = 0; i < runNum; i++) m_runFiles.push_back(m_file + "_run" + std::to_string(i));
+                m_runs.resize(runNum);
+                m_runBuffers.resize(runNum);
+                m_runBytes.resize(runNum, 0);
+                LOG(Helper::LogLevel::LL_Info, "Spilling posting vectors into %zu runs under %s\n", runNum, tmpdir.c_str());
+            }
+
+            ~PostingSpill()
+            {
+                m_runs.clear();
+                for (auto& run : m_runFiles) remove(run.c_str());
+                m_mapped.Close();
+                remove(m_file.c_str());
+            }
+
+            ErrorCode FlushRun(size_t run)
+            {
+                if (m_runBuffers[run].empty()) return ErrorCode::Success;
+                if (m_runs[run] == nullptr) {
+                    m_runs[run] = f_createIO();
+                    if (m_runs[run] == nullptr || !m_runs[run]->Initialize(m_runFiles[run].c_str(), std::ios::out | std::ios::binary)) {
+                        LOG(Helper::LogLevel::LL_Error, "Cannot open %s to spill posting vectors!\n", m_runFiles[run].c_str());
+                        return ErrorCode::FailedCreateFile;
+                    }
+                }
+                if (m_runs[run]->WriteBinary(m_runBuffers[run].size(), m_runBuffers[run].data()) != m_runBuffers[run].size()) {
+                    LOG(Helper::LogLevel::LL_Error, "Cannot write to %s!\n", m_runFiles[run].c_str());
+                    return ErrorCode::DiskIOFail;
+                }
+                m_runBytes[run] += m_runBuffers[run].size();
+                m_runBuffers[run].clear();
+                return ErrorCode::Success;
+            }
+
+            ErrorCode Append(const Edge& edge, const void* vector)
+            {
+                size_t run = (size_t)edge.node * m_runs.size() / m_headCount;
+                m_runBuffers[run].append((const char*)&edge, sizeof(Edge));
+                m_runBuffers[run].append((const char*)vector, m_vectorSize);
+                if (m_runBuffers[run].size() >= c_runFlushBytes) return FlushRun(run);
+                return ErrorCode::Success;
+            }
+
+            // Sorts every run and writes the vectors out in selection order, p_sortedSelections are checked row by row.
+            ErrorCode Merge(const std::vector<Edge>& p_sortedSelections)
+            {
+                ErrorCode ret;
+                for (size_t run = 0; run < m_runs.size(); run++) {
+                    if ((ret = FlushRun(run)) != ErrorCode::Success) return ret;
+                    m_runs[run].reset();
+                }
+
+                auto out = f_createIO();
+                if (out == nullptr || !out->Initialize(m_file.c_str(), std::ios::out | std::ios::binary)) {
+                    LOG(Helper::LogLevel::LL_Error, "Cannot open %s to merge posting vectors!\n", m_file.c_str());
+                    return ErrorCode::FailedCreateFile;
+                }
+
+                size_t row = 0;
+                for (size_t run = 0; run < m_runs.size(); run++) {
+                    if (m_runBytes[run] == 0) continue;
+                    std::string records(m_runBytes[run], '\0');
+                    auto in = f_createIO();
+                    if (in == nullptr || !in->Initialize(m_runFiles[run].c_str(), std::ios::in | std::ios::binary) ||
+                        in->ReadBinary(records.size(), (char*)records.data(), 0) != records.size()) {
+                        LOG(Helper::LogLevel::LL_Error, "Cannot read back %s!\n", m_runFiles[run].c_str());
+                        return ErrorCode::DiskIOFail;
+                    }
+                    in.reset();
+                    remove(m_runFiles[run].c_str());
+
+                    size_t count = records.size() / m_recordSize;
+                    std::vector<std::pair<Edge, size_t>> order(count);
+                    for (size_t i = 0; i < count; i++) {
+                        memcpy(&(order[i].first), records.data() + i * m_recordSize, sizeof(Edge));
+                        order[i].second = i;
+                    }
+                    std::sort(order.begin(), order.end(), [](const std::pair<Edge, size_t>& a, const std::pair<Edge, size_t>& b) {
+                        return Selection::g_edgeComparer(a.first, b.first);
+                    });
+
+                    std::string vectors(count * m_vectorSize, '\0');
+                    for (size_t i = 0; i < count; i++, row++) {
+                        const Edge& edge = order[i].first;
+                        if (row >= p_sortedSelections.size() || p_sortedSelections[row].node != edge.node || p_sortedSelections[row].tonode != edge.tonode) {
+                            LOG(Helper::LogLevel::LL_Error, "Spilled posting vectors do not match the selections at %zu!\n", row);
+                            return ErrorCode::Fail;
+                        }
+                        memcpy((char*)vectors.data() + i * m_vectorSize, records.data() + order[i].second * m_recordSize + sizeof(Edge), m_vectorSize);
+                    }
+                    if (out->WriteBinary(vectors.size(), vectors.data()) != vectors.size()) {
+                        LOG(Helper::LogLevel::LL_Error, "Cannot write to %s!\n", m_file.c_str());
+                        return ErrorCode::DiskIOFail;
+                    }
+                }
+                out.reset();
+
+                if (row < p_sortedSelections.size() && p_sortedSelections[row].node != MaxSize) {
+                    LOG(Helper::LogLevel::LL_Error, "Spilled posting vectors stop at %zu before the selections do!\n", row);
+                    return ErrorCode::Fail;
+                }
+                if (row > 0 && !m_mapped.Open(m_file, false)) {
+                    LOG(Helper::LogLevel::LL_Error, "Cannot map %s!\n", m_file.c_str());
+                    return ErrorCode::FailedOpenFile;
+                }
+                LOG(Helper::LogLevel::LL_Info, "Merged %zu spilled posting vectors.\n", row);
+                return ErrorCode::Success;
+            }
+
+            const void* GetVector(size_t p_selectIdx) const
+            {
+                return m_mapped.Data() + p_selectIdx * m_vectorSize;
+            }
+        };
+
 #define DecompressPosting(){\
         p_postingListFullData = (char*)p_exWorkSpace->m_decompressBuffer.GetBuffer(); \
         if (listInfo->listEleCount != 0) { \
@@ -346,7 +483,8 @@ namespace SPTAG
                 std::shared_ptr<VectorSet> p_fullVectors,
                 bool m_enableDeltaEncoding = false,
                 bool m_enablePostingListRearrange = false,
-                const ValueType *headVector = nullptr)
+                const ValueType *headVector = nullptr,
+                const PostingSpill *p_spill = nullptr)
             {
                 std::string postingListFullData("");
                 std::string vectors("");
@@ -363,10 +501,12 @@ namespace SPTAG
                     std::string vectorID("");
                     std::string vector("");
 
+                    size_t row = selectIdx;
                     int vid = p_selections[selectIdx++].tonode;
                     vectorID.append(reinterpret_cast<char *>(&vid), sizeof(int));
 
-                    ValueType *p_vector = reinterpret_cast<ValueType *>(p_fullVectors->GetVector(vid));
+                    // a streaming build keeps the vectors in the spill, in selection order
+                    ValueType *p_vector = reinterpret_cast<ValueType *>(p_spill ? const_cast<void *>(p_spill->GetVector(row)) : p_fullVectors->GetVector(vid));
                     if (m_enableDeltaEncoding)
                     {
                         DimensionType n = p_fullVectors->Dimension();
@@ -431,16 +571,16 @@ namespace SPTAG
                     LOG(Helper::LogLevel::LL_Info, "Loaded %u Vector IDs\n", static_cast<uint32_t>(headVectorIDS.size()));
                 }
 
-                SizeType fullCount = 0;
-                size_t vectorInfoSize = 0;
-                {
-                    auto fullVectors = p_reader->GetVectorSet();
-                    fullCount = fullVectors->Count();
-                    vectorInfoSize = fullVectors->PerVectorDataSize() + sizeof(int);
-                }
+                // only the header and the first row are read here, the vectors come in batches below
+                SizeType vectorCount = p_reader->GetVectorCount();
+                std::shared_ptr<VectorSet> firstVector = p_reader->GetVectorSet(0, 1);
+                SizeType fullCount = vectorCount;
+                size_t vectorInfoSize = firstVector->PerVectorDataSize() + sizeof(int);
                 if (upperBound > 0) fullCount = upperBound;
 
                 Selection selections(static_cast<size_t>(fullCount) * p_opt.m_replicaCount, p_opt.m_tmpdir);
+                std::unique_ptr<PostingSpill> spill;
+                if (p_opt.m_streamingBuild) spill.reset(new PostingSpill(p_opt.m_tmpdir, firstVector->PerVectorDataSize(), p_headIndex->GetNumSamples(), selections.m_totalsize, ((size_t)p_opt.m_streamingSpillBufferMB) << 20));
                 LOG(Helper::LogLevel::LL_Info, "Full vector count:%d Edge bytes:%llu selection size:%zu, capacity size:%zu\n", fullCount, sizeof(Edge), selections.m_selections.size(), selections.m_selections.capacity());
                 std::vector<std::atomic_int> replicaCount(fullCount);
                 std::vector<std::atomic_int> postingListSize(p_headIndex->GetNumSamples());
@@ -506,6 +646,7 @@ namespace SPTAG
                                     ++postingListSize[selections[vecOffset + resNum].node];
                                     selections[vecOffset + resNum].tonode = j;
                                     ++replicaCount[j];
+                                    if (spill && spill->Append(selections[vecOffset + resNum], fullVectors->GetVector(j - start)) != ErrorCode::Success) return false;
                                 }
                             }
                         }
@@ -532,6 +673,7 @@ namespace SPTAG
 
                 // Sort results either in CPU or GPU
                 VectorIndex::SortSelections(&selections.m_selections);
+                if (spill && spill->Merge(selections.m_selections) != ErrorCode::Success) return false;
 
                 auto t3 = std::chrono::high_resolution_clock::now();
                 LOG(Helper::LogLevel::LL_Info, "Time to sort selections:%.2lf sec.\n", ((double)std::chrono::duration_cast<std::chrono::seconds>(t3 - t2).count()) + ((double)std::chrono::duration_cast<std::chrono::milliseconds>(t3 - t2).count()) / 1000);
@@ -624,8 +766,15 @@ namespace SPTAG
                     }
                 }
 
-                auto fullVectors = p_reader->GetVectorSet();
-                if (p_opt.m_distCalcMethod == DistCalcMethod::Cosine && !p_reader->IsNormalized() && !p_headIndex->m_pQuantizer) fullVectors->Normalize(p_opt.m_iSSDNumberOfThreads);
+                std::shared_ptr<VectorSet> fullVectors;
+                if (spill) {
+                    // postings read their vectors from the spill, this set only describes them for the file header
+                    fullVectors.reset(new BasicVectorSet(ByteArray(), firstVector->GetValueType(), firstVector->Dimension(), vectorCount));
+                }
+                else {
+                    fullVectors = p_reader->GetVectorSet();
+                    if (p_opt.m_distCalcMethod == DistCalcMethod::Cosine && !p_reader->IsNormalized() && !p_headIndex->m_pQuantizer) fullVectors->Normalize(p_opt.m_iSSDNumberOfThreads);
+                }
 
                 // iterate over files
                 for (int i = 0; i < p_opt.m_ssdIndexFileNum; i++) {
@@ -664,7 +813,7 @@ namespace SPTAG
                                     headVector = (ValueType*)p_headIndex->GetSample(j);
                                 }
                                 std::string postingListFullData = GetPostingListFullData(
-                                    j, curPostingListSizes[j], selections, fullVectors, p_opt.m_enableDeltaEncoding, p_opt.m_enablePostingListRearrange, headVector);
+                                    j, curPostingListSizes[j], selections, fullVectors, p_opt.m_enableDeltaEncoding, p_opt.m_enablePostingListRearrange, headVector, spill.get());
 
                                 samplesBuffer += postingListFullData;
                                 samplesSizes.push_back(postingListFullData.size());
@@ -693,7 +842,7 @@ namespace SPTAG
                                 headVector = (ValueType*)p_headIndex->GetSample(postingListId);
                             }
                             std::string postingListFullData = GetPostingListFullData(
-                                postingListId, postingListSize[postingListId], selections, fullVectors, p_opt.m_enableDeltaEncoding, p_opt.m_enablePostingListRearrange, headVector);
+                                postingListId, postingListSize[postingListId], selections, fullVectors, p_opt.m_enableDeltaEncoding, p_opt.m_enablePostingListRearrange, headVector, spill.get());
                             size_t sizeToCompress = postingListSize[postingListId] * vectorInfoSize;
                             if (sizeToCompress != postingListFullData.size()) {
                                 LOG(Helper::LogLevel::LL_Error, "Size to compress NOT MATCH! PostingListFullData size: %zu sizeToCompress: %zu \n", postingListFullData.size(), sizeToCompress);
@@ -733,7 +882,9 @@ namespace SPTAG
                         postPageOffset,
                         postingOrderInIndex,
                         fullVectors,
-                        curPostingListOffSet);
+                        curPostingListOffSet,
+                        ((size_t)p_opt.m_outputChunkMB) << 20,
+                        spill.get());
                 }
 
                 auto t5 = std::chrono::high_resolution_clock::now();
@@ -1025,7 +1176,9 @@ namespace SPTAG
                 const std::unique_ptr<std::uint16_t[]>& p_postPageOffset,
                 const std::vector<int>& p_postingOrderInIndex,
                 std::shared_ptr<VectorSet> p_fullVectors,
-                size_t p_postingListOffset)
+                size_t p_postingListOffset,
+                size_t p_outputChunkBytes,
+                const PostingSpill* p_spill = nullptr)
             {
                 LOG(Helper::LogLevel::LL_Info, "Start output...\n");
 
@@ -1185,103 +1338,117 @@ namespace SPTAG
 
                 LOG(Helper::LogLevel::LL_Info, "SubIndex Size: %llu bytes, %llu MBytes\n", listOffset, listOffset >> 20);
 
-                listOffset = 0;
+                // SelectPostingOffset has fixed where every posting goes, so the content section is cut into
+                // page-aligned chunks: worker threads fill one chunk while the previous one is being written.
+                struct OutputChunk
+                {
+                    size_t m_begin;
+                    size_t m_end;
+                    std::uint64_t m_offset;
+                    std::uint64_t m_bytes;
+                };
+                auto alignUp = [](std::uint64_t offset) { return (offset + PageSize - 1) / PageSize * PageSize; };
 
-                std::uint64_t paddedSize = 0;
-                // iterate over all the posting lists
-                for (auto id : p_postingOrderInIndex)
+                std::vector<OutputChunk> chunks;
+                std::uint64_t postingBytes = 0;
+                listOffset = 0;
+                for (size_t k = 0; k < p_postingOrderInIndex.size(); k++)
                 {
+                    int id = p_postingOrderInIndex[k];
+                    if (p_postingListSizes[id] == 0) continue;
+
                     std::uint64_t targetOffset = static_cast<uint64_t>(p_postPageNum[id]) * PageSize + p_postPageOffset[id];
                     if (targetOffset < listOffset)
                     {
                         LOG(Helper::LogLevel::LL_Info, "List offset not match, targetOffset < listOffset!\n");
                         throw std::runtime_error("List offset mismatch");
                     }
-                    // write padding vals before the posting list
-                    if (targetOffset > listOffset)
-                    {
-                        if (targetOffset - listOffset > PageSize)
-                        {
-                            LOG(Helper::LogLevel::LL_Error, "Padding size greater than page size!\n");
-                            throw std::runtime_error("Padding size mismatch with page size");
-                        }
-
-                        if (ptr->WriteBinary(targetOffset - listOffset, reinterpret_cast<char*>(paddingVals.get())) != targetOffset - listOffset) {
-                            LOG(Helper::LogLevel::LL_Error, "Failed to write SSDIndex File!");
-                            throw std::runtime_error("Failed to write SSDIndex File");
-                        }
-
-                        paddedSize += targetOffset - listOffset;
-
-                        listOffset = targetOffset;
-                    }
-
-                    if (p_postingListSizes[id] == 0)
-                    {
-                        continue;
-                    }
-                    int postingListId = id + (int)p_postingListOffset;
-                    // get posting list full content and write it at once
-                    ValueType *headVector = nullptr;
-                    if (m_enableDeltaEncoding)
+                    if (targetOffset - listOffset > PageSize)
                     {
-                        headVector = (ValueType *)p_headIndex->GetSample(postingListId);
+                        LOG(Helper::LogLevel::LL_Error, "Padding size greater than page size!\n");
+                        throw std::runtime_error("Padding size mismatch with page size");
                     }
-                    std::string postingListFullData = GetPostingListFullData(
-                        postingListId, p_postingListSizes[id], p_postingSelections, p_fullVectors, m_enableDeltaEncoding, m_enablePostingListRearrange, headVector);
-                    size_t postingListFullSize = p_postingListSizes[id] * p_spacePerVector;
-                    if (postingListFullSize != postingListFullData.size())
+                    // a chunk may only end on a page no later posting shares
+                    if (chunks.empty() || (chunks.back().m_bytes >= p_outputChunkBytes && targetOffset >= alignUp(listOffset)))
                     {
-                        LOG(Helper::LogLevel::LL_Error, "posting list full data size NOT MATCH! postingListFullData.size(): %zu postingListFullSize: %zu \n", postingListFullData.size(), postingListFullSize);
-                        throw std::runtime_error("Posting list full size mismatch");
+                        chunks.push_back({ k, k, alignUp(listOffset), 0 });
                     }
-                    if (m_enableDataCompression)
+                    listOffset = targetOffset + p_postingListBytes[id];
+                    postingBytes += p_postingListBytes[id];
+                    chunks.back().m_end = k + 1;
+                    chunks.back().m_bytes = alignUp(listOffset) - chunks.back().m_offset;
+                }
+
+                std::atomic_bool failed(false);
+                auto fillChunk = [&](const OutputChunk& chunk, std::string& buffer)
+                {
+                    buffer.assign(chunk.m_bytes, '\0');
+#pragma omp parallel for schedule(dynamic)
+                    for (int k = (int)chunk.m_begin; k < (int)chunk.m_end; k++)
                     {
-                        std::string compressedData = m_pCompressor->Compress(postingListFullData, m_enableDictTraining);
-                        size_t compressedSize = compressedData.size();
-                        if (compressedSize != p_postingListBytes[id])
+                        int id = p_postingOrderInIndex[k];
+                        if (p_postingListSizes[id] == 0 || failed) continue;
+
+                        int postingListId = id + (int)p_postingListOffset;
+                        ValueType* headVector = nullptr;
+                        if (m_enableDeltaEncoding)
                         {
-                            LOG(Helper::LogLevel::LL_Error, "Compressed size NOT MATCH! compressed size:%zu, pre-calculated compressed size:%zu\n", compressedSize, p_postingListBytes[id]);
-                            throw std::runtime_error("Compression size mismatch");
+                            headVector = (ValueType*)p_headIndex->GetSample(postingListId);
                         }
-                        if (ptr->WriteBinary(compressedSize, compressedData.data()) != compressedSize)
+                        try
                         {
-                            LOG(Helper::LogLevel::LL_Error, "Failed to write SSDIndex File!");
-                            throw std::runtime_error("Failed to write SSDIndex File");
+                            std::string postingListFullData = GetPostingListFullData(
+                                postingListId, p_postingListSizes[id], p_postingSelections, p_fullVectors, m_enableDeltaEncoding, m_enablePostingListRearrange, headVector, p_spill);
+                            size_t postingListFullSize = p_postingListSizes[id] * p_spacePerVector;
+                            if (postingListFullSize != postingListFullData.size())
+                            {
+                                LOG(Helper::LogLevel::LL_Error, "posting list full data size NOT MATCH! postingListFullData.size(): %zu postingListFullSize: %zu \n", postingListFullData.size(), postingListFullSize);
+                                failed = true;
+                                continue;
+                            }
+                            if (m_enableDataCompression)
+                            {
+                                postingListFullData = m_pCompressor->Compress(postingListFullData, m_enableDictTraining);
+                            }
+                            if (postingListFullData.size() != p_postingListBytes[id])
+                            {
+                                LOG(Helper::LogLevel::LL_Error, "Compressed size NOT MATCH! compressed size:%zu, pre-calculated compressed size:%zu\n", postingListFullData.size(), p_postingListBytes[id]);
+                                failed = true;
+                                continue;
+                            }
+                            std::uint64_t targetOffset = static_cast<uint64_t>(p_postPageNum[id]) * PageSize + p_postPageOffset[id];
+                            memcpy((char*)buffer.data() + (targetOffset - chunk.m_offset), postingListFullData.data(), postingListFullData.size());
                         }
-                        listOffset += compressedSize;
-                    }
-                    else
-                    {
-                        if (ptr->WriteBinary(postingListFullSize, postingListFullData.data()) != postingListFullSize)
+                        catch (std::exception& e)
                         {
-                            LOG(Helper::LogLevel::LL_Error, "Failed to write SSDIndex File!");
-                            throw std::runtime_error("Failed to write SSDIndex File");
+                            LOG(Helper::LogLevel::LL_Error, "Failed to serialize posting list %d: %s\n", postingListId, e.what());
+                            failed = true;
                         }
-                        listOffset += postingListFullSize;
                     }
-                }
-
-                paddingSize = PageSize - (listOffset % PageSize);
-                if (paddingSize == PageSize)
-                {
-                    paddingSize = 0;
-                }
-                else
-                {
-                    listOffset += paddingSize;
-                    paddedSize += paddingSize;
-                }
+                };
 
-                if (paddingSize > 0)
+                // double buffering: chunk c is filled into one buffer while chunk c - 1 is written from the other
+                std::string buffers[2];
+                std::future<std::uint64_t> pending;
+                for (size_t c = 0; c <= chunks.size(); c++)
                 {
-                    if (ptr->WriteBinary(paddingSize, reinterpret_cast<char *>(paddingVals.get())) != paddingSize)
+                    if (c < chunks.size()) fillChunk(chunks[c], buffers[c % 2]);
+                    if (pending.valid() && pending.get() != chunks[c - 1].m_bytes)
                     {
                         LOG(Helper::LogLevel::LL_Error, "Failed to write SSDIndex File!");
                         throw std::runtime_error("Failed to write SSDIndex File");
                     }
+                    if (failed) throw std::runtime_error("Posting list serialization failed");
+                    if (c == chunks.size()) break;
+
+                    const std::string& buffer = buffers[c % 2];
+                    pending = std::async(std::launch::async, [&ptr, &buffer]() { return ptr->WriteBinary(buffer.size(), buffer.data()); });
                 }
 
+                listOffset = chunks.empty() ? 0 : chunks.back().m_offset + chunks.back().m_bytes;
+                std::uint64_t paddedSize = listOffset - postingBytes;
+                LOG(Helper::LogLevel::LL_Info, "Wrote %zu posting lists in %zu chunks.\n", p_postingOrderInIndex.size(), chunks.size());
+
                 LOG(Helper::LogLevel::LL_Info, "Padded Size: %llu, final total size: %llu.\n", paddedSize, listOffset);
 
                 LOG(Helper::LogLevel::LL_Info, "Output done...\n");
@@ -0,0 +1,175 @@
+// Copyright (c) Microsoft Corporation. All rights reserved.
+// Licensed under the MIT License.
+
+#ifndef _SPTAG_SPANN_FULLVECTORSTORE_H_
+#define _SPTAG_SPANN_FULLVECTORSTORE_H_
+
+#include "inc/Core/Common.h"
+#include "inc/Helper/Logging.h"
+#include <algorithm>
+#include <cstring>
+#include <numeric>
+#include <string>
+#include <vector>
+
+#ifdef _MSC_VER
+#include <Windows.h>
+#else
+#include <fcntl.h>
+#include <unistd.h>
+#endif
+
+namespace SPTAG {
+    namespace SPANN {
+        // Exact vectors of an index whose postings keep only codes: one fixed-size record per vector id in a flat file,
+        // so every vector is stored once however many postings it is replicated to.
+        // Reads and writes are positional on one raw handle, so threads touching different ids never wait on each other.
+        class FullVectorStore
+        {
+        public:
+            FullVectorStore(const std::string& p_path, int p_vectorSize) : m_vectorSize(p_vectorSize)
+            {
+#ifdef _MSC_VER
+                m_file = CreateFileA(p_path.c_str(), GENERIC_READ | GENERIC_WRITE, FILE_SHARE_READ | FILE_SHARE_WRITE, NULL, OPEN_ALWAYS, FILE_ATTRIBUTE_NORMAL, NULL);
+                if (m_file == INVALID_HANDLE_VALUE) {
+#else
+                m_file = open(p_path.c_str(), O_RDWR | O_CREAT, 0644);
+                if (m_file < 0) {
+#endif
+                    LOG(Helper::LogLevel::LL_Error, "FullVectorStore: cannot open %s\n", p_path.c_str());
+                    return;
+                }
+                LOG(Helper::LogLevel::LL_Info, "FullVectorStore: %s holds vectors of %d bytes\n", p_path.c_str(), m_vectorSize);
+            }
+
+            ~FullVectorStore()
+            {
+                if (!Available()) return;
+                if (!Sync()) LOG(Helper::LogLevel::LL_Error, "FullVectorStore: fail to sync on shutdown\n");
+#ifdef _MSC_VER
+                CloseHandle(m_file);
+#else
+                close(m_file);
+#endif
+            }
+
+#ifdef _MSC_VER
+            inline bool Available() const { return m_file != INVALID_HANDLE_VALUE; }
+#else
+            inline bool Available() const { return m_file >= 0; }
+#endif
+
+            ErrorCode Put(SizeType p_vid, const void* p_vector)
+            {
+                if (!WriteAt((const char*)p_vector, m_vectorSize, Offset(p_vid))) {
+                    LOG(Helper::LogLevel::LL_Error, "FullVectorStore: fail to write vector %d\n", p_vid);
+                    return ErrorCode::DiskIOFail;
+                }
+                return ErrorCode::Success;
+            }
+
+            ErrorCode Get(SizeType p_vid, void* p_vector) const
+            {
+                if (!ReadAt((char*)p_vector, m_vectorSize, Offset(p_vid))) {
+                    LOG(Helper::LogLevel::LL_Error, "FullVectorStore: fail to read vector %d\n", p_vid);
+                    return ErrorCode::DiskIOFail;
+                }
+                return ErrorCode::Success;
+            }
+
+            // Reads the vector of p_vids[i] into p_rows[i]. Requests go out in file order and
+            // neighbouring ids are fetched with one read.
+            ErrorCode MultiGet(const std::vector<SizeType>& p_vids, const std::vector<char*>& p_rows) const
+            {
+                std::vector<size_t> order(p_vids.size());
+                std::iota(order.begin(), order.end(), 0);
+                std::sort(order.begin(), order.end(), [&](size_t a, size_t b) { return p_vids[a] < p_vids[b]; });
+
+                std::string run;
+                for (size_t begin = 0, end = 0; begin < order.size(); begin = end) {
+                    end = begin + 1;
+                    while (end < order.size() && end - begin < kMaxRun && p_vids[order[end]] <= p_vids[order[end - 1]] + 1) end++;
+                    if (end - begin == 1) {
+                        if (Get(p_vids[order[begin]], p_rows[order[begin]]) != ErrorCode::Success) return ErrorCode::DiskIOFail;
+                        continue;
+                    }
+                    SizeType first = p_vids[order[begin]];
+                    std::size_t bytes = (std::size_t)(p_vids[order[end - 1]] - first + 1) * m_vectorSize;
+                    run.resize(bytes);
+                    if (!ReadAt(&run[0], bytes, Offset(first))) {
+                        LOG(Helper::LogLevel::LL_Error, "FullVectorStore: fail to read vectors %d-%d\n", first, p_vids[order[end - 1]]);
+                        return ErrorCode::DiskIOFail;
+                    }
+                    for (size_t i = begin; i < end; i++) {
+                        memcpy(p_rows[order[i]], run.data() + (std::size_t)(p_vids[order[i]] - first) * m_vectorSize, m_vectorSize);
+                    }
+                }
+                return ErrorCode::Success;
+            }
+
+            // Puts so far reach stable storage, called before the postings that refer to them are made durable.
+            bool Sync() const
+            {
+                if (!Available()) return false;
+#ifdef _MSC_VER
+                return FlushFileBuffers(m_file) != 0;
+#else
+                return fdatasync(m_file) == 0;
+#endif
+            }
+
+        private:
+            inline std::uint64_t Offset(SizeType p_vid) const { return (std::uint64_t)p_vid * m_vectorSize; }
+
+            // Short transfers are retried from where they stopped, end of file counts as a failure.
+            bool ReadAt(char* p_buffer, std::size_t p_size, std::uint64_t p_offset) const
+            {
+                while (p_size > 0) {
+#ifdef _MSC_VER
+                    OVERLAPPED ol = {};
+                    ol.Offset = (DWORD)p_offset;
+                    ol.OffsetHigh = (DWORD)(p_offset >> 32);
+                    DWORD done = 0;
+                    if (!ReadFile(m_file, p_buffer, (DWORD)(std::min)(p_size, (std::size_t)(1 << 30)), &done, &ol) || done == 0) return false;
+#else
+                    ssize_t done = pread(m_file, p_buffer, p_size, (off_t)p_offset);
+                    if (done < 0 && errno == EINTR) continue;
+                    if (done <= 0) return false;
+#endif
+                    p_buffer += done; p_size -= done; p_offset += done;
+                }
+                return true;
+            }
+
+            bool WriteAt(const char* p_buffer, std::size_t p_size, std::uint64_t p_offset)
+            {
+                while (p_size > 0) {
+#ifdef _MSC_VER
+                    OVERLAPPED ol = {};
+                    ol.Offset = (DWORD)p_offset;
+                    ol.OffsetHigh = (DWORD)(p_offset >> 32);
+                    DWORD done = 0;
+                    if (!WriteFile(m_file, p_buffer, (DWORD)(std::min)(p_size, (std::size_t)(1 << 30)), &done, &ol) || done == 0) return false;
+#else
+                    ssize_t done = pwrite(m_file, p_buffer, p_size, (off_t)p_offset);
+                    if (done < 0 && errno == EINTR) continue;
+                    if (done <= 0) return false;
+#endif
+                    p_buffer += done; p_size -= done; p_offset += done;
+                }
+                return true;
+            }
+
+            static constexpr size_t kMaxRun = 64;
+
+            int m_vectorSize;
+#ifdef _MSC_VER
+            HANDLE m_file = INVALID_HANDLE_VALUE;
+#else
+            int m_file = -1;
+#endif
+        };
+    }
+}
+
+#endif // _SPTAG_SPANN_FULLVECTORSTORE_H_
@@ -27,6 +27,9 @@ namespace SPTAG {
                 m_totalListElementsCount(0),
                 m_diskIOCount(0),
                 m_diskAccessCount(0),
+                m_postingCount(0),
+                m_postingCovered(0),
+                m_postingSaved(0),
                 m_totalSearchLatency(0),
                 m_totalLatency(0),
                 m_exLatency(0),
@@ -48,6 +51,14 @@ namespace SPTAG {
 
             int m_diskAccessCount;
 
+            // postings probed, and how many of them were read before the latency budget ran out
+            int m_postingCount;
+
+            int m_postingCovered;
+
+            // probed postings left unread because the top-K settled early or their head fell too far behind it
+            int m_postingSaved;
+
             double m_totalSearchLatency;
 
             double m_totalLatency;
@@ -77,6 +88,7 @@ namespace SPTAG {
 
         struct IndexStats {
             std::atomic_uint32_t m_headMiss{ 0 };
+            std::atomic_uint32_t m_reAssignDedup{ 0 };
             uint32_t m_appendTaskNum{ 0 };
             uint32_t m_splitNum{ 0 };
             uint32_t m_theSameHeadNum{ 0 };
@@ -106,6 +118,9 @@ namespace SPTAG {
             // GC
             double m_garbageCost{ 0 };
 
+            // Background scheduling
+            double m_backgroundPauseCost{ 0 };
+
             void PrintStat(int finishedInsert, bool cost = false, bool reset = false) {
                 LOG(Helper::LogLevel::LL_Info, "After %d insertion, head vectors split %d times, head missing %d times, same head %d times, reassign %d times, reassign scan %ld times, garbage collection %d times, merge %d times\n",
                     finishedInsert, m_splitNum, m_headMiss.load(), m_theSameHeadNum, m_reAssignNum, m_reAssignScanNum, m_garbageNum, m_mergeNum);
@@ -124,6 +139,7 @@ namespace SPTAG {
                     LOG(Helper::LogLevel::LL_Info, "ReassignNum: %d, TotalCost: %.3lf us, PerCost: %.3lf us\n", m_reAssignNum, m_reAssignCost, m_reAssignCost / m_reAssignNum);
                     LOG(Helper::LogLevel::LL_Info, "ReassignNum: %d, Select TotalCost: %.3lf us, PerCost: %.3lf us\n", m_reAssignNum, m_selectCost, m_selectCost / m_reAssignNum);
                     LOG(Helper::LogLevel::LL_Info, "ReassignNum: %d, ReassignAppend TotalCost: %.3lf us, PerCost: %.3lf us\n", m_reAssignNum, m_reAssignAppendCost, m_reAssignAppendCost / m_reAssignNum);
+                    LOG(Helper::LogLevel::LL_Info, "Background: duplicate reassigns dropped %d, paused for search latency %.3lf us\n", m_reAssignDedup.load(), m_backgroundPauseCost);
                 }
 
                 if (reset) {
@@ -148,6 +164,8 @@ namespace SPTAG {
                     m_reAssignCost = 0;
                     m_selectCost = 0;
                     m_reAssignAppendCost = 0;
+                    m_reAssignDedup = 0;
+                    m_backgroundPauseCost = 0;
                 }
             }
         };
@@ -231,8 +249,21 @@ namespace SPTAG {
 
             std::vector<int> m_postingIDs;
 
+            // head distance of each of m_postingIDs when the caller has it, empty otherwise
+            std::vector<float> m_postingDists;
+
             COMMON::OptHashPosVector m_deduper;
 
+            // dedup of the dynamic index posting scans, grown to the probe set of the query
+            COMMON::EpochHashSet m_postingDeduper;
+
+            // one deduper per query of a batch search, created on first use
+            std::vector<std::unique_ptr<COMMON::EpochHashSet>> m_batchDedupers;
+
+            // ADC lookup table of the query when postings keep PQ codes, and its uint8 copy for 4-bit fast-scan
+            std::vector<float> m_distanceTable;
+            std::vector<std::uint8_t> m_fastScanTable;
+
             Helper::RequestQueue m_processIocp;
 
             std::vector<PageBuffer<std::uint8_t>> m_pageBuffers;
@@ -265,6 +296,22 @@ namespace SPTAG {
                 std::shared_ptr<VectorIndex> p_index,
                 SearchStats* p_stats, std::set<int>* truth = nullptr, std::map<int, std::set<int>>* found = nullptr) = 0;
 
+            // p_postingIDs[i] are the postings probed for p_queryResults[i], p_stats has one entry per query.
+            // Searchers that can share postings between queries override this, the default searches one query at a time.
+            virtual void SearchIndexBatch(ExtraWorkSpace* p_exWorkSpace,
+                std::vector<QueryResult*>& p_queryResults,
+                std::vector<std::vector<SizeType>>& p_postingIDs,
+                std::shared_ptr<VectorIndex> p_index,
+                SearchStats* p_stats)
+            {
+                for (size_t i = 0; i < p_queryResults.size(); i++) {
+                    p_exWorkSpace->m_deduper.clear();
+                    p_exWorkSpace->m_postingIDs = p_postingIDs[i];
+                    p_exWorkSpace->m_postingDists.clear();
+                    SearchIndex(p_exWorkSpace, *(p_queryResults[i]), p_index, p_stats ? p_stats + i : nullptr);
+                }
+            }
+
             virtual bool BuildIndex(std::shared_ptr<Helper::VectorSetReader>& p_reader, 
                 std::shared_ptr<VectorIndex> p_index, 
                 Options& p_opt, COMMON::VersionLabel& p_versionMap, SizeType upperBound = -1) = 0;
@@ -279,6 +326,8 @@ namespace SPTAG {
             virtual void GetDBStats() { return; }
             virtual void GetIndexStats(int finishedInsert, bool cost, bool reset) { return; }
             virtual void ForceCompaction() { return; }
+            // Flushes what is kept beside the postings, such as the full vectors, to stable storage.
+            virtual bool SyncData() { return true; }
 
             virtual bool CheckValidPosting(SizeType postingID) = 0;
             virtual SizeType SearchVector(std::shared_ptr<VectorSet>& p_vectorSet,
@@ -19,14 +19,17 @@
 #include "inc/Helper/StringConvert.h"
 #include "inc/Helper/ThreadPool.h"
 #include "inc/Helper/ConcurrentSet.h"
+#include "inc/Helper/MappedFile.h"
 #include "inc/Helper/VectorSetReader.h"
 #include "inc/Core/Common/IQuantizer.h"
 
 #include "IExtraSearcher.h"
 #include "Options.h"
 
+#include <atomic>
 #include <functional>
 #include <shared_mutex>
+#include <thread>
 
 namespace SPTAG
 {
@@ -42,6 +45,8 @@ namespace SPTAG
         class Index : public VectorIndex
         {
         private:
+            // Head index files under MmapIndex, declared first so that they outlive m_index.
+            std::vector<std::shared_ptr<Helper::MappedFile>> m_mappedHeadFiles;
             std::shared_ptr<VectorIndex> m_index;
             std::shared_ptr<std::uint64_t> m_vectorTranslateMap;
             std::unordered_map<std::string, std::string> m_headParameters;
@@ -56,6 +61,11 @@ namespace SPTAG
             std::mutex m_dataAddLock;
             COMMON::VersionLabel m_versionMap;
 
+            // Serializes Checkpoint against full saves, m_checkpointMerger folds sealed deltas into the head files.
+            std::mutex m_checkpointLock;
+            std::thread m_checkpointMerger;
+            std::atomic<bool> m_checkpointMerging{ false };
+
         public:
             static thread_local std::shared_ptr<ExtraWorkSpace> m_workspace;
 
@@ -66,7 +76,10 @@ namespace SPTAG
                 m_iBaseSquare = (m_options.m_distCalcMethod == DistCalcMethod::Cosine) ? COMMON::Utils::GetBase<T>() * COMMON::Utils::GetBase<T>() : 1;
             }
 
-            ~Index() {}
+            ~Index()
+            {
+                if (m_checkpointMerger.joinable()) m_checkpointMerger.join();
+            }
 
             inline std::shared_ptr<VectorIndex> GetMemoryIndex() { return m_index; }
             inline std::shared_ptr<IExtraSearcher> GetDiskIndex() { return m_extraSearcher; }
@@ -126,9 +139,15 @@ namespace SPTAG
             ErrorCode BuildIndex(bool p_normalized = false);
             ErrorCode SearchIndex(QueryResult &p_query, bool p_searchDeleted = false) const;
             ErrorCode SearchDiskIndex(QueryResult& p_query, SearchStats* p_stats = nullptr) const;
+            // Heads of every query must already be searched, postings shared by several queries are read once.
+            // p_stats, when given, has one entry per query.
+            ErrorCode SearchDiskIndexBatch(std::vector<QueryResult*>& p_queries, SearchStats* p_stats = nullptr) const;
             ErrorCode DebugSearchDiskIndex(QueryResult& p_query, int p_subInternalResultNum, int p_internalResultNum,
                 SearchStats* p_stats = nullptr, std::set<int>* truth = nullptr, std::map<int, std::set<int>>* found = nullptr) const;
             ErrorCode UpdateIndex();
+            // Appends the head index and version map changes since the last checkpoint, load or full save to .delta
+            // files next to them (HeadCheckpoint), which the next load replays.
+            ErrorCode Checkpoint();
 
             ErrorCode SetParameter(const char* p_param, const char* p_value, const char* p_section = nullptr);
             std::string GetParameter(const char* p_param, const char* p_section = nullptr) const;
@@ -146,16 +165,26 @@ namespace SPTAG
             ErrorCode RefineIndex(std::shared_ptr<VectorIndex>& p_newIndex) { return ErrorCode::Undefined; }
             
         private:
+            // p_postingDists, when given, gets the head distance of every collected posting
+            void CollectPostingIDs(COMMON::QueryResultSet<T>* p_queryResults, std::vector<SizeType>& p_postingIDs, std::vector<float>* p_postingDists = nullptr) const;
             bool CheckHeadIndexType();
             void SelectHeadAdjustOptions(int p_vectorCount);
             int SelectHeadDynamicallyInternal(const std::shared_ptr<COMMON::BKTree> p_tree, int p_nodeID, const Options& p_opts, std::vector<int>& p_selected);
             void SelectHeadDynamically(const std::shared_ptr<COMMON::BKTree> p_tree, int p_vectorCount, std::vector<int>& p_selected);
 
+            std::shared_ptr<VectorSet> SampleHeadCandidates(std::shared_ptr<Helper::VectorSetReader>& p_reader, std::vector<SizeType>& p_sampleIDs);
+
             template <typename InternalDataType>
             bool SelectHeadInternal(std::shared_ptr<Helper::VectorSetReader>& p_reader);
 
             ErrorCode BuildIndexInternal(std::shared_ptr<Helper::VectorSetReader>& p_reader);
 
+            // Head index files and the version map file, last, with the suffix of their delta files appended.
+            std::vector<std::string> CheckpointFiles(const std::string& p_suffix) const;
+            // Replays the head (p_head) or version map deltas a previous run appended.
+            ErrorCode LoadCheckpoints(bool p_head);
+            void MergeCheckpoints(std::vector<std::string> p_baseFiles, std::vector<std::string> p_mergingFiles);
+
         public:
             bool AllFinished() { if (m_options.m_useKV || m_options.m_useSPDK) return m_extraSearcher->AllFinished(); return true; }
 
@@ -45,6 +45,10 @@ namespace SPTAG {
             std::string m_quantizerFilePath;
             int m_datasetRowsInBlock;
             int m_datasetCapacity;
+            std::string m_datasetMemoryPolicy;
+            bool m_mmapIndex;
+            bool m_mmapPrefetch;
+            bool m_streamingBuild;
 
             // Section 2: for selecting head
             bool m_selectHead;
@@ -70,6 +74,7 @@ namespace SPTAG {
             bool m_recursiveCheckSmallCluster;
             bool m_printSizeCount;
             std::string m_selectType;
+            int m_streamingHeadSamples;
 
             // Section 3: for build head
             bool m_buildHead;
@@ -93,6 +98,10 @@ namespace SPTAG {
             bool m_outputEmptyReplicaID;
             int m_batches;
             std::string m_tmpdir;
+            int m_streamingSpillBufferMB;
+            int m_outputChunkMB;
+            bool m_headCheckpoint;
+            float m_headCheckpointMergeRatio;
             float m_rngFactor;
             int m_samples;
             bool m_excludehead;
@@ -155,6 +164,18 @@ namespace SPTAG {
             float m_latencyLimit;
             int m_step;
             int m_insertThreadNum;
+            int m_insertBatchSize;
+            int m_insertBackPressure;
+            bool m_backgroundThrottle;
+            int m_postingCacheSize;
+            int m_searchBatchSize;
+            std::string m_postingQuantizerFilePath;
+            std::string m_fullVectorStorePath;
+            int m_postingRerankNum;
+            int m_searchProbeWave;
+            float m_searchProbeEpsilon;
+            int m_searchProbePatience;
+            float m_searchSkipRatio;
             int m_endVectorNum;
             std::string m_persistentBufferPath;
             int m_appendThreadNum;
@@ -175,6 +196,10 @@ namespace SPTAG {
             int m_spdkBatchSize;
             bool m_stressTest;
             int m_bufferLength;
+            int m_spdkCompactionIOBudget;
+            bool m_spdkEnableWAL;
+            int m_spdkCheckpointWALSize;
+            int m_spdkTailCacheSize;
 
 
             Options() {
@@ -34,6 +34,13 @@ DefineBasicParameter(m_ssdIndexFileNum, int, 1, "SSDIndexFileNum")
 DefineBasicParameter(m_quantizerFilePath, std::string, std::string(), "QuantizerFilePath")
 DefineBasicParameter(m_datasetRowsInBlock, int, 1024 * 1024, "DataBlockSize")
 DefineBasicParameter(m_datasetCapacity, int, SPTAG::MaxSize, "DataCapacity")
+// Hugepage and NUMA placement per dataset name, e.g. Vector:explicit:interleave,RNG:transparent:local. Empty keeps ALIGN_ALLOC
+DefineBasicParameter(m_datasetMemoryPolicy, std::string, std::string(""), "DatasetMemoryPolicy")
+// Map the head index, deleted ids and posting sizes copy-on-write instead of reading them, MmapPrefetch starts readahead of the whole files
+DefineBasicParameter(m_mmapIndex, bool, false, "MmapIndex")
+DefineBasicParameter(m_mmapPrefetch, bool, true, "MmapPrefetch")
+// Build without ever holding the full vector set: heads come from a sample, posting vectors are spilled to TmpDir and sorted by head there
+DefineBasicParameter(m_streamingBuild, bool, false, "StreamingBuild")
 #endif
 
 #ifdef DefineSelectHeadParameter
@@ -62,6 +69,8 @@ DefineSelectHeadParameter(m_headVectorCount, int, 0, "Count")
 DefineSelectHeadParameter(m_recursiveCheckSmallCluster, bool, true, "RecursiveCheckSmallCluster")
 DefineSelectHeadParameter(m_printSizeCount, bool, true, "PrintSizeCount")
 DefineSelectHeadParameter(m_selectType, std::string, "BKT", "SelectHeadType")
+// Vectors sampled for head selection under StreamingBuild, 0 takes four times the head count
+DefineSelectHeadParameter(m_streamingHeadSamples, int, 0, "StreamingHeadSamples")
 #endif
 
 #ifdef DefineBuildHeadParameter
@@ -89,6 +98,14 @@ DefineSSDParameter(m_replicaCount, int, 8, "ReplicaCount")
 DefineSSDParameter(m_outputEmptyReplicaID, bool, false, "OutputEmptyReplicaID")
 DefineSSDParameter(m_batches, int, 1, "Batches")
 DefineSSDParameter(m_tmpdir, std::string, std::string("."), "TmpDir")
+// Memory for sorting one run of spilled posting vectors under StreamingBuild
+DefineSSDParameter(m_streamingSpillBufferMB, int, 4096, "StreamingSpillBufferMB")
+// Size of each buffer the SSD index content is serialized into and written from
+DefineSSDParameter(m_outputChunkMB, int, 64, "OutputChunkMB")
+// Track head index changes so that Checkpoint appends them to .delta files instead of rewriting the head
+DefineSSDParameter(m_headCheckpoint, bool, false, "HeadCheckpoint")
+// Fold the .delta files into the head files in the background once they grow past this share of the head
+DefineSSDParameter(m_headCheckpointMergeRatio, float, 0.25f, "HeadCheckpointMergeRatio")
 DefineSSDParameter(m_rngFactor, float, 1.0f, "RNGFactor")
 DefineSSDParameter(m_samples, int, 100, "RecallTestSampleNumber")
 DefineSSDParameter(m_excludehead, bool, true, "ExcludeHead")
@@ -102,6 +119,10 @@ DefineSSDParameter(m_useDirectIO, bool, false, "UseDirectIO")
 DefineSSDParameter(m_preReassign, bool, false, "PreReassign")
 DefineSSDParameter(m_preReassignRatio, float, 0.7f, "PreReassignRatio")
 DefineSSDParameter(m_bufferLength, int, 3, "BufferLength")
+DefineSSDParameter(m_spdkCompactionIOBudget, int, 0, "SpdkCompactionIOBudget")
+DefineSSDParameter(m_spdkEnableWAL, bool, false, "SpdkEnableWAL")
+DefineSSDParameter(m_spdkCheckpointWALSize, int, 256, "SpdkCheckpointWALSize")
+DefineSSDParameter(m_spdkTailCacheSize, int, 0, "SpdkTailCacheSize")
 
 // GPU Building
 DefineSSDParameter(m_gpuSSDNumTrees, int, 100, "GPUSSDNumTrees")
@@ -154,6 +175,29 @@ DefineSSDParameter(m_latencyLimit, float, 2.0, "LatencyLimit")
 DefineSSDParameter(m_step, int, 0, "Step")
 // Frontend update threadnum
 DefineSSDParameter(m_insertThreadNum, int, 16, "InsertThreadNum")
+// Vectors per AddIndexSPFresh call, a batch appends once per head
+DefineSSDParameter(m_insertBatchSize, int, 1, "InsertBatchSize")
+// Inserts wait while more background jobs are queued, 0 for no limit
+DefineSSDParameter(m_insertBackPressure, int, 0, "InsertBackPressure")
+// Background jobs hold back while searches run past LatencyLimit
+DefineSSDParameter(m_backgroundThrottle, bool, false, "BackgroundThrottle")
+// DRAM cache for hot postings in MB, 0 to read every posting from the store
+DefineSSDParameter(m_postingCacheSize, int, 0, "PostingCacheSize")
+// Queries searched together by SPFresh, postings they share are read once
+DefineSSDParameter(m_searchBatchSize, int, 1, "SearchBatchSize")
+// PQ codebook for dynamic postings, postings then keep codes and the exact vectors live in FullVectorStorePath
+DefineSSDParameter(m_postingQuantizerFilePath, std::string, std::string(""), "PostingQuantizerFilePath")
+DefineSSDParameter(m_fullVectorStorePath, std::string, std::string(""), "FullVectorStorePath")
+// Best candidates by code distance that a search reranks with exact vectors
+DefineSSDParameter(m_postingRerankNum, int, 64, "PostingRerankNum")
+// Postings a search scores per wave while its reads stay in flight, nearest heads first, the rest are dropped once its top-K settles. 0 never stops early
+DefineSSDParameter(m_searchProbeWave, int, 0, "SearchProbeWave")
+// The top-K is settled when its k-th distance improved by less than this fraction over the last SearchProbePatience waves
+DefineSSDParameter(m_searchProbeEpsilon, float, 0.01f, "SearchProbeEpsilon")
+// Waves of scored postings the settle check looks back over
+DefineSSDParameter(m_searchProbePatience, int, 1, "SearchProbePatience")
+// With L2, a probe whose head is farther than this multiple of the current k-th distance is dropped before its read goes out. 0 reads every probe
+DefineSSDParameter(m_searchSkipRatio, float, 0, "SearchSkipRatio")
 // Update limit
 DefineSSDParameter(m_endVectorNum, int, -1, "EndVectorNum")
 // Persistent buffer path
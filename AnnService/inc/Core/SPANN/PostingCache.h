@@ -0,0 +1,255 @@
+// Copyright (c) Microsoft Corporation. All rights reserved.
+// Licensed under the MIT License.
+
+#ifndef _SPTAG_SPANN_POSTINGCACHE_H_
+#define _SPTAG_SPANN_POSTINGCACHE_H_
+
+#include "inc/Core/Common.h"
+#include "inc/Core/Common/FineGrainedLock.h"
+#include "inc/Helper/Logging.h"
+#include <algorithm>
+#include <atomic>
+#include <list>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+namespace SPTAG {
+    namespace SPANN {
+        // Sharded LRU of whole postings under a byte budget, with TinyLFU admission:
+        // a posting only displaces the LRU victim if it has been asked for more often recently.
+        //
+        // Writers change a posting under its head lock and then Update/Append/Invalidate the entry here.
+        // Readers fill the cache with Admit, passing the head lock version taken before their read;
+        // the entry is dropped if a writer started since, so a stale read is never cached.
+        class PostingCache
+        {
+        public:
+            PostingCache(std::size_t p_capacity, int p_shardNum = 64) : m_shardNum(p_shardNum), m_hits(0), m_misses(0), m_rejects(0)
+            {
+                m_shards.reset(new Shard[m_shardNum]);
+                std::size_t shardCapacity = p_capacity / m_shardNum;
+                // about one counter per page of budget, enough to track several times the resident postings
+                std::size_t width = 1024;
+                while (width < shardCapacity / PageSize) width <<= 1;
+                for (int i = 0; i < m_shardNum; i++) {
+                    m_shards[i].capacity = shardCapacity;
+                    m_shards[i].sketch.Initialize(width);
+                }
+                LOG(Helper::LogLevel::LL_Info, "PostingCache: %zu MB in %d shards\n", p_capacity >> 20, m_shardNum);
+            }
+
+            ~PostingCache() {}
+
+            std::shared_ptr<std::string> Get(SizeType p_key)
+            {
+                Shard& shard = GetShard(p_key);
+                std::lock_guard<std::mutex> lock(shard.lock);
+                shard.sketch.Increment(p_key);
+                auto iter = shard.entries.find(p_key);
+                if (iter == shard.entries.end()) {
+                    m_misses++;
+                    return nullptr;
+                }
+                shard.lru.splice(shard.lru.begin(), shard.lru, iter->second.pos);
+                m_hits++;
+                return iter->second.value;
+            }
+
+            // p_seq is p_version.Version() taken before p_value was read.
+            bool Admit(SizeType p_key, std::shared_ptr<std::string> p_value, const COMMON::SequenceCounter& p_version, std::uint32_t p_seq)
+            {
+                Shard& shard = GetShard(p_key);
+                std::size_t charge = Charge(*p_value);
+                std::lock_guard<std::mutex> lock(shard.lock);
+                if ((p_seq & 1) || p_version.Version() != p_seq || charge > shard.capacity) return false;
+
+                auto iter = shard.entries.find(p_key);
+                if (iter != shard.entries.end()) {
+                    Replace(shard, iter->second, std::move(p_value));
+                    return true;
+                }
+
+                std::uint8_t frequency = shard.sketch.Estimate(p_key);
+                while (shard.bytes + charge > shard.capacity) {
+                    SizeType victim = shard.lru.back();
+                    if (shard.sketch.Estimate(victim) >= frequency) {
+                        m_rejects++;
+                        return false;
+                    }
+                    Evict(shard, victim);
+                }
+                shard.lru.push_front(p_key);
+                shard.entries[p_key] = Entry{ std::move(p_value), shard.lru.begin() };
+                shard.bytes += charge;
+                return true;
+            }
+
+            // The posting was rewritten: refresh it if it is cached.
+            void Update(SizeType p_key, const std::string& p_value)
+            {
+                Shard& shard = GetShard(p_key);
+                std::lock_guard<std::mutex> lock(shard.lock);
+                auto iter = shard.entries.find(p_key);
+                if (iter == shard.entries.end()) return;
+                if (Charge(p_value) > shard.capacity) {
+                    Evict(shard, p_key);
+                    return;
+                }
+                Replace(shard, iter->second, std::make_shared<std::string>(p_value));
+            }
+
+            // Vectors were appended to the posting: extend the cached copy.
+            void Append(SizeType p_key, const std::string& p_appendPosting)
+            {
+                Shard& shard = GetShard(p_key);
+                std::lock_guard<std::mutex> lock(shard.lock);
+                auto iter = shard.entries.find(p_key);
+                if (iter == shard.entries.end()) return;
+                const std::string& old = *(iter->second.value);
+                if (Charge(old) + p_appendPosting.size() > shard.capacity) {
+                    Evict(shard, p_key);
+                    return;
+                }
+                auto value = std::make_shared<std::string>();
+                value->reserve(old.size() + p_appendPosting.size());
+                value->append(old).append(p_appendPosting);
+                Replace(shard, iter->second, std::move(value));
+            }
+
+            void Invalidate(SizeType p_key)
+            {
+                Shard& shard = GetShard(p_key);
+                std::lock_guard<std::mutex> lock(shard.lock);
+                if (shard.entries.find(p_key) != shard.entries.end()) Evict(shard, p_key);
+            }
+
+            void GetStat()
+            {
+                std::size_t bytes = 0, count = 0;
+                for (int i = 0; i < m_shardNum; i++) {
+                    std::lock_guard<std::mutex> lock(m_shards[i].lock);
+                    bytes += m_shards[i].bytes;
+                    count += m_shards[i].entries.size();
+                }
+                std::uint64_t hits = m_hits.load(), misses = m_misses.load();
+                LOG(Helper::LogLevel::LL_Info, "PostingCache: %zu postings, %zu MB, hit rate %.2lf%% (%llu/%llu), admission rejects %llu\n",
+                    count, bytes >> 20, hits + misses == 0 ? 0.0 : hits * 100.0 / (hits + misses),
+                    (unsigned long long)hits, (unsigned long long)(hits + misses), (unsigned long long)m_rejects.load());
+            }
+
+        private:
+            // Count-min sketch of recent requests, four rows of saturating counters.
+            // Every counter is halved after 10 * width increments so that old popularity fades.
+            class FrequencySketch
+            {
+            public:
+                void Initialize(std::size_t p_width)
+                {
+                    m_mask = p_width - 1;
+                    m_table.assign(p_width * Depth, 0);
+                    m_sampleSize = p_width * 10;
+                    m_additions = 0;
+                }
+
+                std::uint8_t Estimate(SizeType p_key) const
+                {
+                    std::uint64_t hash = Hash(p_key);
+                    std::uint8_t frequency = MaxCount;
+                    for (int i = 0; i < Depth; i++) {
+                        frequency = std::min(frequency, m_table[Index(hash, i)]);
+                    }
+                    return frequency;
+                }
+
+                void Increment(SizeType p_key)
+                {
+                    std::uint64_t hash = Hash(p_key);
+                    bool added = false;
+                    for (int i = 0; i < Depth; i++) {
+                        std::uint8_t& counter = m_table[Index(hash, i)];
+                        if (counter < MaxCount) {
+                            counter++;
+                            added = true;
+                        }
+                    }
+                    if (added && ++m_additions >= m_sampleSize) {
+                        for (auto& counter : m_table) counter >>= 1;
+                        m_additions >>= 1;
+                    }
+                }
+
+            private:
+                static const int Depth = 4;
+                static const std::uint8_t MaxCount = 15;
+
+                static std::uint64_t Hash(SizeType p_key)
+                {
+                    std::uint64_t hash = (std::uint64_t)(std::uint32_t)p_key * 0x9E3779B97F4A7C15ULL;
+                    return hash ^ (hash >> 29);
+                }
+
+                inline std::size_t Index(std::uint64_t p_hash, int p_row) const
+                {
+                    return (std::size_t)p_row * (m_mask + 1) + ((p_hash >> (p_row * 16)) & m_mask);
+                }
+
+                std::vector<std::uint8_t> m_table;
+                std::size_t m_mask = 0;
+                std::size_t m_sampleSize = 0;
+                std::size_t m_additions = 0;
+            };
+
+            struct Entry
+            {
+                std::shared_ptr<std::string> value;
+                std::list<SizeType>::iterator pos;
+            };
+
+            struct Shard
+            {
+                std::mutex lock;
+                std::list<SizeType> lru;
+                std::unordered_map<SizeType, Entry> entries;
+                std::size_t bytes = 0;
+                std::size_t capacity = 0;
+                FrequencySketch sketch;
+            };
+
+            // posting bytes plus what the map, list node and string header cost
+            static inline std::size_t Charge(const std::string& p_value) { return p_value.size() + 128; }
+
+            inline Shard& GetShard(SizeType p_key) { return m_shards[((std::uint32_t)p_key) % m_shardNum]; }
+
+            void Replace(Shard& p_shard, Entry& p_entry, std::shared_ptr<std::string> p_value)
+            {
+                p_shard.bytes -= Charge(*(p_entry.value));
+                p_shard.bytes += Charge(*p_value);
+                p_entry.value = std::move(p_value);
+                p_shard.lru.splice(p_shard.lru.begin(), p_shard.lru, p_entry.pos);
+                // a grown posting may push the shard over budget, make room behind it
+                while (p_shard.bytes > p_shard.capacity && p_shard.lru.back() != p_shard.lru.front()) {
+                    Evict(p_shard, p_shard.lru.back());
+                }
+            }
+
+            void Evict(Shard& p_shard, SizeType p_key)
+            {
+                auto iter = p_shard.entries.find(p_key);
+                p_shard.bytes -= Charge(*(iter->second.value));
+                p_shard.lru.erase(iter->second.pos);
+                p_shard.entries.erase(iter);
+            }
+
+            int m_shardNum;
+            std::unique_ptr<Shard[]> m_shards;
+            std::atomic<std::uint64_t> m_hits;
+            std::atomic<std::uint64_t> m_misses;
+            std::atomic<std::uint64_t> m_rejects;
+        };
+    }
+}
+
+#endif // _SPTAG_SPANN_POSTINGCACHE_H_
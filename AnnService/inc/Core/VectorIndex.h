@@ -88,6 +88,9 @@ public:
 
     virtual ErrorCode SearchIndex(const void* p_vector, int p_vectorCount, int p_neighborCount, bool p_withMeta, BasicResult* p_results) const;
 
+    // Searches several queries from one thread, indexes that can interleave their traversals override this.
+    virtual ErrorCode SearchIndexBatch(std::vector<QueryResult*>& p_queries, bool p_searchDeleted = false) const;
+
     virtual void ApproximateRNG(std::shared_ptr<VectorSet>& fullVectors, std::unordered_set<SizeType>& exceptIDS, int candidateNum, Edge* selections, int replicaCount, int numThreads, int numTrees, int leafSize, float RNGFactor, int numGPUs);
 
     static void SortSelections(std::vector<Edge>* selections);
@@ -142,6 +145,16 @@ public:
 
     virtual ErrorCode LoadIndexDataFromMemory(const std::vector<ByteArray>& p_indexBlobs) = 0;
 
+    // Appends what changed since the last delta (or load) to one delta stream per index file. A null stream drops
+    // the pending changes of that file, after a full save for instance.
+    virtual ErrorCode SaveIndexDataDelta(const std::vector<std::shared_ptr<Helper::DiskIO>>& p_deltaStreams) { return ErrorCode::Undefined; }
+
+    // Replays the delta streams (null for none) over the loaded index files and starts tracking changes.
+    virtual ErrorCode LoadIndexDataDelta(const std::vector<std::shared_ptr<Helper::DiskIO>>& p_deltaStreams) { return ErrorCode::Undefined; }
+
+    // Folds each delta file into its index file, with both lists in GetIndexFiles order.
+    virtual ErrorCode MergeIndexDataDelta(const std::vector<std::string>& p_indexFiles, const std::vector<std::string>& p_deltaFiles) const { return ErrorCode::Undefined; }
+
     virtual ErrorCode DeleteIndex(const SizeType& p_id) = 0;
 
     virtual ErrorCode RefineIndex(const std::vector<std::shared_ptr<Helper::DiskIO>>& p_indexStreams, IAbortOperation* p_abort) = 0;
@@ -9,6 +9,8 @@
 #include <string.h>
 #include <memory>
 
+#include "inc/Helper/MappedFile.h"
+
 namespace SPTAG
 {
     namespace Helper
@@ -72,6 +74,9 @@ namespace SPTAG
 
             virtual std::uint64_t TellP() = 0;
 
+            // Flushes everything written so far to stable storage, false if the file cannot be synced.
+            virtual bool Sync() { return false; }
+
             virtual void ShutDown() = 0; 
         };
 
@@ -89,6 +94,7 @@ namespace SPTAG
                 std::uint32_t maxWriteRetries = 2,
                 std::uint16_t threadPoolSize = 4)
             {
+                m_path = filePath;
                 m_handle.reset(new std::fstream(filePath, (std::ios::openmode)openMode));
                 return m_handle->is_open();
             }
@@ -97,7 +103,10 @@ namespace SPTAG
             {
                 if (offset != UINT64_MAX) m_handle->seekg(offset, std::ios::beg);
                 m_handle->read((char*)buffer, readSize);
-                return m_handle->gcount();
+                std::uint64_t readCount = m_handle->gcount();
+                // a short positional read must not fail the calls after it
+                if (offset != UINT64_MAX && m_handle->fail()) m_handle->clear();
+                return readCount;
             }
 
             virtual std::uint64_t WriteBinary(std::uint64_t writeSize, const char* buffer, std::uint64_t offset = UINT64_MAX)
@@ -151,12 +160,20 @@ namespace SPTAG
                 return m_handle->tellp();
             }
 
+            virtual bool Sync()
+            {
+                if (m_handle == nullptr || !m_handle->is_open()) return false;
+                m_handle->flush();
+                return !m_handle->fail() && MappedFile::SyncFile(m_path);
+            }
+
             virtual void ShutDown()
             {
                 if (m_handle != nullptr) m_handle->close();
             }
 
         private:
+            std::string m_path;
             std::unique_ptr<std::fstream> m_handle;
         };
 
@@ -3,6 +3,7 @@
 
 #include "inc/Core/Common.h"
 #include <chrono>
+#include <functional>
 
 namespace SPTAG
 {
@@ -24,6 +25,17 @@ namespace SPTAG
 
             virtual ErrorCode MultiGet(const std::vector<SizeType>& keys, std::vector<std::string>* values, const std::chrono::microseconds &timeout = std::chrono::microseconds::max()) = 0;
 
+            // p_ready gets the index of each value as soon as the store has it, stores without completion order report all after the batch.
+            // p_skip may drop a key that is not read yet, a dropped key is never reported.
+            virtual ErrorCode MultiGet(const std::vector<SizeType>& keys, std::vector<std::string>* values, const std::chrono::microseconds &timeout, const std::function<void(size_t)>& p_ready, const std::function<bool(size_t)>& p_skip = nullptr) {
+                ErrorCode ret = MultiGet(keys, values, timeout);
+                if (ret != ErrorCode::Success) return ret;
+                for (size_t i = 0; i < values->size(); i++) {
+                    if (p_skip == nullptr || !p_skip(i)) p_ready(i);
+                }
+                return ret;
+            }
+
             virtual ErrorCode Put(const std::string& key, const std::string& value) { return ErrorCode::Undefined; }
 
             virtual ErrorCode Put(SizeType key, const std::string& value) = 0;
@@ -34,6 +46,10 @@ namespace SPTAG
 
             virtual void ForceCompaction() {}
 
+            // p_sync runs each time the store makes logged changes durable, ahead of its log, for data outside the
+            // store that the values refer to. Set it before the first write.
+            virtual void SetDataSync(std::function<void()> p_sync) {}
+
             virtual void GetStat() {}
 
             virtual bool Initialize(bool debug = false) { return false; }
@@ -0,0 +1,59 @@
+// Copyright (c) Microsoft Corporation. All rights reserved.
+// Licensed under the MIT License.
+
+#ifndef _SPTAG_HELPER_MAPPEDFILE_H_
+#define _SPTAG_HELPER_MAPPEDFILE_H_
+
+#include <cstddef>
+#include <cstdint>
+#include <string>
+
+namespace SPTAG
+{
+    namespace Helper
+    {
+        // Read-only file opened as a private copy-on-write mapping: callers may write into the
+        // pages (the head graph is refined in place) without the changes ever reaching the file.
+        class MappedFile
+        {
+        public:
+            MappedFile() {}
+
+            ~MappedFile() { Close(); }
+
+            MappedFile(const MappedFile&) = delete;
+            MappedFile& operator=(const MappedFile&) = delete;
+
+            // p_prefetch asks the kernel to start reading the whole file in the background.
+            bool Open(const std::string& p_path, bool p_prefetch);
+
+            void Close();
+
+            char* Data() const { return m_data; }
+
+            std::size_t Size() const { return m_size; }
+
+            const std::string& Path() const { return m_path; }
+
+            // Unlinks p_path ahead of rewriting it if this process still maps it, so that the
+            // mapping keeps reading the old contents instead of faulting on a truncated file.
+            static void PrepareRewrite(const std::string& p_path);
+
+            // Flushes the contents of p_path to stable storage, false if it cannot be opened or synced.
+            static bool SyncFile(const std::string& p_path);
+
+        private:
+            char* m_data = nullptr;
+            std::size_t m_size = 0;
+            std::string m_path;
+#ifdef _MSC_VER
+            void* m_mapping = nullptr;
+#else
+            std::uint64_t m_device = 0;
+            std::uint64_t m_inode = 0;
+#endif
+        };
+    }
+}
+
+#endif // _SPTAG_HELPER_MAPPEDFILE_H_
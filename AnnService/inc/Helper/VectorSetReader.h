@@ -47,6 +47,9 @@ public:
 
     virtual std::shared_ptr<VectorSet> GetVectorSet(SizeType start = 0, SizeType end = -1) const = 0;
 
+    // Number of vectors without reading them, readers over a vector file only look at its header.
+    virtual SizeType GetVectorCount() const { return GetVectorSet()->Count(); }
+
     virtual std::shared_ptr<MetadataSet> GetMetadataSet() const = 0;
 
     virtual bool IsNormalized() const { return m_options->m_normalized; }
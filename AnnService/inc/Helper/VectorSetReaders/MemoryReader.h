@@ -31,6 +31,8 @@ namespace SPTAG
                     end - start));
             }
 
+            virtual SizeType GetVectorCount() const { return m_vectors->Count(); }
+
             virtual std::shared_ptr<MetadataSet> GetMetadataSet() const { return nullptr; }
 
         private:
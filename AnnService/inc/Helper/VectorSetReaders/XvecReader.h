@@ -22,6 +22,8 @@ public:
 
     virtual std::shared_ptr<VectorSet> GetVectorSet(SizeType start = 0, SizeType end = -1) const;
 
+    virtual SizeType GetVectorCount() const;
+
     virtual std::shared_ptr<MetadataSet> GetMetadataSet() const;
 
 private:
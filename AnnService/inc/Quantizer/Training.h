@@ -13,7 +13,7 @@ using namespace SPTAG;
 class QuantizerOptions : public Helper::ReaderOptions
 {
 public:
-    QuantizerOptions(SizeType trainingSamples, bool debug, float lambda, SPTAG::QuantizerType qtype, std::string qfile, DimensionType qdim, std::string fullvecs, std::string recvecs) : Helper::ReaderOptions(VectorValueType::Float, 0, VectorFileType::TXT, "|", 32), m_trainingSamples(trainingSamples), m_debug(debug), m_KmeansLambda(lambda), m_quantizerType(qtype), m_outputQuantizerFile(qfile), m_quantizedDim(qdim), m_outputFullVecFile(fullvecs), m_outputReconstructVecFile(recvecs)
+    QuantizerOptions(SizeType trainingSamples, bool debug, float lambda, SPTAG::QuantizerType qtype, std::string qfile, DimensionType qdim, std::string fullvecs, std::string recvecs) : Helper::ReaderOptions(VectorValueType::Float, 0, VectorFileType::TXT, "|", 32), m_trainingSamples(trainingSamples), m_debug(debug), m_KmeansLambda(lambda), m_quantizerType(qtype), m_outputQuantizerFile(qfile), m_quantizedDim(qdim), m_outputFullVecFile(fullvecs), m_outputReconstructVecFile(recvecs), m_KsPerSubvector(256)
     {
         AddRequiredOption(m_inputFiles, "-i", "--input", "Input raw data.");
         AddRequiredOption(m_outputFile, "-o", "--output", "Output quantized vectors.");
@@ -22,6 +22,7 @@ public:
         AddOptionalOption(m_outputQuantizerFile, "-oq", "--outputquantizer", "Output quantizer.");
         AddOptionalOption(m_quantizerType, "-qt", "--quantizer", "Quantizer type.");
         AddOptionalOption(m_quantizedDim, "-qd", "--quantizeddim", "Quantized Dimension.");
+        AddOptionalOption(m_KsPerSubvector, "-qk", "--codewords", "Codewords per subvector, 16 gives 4-bit codes that PQ fast-scan can score.");
 
         // We also use this to determine batch size (max number of vectors to load at once)
         AddOptionalOption(m_trainingSamples, "-ts", "--train_samples", "Number of samples for training.");
@@ -49,6 +50,8 @@ public:
 
     DimensionType m_quantizedDim;
 
+    SizeType m_KsPerSubvector;
+
     SizeType m_trainingSamples;
 
     SPTAG::QuantizerType m_quantizerType;
@@ -61,7 +64,11 @@ public:
 template <typename T>
 std::unique_ptr<T[]> TrainPQQuantizer(std::shared_ptr<QuantizerOptions> options, std::shared_ptr<VectorSet> raw_vectors, std::shared_ptr<VectorSet> quantized_vectors)
 {
-    SizeType numCentroids = 256;
+    SizeType numCentroids = options->m_KsPerSubvector;
+    if (numCentroids < 1 || numCentroids > 256) {
+        LOG(Helper::LogLevel::LL_Error, "Codewords per subvector must be between 1 and 256.\n");
+        exit(1);
+    }
     if (raw_vectors->Dimension() % options->m_quantizedDim != 0) {
         LOG(Helper::LogLevel::LL_Error, "Only n_codebooks that divide dimension are supported.\n");
         exit(1);
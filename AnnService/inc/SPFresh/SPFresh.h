@@ -258,7 +258,7 @@ namespace SPTAG {
                 int p_numThreads,
                 std::vector<QueryResult>& p_results,
                 std::vector<SPANN::SearchStats>& p_stats,
-                int p_maxQueryCount, int p_internalResultNum)
+                int p_maxQueryCount, int p_internalResultNum, int p_batchSize = 1)
             {
                 int numQueries = min(static_cast<int>(p_results.size()), p_maxQueryCount);
 
@@ -273,6 +273,33 @@ namespace SPTAG {
                     p_index->Initialize();
                     StopWSPFresh threadws;
                     size_t index = 0;
+                    std::vector<QueryResult*> batch;
+                    while (p_batchSize > 1)
+                    {
+                        // a batch reads each posting its queries share once, every query reports the batch latency
+                        index = queriesSent.fetch_add(p_batchSize);
+                        if (index >= numQueries)
+                        {
+                            p_index->ExitBlockController();
+                            return;
+                        }
+                        size_t batchEnd = min(index + p_batchSize, (size_t)numQueries);
+                        batch.clear();
+                        double startTime = threadws.getElapsedMs();
+                        for (size_t qi = index; qi < batchEnd; qi++) batch.push_back(&(p_results[qi]));
+                        p_index->GetMemoryIndex()->SearchIndexBatch(batch);
+                        double endTime = threadws.getElapsedMs();
+                        for (size_t qi = index; qi < batchEnd; qi++) p_stats[qi].m_totalLatency = endTime - startTime;
+
+                        p_index->SearchDiskIndexBatch(batch, &(p_stats[index]));
+                        double exEndTime = threadws.getElapsedMs();
+
+                        for (size_t qi = index; qi < batchEnd; qi++)
+                        {
+                            p_stats[qi].m_exLatency = exEndTime - endTime;
+                            p_stats[qi].m_totalLatency = p_stats[qi].m_totalSearchLatency = exEndTime - startTime;
+                        }
+                    }
                     while (true)
                     {
                         index = queriesSent.fetch_add(1);
@@ -380,6 +407,23 @@ namespace SPTAG {
                     },
                     "%4d");
 
+                LOG(Helper::LogLevel::LL_Info, "\nPosting Coverage Distribution(%%):\n");
+                PrintPercentiles<double, SPANN::SearchStats>(stats,
+                    [](const SPANN::SearchStats& ss) -> double
+                    {
+                        int wanted = ss.m_postingCount - ss.m_postingSaved;
+                        return wanted == 0 ? 100.0 : ss.m_postingCovered * 100.0 / wanted;
+                    },
+                    "%.3lf");
+
+                LOG(Helper::LogLevel::LL_Info, "\nPostings Saved By Early Termination Distribution:\n");
+                PrintPercentiles<int, SPANN::SearchStats>(stats,
+                    [](const SPANN::SearchStats& ss) -> int
+                    {
+                        return ss.m_postingSaved;
+                    },
+                    "%4d");
+
                 LOG(Helper::LogLevel::LL_Info, "\n");
             }
 
@@ -603,7 +647,7 @@ namespace SPTAG {
                         results[j].SetTarget(reinterpret_cast<ValueType*>(querySet->GetVector(j)));
                         results[j].Reset();
                     }
-                    totalQPS += SearchSequential(p_index, numThreads, results, stats, queryCountLimit, internalResultNum);
+                    totalQPS += SearchSequential(p_index, numThreads, results, stats, queryCountLimit, internalResultNum, p_opts.m_searchBatchSize);
                     //PrintStats<ValueType>(stats);
                     AddStats(TotalStats, stats);
                 }
@@ -738,14 +782,42 @@ namespace SPTAG {
 
                 std::atomic_size_t vectorsSent(0);
 
+                size_t batchSize = std::max(p_opts.m_insertBatchSize, 1);
                 auto func = [&]()
                 {
                     p_index->Initialize();
                     size_t index = 0;
+                    std::vector<ValueType> batchVectors;
+                    std::vector<SizeType> batchVIDs;
                     while (true)
                     {
-                        index = vectorsSent.fetch_add(1);
-                        if (index < updateSize)
+                        index = vectorsSent.fetch_add(batchSize);
+                        if (index < updateSize && batchSize > 1)
+                        {
+                            size_t batchEnd = std::min(index + batchSize, (size_t)updateSize);
+                            if (((index & ((1 << 14) - 1)) == 0 || (index >> 14) != ((batchEnd - 1) >> 14)) && p_opts.m_showUpdateProgress)
+                            {
+                                LOG(Helper::LogLevel::LL_Info, "Insert: Sent %.2lf%%...\n", index * 100.0 / updateSize);
+                            }
+                            batchVectors.resize((batchEnd - index) * p_opts.m_dim);
+                            batchVIDs.resize(batchEnd - index);
+                            for (size_t i = index; i < batchEnd; i++)
+                            {
+                                if (p_opts.m_stressTest) p_index->DeleteIndex(mapping[insertSet[i]]);
+                                const void* vector = p_opts.m_loadAllVectors ? vectorSet->GetVector(insertSet[i]) : vectorSet->GetVector(i);
+                                memcpy(batchVectors.data() + (i - index) * p_opts.m_dim, vector, sizeof(ValueType) * p_opts.m_dim);
+                            }
+                            auto insertBegin = std::chrono::high_resolution_clock::now();
+                            p_index->AddIndexSPFresh(batchVectors.data(), (SizeType)(batchEnd - index), p_opts.m_dim, batchVIDs.data());
+                            auto insertEnd = std::chrono::high_resolution_clock::now();
+                            double batchLatency = std::chrono::duration_cast<std::chrono::microseconds>(insertEnd - insertBegin).count();
+                            for (size_t i = index; i < batchEnd; i++)
+                            {
+                                mapping[insertSet[i]] = batchVIDs[i - index];
+                                latency_vector[i] = batchLatency;
+                            }
+                        }
+                        else if (index < updateSize)
                         {
                             if ((index & ((1 << 14) - 1)) == 0 && p_opts.m_showUpdateProgress)
                             {
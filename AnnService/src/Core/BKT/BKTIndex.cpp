@@ -14,6 +14,8 @@ namespace SPTAG
     {
         template <typename T>
         thread_local std::shared_ptr<COMMON::WorkSpace> Index<T>::m_workspace;
+        template <typename T>
+        thread_local std::vector<std::shared_ptr<COMMON::WorkSpace>> Index<T>::m_batchWorkspaces;
 
         template <typename T>
         ErrorCode Index<T>::LoadConfig(Helper::IniReader& p_reader)
@@ -124,6 +126,52 @@ namespace SPTAG
             return ret;
         }
 
+        template<typename T>
+        ErrorCode Index<T>::SaveIndexDataDelta(const std::vector<std::shared_ptr<Helper::DiskIO>>& p_deltaStreams)
+        {
+            auto stream = [&p_deltaStreams](size_t i) { return i < p_deltaStreams.size() ? p_deltaStreams[i] : nullptr; };
+
+            // only holds back new vectors, refines and deletes of existing ones keep going and land in the next delta
+            std::lock_guard<std::mutex> lock(m_dataAddLock);
+
+            ErrorCode ret = ErrorCode::Success;
+            if ((ret = m_pSamples.SaveDelta(stream(0))) != ErrorCode::Success) return ret;
+            if ((ret = m_pTrees.SaveTreesDelta(stream(1))) != ErrorCode::Success) return ret;
+            if ((ret = m_pGraph.SaveGraphDelta(stream(2))) != ErrorCode::Success) return ret;
+            if ((ret = m_deletedID.SaveDelta(stream(3))) != ErrorCode::Success) return ret;
+            return ret;
+        }
+
+        template<typename T>
+        ErrorCode Index<T>::LoadIndexDataDelta(const std::vector<std::shared_ptr<Helper::DiskIO>>& p_deltaStreams)
+        {
+            auto stream = [&p_deltaStreams](size_t i) { return i < p_deltaStreams.size() ? p_deltaStreams[i] : nullptr; };
+
+            ErrorCode ret = ErrorCode::Success;
+            if ((ret = m_pSamples.LoadDeltas(stream(0))) != ErrorCode::Success) return ret;
+            if ((ret = m_pTrees.LoadTreesDeltas(stream(1))) != ErrorCode::Success) return ret;
+            if ((ret = m_pGraph.LoadGraphDeltas(stream(2))) != ErrorCode::Success) return ret;
+            if ((ret = m_deletedID.LoadDeltas(stream(3))) != ErrorCode::Success) return ret;
+            if (m_pGraph.R() != m_pSamples.R() || m_deletedID.R() != m_pSamples.R()) {
+                LOG(Helper::LogLevel::LL_Error, "Head deltas disagree on the number of vectors (%d,%d,%d)!\n", m_pSamples.R(), m_pGraph.R(), m_deletedID.R());
+                return ErrorCode::DiskIOFail;
+            }
+            return ret;
+        }
+
+        template<typename T>
+        ErrorCode Index<T>::MergeIndexDataDelta(const std::vector<std::string>& p_indexFiles, const std::vector<std::string>& p_deltaFiles) const
+        {
+            if (p_indexFiles.size() < 4 || p_deltaFiles.size() < 4) return ErrorCode::LackOfInputs;
+
+            ErrorCode ret = ErrorCode::Success;
+            if ((ret = COMMON::Dataset<T>::MergeDeltas(p_indexFiles[0], p_deltaFiles[0], false)) != ErrorCode::Success) return ret;
+            if ((ret = COMMON::BKTree::MergeDeltas(p_indexFiles[1], p_deltaFiles[1])) != ErrorCode::Success) return ret;
+            if ((ret = COMMON::Dataset<SizeType>::MergeDeltas(p_indexFiles[2], p_deltaFiles[2], false)) != ErrorCode::Success) return ret;
+            if ((ret = COMMON::Labelset::MergeDeltas(p_indexFiles[3], p_deltaFiles[3])) != ErrorCode::Success) return ret;
+            return ret;
+        }
+
 #pragma region K-NN search
 /*
 #define Search(CheckDeleted, CheckDuplicated) \
@@ -240,126 +288,182 @@ namespace SPTAG
 //         p_query.SortResult(); \
 
 
+        namespace StaticDispatch
+        {
+            template <typename... Args>
+             bool AlwaysTrue(Args...)
+            {
+                return true;
+            }
+
+            bool CheckIfNotDeleted(const COMMON::Labelset& deletedIDs, SizeType node)
+            {
+                return !deletedIDs.Contains(node);
+            }
+
+            template <typename T>
+            bool CheckDup(COMMON::QueryResultSet<T>& query, SizeType node, float score) 
+            {
+                return !query.AddPoint(node, score);
+            }
+
+            template <typename T>
+            bool NeverDup(COMMON::QueryResultSet<T>& query, SizeType node, float score)
+            {
+                query.AddPoint(node, score);
+                return false;
+            }
+
+            bool CheckFilter(const std::shared_ptr<MetadataSet>& metadata, SizeType node, std::function<bool(const ByteArray&)> filterFunc)
+            {
+                return filterFunc(metadata->GetMetadata(node));
+            }
+
+
+        };
+
+        template<typename T>
+        const SizeType* Index<T>::PrefetchNeighbors(SizeType p_node) const
+        {
+            const SizeType* node = m_pGraph[p_node];
+            _mm_prefetch((const char*)node, _MM_HINT_T0);
+            for (DimensionType i = 0; i < m_pGraph.m_iNeighborhoodSize; i++) {
+                auto futureNode = node[i];
+                if (futureNode < 0 || futureNode >= m_pSamples.R()) break;
+                _mm_prefetch((const char*)(m_pSamples)[futureNode], _MM_HINT_T0);
+            }
+            return node;
+        }
+
         template<typename T>
         template <bool(*notDeleted)(const COMMON::Labelset&, SizeType), 
             bool(*isDup)(COMMON::QueryResultSet<T>&, SizeType, float), 
             bool(*checkFilter)(const std::shared_ptr<MetadataSet>&, SizeType, std::function<bool(const ByteArray&)>)>
-        void Index<T>::Search(COMMON::QueryResultSet<T>& p_query, COMMON::WorkSpace& p_space, std::function<bool(const ByteArray&)> filterFunc) const
+        bool Index<T>::SearchStep(COMMON::QueryResultSet<T>& p_query, COMMON::WorkSpace& p_space, const NodeDistPair& gnode, const SizeType* node, std::function<bool(const ByteArray&)> filterFunc) const
         {
-            std::shared_lock<std::shared_timed_mutex> lock(*(m_pTrees.m_lock));
-            m_pTrees.InitSearchTrees(m_pSamples, m_fComputeDistance, p_query, p_space);
-            m_pTrees.SearchTrees(m_pSamples, m_fComputeDistance, p_query, p_space, m_iNumberOfInitialDynamicPivots);
             const DimensionType checkPos = m_pGraph.m_iNeighborhoodSize - 1;
-
-            while (!p_space.m_NGQueue.empty()) {
-                NodeDistPair gnode = p_space.m_NGQueue.pop();
-                SizeType tmpNode = gnode.node;
-                const SizeType* node = m_pGraph[tmpNode];
-                _mm_prefetch((const char*)node, _MM_HINT_T0);
-                for (DimensionType i = 0; i <= checkPos; i++) {
-                    auto futureNode = node[i];
-                    if (futureNode < 0 || futureNode >= m_pSamples.R()) break;
-                    _mm_prefetch((const char*)(m_pSamples)[futureNode], _MM_HINT_T0);
-                }
-
-                if (gnode.distance <= p_query.worstDist()) 
+            SizeType tmpNode = gnode.node;
+            if (gnode.distance <= p_query.worstDist()) 
+            {
+                SizeType checkNode = node[checkPos];
+                if (checkNode < -1) 
                 {
-                    SizeType checkNode = node[checkPos];
-                    if (checkNode < -1) 
+                    const COMMON::BKTNode& tnode = m_pTrees[-2 - checkNode];
+                    SizeType i = -tnode.childStart;
+                    do 
                     {
-                        const COMMON::BKTNode& tnode = m_pTrees[-2 - checkNode];
-                        SizeType i = -tnode.childStart;
-                        do 
-                        {
-                            if (notDeleted(m_deletedID, tmpNode))
-                            {
-                                if (checkFilter(m_pMetadata, tmpNode, filterFunc))
-                                {
-                                    if (isDup(p_query, tmpNode, gnode.distance)) 
-                                        break;
-                                }
-                            }
-                            tmpNode = m_pTrees[i].centerid;
-                        } while (i++ < tnode.childEnd);
-                    }
-                    else {
-
                         if (notDeleted(m_deletedID, tmpNode))
                         {
                             if (checkFilter(m_pMetadata, tmpNode, filterFunc))
                             {
-                                p_query.AddPoint(tmpNode, gnode.distance);
+                                if (isDup(p_query, tmpNode, gnode.distance)) 
+                                    break;
                             }
                         }
-                    }
+                        tmpNode = m_pTrees[i].centerid;
+                    } while (i++ < tnode.childEnd);
                 }
-                else 
-                {
+                else {
+
                     if (notDeleted(m_deletedID, tmpNode))
                     {
-                        if (gnode.distance > p_space.m_Results.worst() || p_space.m_iNumberOfCheckedLeaves > p_space.m_iMaxCheck) 
+                        if (checkFilter(m_pMetadata, tmpNode, filterFunc))
                         {
-                                p_query.SortResult();
-                                return;
+                            p_query.AddPoint(tmpNode, gnode.distance);
                         }
                     }
                 }
-                for (DimensionType i = 0; i <= checkPos; i++) 
+            }
+            else 
+            {
+                if (notDeleted(m_deletedID, tmpNode))
                 {
-                    SizeType nn_index = node[i];
-                    if (nn_index < 0) 
-                        break;
-                    //IF_NDEBUG(if (nn_index >= m_pSamples.R()) continue; )
-                    if (p_space.CheckAndSet(nn_index)) continue;
-                    float distance2leaf = m_fComputeDistance(p_query.GetQuantizedTarget(), (m_pSamples)[nn_index], GetFeatureDim());
-                    p_space.m_iNumberOfCheckedLeaves++;
-                    if (p_space.m_Results.insert(distance2leaf))
+                    if (gnode.distance > p_space.m_Results.worst() || p_space.m_iNumberOfCheckedLeaves > p_space.m_iMaxCheck) 
                     {
-                        p_space.m_NGQueue.insert(NodeDistPair(nn_index, distance2leaf));
+                        return false;
                     }
                 }
-                if (p_space.m_NGQueue.Top().distance > p_space.m_SPTQueue.Top().distance)
+            }
+            for (DimensionType i = 0; i <= checkPos; i++) 
+            {
+                SizeType nn_index = node[i];
+                if (nn_index < 0) 
+                    break;
+                //IF_NDEBUG(if (nn_index >= m_pSamples.R()) continue; )
+                if (p_space.CheckAndSet(nn_index)) continue;
+                float distance2leaf = m_fComputeDistance(p_query.GetQuantizedTarget(), (m_pSamples)[nn_index], GetFeatureDim());
+                p_space.m_iNumberOfCheckedLeaves++;
+                if (p_space.m_Results.insert(distance2leaf))
                 {
-                    m_pTrees.SearchTrees(m_pSamples, m_fComputeDistance, p_query, p_space, m_iNumberOfOtherDynamicPivots + p_space.m_iNumberOfCheckedLeaves);
+                    p_space.m_NGQueue.insert(NodeDistPair(nn_index, distance2leaf));
                 }
             }
-            p_query.SortResult();
-        }
-
-        namespace StaticDispatch
-        {
-            template <typename... Args>
-             bool AlwaysTrue(Args...)
+            if (p_space.m_NGQueue.Top().distance > p_space.m_SPTQueue.Top().distance)
             {
-                return true;
+                m_pTrees.SearchTrees(m_pSamples, m_fComputeDistance, p_query, p_space, m_iNumberOfOtherDynamicPivots + p_space.m_iNumberOfCheckedLeaves);
             }
+            return true;
+        }
 
-            bool CheckIfNotDeleted(const COMMON::Labelset& deletedIDs, SizeType node)
-            {
-                return !deletedIDs.Contains(node);
-            }
+        template<typename T>
+        template <bool(*notDeleted)(const COMMON::Labelset&, SizeType), 
+            bool(*isDup)(COMMON::QueryResultSet<T>&, SizeType, float), 
+            bool(*checkFilter)(const std::shared_ptr<MetadataSet>&, SizeType, std::function<bool(const ByteArray&)>)>
+        void Index<T>::Search(COMMON::QueryResultSet<T>& p_query, COMMON::WorkSpace& p_space, std::function<bool(const ByteArray&)> filterFunc) const
+        {
+            std::shared_lock<std::shared_timed_mutex> lock(*(m_pTrees.m_lock));
+            m_pTrees.InitSearchTrees(m_pSamples, m_fComputeDistance, p_query, p_space);
+            m_pTrees.SearchTrees(m_pSamples, m_fComputeDistance, p_query, p_space, m_iNumberOfInitialDynamicPivots);
 
-            template <typename T>
-            bool CheckDup(COMMON::QueryResultSet<T>& query, SizeType node, float score) 
-            {
-                return !query.AddPoint(node, score);
+            while (!p_space.m_NGQueue.empty()) {
+                NodeDistPair gnode = p_space.m_NGQueue.pop();
+                const SizeType* node = PrefetchNeighbors(gnode.node);
+                if (!SearchStep<notDeleted, isDup, checkFilter>(p_query, p_space, gnode, node, filterFunc)) break;
             }
+            p_query.SortResult();
+        }
 
-            template <typename T>
-            bool NeverDup(COMMON::QueryResultSet<T>& query, SizeType node, float score)
-            {
-                query.AddPoint(node, score);
-                return false;
+        template<typename T>
+        template <bool(*notDeleted)(const COMMON::Labelset&, SizeType), 
+            bool(*isDup)(COMMON::QueryResultSet<T>&, SizeType, float)>
+        void Index<T>::SearchBlock(COMMON::QueryResultSet<T>** p_queries, COMMON::WorkSpace** p_spaces, int p_count) const
+        {
+            // Each query walks the graph exactly as Search does, but one step at a time in turn: every query
+            // first pops its next node and prefetches its neighbors, then all of them score their neighbors,
+            // so the cache misses of one query are served while the others compute.
+            std::shared_lock<std::shared_timed_mutex> lock(*(m_pTrees.m_lock));
+            for (int q = 0; q < p_count; q++) {
+                m_pTrees.InitSearchTrees(m_pSamples, m_fComputeDistance, *p_queries[q], *p_spaces[q]);
+                m_pTrees.SearchTrees(m_pSamples, m_fComputeDistance, *p_queries[q], *p_spaces[q], m_iNumberOfInitialDynamicPivots);
             }
 
-            bool CheckFilter(const std::shared_ptr<MetadataSet>& metadata, SizeType node, std::function<bool(const ByteArray&)> filterFunc)
-            {
-                return filterFunc(metadata->GetMetadata(node));
+            std::vector<NodeDistPair> gnodes(p_count);
+            std::vector<const SizeType*> nodes(p_count);
+            std::vector<bool> live(p_count, true);
+            int remaining = p_count;
+            while (remaining > 0) {
+                for (int q = 0; q < p_count; q++) {
+                    if (!live[q]) continue;
+                    if (p_spaces[q]->m_NGQueue.empty()) {
+                        live[q] = false;
+                        remaining--;
+                        continue;
+                    }
+                    gnodes[q] = p_spaces[q]->m_NGQueue.pop();
+                    nodes[q] = PrefetchNeighbors(gnodes[q].node);
+                }
+                for (int q = 0; q < p_count; q++) {
+                    if (!live[q]) continue;
+                    if (!SearchStep<notDeleted, isDup, StaticDispatch::AlwaysTrue>(*p_queries[q], *p_spaces[q], gnodes[q], nodes[q], nullptr)) {
+                        live[q] = false;
+                        remaining--;
+                    }
+                }
             }
+            for (int q = 0; q < p_count; q++) p_queries[q]->SortResult();
+        }
 
 
-        };
-
         template <typename T>
         void Index<T>::SearchIndex(COMMON::QueryResultSet<T> &p_query, COMMON::WorkSpace &p_space, bool p_searchDeleted, bool p_searchDuplicated, std::function<bool(const ByteArray&)> filterFunc) const
         {
@@ -430,6 +534,47 @@ namespace SPTAG
             return ErrorCode::Success;
         }
 
+        template<typename T>
+        ErrorCode Index<T>::SearchIndexBatch(std::vector<QueryResult*>& p_queries, bool p_searchDeleted) const
+        {
+            if (!m_bReady) return ErrorCode::EmptyIndex;
+
+            int blockSize = max(1, m_iBatchSearchBlock);
+            while (m_batchWorkspaces.size() < (size_t)blockSize) {
+                m_batchWorkspaces.emplace_back(new COMMON::WorkSpace());
+                m_batchWorkspaces.back()->Initialize(max(m_iMaxCheck, m_pGraph.m_iMaxCheckForRefineGraph), m_iHashTableExp);
+            }
+
+            std::vector<COMMON::QueryResultSet<T>*> queries(blockSize);
+            std::vector<COMMON::WorkSpace*> spaces(blockSize);
+            bool checkDeleted = m_deletedID.Count() > 0 && !p_searchDeleted;
+            for (size_t start = 0; start < p_queries.size(); start += blockSize)
+            {
+                int count = (int)min((size_t)blockSize, p_queries.size() - start);
+                for (int q = 0; q < count; q++) {
+                    queries[q] = (COMMON::QueryResultSet<T>*)p_queries[start + q];
+                    if (m_pQuantizer && !queries[q]->HasQuantizedTarget()) queries[q]->SetTarget(queries[q]->GetTarget(), m_pQuantizer);
+                    spaces[q] = m_batchWorkspaces[q].get();
+                    spaces[q]->Reset(m_iMaxCheck, queries[q]->GetResultNum());
+                }
+
+                if (checkDeleted) SearchBlock<StaticDispatch::CheckIfNotDeleted, StaticDispatch::CheckDup>(queries.data(), spaces.data(), count);
+                else SearchBlock<StaticDispatch::AlwaysTrue, StaticDispatch::CheckDup>(queries.data(), spaces.data(), count);
+
+                if (nullptr == m_pMetadata) continue;
+                for (int q = 0; q < count; q++)
+                {
+                    if (!queries[q]->WithMeta()) continue;
+                    for (int i = 0; i < queries[q]->GetResultNum(); ++i)
+                    {
+                        SizeType result = queries[q]->GetResult(i)->VID;
+                        queries[q]->SetMetadata(i, (result < 0) ? ByteArray::c_empty : m_pMetadata->GetMetadataCopy(result));
+                    }
+                }
+            }
+            return ErrorCode::Success;
+        }
+
         template<typename T>
         ErrorCode Index<T>::RefineSearchIndex(QueryResult &p_query, bool p_searchDeleted) const
         {
@@ -685,13 +830,19 @@ namespace SPTAG
                 int base = COMMON::Utils::GetBase<T>();
                 for (SizeType i = begin; i < end; i++) {
                     COMMON::Utils::Normalize((T*)m_pSamples[i], GetFeatureDim(), base);
+                    m_pSamples.MarkDirty(i);
                 }
             }
 
-            if (end - m_pTrees.sizePerTree() >= m_addCountForRebuild && m_threadPool.jobsize() == 0) {
+            if (m_pTrees.m_bIncrementalInsert && m_pQuantizer == nullptr) {
+                for (SizeType node = begin; node < end; node++) InsertTreeNode(node);
+            }
+            else if (end - m_pTrees.sizePerTree() >= m_addCountForRebuild && m_threadPool.jobsize() == 0) {
                 m_threadPool.add(new RebuildJob(&m_pSamples, &m_pTrees, &m_pGraph, m_iDistCalcMethod));
             }
 
+            // neighbor lists are updated under their row locks, so the new nodes can be linked in parallel
+#pragma omp parallel for schedule(dynamic) if (end - begin > 1)
             for (SizeType node = begin; node < end; node++)
             {
                 m_pGraph.RefineNode<T>(this, node, true, true, m_pGraph.m_iAddCEF);
@@ -735,14 +886,20 @@ namespace SPTAG
         }
 
         template <typename T>
-        ErrorCode Index<T>::AddIndexIdx(SizeType begin, SizeType end)
+        void Index<T>::InsertTreeNode(SizeType p_node)
         {
-            // if (end - m_pTrees.sizePerTree() >= m_addCountForRebuild && m_threadPool.jobsize() == 0) {
-            //     m_threadPool.add(new RebuildJob(&m_pSamples, &m_pTrees, &m_pGraph, m_iDistCalcMethod));
-            // }
+            m_pTrees.InsertNode<T>(m_pSamples, p_node, m_fComputeDistance, [this](SizeType center, SizeType node) {
+                m_pGraph.Update(center, m_pGraph.m_iNeighborhoodSize - 1, -2 - node);
+            });
+        }
 
+        template <typename T>
+        ErrorCode Index<T>::AddIndexIdx(SizeType begin, SizeType end)
+        {
+            // callers split postings from many threads at once, so the nodes go in one after the other here
             for (SizeType node = begin; node < end; node++)
             {
+                if (m_pTrees.m_bIncrementalInsert && m_pQuantizer == nullptr) InsertTreeNode(node);
                 m_pGraph.RefineNode<T>(this, node, true, true, m_pGraph.m_iAddCEF);
             }
             return ErrorCode::Success;
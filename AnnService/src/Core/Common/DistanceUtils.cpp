@@ -1044,3 +1044,327 @@ float DistanceUtils::ComputeCosineDistance_AVX512(const float* pX, const float*
     while (pX < pEnd1) diff += (*pX++) * (*pY++);
     return 1 - diff;
 }
+
+// Batched kernels: four vectors share every load of the query and keep their own accumulator,
+// so scoring a posting costs one call per batch instead of one per vector.
+namespace
+{
+    inline float ReduceAdd(__m256 v)
+    {
+        __m128 v128 = _mm_add_ps(_mm256_castps256_ps128(v), _mm256_extractf128_ps(v, 1));
+        v128 = _mm_add_ps(v128, _mm_movehl_ps(v128, v128));
+        v128 = _mm_add_ss(v128, _mm_shuffle_ps(v128, v128, 1));
+        return _mm_cvtss_f32(v128);
+    }
+
+    // 8-bit vectors are widened to 16 bits and multiplied with madd into exact 32-bit sums,
+    // converting to float once per vector instead of once per step.
+    template <typename T> struct BatchOps_AVX;
+
+    template <> struct BatchOps_AVX<std::int8_t>
+    {
+        typedef __m256i Reg; typedef __m256i Acc; static const int Lanes = 16;
+        static inline Reg Load(const std::int8_t* p) { return _mm256_cvtepi8_epi16(_mm_loadu_si128((const __m128i*)p)); }
+        static inline Acc Sqdf(Reg x, Reg y) { Reg d = _mm256_sub_epi16(x, y); return _mm256_madd_epi16(d, d); }
+        static inline Acc Mul(Reg x, Reg y) { return _mm256_madd_epi16(x, y); }
+        static inline Acc Zero() { return _mm256_setzero_si256(); }
+        static inline Acc Add(Acc a, Acc b) { return _mm256_add_epi32(a, b); }
+        static inline float Reduce(Acc a) { return ReduceAdd(_mm256_cvtepi32_ps(a)); }
+    };
+
+    template <> struct BatchOps_AVX<std::uint8_t>
+    {
+        typedef __m256i Reg; typedef __m256i Acc; static const int Lanes = 16;
+        static inline Reg Load(const std::uint8_t* p) { return _mm256_cvtepu8_epi16(_mm_loadu_si128((const __m128i*)p)); }
+        static inline Acc Sqdf(Reg x, Reg y) { Reg d = _mm256_sub_epi16(x, y); return _mm256_madd_epi16(d, d); }
+        static inline Acc Mul(Reg x, Reg y) { return _mm256_madd_epi16(x, y); }
+        static inline Acc Zero() { return _mm256_setzero_si256(); }
+        static inline Acc Add(Acc a, Acc b) { return _mm256_add_epi32(a, b); }
+        static inline float Reduce(Acc a) { return ReduceAdd(_mm256_cvtepi32_ps(a)); }
+    };
+
+    template <> struct BatchOps_AVX<std::int16_t>
+    {
+        typedef __m256i Reg; typedef __m256 Acc; static const int Lanes = 16;
+        static inline Reg Load(const std::int16_t* p) { return _mm256_loadu_si256((const __m256i*)p); }
+        static inline Acc Sqdf(Reg x, Reg y) { return _mm256_sqdf_epi16(x, y); }
+        static inline Acc Mul(Reg x, Reg y) { return _mm256_mul_epi16(x, y); }
+        static inline Acc Zero() { return _mm256_setzero_ps(); }
+        static inline Acc Add(Acc a, Acc b) { return _mm256_add_ps(a, b); }
+        static inline float Reduce(Acc a) { return ReduceAdd(a); }
+    };
+
+    template <> struct BatchOps_AVX<float>
+    {
+        typedef __m256 Reg; typedef __m256 Acc; static const int Lanes = 8;
+        static inline Reg Load(const float* p) { return _mm256_loadu_ps(p); }
+        static inline Acc Sqdf(Reg x, Reg y) { return _mm256_sqdf_ps(x, y); }
+        static inline Acc Mul(Reg x, Reg y) { return _mm256_mul_ps(x, y); }
+        static inline Acc Zero() { return _mm256_setzero_ps(); }
+        static inline Acc Add(Acc a, Acc b) { return _mm256_add_ps(a, b); }
+        static inline float Reduce(Acc a) { return ReduceAdd(a); }
+    };
+
+#if (!defined _MSC_VER) || (_MSC_VER >= 1920)
+    inline float ReduceAdd(__m512 v)
+    {
+        return ReduceAdd(_mm256_add_ps(_mm512_castps512_ps256(v), _mm512_extractf32x8_ps(v, 1)));
+    }
+
+    template <typename T> struct BatchOps_AVX512;
+
+    template <> struct BatchOps_AVX512<std::int8_t>
+    {
+        typedef __m512i Reg; typedef __m512i Acc; static const int Lanes = 32;
+        static inline Reg Load(const std::int8_t* p) { return _mm512_cvtepi8_epi16(_mm256_loadu_si256((const __m256i*)p)); }
+        static inline Acc Sqdf(Reg x, Reg y) { Reg d = _mm512_sub_epi16(x, y); return _mm512_madd_epi16(d, d); }
+        static inline Acc Mul(Reg x, Reg y) { return _mm512_madd_epi16(x, y); }
+        static inline Acc Zero() { return _mm512_setzero_si512(); }
+        static inline Acc Add(Acc a, Acc b) { return _mm512_add_epi32(a, b); }
+        static inline float Reduce(Acc a) { return ReduceAdd(_mm512_cvtepi32_ps(a)); }
+    };
+
+    template <> struct BatchOps_AVX512<std::uint8_t>
+    {
+        typedef __m512i Reg; typedef __m512i Acc; static const int Lanes = 32;
+        static inline Reg Load(const std::uint8_t* p) { return _mm512_cvtepu8_epi16(_mm256_loadu_si256((const __m256i*)p)); }
+        static inline Acc Sqdf(Reg x, Reg y) { Reg d = _mm512_sub_epi16(x, y); return _mm512_madd_epi16(d, d); }
+        static inline Acc Mul(Reg x, Reg y) { return _mm512_madd_epi16(x, y); }
+        static inline Acc Zero() { return _mm512_setzero_si512(); }
+        static inline Acc Add(Acc a, Acc b) { return _mm512_add_epi32(a, b); }
+        static inline float Reduce(Acc a) { return ReduceAdd(_mm512_cvtepi32_ps(a)); }
+    };
+
+    template <> struct BatchOps_AVX512<std::int16_t>
+    {
+        typedef __m512i Reg; typedef __m512 Acc; static const int Lanes = 32;
+        static inline Reg Load(const std::int16_t* p) { return _mm512_loadu_si512((const void*)p); }
+        static inline Acc Sqdf(Reg x, Reg y) { return _mm512_sqdf_epi16(x, y); }
+        static inline Acc Mul(Reg x, Reg y) { return _mm512_mul_epi16(x, y); }
+        static inline Acc Zero() { return _mm512_setzero_ps(); }
+        static inline Acc Add(Acc a, Acc b) { return _mm512_add_ps(a, b); }
+        static inline float Reduce(Acc a) { return ReduceAdd(a); }
+    };
+
+    template <> struct BatchOps_AVX512<float>
+    {
+        typedef __m512 Reg; typedef __m512 Acc; static const int Lanes = 16;
+        static inline Reg Load(const float* p) { return _mm512_loadu_ps(p); }
+        static inline Acc Sqdf(Reg x, Reg y) { return _mm512_sqdf_ps(x, y); }
+        static inline Acc Mul(Reg x, Reg y) { return _mm512_mul_ps(x, y); }
+        static inline Acc Zero() { return _mm512_setzero_ps(); }
+        static inline Acc Add(Acc a, Acc b) { return _mm512_add_ps(a, b); }
+        static inline float Reduce(Acc a) { return ReduceAdd(a); }
+    };
+#endif
+
+    // Accumulates the whole Ops::Lanes blocks from p_begin on for four vectors, returns the first dimension left over.
+    template <typename T, typename Ops, bool L2>
+    inline DimensionType BatchBlock4(const T* pX, const T* const* pY, DimensionType p_begin, DimensionType length, float* pSum)
+    {
+        DimensionType d = p_begin;
+        if (d + Ops::Lanes > length) return d;
+
+        typename Ops::Acc a0 = Ops::Zero(), a1 = Ops::Zero(), a2 = Ops::Zero(), a3 = Ops::Zero();
+        for (; d + Ops::Lanes <= length; d += Ops::Lanes) {
+            typename Ops::Reg x = Ops::Load(pX + d);
+            a0 = Ops::Add(a0, L2 ? Ops::Sqdf(x, Ops::Load(pY[0] + d)) : Ops::Mul(x, Ops::Load(pY[0] + d)));
+            a1 = Ops::Add(a1, L2 ? Ops::Sqdf(x, Ops::Load(pY[1] + d)) : Ops::Mul(x, Ops::Load(pY[1] + d)));
+            a2 = Ops::Add(a2, L2 ? Ops::Sqdf(x, Ops::Load(pY[2] + d)) : Ops::Mul(x, Ops::Load(pY[2] + d)));
+            a3 = Ops::Add(a3, L2 ? Ops::Sqdf(x, Ops::Load(pY[3] + d)) : Ops::Mul(x, Ops::Load(pY[3] + d)));
+        }
+        pSum[0] += Ops::Reduce(a0); pSum[1] += Ops::Reduce(a1); pSum[2] += Ops::Reduce(a2); pSum[3] += Ops::Reduce(a3);
+        return d;
+    }
+
+    template <typename T, bool L2>
+    inline float BatchTail(const T* pX, const T* pY, DimensionType p_begin, DimensionType length)
+    {
+        float sum = 0;
+        for (DimensionType d = p_begin; d < length; d++) {
+            float x = (float)pX[d], y = (float)pY[d];
+            sum += L2 ? (x - y) * (x - y) : x * y;
+        }
+        return sum;
+    }
+
+    // Wide covers the bulk of the dimensions, Narrow the rest that does not fill a wide register.
+    template <typename T, typename Wide, typename Narrow, bool L2>
+    void ComputeDistanceBatch(const T* pX, const T* const* pY, int count, DimensionType length, float* pDist, float (*p_single)(const T*, const T*, DimensionType))
+    {
+        const float base = L2 ? 0.0f : (float)(Utils::GetBase<T>() * Utils::GetBase<T>());
+        int i = 0;
+        for (; i + 4 <= count; i += 4) {
+            float sum[4] = { 0, 0, 0, 0 };
+            DimensionType d = BatchBlock4<T, Wide, L2>(pX, pY + i, 0, length, sum);
+            d = BatchBlock4<T, Narrow, L2>(pX, pY + i, d, length, sum);
+            for (int k = 0; k < 4; k++) {
+                sum[k] += BatchTail<T, L2>(pX, pY[i + k], d, length);
+                pDist[i + k] = L2 ? sum[k] : base - sum[k];
+            }
+        }
+        for (; i < count; i++) pDist[i] = p_single(pX, pY[i], length);
+    }
+}
+
+#if (!defined _MSC_VER) || (_MSC_VER >= 1920)
+#define BATCH_OPS_AVX512(T) BatchOps_AVX512<T>
+#else
+#define BATCH_OPS_AVX512(T) BatchOps_AVX<T>
+#endif
+
+#define DEFINE_DISTANCE_BATCH(T) \
+void DistanceUtils::ComputeL2DistanceBatch_AVX(const T* pX, const T* const* pY, int count, DimensionType length, float* pDist) \
+{ \
+    ComputeDistanceBatch<T, BatchOps_AVX<T>, BatchOps_AVX<T>, true>(pX, pY, count, length, pDist, &DistanceUtils::ComputeL2Distance_AVX); \
+} \
+void DistanceUtils::ComputeL2DistanceBatch_AVX512(const T* pX, const T* const* pY, int count, DimensionType length, float* pDist) \
+{ \
+    ComputeDistanceBatch<T, BATCH_OPS_AVX512(T), BatchOps_AVX<T>, true>(pX, pY, count, length, pDist, &DistanceUtils::ComputeL2Distance_AVX512); \
+} \
+void DistanceUtils::ComputeCosineDistanceBatch_AVX(const T* pX, const T* const* pY, int count, DimensionType length, float* pDist) \
+{ \
+    ComputeDistanceBatch<T, BatchOps_AVX<T>, BatchOps_AVX<T>, false>(pX, pY, count, length, pDist, &DistanceUtils::ComputeCosineDistance_AVX); \
+} \
+void DistanceUtils::ComputeCosineDistanceBatch_AVX512(const T* pX, const T* const* pY, int count, DimensionType length, float* pDist) \
+{ \
+    ComputeDistanceBatch<T, BATCH_OPS_AVX512(T), BatchOps_AVX<T>, false>(pX, pY, count, length, pDist, &DistanceUtils::ComputeCosineDistance_AVX512); \
+} \
+
+DEFINE_DISTANCE_BATCH(std::int8_t)
+DEFINE_DISTANCE_BATCH(std::uint8_t)
+DEFINE_DISTANCE_BATCH(std::int16_t)
+DEFINE_DISTANCE_BATCH(float)
+
+#undef DEFINE_DISTANCE_BATCH
+#undef BATCH_OPS_AVX512
+
+// Fast-scan block: row m holds 16 bytes, byte j packs the code of vector j in the low nibble and of vector j + 16 in the high one.
+// The 16 entries of a subvector's table fit one 128-bit register, so a single shuffle looks up 16 codes per lane.
+void DistanceUtils::ComputeFastScanDistances(const std::uint8_t* pTable, const std::uint8_t* pBlock, DimensionType numSubvectors, std::uint16_t* pDist)
+{
+    std::uint32_t sum[32] = { 0 };
+    for (DimensionType m = 0; m < numSubvectors; m++, pTable += 16, pBlock += 16) {
+        for (int j = 0; j < 16; j++) {
+            sum[j] += pTable[pBlock[j] & 0x0f];
+            sum[j + 16] += pTable[pBlock[j] >> 4];
+        }
+    }
+    for (int j = 0; j < 32; j++) pDist[j] = (std::uint16_t)min(sum[j], (std::uint32_t)0xffff);
+}
+
+void DistanceUtils::ComputeFastScanDistances_AVX(const std::uint8_t* pTable, const std::uint8_t* pBlock, DimensionType numSubvectors, std::uint16_t* pDist)
+{
+    const __m256i mask = _mm256_set1_epi8(0x0f);
+    __m256i acc0 = _mm256_setzero_si256(), acc1 = _mm256_setzero_si256();
+    for (DimensionType m = 0; m < numSubvectors; m++, pTable += 16, pBlock += 16) {
+        __m256i table = _mm256_broadcastsi128_si256(_mm_loadu_si128((const __m128i*)pTable));
+        __m128i packed = _mm_loadu_si128((const __m128i*)pBlock);
+        // low lane indexes vectors 0-15, high lane vectors 16-31
+        __m256i codes = _mm256_and_si256(_mm256_inserti128_si256(_mm256_castsi128_si256(packed), _mm_srli_epi16(packed, 4), 1), mask);
+        __m256i dist = _mm256_shuffle_epi8(table, codes);
+        acc0 = _mm256_adds_epu16(acc0, _mm256_cvtepu8_epi16(_mm256_castsi256_si128(dist)));
+        acc1 = _mm256_adds_epu16(acc1, _mm256_cvtepu8_epi16(_mm256_extracti128_si256(dist, 1)));
+    }
+    _mm256_storeu_si256((__m256i*)pDist, acc0);
+    _mm256_storeu_si256((__m256i*)(pDist + 16), acc1);
+}
+
+void DistanceUtils::ComputeFastScanDistances_AVX512(const std::uint8_t* pTable, const std::uint8_t* pBlock, DimensionType numSubvectors, std::uint16_t* pDist)
+{
+#if (!defined _MSC_VER) || (_MSC_VER >= 1920)
+    // two subvectors per shuffle, one in each 256-bit half
+    const __m256i mask = _mm256_set1_epi8(0x0f);
+    __m512i acc = _mm512_setzero_si512();
+    DimensionType m = 0;
+    for (; m + 2 <= numSubvectors; m += 2, pTable += 32, pBlock += 32) {
+        __m512i table = _mm512_inserti64x4(_mm512_castsi256_si512(_mm256_broadcastsi128_si256(_mm_loadu_si128((const __m128i*)pTable))),
+            _mm256_broadcastsi128_si256(_mm_loadu_si128((const __m128i*)(pTable + 16))), 1);
+        __m256i packed = _mm256_loadu_si256((const __m256i*)pBlock);
+        __m256i lo = _mm256_and_si256(packed, mask), hi = _mm256_and_si256(_mm256_srli_epi16(packed, 4), mask);
+        // lanes: low nibbles then high nibbles of subvector m, the same for m + 1
+        __m512i codes = _mm512_inserti64x4(_mm512_castsi256_si512(_mm256_permute2x128_si256(lo, hi, 0x20)), _mm256_permute2x128_si256(lo, hi, 0x31), 1);
+        __m512i dist = _mm512_shuffle_epi8(table, codes);
+        acc = _mm512_adds_epu16(acc, _mm512_cvtepu8_epi16(_mm512_castsi512_si256(dist)));
+        acc = _mm512_adds_epu16(acc, _mm512_cvtepu8_epi16(_mm512_extracti64x4_epi64(dist, 1)));
+    }
+    _mm512_storeu_si512((__m512i*)pDist, acc);
+    if (m < numSubvectors) {
+        std::uint16_t tail[32];
+        ComputeFastScanDistances_AVX(pTable, pBlock, numSubvectors - m, tail);
+        for (int j = 0; j < 32; j++) pDist[j] = (std::uint16_t)min((std::uint32_t)pDist[j] + tail[j], (std::uint32_t)0xffff);
+    }
+#else
+    ComputeFastScanDistances_AVX(pTable, pBlock, numSubvectors, pDist);
+#endif
+}
+
+// GEMM-style tile: a broadcast point dimension multiplies a register of centers, the accumulators hold finished dot products
+// and no horizontal sums are needed. Point rows are padded to 8 and center columns to 16 by the caller.
+void DistanceUtils::ComputeDotProductTile(const float* pX, int xCount, const float* pYT, int yCount, int ldY, DimensionType length, float* pDot)
+{
+    for (int i = 0; i < xCount; i++) {
+        float* dot = pDot + i * yCount;
+        for (int j = 0; j < yCount; j++) dot[j] = 0;
+        for (DimensionType d = 0; d < length; d++) {
+            float x = pX[i * length + d];
+            const float* y = pYT + d * ldY;
+            for (int j = 0; j < yCount; j++) dot[j] += x * y[j];
+        }
+    }
+}
+
+void DistanceUtils::ComputeDotProductTile_AVX(const float* pX, int xCount, const float* pYT, int yCount, int ldY, DimensionType length, float* pDot)
+{
+    // 4 points by 16 centers, eight accumulators
+    for (int i = 0; i < xCount; i += 4) {
+        const float* x0 = pX + i * length;
+        const float* x1 = x0 + length;
+        const float* x2 = x1 + length;
+        const float* x3 = x2 + length;
+        for (int j = 0; j < yCount; j += 16) {
+            __m256 a00 = _mm256_setzero_ps(), a01 = _mm256_setzero_ps(), a10 = _mm256_setzero_ps(), a11 = _mm256_setzero_ps();
+            __m256 a20 = _mm256_setzero_ps(), a21 = _mm256_setzero_ps(), a30 = _mm256_setzero_ps(), a31 = _mm256_setzero_ps();
+            const float* y = pYT + j;
+            for (DimensionType d = 0; d < length; d++, y += ldY) {
+                __m256 y0 = _mm256_loadu_ps(y), y1 = _mm256_loadu_ps(y + 8);
+                __m256 x = _mm256_broadcast_ss(x0 + d);
+                a00 = _mm256_add_ps(a00, _mm256_mul_ps(x, y0)); a01 = _mm256_add_ps(a01, _mm256_mul_ps(x, y1));
+                x = _mm256_broadcast_ss(x1 + d);
+                a10 = _mm256_add_ps(a10, _mm256_mul_ps(x, y0)); a11 = _mm256_add_ps(a11, _mm256_mul_ps(x, y1));
+                x = _mm256_broadcast_ss(x2 + d);
+                a20 = _mm256_add_ps(a20, _mm256_mul_ps(x, y0)); a21 = _mm256_add_ps(a21, _mm256_mul_ps(x, y1));
+                x = _mm256_broadcast_ss(x3 + d);
+                a30 = _mm256_add_ps(a30, _mm256_mul_ps(x, y0)); a31 = _mm256_add_ps(a31, _mm256_mul_ps(x, y1));
+            }
+            float* dot = pDot + i * yCount + j;
+            _mm256_storeu_ps(dot, a00); _mm256_storeu_ps(dot + 8, a01); dot += yCount;
+            _mm256_storeu_ps(dot, a10); _mm256_storeu_ps(dot + 8, a11); dot += yCount;
+            _mm256_storeu_ps(dot, a20); _mm256_storeu_ps(dot + 8, a21); dot += yCount;
+            _mm256_storeu_ps(dot, a30); _mm256_storeu_ps(dot + 8, a31);
+        }
+    }
+}
+
+void DistanceUtils::ComputeDotProductTile_AVX512(const float* pX, int xCount, const float* pYT, int yCount, int ldY, DimensionType length, float* pDot)
+{
+#if (!defined _MSC_VER) || (_MSC_VER >= 1920)
+    // 8 points by 16 centers, eight accumulators
+    for (int i = 0; i < xCount; i += 8) {
+        const float* x = pX + i * length;
+        for (int j = 0; j < yCount; j += 16) {
+            __m512 acc[8];
+            for (int p = 0; p < 8; p++) acc[p] = _mm512_setzero_ps();
+            const float* y = pYT + j;
+            for (DimensionType d = 0; d < length; d++, y += ldY) {
+                __m512 y0 = _mm512_loadu_ps(y);
+                for (int p = 0; p < 8; p++) acc[p] = _mm512_add_ps(acc[p], _mm512_mul_ps(_mm512_set1_ps(x[p * length + d]), y0));
+            }
+            float* dot = pDot + i * yCount + j;
+            for (int p = 0; p < 8; p++) _mm512_storeu_ps(dot + p * yCount, acc[p]);
+        }
+    }
+#else
+    ComputeDotProductTile_AVX(pX, xCount, pYT, yCount, ldY, length, pDot);
+#endif
+}
@@ -0,0 +1,121 @@
+// Copyright (c) Microsoft Corporation. All rights reserved.
+// Licensed under the MIT License.
+
+#include "inc/Core/Common.h"
+#include "inc/Core/Common/MemoryPolicy.h"
+#include "inc/Helper/CommonHelper.h"
+
+#include <map>
+#include <mutex>
+
+#ifndef _MSC_VER
+#include <sys/mman.h>
+#ifdef NUMA
+#include <numa.h>
+#endif
+#endif
+
+using namespace SPTAG;
+using namespace SPTAG::COMMON;
+
+namespace
+{
+    const std::size_t c_hugePageSize = 2 * 1024 * 1024;
+
+    std::mutex g_policyLock;
+    std::map<std::string, DatasetMemoryPolicy> g_policies;
+
+    inline std::size_t MappedSize(std::size_t p_size)
+    {
+        return (p_size + c_hugePageSize - 1) & ~(c_hugePageSize - 1);
+    }
+}
+
+void* DatasetMemoryPolicy::Allocate(std::size_t p_size) const
+{
+#ifndef _MSC_VER
+    if (IsDefault() || p_size == 0) return ALIGN_ALLOC(p_size);
+
+    std::size_t length = MappedSize(p_size);
+    void* ptr = MAP_FAILED;
+    if (m_hugePages == HugePages::Explicit) {
+        ptr = mmap(nullptr, length, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS | MAP_HUGETLB, -1, 0);
+    }
+    if (ptr == MAP_FAILED) {
+        ptr = mmap(nullptr, length, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+        if (ptr == MAP_FAILED) return nullptr;
+        if (m_hugePages != HugePages::None) madvise(ptr, length, MADV_HUGEPAGE);
+    }
+#ifdef NUMA
+    // placement is set before the first touch, nothing has been faulted in yet
+    if (m_numa != NumaPlacement::Default && numa_available() >= 0) {
+        if (m_numa == NumaPlacement::Interleave) numa_interleave_memory(ptr, length, numa_all_nodes_ptr);
+        else numa_setlocal_memory(ptr, length);
+    }
+#endif
+    return ptr;
+#else
+    return ALIGN_ALLOC(p_size);
+#endif
+}
+
+void DatasetMemoryPolicy::Free(void* p_ptr, std::size_t p_size) const
+{
+    if (p_ptr == nullptr) return;
+#ifndef _MSC_VER
+    if (!IsDefault() && p_size > 0) {
+        munmap(p_ptr, MappedSize(p_size));
+        return;
+    }
+#endif
+    ALIGN_FREE(p_ptr);
+}
+
+bool DatasetMemoryPolicy::Configure(const std::string& p_config)
+{
+    std::map<std::string, DatasetMemoryPolicy> policies;
+    for (const std::string& entry : Helper::StrUtils::SplitString(p_config, ",")) {
+        std::vector<std::string> fields = Helper::StrUtils::SplitString(entry, ":");
+        if (fields.size() < 2 || fields.size() > 3) {
+            LOG(Helper::LogLevel::LL_Error, "Bad dataset memory policy entry: %s\n", entry.c_str());
+            return false;
+        }
+
+        DatasetMemoryPolicy policy;
+        if (Helper::StrUtils::StrEqualIgnoreCase(fields[1].c_str(), "transparent")) policy.m_hugePages = HugePages::Transparent;
+        else if (Helper::StrUtils::StrEqualIgnoreCase(fields[1].c_str(), "explicit")) policy.m_hugePages = HugePages::Explicit;
+        else if (!Helper::StrUtils::StrEqualIgnoreCase(fields[1].c_str(), "none")) {
+            LOG(Helper::LogLevel::LL_Error, "Unknown hugepage mode %s for dataset %s\n", fields[1].c_str(), fields[0].c_str());
+            return false;
+        }
+
+        if (fields.size() == 3) {
+            if (Helper::StrUtils::StrEqualIgnoreCase(fields[2].c_str(), "interleave")) policy.m_numa = NumaPlacement::Interleave;
+            else if (Helper::StrUtils::StrEqualIgnoreCase(fields[2].c_str(), "local")) policy.m_numa = NumaPlacement::Local;
+            else if (!Helper::StrUtils::StrEqualIgnoreCase(fields[2].c_str(), "default")) {
+                LOG(Helper::LogLevel::LL_Error, "Unknown numa placement %s for dataset %s\n", fields[2].c_str(), fields[0].c_str());
+                return false;
+            }
+        }
+        policies[fields[0]] = policy;
+    }
+
+#ifdef _MSC_VER
+    if (!policies.empty()) LOG(Helper::LogLevel::LL_Warning, "Dataset memory policies are not supported on Windows, using default allocation.\n");
+#elif !defined(NUMA)
+    for (const auto& policy : policies) {
+        if (policy.second.m_numa != NumaPlacement::Default) LOG(Helper::LogLevel::LL_Warning, "Built without libnuma, ignoring the numa placement of dataset %s.\n", policy.first.c_str());
+    }
+#endif
+    std::lock_guard<std::mutex> lock(g_policyLock);
+    g_policies.swap(policies);
+    return true;
+}
+
+DatasetMemoryPolicy DatasetMemoryPolicy::Get(const std::string& p_name)
+{
+    std::lock_guard<std::mutex> lock(g_policyLock);
+    auto iter = g_policies.find(p_name);
+    if (iter == g_policies.end()) iter = g_policies.find("*");
+    return (iter == g_policies.end()) ? DatasetMemoryPolicy() : iter->second;
+}
@@ -233,3 +233,47 @@ void SIMDUtils::ComputeSum_AVX512(float* pX, const float* pY, DimensionType leng
         *pX++ += *pY++;
     }
 }
+
+int SIMDUtils::ComputeBitFilter_Naive(const std::uint32_t* const* pBlocks, int blockEx, const SizeType* pIDs, int count, std::uint8_t* pKeep)
+{
+    const std::uint32_t mask = (1u << blockEx) - 1;
+    int kept = 0;
+    for (int i = 0; i < count; i++) {
+        std::uint32_t id = (std::uint32_t)pIDs[i];
+        std::uint32_t word = pBlocks[id >> blockEx][(id & mask) >> 5];
+        pKeep[i] = (std::uint8_t)(((word >> (id & 31)) & 1) ^ 1);
+        kept += pKeep[i];
+    }
+    return kept;
+}
+
+// Eight ids per step: one gather fetches the block pointers, a second one the 32-bit words holding the bits.
+static inline __m128i GatherBitWords(const std::uint32_t* const* pBlocks, __m128i blocks, __m128i words)
+{
+    __m256i addr = _mm256_i32gather_epi64((const long long*)pBlocks, blocks, 8);
+    addr = _mm256_add_epi64(addr, _mm256_slli_epi64(_mm256_cvtepu32_epi64(words), 2));
+    return _mm256_i64gather_epi32((const int*)nullptr, addr, 1);
+}
+
+int SIMDUtils::ComputeBitFilter_AVX(const std::uint32_t* const* pBlocks, int blockEx, const SizeType* pIDs, int count, std::uint8_t* pKeep)
+{
+    const __m256i mask = _mm256_set1_epi32((1 << blockEx) - 1);
+    const __m256i low5 = _mm256_set1_epi32(31);
+    const __m128i shift = _mm_cvtsi32_si128(blockEx);
+    int kept = 0;
+    int i = 0;
+    for (; i + 8 <= count; i += 8) {
+        __m256i ids = _mm256_loadu_si256((const __m256i*)(pIDs + i));
+        __m256i blocks = _mm256_srl_epi32(ids, shift);
+        __m256i words = _mm256_srli_epi32(_mm256_and_si256(ids, mask), 5);
+        __m128i lo = GatherBitWords(pBlocks, _mm256_castsi256_si128(blocks), _mm256_castsi256_si128(words));
+        __m128i hi = GatherBitWords(pBlocks, _mm256_extracti128_si256(blocks, 1), _mm256_extracti128_si256(words, 1));
+        __m256i bits = _mm256_srlv_epi32(_mm256_set_m128i(hi, lo), _mm256_and_si256(ids, low5));
+        int set = _mm256_movemask_ps(_mm256_castsi256_ps(_mm256_slli_epi32(bits, 31)));
+        for (int k = 0; k < 8; k++) {
+            pKeep[i + k] = (std::uint8_t)(((set >> k) & 1) ^ 1);
+            kept += pKeep[i + k];
+        }
+    }
+    return kept + ComputeBitFilter_Naive(pBlocks, blockEx, pIDs + i, count - i, pKeep + i);
+}
@@ -3,12 +3,23 @@
 
 #include "inc/Core/SPANN/ExtraSPDKController.h"
 
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/ioctl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <sys/syscall.h>
+#include <sys/uio.h>
+#include <linux/fs.h>
+
 namespace SPTAG::SPANN
 {
 
 thread_local struct SPDKIO::BlockController::IoContext SPDKIO::BlockController::m_currIoContext;
+thread_local struct SPDKIO::BlockController::UringContext SPDKIO::BlockController::m_currUringContext;
 int SPDKIO::BlockController::m_ssdInflight = 0;
 int SPDKIO::BlockController::m_ioCompleteCount = 0;
+int SPDKIO::BlockController::m_ioCompleteBlocks = 0;
 std::unique_ptr<char[]> SPDKIO::BlockController::m_memBuffer;
 
 void SPDKIO::BlockController::SpdkBdevEventCallback(enum spdk_bdev_event_type type, struct spdk_bdev *bdev, void *event_ctx) {
@@ -19,6 +30,7 @@ void SPDKIO::BlockController::SpdkBdevIoCallback(struct spdk_bdev_io *bdev_io, b
     SubIoRequest* currSubIo = (SubIoRequest *)cb_arg;
     if (success) {
         m_ioCompleteCount++;
+        m_ioCompleteBlocks += currSubIo->length >> PageSizeEx;
         spdk_bdev_free_io(bdev_io);
         currSubIo->completed_sub_io_requests->push(currSubIo);
         m_ssdInflight--;
@@ -46,11 +58,11 @@ void SPDKIO::BlockController::SpdkIoLoop(void *arg) {
             if (currSubIo->is_read) {
                 rc = spdk_bdev_read(
                     ctrl->m_ssdSpdkBdevDesc, ctrl->m_ssdSpdkBdevIoChannel,
-                    currSubIo->dma_buff, currSubIo->offset, PageSize, SpdkBdevIoCallback, currSubIo);
+                    currSubIo->dma_buff, currSubIo->offset, currSubIo->length, SpdkBdevIoCallback, currSubIo);
             } else {
                 rc = spdk_bdev_write(
                     ctrl->m_ssdSpdkBdevDesc, ctrl->m_ssdSpdkBdevIoChannel,
-                    currSubIo->dma_buff, currSubIo->offset, PageSize, SpdkBdevIoCallback, currSubIo);
+                    currSubIo->dma_buff, currSubIo->offset, currSubIo->length, SpdkBdevIoCallback, currSubIo);
             }
             if (rc && rc != -ENOMEM) {
                 fprintf(stderr, "SPDKIO::BlockController::SpdkStart %s failed: %d, shutting down, offset: %ld\n",
@@ -127,6 +139,222 @@ void* SPDKIO::BlockController::InitializeSpdk(void *arg) {
     pthread_exit(NULL);
 }
 
+bool SPDKIO::BlockController::UringSetup(int depth) {
+    UringContext& ctx = m_currUringContext;
+    if (ctx.ring_fd >= 0) return true;
+
+    struct io_uring_params params;
+    memset(&params, 0, sizeof(params));
+    ctx.ring_fd = (int)syscall(__NR_io_uring_setup, (unsigned)depth, &params);
+    if (ctx.ring_fd < 0) {
+        fprintf(stderr, "SPDKIO::BlockController::UringSetup: io_uring_setup failed, %d\n", errno);
+        return false;
+    }
+    ctx.to_submit = 0;
+    ctx.in_flight = 0;
+
+    ctx.sq_ring_size = params.sq_off.array + params.sq_entries * sizeof(unsigned);
+    ctx.cq_ring_size = params.cq_off.cqes + params.cq_entries * sizeof(struct io_uring_cqe);
+    bool singleMmap = (params.features & IORING_FEAT_SINGLE_MMAP) != 0;
+    if (singleMmap) ctx.sq_ring_size = ctx.cq_ring_size = std::max(ctx.sq_ring_size, ctx.cq_ring_size);
+
+    // a failed mapping is kept as nullptr so UringTeardown unmaps just the ones that succeeded
+    auto map = [&ctx](size_t size, off_t offset) -> void* {
+        void* ring = mmap(nullptr, size, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, ctx.ring_fd, offset);
+        return (ring == MAP_FAILED) ? nullptr : ring;
+    };
+    ctx.sq_ring = map(ctx.sq_ring_size, IORING_OFF_SQ_RING);
+    ctx.cq_ring = singleMmap ? ctx.sq_ring : map(ctx.cq_ring_size, IORING_OFF_CQ_RING);
+    ctx.sqes_size = params.sq_entries * sizeof(struct io_uring_sqe);
+    ctx.sqes = (struct io_uring_sqe*)map(ctx.sqes_size, IORING_OFF_SQES);
+    if (ctx.sq_ring == nullptr || ctx.cq_ring == nullptr || ctx.sqes == nullptr) {
+        fprintf(stderr, "SPDKIO::BlockController::UringSetup: mmap ring failed, %d\n", errno);
+        UringTeardown();
+        return false;
+    }
+
+    char* sq = (char*)ctx.sq_ring;
+    ctx.sq_head = (unsigned*)(sq + params.sq_off.head);
+    ctx.sq_tail = (unsigned*)(sq + params.sq_off.tail);
+    ctx.sq_mask = (unsigned*)(sq + params.sq_off.ring_mask);
+    ctx.sq_array = (unsigned*)(sq + params.sq_off.array);
+    char* cq = (char*)ctx.cq_ring;
+    ctx.cq_head = (unsigned*)(cq + params.cq_off.head);
+    ctx.cq_tail = (unsigned*)(cq + params.cq_off.tail);
+    ctx.cq_mask = (unsigned*)(cq + params.cq_off.ring_mask);
+    ctx.cqes = (struct io_uring_cqe*)(cq + params.cq_off.cqes);
+
+    // Create sub I/O request pool backed by one registered kMaxIoBlocks buffer per request,
+    // depth counts blocks in flight so the buffer memory does not grow with the command size
+    int numRequests = std::max(1, depth / kMaxIoBlocks);
+    size_t bufferSize = (size_t)kMaxIoBlocks * PageSize;
+    ctx.buffers = (char*)aligned_alloc(PageSize, (size_t)numRequests * bufferSize);
+    if (ctx.buffers == nullptr) {
+        fprintf(stderr, "SPDKIO::BlockController::UringSetup: alloc %zu bytes of buffers failed\n", (size_t)numRequests * bufferSize);
+        UringTeardown();
+        return false;
+    }
+    std::vector<struct iovec> iovs(numRequests);
+    ctx.sub_io_requests.resize(numRequests);
+    for (int i = 0; i < numRequests; i++) {
+        auto& sr = ctx.sub_io_requests[i];
+        sr.completed_sub_io_requests = nullptr;
+        sr.app_buff = nullptr;
+        sr.dma_buff = ctx.buffers + (size_t)i * bufferSize;
+        sr.ctrl = this;
+        sr.buf_index = i;
+        iovs[i].iov_base = sr.dma_buff;
+        iovs[i].iov_len = bufferSize;
+        ctx.free_sub_io_requests.push_back(&sr);
+    }
+
+    int rc = (int)syscall(__NR_io_uring_register, ctx.ring_fd, IORING_REGISTER_BUFFERS, iovs.data(), (unsigned)numRequests);
+    if (rc == 0) rc = (int)syscall(__NR_io_uring_register, ctx.ring_fd, IORING_REGISTER_FILES, &m_uringFd, 1U);
+    ctx.fixed = (rc == 0);
+    if (!ctx.fixed) {
+        fprintf(stderr, "SPDKIO::BlockController::UringSetup: register buffers/files failed (%d), fall back to unregistered I/O\n", errno);
+    }
+    return true;
+}
+
+void SPDKIO::BlockController::UringTeardown() {
+    UringContext& ctx = m_currUringContext;
+    if (ctx.ring_fd < 0) return;
+
+    int res;
+    while (ctx.in_flight && UringComplete(true, res) != nullptr);
+
+    if (ctx.sqes != nullptr) munmap(ctx.sqes, ctx.sqes_size);
+    if (ctx.cq_ring != nullptr && ctx.cq_ring != ctx.sq_ring) munmap(ctx.cq_ring, ctx.cq_ring_size);
+    if (ctx.sq_ring != nullptr) munmap(ctx.sq_ring, ctx.sq_ring_size);
+    ctx.sqes = nullptr;
+    ctx.cq_ring = ctx.sq_ring = nullptr;
+    close(ctx.ring_fd);
+    ctx.ring_fd = -1;
+
+    free(ctx.buffers);
+    ctx.buffers = nullptr;
+    ctx.free_sub_io_requests.clear();
+    ctx.sub_io_requests.clear();
+}
+
+void SPDKIO::BlockController::UringPrepare(SubIoRequest* currSubIo) {
+    UringContext& ctx = m_currUringContext;
+    unsigned tail = *ctx.sq_tail;
+    unsigned index = tail & *ctx.sq_mask;
+    struct io_uring_sqe* sqe = &ctx.sqes[index];
+    memset(sqe, 0, sizeof(*sqe));
+    if (ctx.fixed) {
+        sqe->opcode = currSubIo->is_read ? IORING_OP_READ_FIXED : IORING_OP_WRITE_FIXED;
+        sqe->flags = IOSQE_FIXED_FILE;
+        sqe->fd = 0;
+        sqe->buf_index = currSubIo->buf_index;
+    } else {
+        sqe->opcode = currSubIo->is_read ? IORING_OP_READ : IORING_OP_WRITE;
+        sqe->fd = m_uringFd;
+    }
+    sqe->addr = (std::uint64_t)currSubIo->dma_buff;
+    sqe->len = (unsigned)currSubIo->length;
+    sqe->off = currSubIo->offset;
+    sqe->user_data = (std::uint64_t)currSubIo;
+    ctx.sq_array[index] = index;
+    __atomic_store_n(ctx.sq_tail, tail + 1, __ATOMIC_RELEASE);
+    ctx.to_submit++;
+    ctx.in_flight++;
+}
+
+SPDKIO::BlockController::SubIoRequest* SPDKIO::BlockController::UringComplete(bool wait, int& p_result) {
+    UringContext& ctx = m_currUringContext;
+    while (true) {
+        unsigned head = *ctx.cq_head;
+        if (head != __atomic_load_n(ctx.cq_tail, __ATOMIC_ACQUIRE)) {
+            struct io_uring_cqe* cqe = &ctx.cqes[head & *ctx.cq_mask];
+            SubIoRequest* currSubIo = (SubIoRequest*)cqe->user_data;
+            p_result = cqe->res;
+            __atomic_store_n(ctx.cq_head, head + 1, __ATOMIC_RELEASE);
+            ctx.in_flight--;
+            m_ioCompleteCount++;
+            m_ioCompleteBlocks += currSubIo->length >> PageSizeEx;
+            return currSubIo;
+        }
+        if (!wait && !ctx.to_submit) return nullptr;
+
+        int rc = (int)syscall(__NR_io_uring_enter, ctx.ring_fd, (unsigned)ctx.to_submit, wait ? 1U : 0U, wait ? IORING_ENTER_GETEVENTS : 0U, nullptr, 0);
+        if (rc < 0) {
+            if (errno == EINTR || errno == EAGAIN || errno == EBUSY) continue;
+            fprintf(stderr, "SPDKIO::BlockController::UringComplete: io_uring_enter failed, %d\n", errno);
+            return nullptr;
+        }
+        ctx.to_submit -= rc;
+        if (!wait && !ctx.to_submit && head == __atomic_load_n(ctx.cq_tail, __ATOMIC_ACQUIRE)) return nullptr;
+    }
+}
+
+bool SPDKIO::BlockController::SkipSubIo(const std::vector<SubIoRequest>& p_requests, size_t p_idx, std::vector<char>& p_dropped, const std::function<bool(int)>& p_skip) {
+    int postingId = p_requests[p_idx].posting_id;
+    if (p_idx == 0 || p_requests[p_idx - 1].posting_id != postingId) p_dropped[postingId] = p_skip(postingId);
+    return p_dropped[postingId];
+}
+
+bool SPDKIO::BlockController::UringRun(std::vector<SubIoRequest>& p_requests, std::vector<int>* p_pending, const std::chrono::microseconds &timeout, const std::function<void(int)>& p_ready, const std::function<bool(int)>& p_skip) {
+    UringContext& ctx = m_currUringContext;
+    auto t1 = std::chrono::high_resolution_clock::now();
+    size_t currSubIoIdx = 0;
+    bool success = true;
+    SubIoRequest* currSubIo;
+    int res;
+    std::vector<char> dropped(p_skip && p_pending ? p_pending->size() : 0, 0);
+    auto submit = [&]() {
+        while (currSubIoIdx < p_requests.size() && ctx.free_sub_io_requests.size()) {
+            if (!dropped.empty() && SkipSubIo(p_requests, currSubIoIdx, dropped, p_skip)) {
+                currSubIoIdx++;
+                continue;
+            }
+            currSubIo = ctx.free_sub_io_requests.back();
+            ctx.free_sub_io_requests.pop_back();
+            currSubIo->app_buff = p_requests[currSubIoIdx].app_buff;
+            currSubIo->real_size = p_requests[currSubIoIdx].real_size;
+            currSubIo->length = p_requests[currSubIoIdx].length;
+            currSubIo->is_read = p_requests[currSubIoIdx].is_read;
+            currSubIo->offset = p_requests[currSubIoIdx].offset;
+            currSubIo->posting_id = p_requests[currSubIoIdx].posting_id;
+            if (!currSubIo->is_read) memcpy(currSubIo->dma_buff, currSubIo->app_buff, currSubIo->real_size);
+            UringPrepare(currSubIo);
+            currSubIoIdx++;
+        }
+    };
+    while (currSubIoIdx < p_requests.size() || ctx.in_flight) {
+        // Stop submitting on timeout, but drain the in-flight I/Os since their buffers are reused
+        if (currSubIoIdx < p_requests.size() && std::chrono::duration_cast<std::chrono::microseconds>(std::chrono::high_resolution_clock::now() - t1) > timeout) {
+            currSubIoIdx = p_requests.size();
+            success = false;
+        }
+        // Try submit
+        submit();
+        if (!ctx.in_flight) continue;
+        // Try complete
+        currSubIo = UringComplete(true, res);
+        if (currSubIo == nullptr) return false;
+        int readyPosting = -1;
+        if (res < (currSubIo->is_read ? currSubIo->real_size : currSubIo->length)) {
+            fprintf(stderr, "SPDKIO::BlockController::UringRun: %s failed: %d, offset: %ld\n",
+                currSubIo->is_read ? "read" : "write", res, currSubIo->offset);
+            success = false;
+        } else if (currSubIo->is_read) {
+            memcpy(currSubIo->app_buff, currSubIo->dma_buff, currSubIo->real_size);
+            if (p_pending && --(*p_pending)[currSubIo->posting_id] == 0) readyPosting = currSubIo->posting_id;
+        }
+        currSubIo->app_buff = nullptr;
+        ctx.free_sub_io_requests.push_back(currSubIo);
+        if (readyPosting >= 0 && p_ready) {
+            // refill the ring first so the device stays busy while the posting is consumed
+            submit();
+            p_ready(readyPosting);
+        }
+    }
+    return success;
+}
+
 bool SPDKIO::BlockController::Initialize(int batchSize) {
     std::lock_guard<std::mutex> lock(m_initMutex);
     m_numInitCalled++;
@@ -135,22 +363,20 @@ bool SPDKIO::BlockController::Initialize(int batchSize) {
     m_useMemImpl = useMemImplEnvStr && !strcmp(useMemImplEnvStr, "1");
     const char* useSsdImplEnvStr = getenv(kUseSsdImplEnv);
     m_useSsdImpl = useSsdImplEnvStr && !strcmp(useSsdImplEnvStr, "1");
+    const char* useUringImplEnvStr = getenv(kUseUringImplEnv);
+    m_useUringImpl = useUringImplEnvStr && !strcmp(useUringImplEnvStr, "1");
     if (m_useMemImpl) {
         if (m_numInitCalled == 1) {
             if (m_memBuffer == nullptr) {
                 m_memBuffer.reset(new char[kMemImplMaxNumBlocks * PageSize]);
             }
-            for (AddressType i = 0; i < kMemImplMaxNumBlocks; i++) {
-                m_blockAddresses.push(i);
-            }
+            PushAllBlocks(kMemImplMaxNumBlocks);
         }
         return true;
     } else if (m_useSsdImpl) {
         if (m_numInitCalled == 1) {
             m_batchSize = batchSize;
-            for (AddressType i = 0; i < kSsdImplMaxNumBlocks; i++) {
-                m_blockAddresses.push(i);
-            }
+            PushAllBlocks(kSsdImplMaxNumBlocks);
             pthread_create(&m_ssdSpdkTid, NULL, &InitializeSpdk, this);
             while (!m_ssdSpdkThreadReady && !m_ssdSpdkThreadStartFailed);
             if (m_ssdSpdkThreadStartFailed) {
@@ -158,32 +384,126 @@ bool SPDKIO::BlockController::Initialize(int batchSize) {
                 return false;
             }
         }
-        // Create sub I/O request pool
-        m_currIoContext.sub_io_requests.resize(m_ssdSpdkIoDepth);
+        // Create sub I/O request pool, each request can carry kMaxIoBlocks contiguous blocks
+        m_currIoContext.sub_io_requests.resize(std::max(1, m_ssdSpdkIoDepth / kMaxIoBlocks));
         m_currIoContext.in_flight = 0;
         uint32_t buf_align;
         buf_align = spdk_bdev_get_buf_align(m_ssdSpdkBdev);
         for (auto &sr : m_currIoContext.sub_io_requests) {
             sr.completed_sub_io_requests = &(m_currIoContext.completed_sub_io_requests);
             sr.app_buff = nullptr;
-            sr.dma_buff = spdk_dma_zmalloc(PageSize, buf_align, NULL);
+            sr.dma_buff = spdk_dma_zmalloc(kMaxIoBlocks * PageSize, buf_align, NULL);
             sr.ctrl = this;
             m_currIoContext.free_sub_io_requests.push_back(&sr);
         }
         return true;
+    } else if (m_useUringImpl) {
+        if (m_numInitCalled == 1) {
+            m_batchSize = batchSize;
+            const char* spdkIoDepth = getenv(kSpdkIoDepth);
+            if (spdkIoDepth) m_ssdSpdkIoDepth = atoi(spdkIoDepth);
+            const char* uringFilePath = getenv(kUringFilePathEnv);
+            if (uringFilePath == nullptr) {
+                fprintf(stderr, "SPDKIO::BlockController::Initialize: %s is not set\n", kUringFilePathEnv);
+                return false;
+            }
+            m_uringFd = open(uringFilePath, O_RDWR | O_CREAT | O_DIRECT, 0644);
+            if (m_uringFd < 0) {
+                fprintf(stderr, "SPDKIO::BlockController::Initialize: open %s failed, %d\n", uringFilePath, errno);
+                return false;
+            }
+            // Use the whole block device, or grow a regular file to a sparse size, SPFRESH_URING_FILE_BLOCKS or 64GB
+            struct stat st;
+            std::uint64_t deviceBytes = 0;
+            if (fstat(m_uringFd, &st) == 0 && S_ISBLK(st.st_mode)) {
+                ioctl(m_uringFd, BLKGETSIZE64, &deviceBytes);
+            } else {
+                const char* uringFileBlocks = getenv(kUringFileBlocksEnv);
+                std::uint64_t fileBlocks = uringFileBlocks ? strtoull(uringFileBlocks, nullptr, 10) : 0;
+                if (fileBlocks == 0) fileBlocks = kUringImplDefaultNumBlocks;
+                deviceBytes = st.st_size;
+                if (deviceBytes < fileBlocks * PageSize) {
+                    deviceBytes = fileBlocks * PageSize;
+                    if (ftruncate(m_uringFd, deviceBytes)) {
+                        fprintf(stderr, "SPDKIO::BlockController::Initialize: ftruncate %s failed, %d\n", uringFilePath, errno);
+                        close(m_uringFd);
+                        m_uringFd = -1;
+                        return false;
+                    }
+                }
+            }
+            AddressType numBlocks = std::min((AddressType)(deviceBytes >> PageSizeEx), kSsdImplMaxNumBlocks);
+            PushAllBlocks(numBlocks);
+            fprintf(stdout, "SPDKIO::BlockController::Initialize: using io_uring on %s with %ld blocks\n", uringFilePath, numBlocks);
+        }
+        return UringSetup(m_ssdSpdkIoDepth);
     } else {
         fprintf(stderr, "SPDKIO::BlockController::Initialize failed\n");
         return false;
     }
 }
 
-// get p_size blocks from front, and fill in p_data array
+void SPDKIO::BlockController::PushExtent(AddressType p_offset, AddressType p_length) {
+    m_freeBlocks += p_length;
+    auto next = m_freeExtents.lower_bound(p_offset);
+    if (next != m_freeExtents.begin()) {
+        auto prev = std::prev(next);
+        if (prev->first + prev->second == p_offset) {
+            p_offset = prev->first;
+            p_length += prev->second;
+            m_freeBySize.erase({ prev->second, prev->first });
+            m_freeExtents.erase(prev);
+        }
+    }
+    if (next != m_freeExtents.end() && p_offset + p_length == next->first) {
+        p_length += next->second;
+        m_freeBySize.erase({ next->second, next->first });
+        m_freeExtents.erase(next);
+    }
+    m_freeExtents[p_offset] = p_length;
+    m_freeBySize.insert({ p_length, p_offset });
+}
+
+bool SPDKIO::BlockController::PopExtent(AddressType p_need, Extent& p_extent) {
+    if (m_freeBySize.empty()) return false;
+    auto fit = m_freeBySize.lower_bound({ p_need, 0 });
+    if (fit == m_freeBySize.end()) fit = std::prev(fit);
+    p_extent.length = fit->first;
+    p_extent.offset = fit->second;
+    m_freeBySize.erase(fit);
+    m_freeExtents.erase(p_extent.offset);
+    m_freeBlocks -= p_extent.length;
+    return true;
+}
+
+void SPDKIO::BlockController::PushAllBlocks(AddressType p_numBlocks) {
+    std::lock_guard<std::mutex> lock(m_extentLock);
+    if (p_numBlocks > 0) PushExtent(0, p_numBlocks);
+}
+
+void SPDKIO::BlockController::ClearBlocks() {
+    std::lock_guard<std::mutex> lock(m_extentLock);
+    m_freeExtents.clear();
+    m_freeBySize.clear();
+    m_freeBlocks = 0;
+}
+
+// get p_size blocks, as few contiguous runs as the free extents allow, and fill in p_data array
 bool SPDKIO::BlockController::GetBlocks(AddressType* p_data, int p_size) {
-    AddressType currBlockAddress = 0;
-    if (m_useMemImpl || m_useSsdImpl) {
-        for (int i = 0; i < p_size; i++) {
-            while (!m_blockAddresses.try_pop(currBlockAddress));
-            p_data[i] = currBlockAddress;
+    if (m_useMemImpl || m_useSsdImpl || m_useUringImpl) {
+        std::unique_lock<std::mutex> lock(m_extentLock);
+        // all or nothing, so waiting callers never sit on part of the space
+        while (m_freeBlocks < p_size) {
+            if (m_extentReleased.wait_for(lock, std::chrono::seconds(1)) == std::cv_status::timeout) {
+                fprintf(stderr, "SPDKIO::BlockController::GetBlocks: waiting for %d blocks, %lld free\n", p_size, (long long)m_freeBlocks.load());
+            }
+        }
+        int got = 0;
+        Extent extent;
+        while (got < p_size && PopExtent(p_size - got, extent)) {
+            AddressType take = std::min((AddressType)(p_size - got), extent.length);
+            for (AddressType i = 0; i < take; i++) p_data[got++] = extent.offset + i;
+            if (extent.length > take) PushExtent(extent.offset + take, extent.length - take);
         }
         return true;
     } else {
@@ -192,12 +512,38 @@ bool SPDKIO::BlockController::GetBlocks(AddressType* p_data, int p_size) {
     }
 }
 
-// release p_size blocks, put them at the end of the queue
+// get at most p_size blocks without waiting, return the number of blocks got
+int SPDKIO::BlockController::TryGetBlocks(AddressType* p_data, int p_size) {
+    if (m_useMemImpl || m_useSsdImpl || m_useUringImpl) {
+        std::lock_guard<std::mutex> lock(m_extentLock);
+        int got = 0;
+        Extent extent;
+        while (got < p_size && PopExtent(p_size - got, extent)) {
+            AddressType take = std::min((AddressType)(p_size - got), extent.length);
+            for (AddressType i = 0; i < take; i++) p_data[got++] = extent.offset + i;
+            if (extent.length > take) PushExtent(extent.offset + take, extent.length - take);
+        }
+        return got;
+    } else {
+        fprintf(stderr, "SPDKIO::BlockController::TryGetBlocks failed\n");
+        return 0;
+    }
+}
+
+// release p_size blocks, every contiguous run merges with the free runs around it
 bool SPDKIO::BlockController::ReleaseBlocks(AddressType* p_data, int p_size) {
-    if (m_useMemImpl || m_useSsdImpl) {
-        for (int i = 0; i < p_size; i++) {
-            m_blockAddresses.push(p_data[i]);
+    if (m_useMemImpl || m_useSsdImpl || m_useUringImpl) {
+        {
+            std::lock_guard<std::mutex> lock(m_extentLock);
+            int start = 0;
+            for (int i = 1; i <= p_size; i++) {
+                if (i == p_size || p_data[i] != p_data[i - 1] + 1) {
+                    PushExtent(p_data[start], i - start);
+                    start = i;
+                }
+            }
         }
+        m_extentReleased.notify_all();
         return true;
     } else {
         fprintf(stderr, "SPDKIO::BlockController::ReleaseBlocks failed\n");
@@ -205,6 +551,45 @@ bool SPDKIO::BlockController::ReleaseBlocks(AddressType* p_data, int p_size) {
     }
 }
 
+int SPDKIO::BlockController::ReserveBlocks(const AddressType* p_data, int p_size) {
+    std::lock_guard<std::mutex> lock(m_extentLock);
+    int reserved = 0;
+    for (int i = 0; i < p_size; i++) {
+        auto it = m_freeExtents.upper_bound(p_data[i]);
+        if (it == m_freeExtents.begin()) continue;
+        it--;
+        AddressType offset = it->first, length = it->second;
+        if (offset + length <= p_data[i]) continue;
+
+        m_freeBySize.erase({ length, offset });
+        m_freeExtents.erase(it);
+        m_freeBlocks -= length;
+        if (p_data[i] > offset) PushExtent(offset, p_data[i] - offset);
+        if (offset + length > p_data[i] + 1) PushExtent(p_data[i] + 1, offset + length - p_data[i] - 1);
+        reserved++;
+    }
+    return reserved;
+}
+
+void SPDKIO::BlockController::BuildSubIoRequests(AddressType* p_blocks, AddressType p_bytes, char* p_buff, bool p_isRead, int p_postingId, std::vector<SubIoRequest>& p_requests) {
+    AddressType currOffset = 0;
+    AddressType blockIdx = 0;
+    while (currOffset < p_bytes) {
+        AddressType blocks = 1;
+        while (blocks < kMaxIoBlocks && currOffset + blocks * PageSize < p_bytes && p_blocks[blockIdx + blocks] == p_blocks[blockIdx] + blocks) blocks++;
+        SubIoRequest currSubIo;
+        currSubIo.app_buff = p_buff + currOffset;
+        currSubIo.length = blocks * PageSize;
+        currSubIo.real_size = std::min(p_bytes - currOffset, currSubIo.length);
+        currSubIo.is_read = p_isRead;
+        currSubIo.offset = p_blocks[blockIdx] * PageSize;
+        currSubIo.posting_id = p_postingId;
+        p_requests.push_back(currSubIo);
+        currOffset += currSubIo.length;
+        blockIdx += blocks;
+    }
+}
+
 // read a posting list. p_data[0] is the total data size,
 // p_data[1], p_data[2], ..., p_data[((p_data[0] + PageSize - 1) >> PageSizeEx)] are the addresses of the blocks
 // concat all the block contents together into p_value string.
@@ -222,8 +607,9 @@ bool SPDKIO::BlockController::ReadBlocks(AddressType* p_data, std::string* p_val
         return true;
     } else if (m_useSsdImpl) {
         p_value->resize(p_data[0]);
-        AddressType currOffset = 0;
-        AddressType dataIdx = 1;
+        std::vector<SubIoRequest> subIoRequests;
+        BuildSubIoRequests(p_data + 1, p_data[0], p_value->data(), true, 0, subIoRequests);
+        size_t currSubIoIdx = 0;
         SubIoRequest* currSubIo;
 
         // Clear timeout I/Os
@@ -237,22 +623,22 @@ bool SPDKIO::BlockController::ReadBlocks(AddressType* p_data, std::string* p_val
 
         auto t1 = std::chrono::high_resolution_clock::now();
         // Submit all I/Os
-        while (currOffset < p_data[0] || m_currIoContext.in_flight) {
+        while (currSubIoIdx < subIoRequests.size() || m_currIoContext.in_flight) {
             auto t2 = std::chrono::high_resolution_clock::now();
             if (std::chrono::duration_cast<std::chrono::microseconds>(t2 - t1) > timeout) {
                 return false;
             }
             // Try submit
-            if (currOffset < p_data[0] && m_currIoContext.free_sub_io_requests.size()) {
+            if (currSubIoIdx < subIoRequests.size() && m_currIoContext.free_sub_io_requests.size()) {
                 currSubIo = m_currIoContext.free_sub_io_requests.back();
                 m_currIoContext.free_sub_io_requests.pop_back();
-                currSubIo->app_buff = p_value->data() + currOffset;
-                currSubIo->real_size = (p_data[0] - currOffset) < PageSize ? (p_data[0] - currOffset) : PageSize;
+                currSubIo->app_buff = subIoRequests[currSubIoIdx].app_buff;
+                currSubIo->real_size = subIoRequests[currSubIoIdx].real_size;
+                currSubIo->length = subIoRequests[currSubIoIdx].length;
                 currSubIo->is_read = true;
-                currSubIo->offset = p_data[dataIdx] * PageSize;
+                currSubIo->offset = subIoRequests[currSubIoIdx].offset;
                 m_submittedSubIoRequests.push(currSubIo);
-                currOffset += PageSize;
-                dataIdx++;
+                currSubIoIdx++;
                 m_currIoContext.in_flight++;
             }
             // Try complete
@@ -264,6 +650,11 @@ bool SPDKIO::BlockController::ReadBlocks(AddressType* p_data, std::string* p_val
             }
         }
         return true;
+    } else if (m_useUringImpl) {
+        p_value->resize(p_data[0]);
+        std::vector<SubIoRequest> subIoRequests;
+        BuildSubIoRequests(p_data + 1, p_data[0], p_value->data(), true, 0, subIoRequests);
+        return UringRun(subIoRequests, nullptr, timeout);
     } else {
         fprintf(stderr, "SPDKIO::BlockController::ReadBlocks single failed\n");
         return false;
@@ -271,14 +662,16 @@ bool SPDKIO::BlockController::ReadBlocks(AddressType* p_data, std::string* p_val
 }
 
 // parallel read a list of posting lists.
-bool SPDKIO::BlockController::ReadBlocks(std::vector<AddressType*>& p_data, std::vector<std::string>* p_values, const std::chrono::microseconds &timeout) {
+bool SPDKIO::BlockController::ReadBlocks(std::vector<AddressType*>& p_data, std::vector<std::string>* p_values, const std::chrono::microseconds &timeout, const std::function<void(int)>& p_ready, const std::function<bool(int)>& p_skip) {
     if (m_useMemImpl) {
         p_values->resize(p_data.size());
         for (size_t i = 0; i < p_data.size(); i++) {
+            if (p_skip && p_skip((int)i)) continue;
             ReadBlocks(p_data[i], &((*p_values)[i]));
+            if (p_ready) p_ready((int)i);
         }
         return true;
-    } else if (m_useSsdImpl) {
+    } else if (m_useSsdImpl || m_useUringImpl) {
         // Temporarily disable timeout
 
         // Convert request format to SubIoRequests
@@ -292,21 +685,26 @@ bool SPDKIO::BlockController::ReadBlocks(std::vector<AddressType*>& p_data, std:
             std::string* p_value = &((*p_values)[i]);
 
             p_value->resize(p_data_i[0]);
-            AddressType currOffset = 0;
-            AddressType dataIdx = 1;
-
-            while (currOffset < p_data_i[0]) {
-                SubIoRequest currSubIo;
-                currSubIo.app_buff = p_value->data() + currOffset;
-                currSubIo.real_size = (p_data_i[0] - currOffset) < PageSize ? (p_data_i[0] - currOffset) : PageSize;
-                currSubIo.is_read = true;
-                currSubIo.offset = p_data_i[dataIdx] * PageSize;
-                currSubIo.posting_id = i;
-                subIoRequests.push_back(currSubIo);
-                subIoRequestCount[i]++;
-                currOffset += PageSize;
-                dataIdx++;
+            size_t prevSize = subIoRequests.size();
+            BuildSubIoRequests(p_data_i + 1, p_data_i[0], p_value->data(), true, (int)i, subIoRequests);
+            subIoRequestCount[i] = (int)(subIoRequests.size() - prevSize);
+        }
+
+        // empty postings are complete before any I/O
+        if (p_ready) {
+            for (int i = 0; i < subIoRequestCount.size(); i++) {
+                if (subIoRequestCount[i] == 0) p_ready(i);
+            }
+        }
+
+        if (m_useUringImpl) {
+            UringRun(subIoRequests, &subIoRequestCount, timeout, p_ready, p_skip);
+            for (int i = 0; i < subIoRequestCount.size(); i++) {
+                if (subIoRequestCount[i] != 0) {
+                    (*p_values)[i].clear();
+                }
             }
+            return true;
         }
 
         // Clear timeout I/Os
@@ -319,6 +717,7 @@ bool SPDKIO::BlockController::ReadBlocks(std::vector<AddressType*>& p_data, std:
             }
         }
 
+        std::vector<char> dropped(p_skip ? p_data.size() : 0, 0);
         const int batch_size = m_batchSize;
         for (int currSubIoStartId = 0; currSubIoStartId < subIoRequests.size(); currSubIoStartId += batch_size) {
             int currSubIoEndId = (currSubIoStartId + batch_size) > subIoRequests.size() ? subIoRequests.size() : currSubIoStartId + batch_size;
@@ -330,11 +729,15 @@ bool SPDKIO::BlockController::ReadBlocks(std::vector<AddressType*>& p_data, std:
                     break;
                 }
                 // Try submit
-                if (currSubIoIdx < currSubIoEndId && m_currIoContext.free_sub_io_requests.size()) {
+                if (currSubIoIdx < currSubIoEndId && !dropped.empty() && SkipSubIo(subIoRequests, currSubIoIdx, dropped, p_skip)) {
+                    currSubIoIdx++;
+                }
+                else if (currSubIoIdx < currSubIoEndId && m_currIoContext.free_sub_io_requests.size()) {
                     currSubIo = m_currIoContext.free_sub_io_requests.back();
                     m_currIoContext.free_sub_io_requests.pop_back();
                     currSubIo->app_buff = subIoRequests[currSubIoIdx].app_buff;
                     currSubIo->real_size = subIoRequests[currSubIoIdx].real_size;
+                    currSubIo->length = subIoRequests[currSubIoIdx].length;
                     currSubIo->is_read = true;
                     currSubIo->offset = subIoRequests[currSubIoIdx].offset;
                     currSubIo->posting_id = subIoRequests[currSubIoIdx].posting_id;
@@ -346,9 +749,10 @@ bool SPDKIO::BlockController::ReadBlocks(std::vector<AddressType*>& p_data, std:
                 if (m_currIoContext.in_flight && m_currIoContext.completed_sub_io_requests.try_pop(currSubIo)) {
                     memcpy(currSubIo->app_buff, currSubIo->dma_buff, currSubIo->real_size);
                     currSubIo->app_buff = nullptr;
-                    subIoRequestCount[currSubIo->posting_id]--;
+                    int postingId = currSubIo->posting_id;
                     m_currIoContext.free_sub_io_requests.push_back(currSubIo);
                     m_currIoContext.in_flight--;
+                    if (--subIoRequestCount[postingId] == 0 && p_ready) p_ready(postingId);
                 }
             }
 
@@ -378,23 +782,25 @@ bool SPDKIO::BlockController::WriteBlocks(AddressType* p_data, int p_size, const
         }
         return true;
     } else if (m_useSsdImpl) {
-        AddressType currBlockIdx = 0;
+        std::vector<SubIoRequest> subIoRequests;
+        BuildSubIoRequests(p_data, std::min((AddressType)p_value.size(), (AddressType)p_size * PageSize), const_cast<char *>(p_value.data()), false, 0, subIoRequests);
+        size_t currSubIoIdx = 0;
         int inflight = 0;
         SubIoRequest* currSubIo;
-        int totalSize = p_value.size();
         // Submit all I/Os
-        while (currBlockIdx < p_size || inflight) {
+        while (currSubIoIdx < subIoRequests.size() || inflight) {
             // Try submit
-            if (currBlockIdx < p_size && m_currIoContext.free_sub_io_requests.size()) {
+            if (currSubIoIdx < subIoRequests.size() && m_currIoContext.free_sub_io_requests.size()) {
                 currSubIo = m_currIoContext.free_sub_io_requests.back();
                 m_currIoContext.free_sub_io_requests.pop_back();
-                currSubIo->app_buff = const_cast<char *>(p_value.data()) + currBlockIdx * PageSize;
-                currSubIo->real_size = (PageSize * (currBlockIdx + 1)) > totalSize ? (totalSize - currBlockIdx * PageSize): PageSize;
+                currSubIo->app_buff = subIoRequests[currSubIoIdx].app_buff;
+                currSubIo->real_size = subIoRequests[currSubIoIdx].real_size;
+                currSubIo->length = subIoRequests[currSubIoIdx].length;
                 currSubIo->is_read = false;
-                currSubIo->offset = p_data[currBlockIdx] * PageSize;
+                currSubIo->offset = subIoRequests[currSubIoIdx].offset;
                 memcpy(currSubIo->dma_buff, currSubIo->app_buff, currSubIo->real_size);
                 m_submittedSubIoRequests.push(currSubIo);
-                currBlockIdx++;
+                currSubIoIdx++;
                 inflight++;
             }
             // Try complete
@@ -405,6 +811,10 @@ bool SPDKIO::BlockController::WriteBlocks(AddressType* p_data, int p_size, const
             }
         }
         return true;
+    } else if (m_useUringImpl) {
+        std::vector<SubIoRequest> subIoRequests;
+        BuildSubIoRequests(p_data, std::min((AddressType)p_value.size(), (AddressType)p_size * PageSize), const_cast<char *>(p_value.data()), false, 0, subIoRequests);
+        return UringRun(subIoRequests, nullptr, std::chrono::microseconds::max());
     } else {
         fprintf(stderr, "SPDKIO::BlockController::ReadBlocks single failed\n");
         return false;
@@ -415,29 +825,38 @@ bool SPDKIO::BlockController::IOStatistics() {
     int currIOCount = m_ioCompleteCount;
     int diffIOCount = currIOCount - m_preIOCompleteCount;
     m_preIOCompleteCount = currIOCount;
+    int currIOBlocks = m_ioCompleteBlocks;
+    int diffIOBlocks = currIOBlocks - m_preIOCompleteBlocks;
+    m_preIOCompleteBlocks = currIOBlocks;
 
     auto currTime = std::chrono::high_resolution_clock::now();
     auto duration = std::chrono::duration_cast<std::chrono::microseconds>(currTime - m_preTime);
     m_preTime = currTime;
 
     double currIOPS = (double)diffIOCount * 1000 / duration.count();
-    double currBandWidth = (double)diffIOCount * PageSize / 1024 * 1000 / 1024 * 1000 / duration.count();
+    double currBandWidth = (double)diffIOBlocks * PageSize / 1024 * 1000 / 1024 * 1000 / duration.count();
 
     std::cout << "IOPS: " << currIOPS << "k Bandwidth: " << currBandWidth << "MB/s" << std::endl;
 
     return true;
 }
 
+bool SPDKIO::BlockController::Sync() {
+    if (m_useUringImpl) {
+        // O_DIRECT writes may still sit in the device cache
+        return m_uringFd < 0 || fdatasync(m_uringFd) == 0;
+    }
+    // mem impl is not persistent, and SPDK writes are complete once their callbacks fired
+    return true;
+}
+
 bool SPDKIO::BlockController::ShutDown() {
     std::lock_guard<std::mutex> lock(m_initMutex);
     m_numInitCalled--;
 
     if (m_useMemImpl) {
         if (m_numInitCalled == 0) {
-            while (!m_blockAddresses.empty()) {
-                AddressType currBlockAddress;
-                m_blockAddresses.try_pop(currBlockAddress);
-            }
+            ClearBlocks();
         }
         return true;
     } else if (m_useSsdImpl) {
@@ -445,10 +864,7 @@ bool SPDKIO::BlockController::ShutDown() {
             m_ssdSpdkThreadExiting = true;
             spdk_app_start_shutdown();
             pthread_join(m_ssdSpdkTid, NULL);
-            while (!m_blockAddresses.empty()) {
-                AddressType currBlockAddress;
-                m_blockAddresses.try_pop(currBlockAddress);
-            }
+            ClearBlocks();
         }
 
         SubIoRequest* currSubIo;
@@ -468,10 +884,296 @@ bool SPDKIO::BlockController::ShutDown() {
         }
         m_currIoContext.free_sub_io_requests.clear();
         return true;
+    } else if (m_useUringImpl) {
+        UringTeardown();
+        if (m_numInitCalled == 0) {
+            close(m_uringFd);
+            m_uringFd = -1;
+            ClearBlocks();
+        }
+        return true;
     } else {
         fprintf(stderr, "SPDKIO::BlockController::ShutDown failed\n");
         return false;
     }
 }
 
+std::uint32_t SPDKIO::MappingLog::Checksum(SizeType p_key, const AddressType* p_row, std::uint32_t p_count) {
+    // FNV-1a over key, count and row
+    std::uint32_t hash = 2166136261u;
+    auto mix = [&hash](const void* p_data, size_t p_len) {
+        const std::uint8_t* bytes = (const std::uint8_t*)p_data;
+        for (size_t i = 0; i < p_len; i++) {
+            hash ^= bytes[i];
+            hash *= 16777619u;
+        }
+    };
+    mix(&p_key, sizeof(p_key));
+    mix(&p_count, sizeof(p_count));
+    mix(p_row, sizeof(AddressType) * p_count);
+    return hash;
+}
+
+bool SPDKIO::MappingLog::WriteAll(const std::string& p_data) {
+    size_t written = 0;
+    while (written < p_data.size()) {
+        ssize_t ret = write(m_fd, p_data.data() + written, p_data.size() - written);
+        if (ret < 0) {
+            if (errno == EINTR) continue;
+            return false;
+        }
+        written += ret;
+    }
+    return true;
+}
+
+bool SPDKIO::MappingLog::Open(const std::string& p_path, std::function<void()> p_syncData) {
+    std::lock_guard<std::mutex> lock(m_lock);
+    m_path = p_path;
+    m_syncData = p_syncData;
+    m_fd = open(m_path.c_str(), O_WRONLY | O_CREAT | O_APPEND, 0644);
+    if (m_fd < 0) {
+        LOG(Helper::LogLevel::LL_Error, "MappingLog: open %s failed, %d\n", m_path.c_str(), errno);
+        return false;
+    }
+    struct stat st;
+    m_size = (fstat(m_fd, &st) == 0) ? st.st_size : 0;
+    return true;
+}
+
+void SPDKIO::MappingLog::Close() {
+    std::unique_lock<std::mutex> lock(m_lock);
+    m_cond.wait(lock, [this] { return !m_flushing; });
+    if (m_fd < 0) return;
+    if (!m_pending.empty()) {
+        if (m_syncData) m_syncData();
+        if (!WriteAll(m_pending) || fdatasync(m_fd) != 0) {
+            LOG(Helper::LogLevel::LL_Error, "MappingLog: flush %s failed, %d\n", m_path.c_str(), errno);
+        }
+        m_size += m_pending.size();
+        m_pending.clear();
+    }
+    m_durableLSN = m_appendLSN;
+    close(m_fd);
+    m_fd = -1;
+    m_cond.notify_all();
+}
+
+std::uint64_t SPDKIO::MappingLog::Append(SizeType p_key, const AddressType* p_row, std::uint32_t p_count) {
+    RecordHeader header;
+    header.magic = kRecordMagic;
+    header.count = p_count;
+    header.key = p_key;
+    header.checksum = Checksum(p_key, p_row, p_count);
+
+    std::lock_guard<std::mutex> lock(m_lock);
+    m_pending.append((const char*)&header, sizeof(header));
+    m_pending.append((const char*)p_row, sizeof(AddressType) * p_count);
+    m_dirty.insert(p_key);
+    return ++m_appendLSN;
+}
+
+bool SPDKIO::MappingLog::Commit(std::uint64_t p_lsn) {
+    std::unique_lock<std::mutex> lock(m_lock);
+    while (m_durableLSN < p_lsn) {
+        if (m_fd < 0) return false;
+        if (m_flushing) {
+            m_cond.wait(lock);
+            continue;
+        }
+
+        // become the leader: everything appended so far goes out with one fdatasync,
+        // records appended meanwhile form the next group
+        m_flushing = true;
+        std::string batch;
+        batch.swap(m_pending);
+        std::uint64_t batchLSN = m_appendLSN;
+        lock.unlock();
+
+        if (m_syncData) m_syncData();
+        bool success = WriteAll(batch) && fdatasync(m_fd) == 0;
+
+        lock.lock();
+        m_flushing = false;
+        if (success) {
+            m_size += batch.size();
+            m_durableLSN = batchLSN;
+            m_groupCommits++;
+        }
+        m_cond.notify_all();
+        if (!success) {
+            LOG(Helper::LogLevel::LL_Error, "MappingLog: commit to %s failed, %d\n", m_path.c_str(), errno);
+            return false;
+        }
+    }
+    return true;
+}
+
+bool SPDKIO::MappingLog::Rotate(const std::string& p_sealedPath, std::unordered_set<SizeType>& p_dirty) {
+    std::unique_lock<std::mutex> lock(m_lock);
+    m_cond.wait(lock, [this] { return !m_flushing; });
+    if (m_fd < 0) return false;
+
+    if (m_syncData) m_syncData();
+    if (!WriteAll(m_pending) || fdatasync(m_fd) != 0) {
+        LOG(Helper::LogLevel::LL_Error, "MappingLog: flush %s failed, %d\n", m_path.c_str(), errno);
+        return false;
+    }
+    m_pending.clear();
+    m_durableLSN = m_appendLSN;
+    m_cond.notify_all();
+
+    close(m_fd);
+    m_fd = -1;
+    if (rename(m_path.c_str(), p_sealedPath.c_str()) != 0) {
+        LOG(Helper::LogLevel::LL_Error, "MappingLog: seal %s failed, %d\n", m_path.c_str(), errno);
+    }
+    m_fd = open(m_path.c_str(), O_WRONLY | O_CREAT | O_APPEND | O_TRUNC, 0644);
+    if (m_fd < 0 || !SyncFile(m_path, true)) {
+        LOG(Helper::LogLevel::LL_Error, "MappingLog: reopen %s failed, %d\n", m_path.c_str(), errno);
+        return false;
+    }
+    m_size = 0;
+    p_dirty.clear();
+    p_dirty.swap(m_dirty);
+    return true;
+}
+
+std::uint64_t SPDKIO::MappingLog::Replay(const std::string& p_path, std::function<void(SizeType, AddressType*, std::uint32_t)> p_apply) {
+    int fd = open(p_path.c_str(), O_RDONLY);
+    if (fd < 0) return 0;
+
+    struct stat st;
+    std::string data;
+    if (fstat(fd, &st) == 0) data.resize(st.st_size);
+    size_t readBytes = 0;
+    while (readBytes < data.size()) {
+        ssize_t ret = read(fd, &data[readBytes], data.size() - readBytes);
+        if (ret <= 0) {
+            if (ret < 0 && errno == EINTR) continue;
+            break;
+        }
+        readBytes += ret;
+    }
+    close(fd);
+
+    std::uint64_t records = 0;
+    size_t offset = 0;
+    std::vector<AddressType> row;
+    while (offset + sizeof(RecordHeader) <= readBytes) {
+        RecordHeader header;
+        memcpy(&header, data.data() + offset, sizeof(header));
+        if (header.magic != kRecordMagic || header.count == 0 ||
+            offset + sizeof(header) + sizeof(AddressType) * (size_t)header.count > readBytes) break;
+
+        row.resize(header.count);
+        memcpy(row.data(), data.data() + offset + sizeof(header), sizeof(AddressType) * header.count);
+        if (Checksum(header.key, row.data(), header.count) != header.checksum) break;
+
+        p_apply(header.key, row.data(), header.count);
+        offset += sizeof(header) + sizeof(AddressType) * header.count;
+        records++;
+    }
+    if (offset < readBytes) {
+        LOG(Helper::LogLevel::LL_Warning, "MappingLog: %s has a torn tail at %llu of %llu bytes, ignored\n", p_path.c_str(), (unsigned long long)offset, (unsigned long long)readBytes);
+    }
+    return records;
+}
+
+bool SPDKIO::SyncFile(const std::string& p_path, bool p_parentDir) {
+    std::string path = p_path;
+    if (p_parentDir) {
+        auto pos = path.find_last_of('/');
+        path = (pos == std::string::npos) ? "." : (pos == 0 ? "/" : path.substr(0, pos));
+    }
+    int fd = open(path.c_str(), O_RDONLY);
+    if (fd < 0) return false;
+    bool success = fsync(fd) == 0;
+    close(fd);
+    return success;
+}
+
+ErrorCode SPDKIO::WriteRows(std::vector<SizeType> p_keys) {
+    SizeType CR = m_pBlockMapping.R();
+    SizeType header[2] = { 0, 0 };
+    int fd = open(m_mappingPath.c_str(), O_RDWR);
+    if (fd < 0 || pread(fd, header, sizeof(header), 0) != sizeof(header) || header[1] != m_blockLimit || header[0] > CR) {
+        if (fd >= 0) close(fd);
+        return Save(m_mappingPath);
+    }
+
+    for (SizeType i = header[0]; i < CR; i++) p_keys.push_back(i);
+    std::sort(p_keys.begin(), p_keys.end());
+    p_keys.erase(std::unique(p_keys.begin(), p_keys.end()), p_keys.end());
+
+    size_t rowBytes = sizeof(AddressType) * m_blockLimit;
+    std::vector<AddressType> row(m_blockLimit);
+    for (SizeType key : p_keys) {
+        if (key >= CR) break;
+        {
+            std::lock_guard<std::mutex> keyLock(m_keyLocks[key]);
+            if (At(key) == 0xffffffffffffffff) memset(row.data(), -1, rowBytes);
+            else memcpy(row.data(), (AddressType*)At(key), rowBytes);
+        }
+        if (pwrite(fd, row.data(), rowBytes, sizeof(header) + rowBytes * key) != (ssize_t)rowBytes) {
+            LOG(Helper::LogLevel::LL_Error, "Fail to write mapping row %d to %s, %d\n", key, m_mappingPath.c_str(), errno);
+            close(fd);
+            return ErrorCode::DiskIOFail;
+        }
+    }
+    // rows must be on disk before the header makes the appended ones visible
+    bool success = fdatasync(fd) == 0;
+    header[0] = CR;
+    success = success && pwrite(fd, header, sizeof(header), 0) == sizeof(header) && fdatasync(fd) == 0;
+    close(fd);
+    if (!success) {
+        LOG(Helper::LogLevel::LL_Error, "Fail to sync mapping %s, %d\n", m_mappingPath.c_str(), errno);
+        return ErrorCode::DiskIOFail;
+    }
+    return ErrorCode::Success;
+}
+
+void SPDKIO::Recover() {
+    std::unordered_set<SizeType> replayed;
+    auto apply = [this, &replayed](SizeType key, AddressType* row, std::uint32_t count) {
+        if (key >= m_pBlockMapping.R()) m_pBlockMapping.AddBatch(key + 1 - m_pBlockMapping.R());
+        if (row[0] < 0) {
+            if (At(key) != 0xffffffffffffffff) {
+                delete[]((AddressType*)At(key));
+                At(key) = 0xffffffffffffffff;
+            }
+        }
+        else {
+            if (At(key) == 0xffffffffffffffff) At(key) = (uintptr_t)(new AddressType[m_blockLimit]);
+            memset((AddressType*)At(key), -1, sizeof(AddressType) * m_blockLimit);
+            memcpy((AddressType*)At(key), row, sizeof(AddressType) * std::min((SizeType)count, m_blockLimit));
+        }
+        replayed.insert(key);
+    };
+
+    std::string sealedPath = m_mappingPath + kSealedWALSuffix;
+    std::string activePath = m_mappingPath + kWALSuffix;
+    std::uint64_t records = MappingLog::Replay(sealedPath, apply);
+    records += MappingLog::Replay(activePath, apply);
+    if (records == 0) return;
+
+    LOG(Helper::LogLevel::LL_Info, "Replay %llu mapping log records on %d rows\n", (unsigned long long)records, (int)replayed.size());
+    if (WriteRows(std::vector<SizeType>(replayed.begin(), replayed.end())) == ErrorCode::Success) {
+        remove(sealedPath.c_str());
+        remove(activePath.c_str());
+    }
+}
+
+void SPDKIO::ReserveMappedBlocks() {
+    std::uint64_t reserved = 0;
+    for (SizeType i = 0; i < m_pBlockMapping.R(); i++) {
+        if (At(i) == 0xffffffffffffffff) continue;
+        AddressType* row = (AddressType*)At(i);
+        if (row[0] < 0) continue;
+        int blocks = (int)((row[0] + PageSize - 1) >> PageSizeEx);
+        reserved += m_pBlockController.ReserveBlocks(row + 1, blocks);
+    }
+    LOG(Helper::LogLevel::LL_Info, "Reserve %llu blocks referenced by the mapping\n", (unsigned long long)reserved);
+}
+
 }
@@ -83,6 +83,7 @@ namespace SPTAG
         template <typename T>
         ErrorCode Index<T>::LoadIndexDataFromMemory(const std::vector<ByteArray>& p_indexBlobs)
         {
+            if (!COMMON::DatasetMemoryPolicy::Configure(m_options.m_datasetMemoryPolicy)) return ErrorCode::FailedParseValue;
             m_index->SetQuantizer(m_pQuantizer);
             if (m_index->LoadIndexDataFromMemory(p_indexBlobs) != ErrorCode::Success) return ErrorCode::Fail;
 
@@ -122,8 +123,26 @@ namespace SPTAG
         template <typename T>
         ErrorCode Index<T>::LoadIndexData(const std::vector<std::shared_ptr<Helper::DiskIO>>& p_indexStreams)
         {
+            if (!COMMON::DatasetMemoryPolicy::Configure(m_options.m_datasetMemoryPolicy)) return ErrorCode::FailedParseValue;
             m_index->SetQuantizer(m_pQuantizer);
-            if (m_index->LoadIndexData(p_indexStreams) != ErrorCode::Success) return ErrorCode::Fail;
+            if (m_options.m_mmapIndex) {
+                // the head reads its samples, graph and labels in place, appends land in new blocks
+                std::string headFolder = m_options.m_indexDirectory + FolderSep + m_options.m_headIndexFolder + FolderSep;
+                std::vector<ByteArray> blobs;
+                m_mappedHeadFiles.clear();
+                for (const std::string& file : *(m_index->GetIndexFiles())) {
+                    std::shared_ptr<Helper::MappedFile> mapped(new Helper::MappedFile());
+                    if (!mapped->Open(headFolder + file, m_options.m_mmapPrefetch)) {
+                        LOG(Helper::LogLevel::LL_Error, "Failed to map %s\n", (headFolder + file).c_str());
+                        return ErrorCode::FailedOpenFile;
+                    }
+                    blobs.push_back(ByteArray((std::uint8_t*)mapped->Data(), mapped->Size(), false));
+                    m_mappedHeadFiles.push_back(std::move(mapped));
+                }
+                if (m_index->LoadIndexDataFromMemory(blobs) != ErrorCode::Success) return ErrorCode::Fail;
+            }
+            else if (m_index->LoadIndexData(p_indexStreams) != ErrorCode::Success) return ErrorCode::Fail;
+            if (m_options.m_headCheckpoint && LoadCheckpoints(true) != ErrorCode::Success) return ErrorCode::Fail;
 
             m_index->SetParameter("NumberOfThreads", std::to_string(m_options.m_iSSDNumberOfThreads));
             m_index->SetParameter("MaxCheck", std::to_string(m_options.m_maxCheck));
@@ -148,7 +167,7 @@ namespace SPTAG
                     }
                 }
                 else if (m_options.m_useSPDK) {
-                    m_extraSearcher.reset(new ExtraDynamicSearcher<T>(m_options.m_spdkMappingPath.c_str(), m_options.m_dim, m_options.m_postingPageLimit, m_options.m_useDirectIO, m_options.m_latencyLimit, m_options.m_mergeThreshold, true, m_options.m_spdkBatchSize, m_options.m_bufferLength));
+                    m_extraSearcher.reset(new ExtraDynamicSearcher<T>(m_options.m_spdkMappingPath.c_str(), m_options.m_dim, m_options.m_postingPageLimit, m_options.m_useDirectIO, m_options.m_latencyLimit, m_options.m_mergeThreshold, true, m_options.m_spdkBatchSize, m_options.m_bufferLength, m_options.m_spdkCompactionIOBudget, m_options.m_spdkEnableWAL, m_options.m_spdkCheckpointWALSize, m_options.m_spdkTailCacheSize));
                 } else {
                     m_extraSearcher.reset(new ExtraStaticSearcher<T>());
                 }
@@ -165,7 +184,14 @@ namespace SPTAG
 
             if (m_options.m_useSPDK) {
                 int m_vectorLimit = m_options.m_postingPageLimit * PageSize / (sizeof(T) * m_options.m_dim + sizeof(int) + sizeof(uint8_t));
-                m_versionMap.Initialize(m_options.m_vectorSize, m_index->m_iDataBlockSize, m_index->m_iDataCapacity);
+                if (m_options.m_headCheckpoint) {
+                    // the label deltas build on the saved labels, replay them ahead of the copy so that it writes the current versions
+                    if (m_versionMap.Load(m_options.m_deleteIDFile, m_index->m_iDataBlockSize, m_index->m_iDataCapacity) != ErrorCode::Success ||
+                        LoadCheckpoints(false) != ErrorCode::Success) return ErrorCode::Fail;
+                }
+                else {
+                    m_versionMap.Initialize(m_options.m_vectorSize, m_index->m_iDataBlockSize, m_index->m_iDataCapacity);
+                }
                 int m_vectorInfoSize = sizeof(T) * m_options.m_dim + sizeof(int) + sizeof(uint8_t);
                 LOG(Helper::LogLevel::LL_Info, "Copying data from static to SPDK\n");
                 std::shared_ptr<IExtraSearcher> storeExtraSearcher;
@@ -234,9 +260,13 @@ namespace SPTAG
                 };
             for (int j = 0; j < m_options.m_iSSDNumberOfThreads; j++) { threads.emplace_back(func); }
             for (auto& thread : threads) { thread.join(); }
+            } else if (m_options.m_mmapIndex) {
+                m_versionMap.LoadMapped(m_options.m_deleteIDFile, m_index->m_iDataBlockSize, m_index->m_iDataCapacity, m_options.m_mmapPrefetch);
             } else {
                 m_versionMap.Load(m_options.m_deleteIDFile, m_index->m_iDataBlockSize, m_index->m_iDataCapacity);
             }
+            // SPDK mode has replayed the label deltas ahead of its copy
+            if (m_options.m_headCheckpoint && !m_options.m_useSPDK && LoadCheckpoints(false) != ErrorCode::Success) return ErrorCode::Fail;
 
             if ((m_options.m_useSPDK || m_options.m_useKV) && m_options.m_preReassign) {
                 std::shared_ptr<Helper::ReaderOptions> vectorOptions(new Helper::ReaderOptions(m_options.m_valueType, m_options.m_dim, m_options.m_vectorType, m_options.m_vectorDelimiter, m_options.m_iSSDNumberOfThreads));
@@ -302,14 +332,161 @@ namespace SPTAG
         {
             if (m_index == nullptr) return ErrorCode::EmptyIndex;
 
+            std::unique_lock<std::mutex> checkpointLock(m_checkpointLock, std::defer_lock);
+            if (m_options.m_headCheckpoint) {
+                // the full save covers every change up to here, the ones racing it are simply in the next delta too
+                checkpointLock.lock();
+                if (m_checkpointMerger.joinable()) m_checkpointMerger.join();
+                m_index->SaveIndexDataDelta(std::vector<std::shared_ptr<Helper::DiskIO>>());
+                std::lock_guard<std::mutex> lock(m_dataAddLock);
+                m_versionMap.SaveDelta(nullptr);
+            }
+
             ErrorCode ret;
             if ((ret = m_index->SaveIndexData(p_indexStreams)) != ErrorCode::Success) return ret;
 
             if (m_options.m_excludehead) IOBINARY(p_indexStreams[m_index->GetIndexFiles()->size()], WriteBinary, sizeof(std::uint64_t) * m_index->GetNumSamples(), (char*)(m_vectorTranslateMap.get()));
             m_versionMap.Save(m_options.m_deleteIDFile);
+
+            if (m_options.m_headCheckpoint) {
+                for (const char* suffix : { ".delta", ".delta.merging" }) {
+                    for (const std::string& file : CheckpointFiles(suffix)) {
+                        if (fileexists(file.c_str())) std::remove(file.c_str());
+                    }
+                }
+            }
             return ErrorCode::Success;
         }
 
+        template<typename T>
+        std::vector<std::string> Index<T>::CheckpointFiles(const std::string& p_suffix) const
+        {
+            std::string headFolder = m_options.m_indexDirectory + FolderSep + m_options.m_headIndexFolder + FolderSep;
+            std::vector<std::string> files;
+            for (const std::string& file : *(m_index->GetIndexFiles())) files.push_back(headFolder + file + p_suffix);
+            files.push_back(m_options.m_deleteIDFile + p_suffix);
+            return files;
+        }
+
+        template<typename T>
+        ErrorCode Index<T>::LoadCheckpoints(bool p_head)
+        {
+            // an interrupted merge leaves its input behind, replaying it over files it was already folded into is harmless
+            ErrorCode ret = ErrorCode::Success;
+            for (const char* suffix : { ".delta.merging", ".delta" }) {
+                std::vector<std::string> files = CheckpointFiles(suffix);
+                if (!p_head) {
+                    if ((ret = m_versionMap.LoadDeltas(files.back())) != ErrorCode::Success) return ret;
+                    continue;
+                }
+
+                std::vector<std::shared_ptr<Helper::DiskIO>> streams;
+                for (size_t i = 0; i + 1 < files.size(); i++) {
+                    std::shared_ptr<Helper::DiskIO> ptr;
+                    if (fileexists(files[i].c_str())) {
+                        LOG(Helper::LogLevel::LL_Info, "Load head deltas From %s\n", files[i].c_str());
+                        ptr = f_createIO();
+                        if (ptr == nullptr || !ptr->Initialize(files[i].c_str(), std::ios::binary | std::ios::in)) return ErrorCode::FailedOpenFile;
+                    }
+                    streams.push_back(ptr);
+                }
+                if ((ret = m_index->LoadIndexDataDelta(streams)) != ErrorCode::Success) return ret;
+            }
+            return ret;
+        }
+
+        template<typename T>
+        ErrorCode Index<T>::Checkpoint()
+        {
+            if (m_index == nullptr) return ErrorCode::EmptyIndex;
+            if (!m_options.m_headCheckpoint) {
+                LOG(Helper::LogLevel::LL_Error, "Checkpoint needs HeadCheckpoint, which tracks the head changes from the load on\n");
+                return ErrorCode::Fail;
+            }
+
+            std::lock_guard<std::mutex> lock(m_checkpointLock);
+            auto t1 = std::chrono::high_resolution_clock::now();
+            std::vector<std::string> files = CheckpointFiles(".delta");
+            std::vector<std::shared_ptr<Helper::DiskIO>> streams;
+            for (const std::string& file : files) {
+                auto ptr = f_createIO();
+                if (ptr == nullptr || !ptr->Initialize(file.c_str(), std::ios::binary | std::ios::out | std::ios::app)) return ErrorCode::FailedCreateFile;
+                streams.push_back(ptr);
+            }
+            std::shared_ptr<Helper::DiskIO> versionStream = streams.back();
+            streams.pop_back();
+
+            ErrorCode ret;
+            if ((ret = m_index->SaveIndexDataDelta(streams)) != ErrorCode::Success) return ret;
+            {
+                std::lock_guard<std::mutex> addLock(m_dataAddLock);
+                if ((ret = m_versionMap.SaveDelta(versionStream)) != ErrorCode::Success) return ret;
+            }
+
+            // the checkpoint only counts once every delta is on stable storage
+            streams.push_back(versionStream);
+            std::uint64_t deltaBytes = 0;
+            for (size_t i = 0; i < streams.size(); i++) {
+                deltaBytes += streams[i]->TellP();
+                if (!streams[i]->Sync()) {
+                    LOG(Helper::LogLevel::LL_Error, "Checkpoint head: failed to sync %s\n", files[i].c_str());
+                    return ErrorCode::DiskIOFail;
+                }
+                streams[i]->ShutDown();
+            }
+            if (m_extraSearcher != nullptr && !m_extraSearcher->SyncData()) {
+                LOG(Helper::LogLevel::LL_Error, "Checkpoint head: failed to sync the data beside the postings\n");
+                return ErrorCode::DiskIOFail;
+            }
+            std::uint64_t baseBytes = m_versionMap.BufferSize();
+            for (std::uint64_t bytes : *(m_index->BufferSize())) baseBytes += bytes;
+
+            auto t2 = std::chrono::high_resolution_clock::now();
+            LOG(Helper::LogLevel::LL_Info, "Checkpoint head: %llu delta bytes over %llu, cost %.2lf s\n", (unsigned long long)deltaBytes, (unsigned long long)baseBytes,
+                std::chrono::duration_cast<std::chrono::milliseconds>(t2 - t1).count() / 1000.0);
+
+            if (deltaBytes <= baseBytes * m_options.m_headCheckpointMergeRatio || m_checkpointMerging) return ErrorCode::Success;
+
+            std::vector<std::string> merging = CheckpointFiles(".delta.merging");
+            for (const std::string& file : merging) {
+                if (fileexists(file.c_str())) {
+                    LOG(Helper::LogLevel::LL_Warning, "Checkpoint head: %s from a failed merge is still pending\n", file.c_str());
+                    return ErrorCode::Success;
+                }
+            }
+            if (m_checkpointMerger.joinable()) m_checkpointMerger.join();
+            for (size_t i = 0; i < files.size(); i++) {
+                if (!COMMON::ReplaceDeltaBase(files[i], merging[i])) {
+                    LOG(Helper::LogLevel::LL_Error, "Checkpoint head: failed to seal %s\n", files[i].c_str());
+                    return ErrorCode::Fail;
+                }
+            }
+            m_checkpointMerging = true;
+            m_checkpointMerger = std::thread(&Index<T>::MergeCheckpoints, this, CheckpointFiles(""), merging);
+            return ErrorCode::Success;
+        }
+
+        template<typename T>
+        void Index<T>::MergeCheckpoints(std::vector<std::string> p_baseFiles, std::vector<std::string> p_mergingFiles)
+        {
+            auto t1 = std::chrono::high_resolution_clock::now();
+            std::vector<std::string> headFiles(p_baseFiles.begin(), p_baseFiles.end() - 1);
+            std::vector<std::string> headDeltas(p_mergingFiles.begin(), p_mergingFiles.end() - 1);
+            ErrorCode ret = m_index->MergeIndexDataDelta(headFiles, headDeltas);
+            if (ret == ErrorCode::Success) ret = COMMON::VersionLabel::MergeDeltas(p_baseFiles.back(), p_mergingFiles.back());
+
+            if (ret == ErrorCode::Success) {
+                for (const std::string& file : p_mergingFiles) std::remove(file.c_str());
+                auto t2 = std::chrono::high_resolution_clock::now();
+                LOG(Helper::LogLevel::LL_Info, "Checkpoint head: merged the deltas, cost %.2lf s\n",
+                    std::chrono::duration_cast<std::chrono::milliseconds>(t2 - t1).count() / 1000.0);
+            }
+            else {
+                LOG(Helper::LogLevel::LL_Error, "Checkpoint head: merge failed (%d), the next load replays the sealed deltas\n", (int)ret);
+            }
+            m_checkpointMerging = false;
+        }
+
 #pragma region K-NN search
 
         template<typename T>
@@ -332,6 +509,7 @@ namespace SPTAG
                 }
                 m_workspace->m_deduper.clear();
                 m_workspace->m_postingIDs.clear();
+                m_workspace->m_postingDists.clear();
 
                 float limitDist = p_queryResults->GetResult(0)->Dist * m_options.m_maxDistRatio;
                 for (int i = 0; i < p_queryResults->GetResultNum(); ++i)
@@ -340,6 +518,7 @@ namespace SPTAG
                     if (res->VID == -1) break;
                     
                     auto postingID = res->VID;
+                    float headDist = res->Dist;
                     if (m_vectorTranslateMap.get() != nullptr) res->VID = static_cast<SizeType>((m_vectorTranslateMap.get())[res->VID]);
                     else {
                         res->VID = -1;
@@ -352,6 +531,7 @@ namespace SPTAG
                         !m_extraSearcher->CheckValidPosting(postingID))
                         continue;
                     m_workspace->m_postingIDs.emplace_back(postingID);
+                    m_workspace->m_postingDists.emplace_back(headDist);
                 }
 
                 if (m_vectorTranslateMap.get() != nullptr) p_queryResults->Reverse();
@@ -388,7 +568,36 @@ namespace SPTAG
             }
             m_workspace->m_deduper.clear();
             m_workspace->m_postingIDs.clear();
+            m_workspace->m_postingDists.clear();
+
+            CollectPostingIDs(p_queryResults, m_workspace->m_postingIDs, &m_workspace->m_postingDists);
+            m_extraSearcher->SearchIndex(m_workspace.get(), *p_queryResults, m_index, p_stats);
+            p_queryResults->SortResult();
+            return ErrorCode::Success;
+        }
+
+        template <typename T>
+        ErrorCode Index<T>::SearchDiskIndexBatch(std::vector<QueryResult*>& p_queries, SearchStats* p_stats) const
+        {
+            if (nullptr == m_extraSearcher) return ErrorCode::EmptyIndex;
+
+            if (m_workspace.get() == nullptr) {
+                m_workspace.reset(new ExtraWorkSpace());
+                m_workspace->Initialize(m_options.m_maxCheck, m_options.m_hashExp, m_options.m_searchInternalResultNum, min(m_options.m_postingPageLimit, m_options.m_searchPostingPageLimit + 1) << PageSizeEx, m_options.m_enableDataCompression);
+            }
 
+            std::vector<std::vector<SizeType>> postingIDs(p_queries.size());
+            for (size_t i = 0; i < p_queries.size(); i++) {
+                CollectPostingIDs((COMMON::QueryResultSet<T>*)p_queries[i], postingIDs[i]);
+            }
+            m_extraSearcher->SearchIndexBatch(m_workspace.get(), p_queries, postingIDs, m_index, p_stats);
+            for (QueryResult* p_query : p_queries) ((COMMON::QueryResultSet<T>*)p_query)->SortResult();
+            return ErrorCode::Success;
+        }
+
+        template <typename T>
+        void Index<T>::CollectPostingIDs(COMMON::QueryResultSet<T>* p_queryResults, std::vector<SizeType>& p_postingIDs, std::vector<float>* p_postingDists) const
+        {
             float limitDist = p_queryResults->GetResult(0)->Dist * m_options.m_maxDistRatio;
             int i = 0;
             for (; i < p_queryResults->GetResultNum(); ++i)
@@ -397,7 +606,8 @@ namespace SPTAG
                 if (res->VID == -1 || (limitDist > 0.1 && res->Dist > limitDist)) break;
                 if (m_extraSearcher->CheckValidPosting(res->VID))
                 {
-                    m_workspace->m_postingIDs.emplace_back(res->VID);
+                    p_postingIDs.emplace_back(res->VID);
+                    if (p_postingDists != nullptr) p_postingDists->emplace_back(res->Dist);
                 }
                 if (m_vectorTranslateMap.get() != nullptr) res->VID = static_cast<SizeType>((m_vectorTranslateMap.get())[res->VID]);
                 else {
@@ -417,9 +627,6 @@ namespace SPTAG
                 }
             }
             if (m_vectorTranslateMap.get() != nullptr) p_queryResults->Reverse();
-            m_extraSearcher->SearchIndex(m_workspace.get(), *p_queryResults, m_index, p_stats);
-            p_queryResults->SortResult();
-            return ErrorCode::Success;
         }
 
         template <typename T>
@@ -458,6 +665,7 @@ namespace SPTAG
                 int subInternalResultNum = min(p_subInternalResultNum, p_internalResultNum - p_subInternalResultNum * p);
 
                 m_workspace->m_postingIDs.clear();
+                m_workspace->m_postingDists.clear();
 
                 for (int i = p * p_subInternalResultNum; i < p * p_subInternalResultNum + subInternalResultNum; i++)
                 {
@@ -647,10 +855,47 @@ namespace SPTAG
             p_selected.erase(std::unique(p_selected.begin(), p_selected.end()), p_selected.end());
         }
 
+        template <typename T>
+        std::shared_ptr<VectorSet> Index<T>::SampleHeadCandidates(std::shared_ptr<Helper::VectorSetReader>& p_reader, std::vector<SizeType>& p_sampleIDs)
+        {
+            SizeType vectorCount = p_reader->GetVectorCount();
+            std::int64_t headCount = (m_options.m_headVectorCount != 0) ? m_options.m_headVectorCount : static_cast<std::int64_t>(std::round(m_options.m_ratio * vectorCount));
+            std::int64_t sampleCount = (m_options.m_streamingHeadSamples > 0) ? m_options.m_streamingHeadSamples : 4 * headCount;
+            sampleCount = max(sampleCount, headCount);
+            if (sampleCount >= vectorCount) return p_reader->GetVectorSet();
+
+            // Selection sampling keeps the ids sorted, so the sample is read front to back.
+            p_sampleIDs.reserve(sampleCount);
+            for (SizeType i = 0; i < vectorCount && (std::int64_t)p_sampleIDs.size() < sampleCount; i++) {
+                std::uniform_int_distribution<std::int64_t> dist(0, (std::int64_t)vectorCount - i - 1);
+                if (dist(rg) < sampleCount - (std::int64_t)p_sampleIDs.size()) p_sampleIDs.push_back(i);
+            }
+
+            std::shared_ptr<VectorSet> first = p_reader->GetVectorSet(0, 1);
+            SizeType perVectorSize = first->PerVectorDataSize();
+            ByteArray samples = ByteArray::Alloc((std::uint64_t)perVectorSize * p_sampleIDs.size());
+
+            const SizeType rowsPerRead = 1 << 20;
+            size_t next = 0;
+            for (SizeType start = 0; start < vectorCount && next < p_sampleIDs.size(); start += rowsPerRead) {
+                SizeType end = min(start + rowsPerRead, vectorCount);
+                if (p_sampleIDs[next] >= end) continue;
+
+                std::shared_ptr<VectorSet> rows = p_reader->GetVectorSet(start, end);
+                for (; next < p_sampleIDs.size() && p_sampleIDs[next] < end; next++) {
+                    std::memcpy(samples.Data() + (std::uint64_t)perVectorSize * next, rows->GetVector(p_sampleIDs[next] - start), perVectorSize);
+                }
+            }
+            LOG(Helper::LogLevel::LL_Info, "Sampled %zu of %d vectors for head selection.\n", p_sampleIDs.size(), vectorCount);
+            return std::make_shared<BasicVectorSet>(samples, first->GetValueType(), first->Dimension(), (SizeType)p_sampleIDs.size());
+        }
+
         template <typename T>
         template <typename InternalDataType>
         bool Index<T>::SelectHeadInternal(std::shared_ptr<Helper::VectorSetReader>& p_reader) {
-            std::shared_ptr<VectorSet> vectorset = p_reader->GetVectorSet();
+            // Global id of every sampled row, left empty when the whole set is selected from.
+            std::vector<SizeType> sampleIDs;
+            std::shared_ptr<VectorSet> vectorset = m_options.m_streamingBuild ? SampleHeadCandidates(p_reader, sampleIDs) : p_reader->GetVectorSet();
             if (m_options.m_distCalcMethod == DistCalcMethod::Cosine && !p_reader->IsNormalized())
                 vectorset->Normalize(m_options.m_iSelectHeadNumberOfThreads);
 
@@ -659,6 +904,10 @@ namespace SPTAG
             COMMON::Dataset<InternalDataType> data(vectorset->Count(), vectorset->Dimension(), vectorset->Count(), vectorset->Count() + 1, (InternalDataType*)vectorset->GetData());
 
             auto t1 = std::chrono::high_resolution_clock::now();
+            if (!sampleIDs.empty() && m_options.m_headVectorCount == 0) {
+                // The sample has to yield as many heads as the ratio asks of the full set.
+                m_options.m_headVectorCount = static_cast<int>(std::round(m_options.m_ratio * p_reader->GetVectorCount()));
+            }
             SelectHeadAdjustOptions(data.R());
             std::vector<int> selected;
             if (data.R() == 1) {
@@ -741,7 +990,8 @@ namespace SPTAG
                 for (int i = 0; i < selected.size(); i++)
                 {
                     uint64_t vid = static_cast<uint64_t>(selected[i]);
-                    if (outputIDs->WriteBinary(sizeof(vid), reinterpret_cast<char*>(&vid)) != sizeof(vid)) {
+                    uint64_t globalID = sampleIDs.empty() ? vid : static_cast<uint64_t>(sampleIDs[vid]);
+                    if (outputIDs->WriteBinary(sizeof(globalID), reinterpret_cast<char*>(&globalID)) != sizeof(globalID)) {
                         LOG(Helper::LogLevel::LL_Error, "Failed to write output file!\n");
                         return false;
                     }
@@ -760,6 +1010,7 @@ namespace SPTAG
 
         template <typename T>
         ErrorCode Index<T>::BuildIndexInternal(std::shared_ptr<Helper::VectorSetReader>& p_reader) {
+            if (!COMMON::DatasetMemoryPolicy::Configure(m_options.m_datasetMemoryPolicy)) return ErrorCode::FailedParseValue;
             if (!m_options.m_indexDirectory.empty()) {
                 if (!direxists(m_options.m_indexDirectory.c_str()))
                 {
@@ -860,7 +1111,7 @@ namespace SPTAG
                         exit(1);
                     }
                     else {
-                        m_extraSearcher.reset(new ExtraDynamicSearcher<T>(m_options.m_spdkMappingPath.c_str(), m_options.m_dim, m_options.m_postingPageLimit, m_options.m_useDirectIO, m_options.m_latencyLimit, m_options.m_mergeThreshold, true, m_options.m_spdkBatchSize));
+                        m_extraSearcher.reset(new ExtraDynamicSearcher<T>(m_options.m_spdkMappingPath.c_str(), m_options.m_dim, m_options.m_postingPageLimit, m_options.m_useDirectIO, m_options.m_latencyLimit, m_options.m_mergeThreshold, true, m_options.m_spdkBatchSize, m_options.m_bufferLength, m_options.m_spdkCompactionIOBudget, m_options.m_spdkEnableWAL, m_options.m_spdkCheckpointWALSize, m_options.m_spdkTailCacheSize));
                     }  
                 }
                 else {
@@ -910,6 +1161,17 @@ namespace SPTAG
                         m_extraSearcher->RefineIndex(p_reader, m_index);
                     }
                 }
+
+                if (m_options.m_headCheckpoint) {
+                    // checkpoints append to the head and labels the build wrote, deltas left over belong to an older index
+                    m_index->SaveIndexDataDelta(std::vector<std::shared_ptr<Helper::DiskIO>>());
+                    m_versionMap.SaveDelta(nullptr);
+                    for (const char* suffix : { ".delta", ".delta.merging" }) {
+                        for (const std::string& file : CheckpointFiles(suffix)) {
+                            if (fileexists(file.c_str())) std::remove(file.c_str());
+                        }
+                    }
+                }
             }
             
             auto t4 = std::chrono::high_resolution_clock::now();
@@ -944,7 +1206,7 @@ namespace SPTAG
                     LOG(Helper::LogLevel::LL_Error, "Failed to read vector file.\n");
                     return ErrorCode::Fail;
                 }
-                m_options.m_vectorSize = vectorReader->GetVectorSet()->Count();
+                m_options.m_vectorSize = vectorReader->GetVectorCount();
             }
 
             return BuildIndexInternal(vectorReader);
@@ -6,6 +6,7 @@
 #include "inc/Helper/StringConvert.h"
 #include "inc/Helper/SimpleIniReader.h"
 #include "inc/Helper/ConcurrentSet.h"
+#include "inc/Helper/MappedFile.h"
 
 #include "inc/Core/BKT/Index.h"
 #include "inc/Core/KDT/Index.h"
@@ -332,6 +333,7 @@ VectorIndex::SaveIndex(const std::string& p_folderPath)
         std::string newfile = folderPath + f;
         if (!direxists(newfile.substr(0, newfile.find_last_of(FolderSep)).c_str())) mkdir(newfile.substr(0, newfile.find_last_of(FolderSep)).c_str());
         
+        Helper::MappedFile::PrepareRewrite(newfile);
         auto ptr = SPTAG::f_createIO();
         if (ptr == nullptr || !ptr->Initialize(newfile.c_str(), std::ios::binary | std::ios::out)) return ErrorCode::FailedCreateFile;
         handles.push_back(std::move(ptr));
@@ -430,10 +432,27 @@ VectorIndex::BuildIndex(std::shared_ptr<VectorSet> p_vectorSet,
 ErrorCode
 VectorIndex::SearchIndex(const void* p_vector, int p_vectorCount, int p_neighborCount, bool p_withMeta, BasicResult* p_results) const {
     size_t vectorSize = GetValueTypeSize(GetVectorValueType()) * GetFeatureDim();
-#pragma omp parallel for schedule(dynamic,10)
-    for (int i = 0; i < p_vectorCount; i++) {
-        QueryResult res((char*)p_vector + i * vectorSize, p_neighborCount, p_withMeta, p_results + i * p_neighborCount);
-        SearchIndex(res);
+    const int batchSize = 64;
+#pragma omp parallel for schedule(dynamic)
+    for (int start = 0; start < p_vectorCount; start += batchSize) {
+        std::vector<QueryResult> res;
+        std::vector<QueryResult*> batch;
+        res.reserve(batchSize);
+        for (int i = start; i < min(start + batchSize, p_vectorCount); i++) {
+            res.emplace_back((char*)p_vector + i * vectorSize, p_neighborCount, p_withMeta, p_results + i * p_neighborCount);
+            batch.push_back(&res.back());
+        }
+        SearchIndexBatch(batch);
+    }
+    return ErrorCode::Success;
+}
+
+
+ErrorCode
+VectorIndex::SearchIndexBatch(std::vector<QueryResult*>& p_queries, bool p_searchDeleted) const {
+    for (QueryResult* p_query : p_queries) {
+        ErrorCode ret = SearchIndex(*p_query, p_searchDeleted);
+        if (ret != ErrorCode::Success) return ret;
     }
     return ErrorCode::Success;
 }
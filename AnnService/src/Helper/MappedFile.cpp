@@ -0,0 +1,142 @@
+// Copyright (c) Microsoft Corporation. All rights reserved.
+// Licensed under the MIT License.
+
+#include "inc/Core/Common.h"
+#include "inc/Helper/MappedFile.h"
+
+#include <cstdint>
+#include <map>
+#include <mutex>
+
+#ifdef _MSC_VER
+#include <Windows.h>
+#else
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+
+using namespace SPTAG;
+using namespace SPTAG::Helper;
+
+#ifndef _MSC_VER
+namespace
+{
+    // Files with a live mapping in this process, keyed by (device, inode) so that any
+    // spelling of the path matches, with the number of mappings on each.
+    std::mutex g_mappedLock;
+    std::map<std::pair<std::uint64_t, std::uint64_t>, int> g_mappedFiles;
+}
+#endif
+
+bool MappedFile::Open(const std::string& p_path, bool p_prefetch)
+{
+    Close();
+#ifdef _MSC_VER
+    HANDLE file = ::CreateFileA(p_path.c_str(), GENERIC_READ, FILE_SHARE_READ | FILE_SHARE_DELETE, NULL, OPEN_EXISTING, FILE_ATTRIBUTE_NORMAL, NULL);
+    if (file == INVALID_HANDLE_VALUE) return false;
+
+    LARGE_INTEGER size;
+    if (!::GetFileSizeEx(file, &size) || size.QuadPart == 0) {
+        ::CloseHandle(file);
+        return false;
+    }
+
+    HANDLE mapping = ::CreateFileMappingA(file, NULL, PAGE_WRITECOPY, 0, 0, NULL);
+    ::CloseHandle(file);
+    if (mapping == NULL) return false;
+
+    void* data = ::MapViewOfFile(mapping, FILE_MAP_COPY, 0, 0, 0);
+    if (data == NULL) {
+        ::CloseHandle(mapping);
+        return false;
+    }
+
+    if (p_prefetch) {
+        WIN32_MEMORY_RANGE_ENTRY range = { data, (SIZE_T)size.QuadPart };
+        ::PrefetchVirtualMemory(::GetCurrentProcess(), 1, &range, 0);
+    }
+
+    m_mapping = mapping;
+    m_size = (std::size_t)size.QuadPart;
+#else
+    int fd = ::open(p_path.c_str(), O_RDONLY);
+    if (fd < 0) return false;
+
+    struct stat st;
+    if (::fstat(fd, &st) != 0 || st.st_size == 0) {
+        ::close(fd);
+        return false;
+    }
+
+    void* data = ::mmap(nullptr, (std::size_t)st.st_size, PROT_READ | PROT_WRITE, MAP_PRIVATE, fd, 0);
+    ::close(fd);
+    if (data == MAP_FAILED) return false;
+
+    ::madvise(data, (std::size_t)st.st_size, p_prefetch ? MADV_WILLNEED : MADV_RANDOM);
+
+    m_size = (std::size_t)st.st_size;
+    m_device = (std::uint64_t)st.st_dev;
+    m_inode = (std::uint64_t)st.st_ino;
+    {
+        std::lock_guard<std::mutex> lock(g_mappedLock);
+        g_mappedFiles[std::make_pair(m_device, m_inode)]++;
+    }
+#endif
+    m_data = (char*)data;
+    m_path = p_path;
+    LOG(Helper::LogLevel::LL_Info, "Mapped %s (%zu bytes)\n", p_path.c_str(), m_size);
+    return true;
+}
+
+void MappedFile::Close()
+{
+    if (m_data == nullptr) return;
+#ifdef _MSC_VER
+    ::UnmapViewOfFile(m_data);
+    ::CloseHandle((HANDLE)m_mapping);
+    m_mapping = nullptr;
+#else
+    ::munmap(m_data, m_size);
+    {
+        std::lock_guard<std::mutex> lock(g_mappedLock);
+        auto iter = g_mappedFiles.find(std::make_pair(m_device, m_inode));
+        if (iter != g_mappedFiles.end() && --(iter->second) == 0) g_mappedFiles.erase(iter);
+    }
+#endif
+    m_data = nullptr;
+    m_size = 0;
+    m_path.clear();
+}
+
+void MappedFile::PrepareRewrite(const std::string& p_path)
+{
+#ifndef _MSC_VER
+    struct stat st;
+    if (::stat(p_path.c_str(), &st) != 0) return;
+
+    std::lock_guard<std::mutex> lock(g_mappedLock);
+    if (g_mappedFiles.find(std::make_pair((std::uint64_t)st.st_dev, (std::uint64_t)st.st_ino)) == g_mappedFiles.end()) return;
+    // The mapping pins the old inode, so the rewrite lands in a fresh file.
+    ::unlink(p_path.c_str());
+#endif
+    // Windows refuses to truncate a mapped file, the following open fails cleanly instead.
+}
+
+bool MappedFile::SyncFile(const std::string& p_path)
+{
+#ifdef _MSC_VER
+    HANDLE file = ::CreateFileA(p_path.c_str(), GENERIC_WRITE, FILE_SHARE_READ | FILE_SHARE_WRITE | FILE_SHARE_DELETE, NULL, OPEN_EXISTING, FILE_ATTRIBUTE_NORMAL, NULL);
+    if (file == INVALID_HANDLE_VALUE) return false;
+    bool success = ::FlushFileBuffers(file) != 0;
+    ::CloseHandle(file);
+    return success;
+#else
+    int fd = ::open(p_path.c_str(), O_RDONLY);
+    if (fd < 0) return false;
+    bool success = ::fsync(fd) == 0;
+    ::close(fd);
+    return success;
+#endif
+}
@@ -75,6 +75,24 @@ DefaultVectorReader::GetVectorSet(SizeType start, SizeType end) const
 }
 
 
+SizeType
+DefaultVectorReader::GetVectorCount() const
+{
+    auto ptr = f_createIO();
+    if (ptr == nullptr || !ptr->Initialize(m_vectorOutput.c_str(), std::ios::binary | std::ios::in)) {
+        LOG(Helper::LogLevel::LL_Error, "Failed to read file %s.\n", m_vectorOutput.c_str());
+        throw std::runtime_error("Failed read file");
+    }
+
+    SizeType row;
+    if (ptr->ReadBinary(sizeof(SizeType), (char*)&row) != sizeof(SizeType)) {
+        LOG(Helper::LogLevel::LL_Error, "Failed to read VectorSet!\n");
+        throw std::runtime_error("Failed read file");
+    }
+    return row;
+}
+
+
 std::shared_ptr<MetadataSet>
 DefaultVectorReader::GetMetadataSet() const
 {
@@ -4,4 +4,32 @@
 #pragma once
 
 #include <iostream>
+#include <cstdio>
+#include <cstdlib>
+#include <string>
 #include <boost/test/unit_test.hpp>
+
+#ifndef _MSC_VER
+// Points the SPDK controller at an io_uring backed image file of p_blocks pages for the lifetime of the object.
+// The image starts empty and is removed again however the test ends.
+struct UringImage
+{
+    UringImage(const char* p_file, unsigned long long p_blocks) : m_file(p_file)
+    {
+        std::remove(p_file);
+        setenv("SPFRESH_SPDK_USE_URING_IMPL", "1", 1);
+        setenv("SPFRESH_URING_FILE", p_file, 1);
+        setenv("SPFRESH_URING_FILE_BLOCKS", std::to_string(p_blocks).c_str(), 1);
+    }
+
+    ~UringImage()
+    {
+        unsetenv("SPFRESH_URING_FILE_BLOCKS");
+        unsetenv("SPFRESH_URING_FILE");
+        unsetenv("SPFRESH_SPDK_USE_URING_IMPL");
+        std::remove(m_file.c_str());
+    }
+
+    std::string m_file;
+};
+#endif
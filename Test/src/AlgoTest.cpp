@@ -5,12 +5,19 @@
 #include "inc/Helper/SimpleIniReader.h"
 #include "inc/Core/VectorIndex.h"
 #include "inc/Core/Common/CommonUtils.h"
+#include "inc/Core/Common/Dataset.h"
+#include "inc/Core/Common/BKTree.h"
+#include "inc/Core/Common/VersionLabel.h"
+#include "inc/Core/SPANN/Index.h"
 
 #include <unordered_set>
+#include <fstream>
 #include <chrono>
+#include <random>
+#include <thread>
 
 template <typename T>
-void Build(SPTAG::IndexAlgoType algo, std::string distCalcMethod, std::shared_ptr<SPTAG::VectorSet>& vec, std::shared_ptr<SPTAG::MetadataSet>& meta, const std::string out)
+void Build(SPTAG::IndexAlgoType algo, std::string distCalcMethod, std::shared_ptr<SPTAG::VectorSet>& vec, std::shared_ptr<SPTAG::MetadataSet>& meta, const std::string out, bool streaming = false)
 {
 
     std::shared_ptr<SPTAG::VectorIndex> vecIndex = SPTAG::VectorIndex::CreateInstance(algo, SPTAG::GetEnumValueType<T>());
@@ -23,6 +30,7 @@ void Build(SPTAG::IndexAlgoType algo, std::string distCalcMethod, std::shared_pt
     else {
         vecIndex->SetParameter("IndexAlgoType", "BKT", "Base");
         vecIndex->SetParameter("DistCalcMethod", distCalcMethod, "Base");
+        if (streaming) vecIndex->SetParameter("StreamingBuild", "true", "Base");
 
         vecIndex->SetParameter("isExecute", "true", "SelectHead");
         vecIndex->SetParameter("NumberOfThreads", "4", "SelectHead");
@@ -158,7 +166,7 @@ void Delete(const std::string folder, T* vec, SPTAG::SizeType n, const std::stri
 }
 
 template <typename T>
-void Test(SPTAG::IndexAlgoType algo, std::string distCalcMethod)
+void Test(SPTAG::IndexAlgoType algo, std::string distCalcMethod, bool streaming = false)
 {
     SPTAG::SizeType n = 2000, q = 3;
     SPTAG::DimensionType m = 10;
@@ -196,9 +204,10 @@ void Test(SPTAG::IndexAlgoType algo, std::string distCalcMethod)
         SPTAG::ByteArray((std::uint8_t*)metaoffset.data(), metaoffset.size() * sizeof(std::uint64_t), false),
         n));
     
-    Build<T>(algo, distCalcMethod, vecset, metaset, "testindices");
+    Build<T>(algo, distCalcMethod, vecset, metaset, "testindices", streaming);
     std::string truthmeta1[] = { "0", "1", "2", "2", "1", "3", "4", "3", "5" };
     Search<T>("testindices", query.data(), q, k, truthmeta1);
+    if (streaming) return;
 
     if (algo != SPTAG::IndexAlgoType::SPANN) {
         Add<T>("testindices", vecset, metaset, "testindices");
@@ -242,4 +251,374 @@ BOOST_AUTO_TEST_CASE(SPANNTest)
     Test<float>(SPTAG::IndexAlgoType::SPANN, "L2");
 }
 
+BOOST_AUTO_TEST_CASE(SPANNStreamingBuildTest)
+{
+    // heads come from a sample and posting vectors from the on-disk spill
+    Test<float>(SPTAG::IndexAlgoType::SPANN, "L2", true);
+}
+
+BOOST_AUTO_TEST_CASE(BatchSearchTest)
+{
+    SPTAG::SizeType n = 2000, q = 50;
+    SPTAG::DimensionType m = 16;
+    std::mt19937 rng(7);
+    std::uniform_real_distribution<float> value(0.0f, 1.0f);
+    std::vector<float> vec(n * m), query(q * m);
+    for (auto& v : vec) v = value(rng);
+    for (auto& v : query) v = value(rng);
+
+    std::shared_ptr<SPTAG::VectorSet> vecset(new SPTAG::BasicVectorSet(
+        SPTAG::ByteArray((std::uint8_t*)vec.data(), sizeof(float) * n * m, false),
+        SPTAG::VectorValueType::Float, m, n));
+    std::shared_ptr<SPTAG::VectorIndex> vecIndex = SPTAG::VectorIndex::CreateInstance(SPTAG::IndexAlgoType::BKT, SPTAG::VectorValueType::Float);
+    vecIndex->SetParameter("DistCalcMethod", "L2");
+    vecIndex->SetParameter("NumberOfThreads", "4");
+    vecIndex->SetParameter("BatchSearchBlock", "8");
+    BOOST_CHECK(SPTAG::ErrorCode::Success == vecIndex->BuildIndex(vecset, nullptr));
+    BOOST_CHECK(SPTAG::ErrorCode::Success == vecIndex->DeleteIndex(SPTAG::SizeType(0)));
+
+    // walking the queries in lockstep must find exactly what searching them one by one finds
+    int k = 10;
+    std::vector<SPTAG::QueryResult> single, batched;
+    std::vector<SPTAG::QueryResult*> batch;
+    for (SPTAG::SizeType i = 0; i < q; i++) {
+        single.emplace_back(query.data() + i * m, k, false);
+        batched.emplace_back(query.data() + i * m, k, false);
+    }
+    for (auto& res : batched) batch.push_back(&res);
+    for (auto& res : single) BOOST_CHECK(SPTAG::ErrorCode::Success == vecIndex->SearchIndex(res));
+    BOOST_CHECK(SPTAG::ErrorCode::Success == vecIndex->SearchIndexBatch(batch));
+    for (SPTAG::SizeType i = 0; i < q; i++) {
+        for (int j = 0; j < k; j++) {
+            BOOST_CHECK(single[i].GetResult(j)->VID == batched[i].GetResult(j)->VID);
+            BOOST_CHECK(single[i].GetResult(j)->Dist == batched[i].GetResult(j)->Dist);
+        }
+    }
+}
+
+BOOST_AUTO_TEST_CASE(SSDIndexOutputThreadsTest)
+{
+    SPTAG::SizeType n = 20000;
+    SPTAG::DimensionType m = 16;
+    std::mt19937 rng(11);
+    std::uniform_real_distribution<float> value(0.0f, 1.0f);
+    std::vector<float> vec(n * m);
+    for (auto& v : vec) v = value(rng);
+
+    std::shared_ptr<SPTAG::VectorSet> vecset(new SPTAG::BasicVectorSet(
+        SPTAG::ByteArray((std::uint8_t*)vec.data(), sizeof(float) * n * m, false),
+        SPTAG::VectorValueType::Float, m, n));
+
+    // the head is built once, then the SSD index is written over it with 1 and with 4 threads in 1 MB chunks
+    const std::string folder = "ssd_output_threads";
+    auto build = [&](int threads, bool buildHead) {
+        std::shared_ptr<SPTAG::VectorIndex> vecIndex = SPTAG::VectorIndex::CreateInstance(SPTAG::IndexAlgoType::SPANN, SPTAG::VectorValueType::Float);
+        vecIndex->SetParameter("IndexAlgoType", "BKT", "Base");
+        vecIndex->SetParameter("DistCalcMethod", "L2", "Base");
+        vecIndex->SetParameter("IndexDirectory", folder, "Base");
+
+        vecIndex->SetParameter("isExecute", buildHead ? "true" : "false", "SelectHead");
+        vecIndex->SetParameter("NumberOfThreads", "4", "SelectHead");
+        vecIndex->SetParameter("Ratio", "0.2", "SelectHead");
+
+        vecIndex->SetParameter("isExecute", buildHead ? "true" : "false", "BuildHead");
+        vecIndex->SetParameter("NumberOfThreads", "4", "BuildHead");
+
+        vecIndex->SetParameter("isExecute", "true", "BuildSSDIndex");
+        vecIndex->SetParameter("BuildSsdIndex", "true", "BuildSSDIndex");
+        vecIndex->SetParameter("NumberOfThreads", std::to_string(threads), "BuildSSDIndex");
+        vecIndex->SetParameter("PostingPageLimit", "12", "BuildSSDIndex");
+        vecIndex->SetParameter("InternalResultNum", "64", "BuildSSDIndex");
+        vecIndex->SetParameter("OutputChunkMB", "1", "BuildSSDIndex");
+        BOOST_CHECK(SPTAG::ErrorCode::Success == vecIndex->BuildIndex(vecset, nullptr));
+        BOOST_CHECK(vecIndex->IsReady());
+        vecIndex.reset();
+
+        std::ifstream in(folder + "/SPTAGFullList.bin", std::ios::binary);
+        return std::string(std::istreambuf_iterator<char>(in), std::istreambuf_iterator<char>());
+    };
+    std::string single = build(1, true);
+    std::string parallel = build(4, false);
+    BOOST_CHECK(single.size() > ((size_t)1 << 20));
+    BOOST_CHECK(single == parallel);
+}
+
+#ifndef _MSC_VER
+BOOST_AUTO_TEST_CASE(SPANNBatchInsertTest)
+{
+    UringImage image("tmp_batchinsert.img");
+    for (const char* file : { "tmp_batchinsert.img", "tmp_batchinsert_mapping" }) std::remove(file);
+
+    SPTAG::SizeType n = 2000, added = 600;
+    SPTAG::DimensionType m = 10;
+    std::vector<float> vec;
+    for (SPTAG::SizeType i = 0; i < n; i++) vec.insert(vec.end(), m, (float)i);
+    // all added vectors sit between the same two heads, so one head gets a group of several append chunks
+    std::vector<float> addvec;
+    for (SPTAG::SizeType i = 0; i < added; i++) addvec.insert(addvec.end(), m, 1000.25f + 0.001f * i);
+
+    std::shared_ptr<SPTAG::VectorSet> vecset(new SPTAG::BasicVectorSet(
+        SPTAG::ByteArray((std::uint8_t*)vec.data(), sizeof(float) * n * m, false),
+        SPTAG::VectorValueType::Float, m, n));
+    std::shared_ptr<SPTAG::VectorIndex> vecIndex = SPTAG::VectorIndex::CreateInstance(SPTAG::IndexAlgoType::SPANN, SPTAG::VectorValueType::Float);
+    vecIndex->SetParameter("IndexAlgoType", "BKT", "Base");
+    vecIndex->SetParameter("DistCalcMethod", "L2", "Base");
+    vecIndex->SetParameter("isExecute", "true", "SelectHead");
+    vecIndex->SetParameter("Ratio", "0.2", "SelectHead");
+    vecIndex->SetParameter("isExecute", "true", "BuildHead");
+    vecIndex->SetParameter("isExecute", "true", "BuildSSDIndex");
+    vecIndex->SetParameter("BuildSsdIndex", "true", "BuildSSDIndex");
+    vecIndex->SetParameter("UseSPDK", "true", "BuildSSDIndex");
+    vecIndex->SetParameter("SpdkMappingPath", "tmp_batchinsert_mapping", "BuildSSDIndex");
+    vecIndex->SetParameter("Update", "true", "BuildSSDIndex");
+    // one page per posting and one spare page: an append chunk holds 91 vectors, a posting at most 182
+    vecIndex->SetParameter("PostingPageLimit", "1", "BuildSSDIndex");
+    vecIndex->SetParameter("BufferLength", "1", "BuildSSDIndex");
+    vecIndex->SetParameter("AppendThreadNum", "1", "BuildSSDIndex");
+    vecIndex->SetParameter("ReassignThreadNum", "1", "BuildSSDIndex");
+    vecIndex->SetParameter("InternalResultNum", "64", "BuildSSDIndex");
+    vecIndex->SetParameter("SearchInternalResultNum", "64", "BuildSSDIndex");
+    vecIndex->SetParameter("HeadCheckpoint", "true", "BuildSSDIndex");
+    BOOST_CHECK(SPTAG::ErrorCode::Success == vecIndex->BuildIndex(vecset, nullptr));
+
+    BOOST_CHECK(SPTAG::ErrorCode::Success == vecIndex->AddIndex(addvec.data(), added, m, nullptr));
+    auto* spann = (SPTAG::SPANN::Index<float>*)vecIndex.get();
+    while (!spann->AllFinished()) std::this_thread::sleep_for(std::chrono::milliseconds(10));
+
+    for (SPTAG::SizeType i = 0; i < added; i += 50) {
+        SPTAG::QueryResult res(addvec.data() + i * m, 1, false);
+        vecIndex->SearchIndex(res);
+        BOOST_CHECK(res.GetResult(0)->VID == n + i);
+    }
+    // the build leaves a delta baseline behind, so the labels and the head checkpoint without a full save
+    BOOST_CHECK(SPTAG::ErrorCode::Success == vecIndex->DeleteIndex((SPTAG::SizeType)0));
+    BOOST_CHECK(SPTAG::ErrorCode::Success == spann->Checkpoint());
+    vecIndex.reset();
+    for (const char* file : { "tmp_batchinsert.img", "tmp_batchinsert_mapping" }) std::remove(file);
+}
+#endif
+
+BOOST_AUTO_TEST_CASE(BKTreeInsertTest)
+{
+    const SPTAG::DimensionType dim = 4;
+    const SPTAG::SizeType base = 200, added = 300, copies = 20;
+    std::mt19937 rg(7);
+    std::uniform_real_distribution<float> uniform(0.0f, 100.0f);
+    SPTAG::COMMON::Dataset<float> vectors;
+    vectors.Initialize(base, dim, 256, 4096);
+    for (SPTAG::SizeType i = 0; i < base; i++) {
+        for (SPTAG::DimensionType j = 0; j < dim; j++) vectors[i][j] = (i < copies) ? 50.0f : uniform(rg);
+    }
+
+    SPTAG::COMMON::BKTree tree;
+    tree.m_iBKTKmeansK = 4;
+    tree.m_iBKTLeafSize = 4;
+    tree.BuildTrees<float>(vectors, SPTAG::DistCalcMethod::L2, 1);
+    BOOST_CHECK(tree.sizePerTree() == base);
+    bool duplicates = tree.GetSampleMap().count(0) + tree.GetSampleMap().count(1) > 0;
+
+    // the new samples crowd around one point, so their leaves fill up past BKTKmeansK siblings and split,
+    // and the last one copies the duplicates
+    std::vector<float> batch(added * dim);
+    std::normal_distribution<float> near(10.0f, 0.5f);
+    for (SPTAG::SizeType i = 0; i < added * dim; i++) batch[i] = (i < (added - 1) * dim) ? near(rg) : 50.0f;
+    BOOST_CHECK(vectors.AddBatch(added, batch.data()) == SPTAG::ErrorCode::Success);
+    auto distance = SPTAG::COMMON::DistanceCalcSelector<float>(SPTAG::DistCalcMethod::L2);
+    for (SPTAG::SizeType i = base; i < base + added; i++) tree.InsertNode<float>(vectors, i, distance);
+    BOOST_CHECK(tree.sizePerTree() == base + added);
+    if (duplicates) BOOST_CHECK(tree.GetSampleMap().count(base + added - 1) == 1);
+
+    // every sample hangs off the tree once, in child ranges of at most BKTKmeansK besides the duplicates
+    auto check = [&](const SPTAG::COMMON::BKTree& t, SPTAG::SizeType count) {
+        std::vector<int> seen(count, 0);
+        std::vector<SPTAG::SizeType> stack(1, 0);
+        while (!stack.empty()) {
+            const SPTAG::COMMON::BKTNode& node = t[stack.back()];
+            stack.pop_back();
+            if (node.childStart == -1) continue;
+            SPTAG::SizeType begin = (node.childStart < 0) ? -node.childStart : node.childStart;
+            if (node.childStart < 0) seen[node.centerid]++;
+            else BOOST_CHECK(node.childEnd - begin <= t.m_iBKTKmeansK);
+            for (SPTAG::SizeType i = begin; i < node.childEnd; i++) {
+                BOOST_CHECK(t[i].centerid >= 0 && t[i].centerid < count);
+                if (t[i].childStart >= -1) seen[t[i].centerid]++;
+                stack.push_back(i);
+            }
+        }
+        for (SPTAG::SizeType i = 0; i < count; i++) BOOST_CHECK(seen[i] == 1);
+    };
+    check(tree, base + added);
+
+    // the slack behind the child ranges survives a round trip and the reloaded tree keeps taking inserts
+    const std::string file = "bkt_insert.bin";
+    BOOST_CHECK(tree.SaveTrees(file) == SPTAG::ErrorCode::Success);
+    SPTAG::COMMON::BKTree loaded;
+    loaded.m_iBKTKmeansK = tree.m_iBKTKmeansK;
+    BOOST_CHECK(loaded.LoadTrees(file) == SPTAG::ErrorCode::Success);
+    BOOST_CHECK(loaded.size() >= tree.size());
+    int freeSlots = 0;
+    for (SPTAG::SizeType i = 0; i < tree.size(); i++) {
+        BOOST_CHECK(loaded[i].centerid == tree[i].centerid && loaded[i].childStart == tree[i].childStart && loaded[i].childEnd == tree[i].childEnd);
+        if (tree[i].centerid == -2) freeSlots++;
+    }
+    BOOST_CHECK(freeSlots > 0);
+    BOOST_CHECK(loaded.sizePerTree() == base + added);
+
+    std::vector<float> more(dim, 10.0f);
+    BOOST_CHECK(vectors.AddBatch(1, more.data()) == SPTAG::ErrorCode::Success);
+    loaded.InsertNode<float>(vectors, base + added, distance);
+    BOOST_CHECK(loaded.sizePerTree() == base + added + 1);
+    check(loaded, base + added + 1);
+
+    // a sample next to the duplicates joins the range that holds their cluster and moves it, a copy added after
+    // that is still found from the cluster node the sample map and the graph are pointed at
+    SPTAG::SizeType center = -1;
+    for (auto& entry : tree.GetSampleMap()) if (entry.first < 0) center = -1 - entry.first;
+    if (center >= 0) {
+        std::vector<float> close(dim, 50.5f), copy(dim, 50.0f);
+        BOOST_CHECK(vectors.AddBatch(1, close.data()) == SPTAG::ErrorCode::Success);
+        BOOST_CHECK(vectors.AddBatch(1, copy.data()) == SPTAG::ErrorCode::Success);
+        std::unordered_map<SPTAG::SizeType, SPTAG::SizeType> moved;
+        auto follow = [&](SPTAG::SizeType c, SPTAG::SizeType node) { moved[c] = node; };
+        loaded.InsertNode<float>(vectors, base + added + 1, distance, follow);
+        BOOST_CHECK(moved.count(center) == 1);
+        loaded.InsertNode<float>(vectors, base + added + 2, distance, follow);
+        check(loaded, base + added + 3);
+
+        SPTAG::SizeType node = moved[center];
+        auto entry = loaded.GetSampleMap().find(-1 - center);
+        BOOST_CHECK(entry != loaded.GetSampleMap().end() && entry->second == node);
+        BOOST_CHECK(loaded[node].centerid == center && loaded[node].childStart < -1);
+        bool found = false;
+        for (SPTAG::SizeType i = -loaded[node].childStart; i < loaded[node].childEnd; i++) found |= (loaded[i].centerid == base + added + 2);
+        BOOST_CHECK(found);
+    }
+    std::remove(file.c_str());
+}
+
+BOOST_AUTO_TEST_CASE(DatasetMemoryPolicyTest)
+{
+    BOOST_CHECK(!SPTAG::COMMON::DatasetMemoryPolicy::Configure("Vector:huge"));
+    BOOST_CHECK(!SPTAG::COMMON::DatasetMemoryPolicy::Configure("Vector"));
+    BOOST_CHECK(SPTAG::COMMON::DatasetMemoryPolicy::Configure("Vector:explicit:interleave,*:transparent"));
+    BOOST_CHECK(SPTAG::COMMON::DatasetMemoryPolicy::Get("Vector").m_numa == SPTAG::COMMON::DatasetMemoryPolicy::NumaPlacement::Interleave);
+    BOOST_CHECK(SPTAG::COMMON::DatasetMemoryPolicy::Get("RNG").m_hugePages == SPTAG::COMMON::DatasetMemoryPolicy::HugePages::Transparent);
+
+    // both the base rows and the blocks AddBatch appends come from the policy and keep their content
+    SPTAG::COMMON::Dataset<float> vectors;
+    vectors.SetName("Vector");
+    vectors.Initialize(1000, 16, 256, 4096);
+    for (SPTAG::SizeType i = 0; i < 1000; i++) vectors[i][15] = (float)i;
+    std::vector<float> batch(600 * 16);
+    for (int i = 0; i < 600; i++) batch[i * 16 + 15] = (float)(1000 + i);
+    BOOST_CHECK(vectors.AddBatch(600, batch.data()) == SPTAG::ErrorCode::Success);
+    for (SPTAG::SizeType i = 0; i < vectors.R(); i++) BOOST_CHECK(vectors[i][15] == (float)i);
+
+    // the interleaved layout shares the blocks the vectors append with the graph, whose policy differs
+    BOOST_CHECK(SPTAG::COMMON::DatasetMemoryPolicy::Configure("Vector:transparent"));
+    const std::string vectorFile = "opt_vectors.bin", graphFile = "opt_graph.bin";
+    SPTAG::COMMON::Dataset<SPTAG::SizeType> links;
+    links.SetName("RNG");
+    links.Initialize(vectors.R(), 8, 256, 4096);
+    auto save = [](const std::string& file, auto& dataset) {
+        auto ptr = SPTAG::f_createIO();
+        BOOST_CHECK(ptr != nullptr && ptr->Initialize(file.c_str(), std::ios::binary | std::ios::out));
+        BOOST_CHECK(dataset.Save(ptr) == SPTAG::ErrorCode::Success);
+    };
+    save(vectorFile, vectors);
+    save(graphFile, links);
+    {
+        auto vectorIn = SPTAG::f_createIO(), graphIn = SPTAG::f_createIO();
+        BOOST_CHECK(vectorIn->Initialize(vectorFile.c_str(), std::ios::binary | std::ios::in));
+        BOOST_CHECK(graphIn->Initialize(graphFile.c_str(), std::ios::binary | std::ios::in));
+        std::unique_ptr<SPTAG::COMMON::Dataset<float>> optVectors(new SPTAG::COMMON::Dataset<float>());
+        std::unique_ptr<SPTAG::COMMON::Dataset<SPTAG::SizeType>> optGraph(new SPTAG::COMMON::Dataset<SPTAG::SizeType>());
+        optVectors->SetName("Vector");
+        optGraph->SetName("RNG");
+        BOOST_CHECK(SPTAG::COMMON::LoadOptDatasets(vectorIn, graphIn, *optVectors, *optGraph, 8, 256, 4096) == SPTAG::ErrorCode::Success);
+        BOOST_CHECK(optVectors->AddBatch(300, batch.data()) == SPTAG::ErrorCode::Success);
+        BOOST_CHECK((*optVectors)[vectors.R() + 299][15] == (float)1299);
+        // the graph goes first and must not free the blocks with its own policy
+        optGraph.reset();
+        BOOST_CHECK((*optVectors)[vectors.R() + 299][15] == (float)1299);
+    }
+    std::remove(vectorFile.c_str());
+    std::remove(graphFile.c_str());
+
+    BOOST_CHECK(SPTAG::COMMON::DatasetMemoryPolicy::Configure(""));
+    BOOST_CHECK(SPTAG::COMMON::DatasetMemoryPolicy::Get("Vector").IsDefault());
+}
+
+BOOST_AUTO_TEST_CASE(MmapLoadTest)
+{
+    const std::string file = "mmap_versionlabel.bin";
+    SPTAG::COMMON::VersionLabel labels;
+    labels.Initialize(1000, 256, 4096);
+    for (SPTAG::SizeType i = 0; i < 1000; i += 3) labels.Delete(i);
+    BOOST_CHECK(labels.Save(file) == SPTAG::ErrorCode::Success);
+
+    // deletes and appends on the mapped copy stay private to the process
+    SPTAG::COMMON::VersionLabel mapped;
+    BOOST_CHECK(mapped.LoadMapped(file, 256, 4096, true) == SPTAG::ErrorCode::Success);
+    BOOST_CHECK(mapped.GetVectorNum() == 1000 && mapped.GetDeleteCount() == labels.GetDeleteCount());
+    for (SPTAG::SizeType i = 0; i < 1000; i++) BOOST_CHECK(mapped.Deleted(i) == (i % 3 == 0));
+    BOOST_CHECK(mapped.Delete(1));
+    BOOST_CHECK(mapped.AddBatch(500) == SPTAG::ErrorCode::Success);
+    BOOST_CHECK(mapped.Delete(1200));
+    BOOST_CHECK(!labels.Deleted(1));
+
+    // saving over the file that is still mapped must not pull the pages out from under the mapping
+    BOOST_CHECK(mapped.Save(file) == SPTAG::ErrorCode::Success);
+    BOOST_CHECK(mapped.Deleted(1) && mapped.Deleted(1200) && !mapped.Deleted(2));
+
+    SPTAG::COMMON::VersionLabel reloaded;
+    BOOST_CHECK(reloaded.Load(file, 256, 4096) == SPTAG::ErrorCode::Success);
+    BOOST_CHECK(reloaded.GetVectorNum() == 1500 && reloaded.GetDeleteCount() == mapped.GetDeleteCount());
+    for (SPTAG::SizeType i = 0; i < 1500; i++) BOOST_CHECK(reloaded.Deleted(i) == mapped.Deleted(i));
+    std::remove(file.c_str());
+}
+
+BOOST_AUTO_TEST_CASE(DeltaCheckpointTest)
+{
+    const std::string file = "delta_versionlabel.bin", delta = file + ".delta";
+    SPTAG::COMMON::VersionLabel labels;
+    labels.Initialize(1000, 256, 4096);
+    for (SPTAG::SizeType i = 0; i < 1000; i += 3) labels.Delete(i);
+    BOOST_CHECK(labels.Save(file) == SPTAG::ErrorCode::Success);
+    BOOST_CHECK(labels.SaveDelta(nullptr) == SPTAG::ErrorCode::Success);
+
+    // two checkpoints: in-place deletes and appended ids, then a single delete
+    auto append = [&]() {
+        auto ptr = SPTAG::f_createIO();
+        BOOST_CHECK(ptr != nullptr && ptr->Initialize(delta.c_str(), std::ios::binary | std::ios::out | std::ios::app));
+        BOOST_CHECK(labels.SaveDelta(ptr) == SPTAG::ErrorCode::Success);
+        BOOST_CHECK(ptr->Sync());
+    };
+    labels.Delete(1);
+    BOOST_CHECK(labels.AddBatch(500) == SPTAG::ErrorCode::Success);
+    labels.Delete(1200);
+    append();
+    labels.Delete(998);
+    append();
+
+    auto check = [&](SPTAG::COMMON::VersionLabel& loaded) {
+        BOOST_CHECK(loaded.GetVectorNum() == 1500 && loaded.GetDeleteCount() == labels.GetDeleteCount());
+        for (SPTAG::SizeType i = 0; i < 1500; i++) BOOST_CHECK(loaded.Deleted(i) == labels.Deleted(i));
+    };
+    SPTAG::COMMON::VersionLabel replayed;
+    BOOST_CHECK(replayed.Load(file, 256, 4096) == SPTAG::ErrorCode::Success);
+    BOOST_CHECK(replayed.LoadDeltas(delta) == SPTAG::ErrorCode::Success);
+    check(replayed);
+
+    // folding the deltas into the base gives the same labels, replaying them once more changes nothing
+    BOOST_CHECK(SPTAG::COMMON::VersionLabel::MergeDeltas(file, delta) == SPTAG::ErrorCode::Success);
+    SPTAG::COMMON::VersionLabel merged;
+    BOOST_CHECK(merged.Load(file, 256, 4096) == SPTAG::ErrorCode::Success);
+    check(merged);
+    BOOST_CHECK(merged.LoadDeltas(delta) == SPTAG::ErrorCode::Success);
+    check(merged);
+    std::remove(file.c_str());
+    std::remove(delta.c_str());
+}
+
 BOOST_AUTO_TEST_SUITE_END()
@@ -7,6 +7,7 @@
 #include <vector>
 #include "inc/Test.h"
 #include "inc/Core/Common/DistanceUtils.h"
+#include "inc/Core/Common/PQQuantizer.h"
 
 template<typename T>
 static float ComputeCosineDistance(const T *pX, const T *pY, SPTAG::DimensionType length) {
@@ -49,6 +50,79 @@ void test(int high) {
     delete[] Y;
 }
 
+template<typename T>
+void test_batch(int high, SPTAG::DistCalcMethod calc_method) {
+    auto batch = SPTAG::COMMON::DistanceBatchCalcSelector<T>(calc_method);
+    if (batch == nullptr) return;
+
+    SPTAG::DimensionType dimension = random<SPTAG::DimensionType>(256, 2);
+    int count = random<int>(20, 1);
+    std::vector<T> X(dimension), Y(dimension * count);
+    for (auto& x : X) x = random<T>(high, -high);
+    for (auto& y : Y) y = random<T>(high, -high);
+    std::vector<const T*> pY(count);
+    for (int i = 0; i < count; i++) pY[i] = Y.data() + i * dimension;
+
+    std::vector<float> dist(count);
+    batch(X.data(), pY.data(), count, dimension, dist.data());
+    for (int i = 0; i < count; i++) {
+        BOOST_CHECK_CLOSE_FRACTION(SPTAG::COMMON::DistanceUtils::ComputeDistance(X.data(), pY[i], dimension, calc_method), dist[i], 1e-5);
+    }
+}
+
+static std::unique_ptr<float[]> random_codebooks(int M, int Ks, int sub)
+{
+    std::unique_ptr<float[]> codebooks(new float[M * Ks * sub]);
+    for (int i = 0; i < M * Ks * sub; i++) codebooks[i] = random<float>(12, -12);
+    return codebooks;
+}
+
+// ADC through a precomputed table matches distances to the reconstructed vector
+void test_pq_distance_table(int M, int Ks, int sub) {
+    SPTAG::COMMON::PQQuantizer<float> quantizer(M, Ks, sub, false, random_codebooks(M, Ks, sub));
+    SPTAG::DimensionType dimension = M * sub;
+    std::vector<float> query(dimension), vec(dimension), decoded(dimension), table(M * Ks);
+    for (auto& q : query) q = random<float>(12, -12);
+    for (auto& v : vec) v = random<float>(12, -12);
+    std::vector<std::uint8_t> code(M);
+    quantizer.QuantizeVector(vec.data(), code.data());
+    quantizer.ReconstructVector(code.data(), decoded.data());
+    quantizer.ComputeDistanceTable(query.data(), table.data());
+
+    float exact = ComputeL2Distance(query.data(), decoded.data(), dimension);
+    BOOST_CHECK_SMALL(quantizer.ADCL2Distance(table.data(), code.data()) - exact, 1e-4f * (1 + exact));
+}
+
+// 16 codewords per subvector: fast-scan blocks score codes within the rounding of the uint8 table
+void test_pq_fast_scan(int M, int sub, int count) {
+    const int Ks = 16;
+    SPTAG::COMMON::PQQuantizer<float> quantizer(M, Ks, sub, false, random_codebooks(M, Ks, sub));
+    BOOST_REQUIRE(quantizer.FastScanEnabled());
+
+    SPTAG::DimensionType dimension = M * sub;
+    std::vector<float> query(dimension), table(M * Ks), vec(dimension);
+    for (auto& q : query) q = random<float>(12, -12);
+    quantizer.ComputeDistanceTable(query.data(), table.data());
+    std::vector<std::uint8_t> qtable(M * Ks);
+    float scale, bias;
+    quantizer.QuantizeDistanceTable(table.data(), qtable.data(), scale, bias);
+
+    std::vector<std::vector<std::uint8_t>> codes(count, std::vector<std::uint8_t>(M));
+    std::vector<const std::uint8_t*> codePtrs;
+    for (int j = 0; j < count; j++) {
+        for (auto& v : vec) v = random<float>(12, -12);
+        quantizer.QuantizeVector(vec.data(), codes[j].data());
+        codePtrs.push_back(codes[j].data());
+    }
+    std::vector<std::uint8_t> block(quantizer.FastScanBlockSize());
+    quantizer.PackFastScanBlock(codePtrs.data(), count, block.data());
+    std::vector<float> dist(count);
+    quantizer.FastScanL2Distances(qtable.data(), scale, bias, block.data(), count, dist.data());
+    for (int j = 0; j < count; j++) {
+        BOOST_CHECK_SMALL(dist[j] - quantizer.ADCL2Distance(table.data(), codes[j].data()), 0.5f * M / scale + 1e-3f);
+    }
+}
+
 template <typename T>
 void test_dist_calc_performance(
     int high, 
@@ -92,6 +166,76 @@ BOOST_AUTO_TEST_CASE(TestDistanceComputation)
     test<std::int16_t>(32767);
 }
 
+BOOST_AUTO_TEST_CASE(TestBatchDistanceComputation)
+{
+    for (int i = 0; i < 10; i++) {
+        for (auto calc_method : { SPTAG::DistCalcMethod::L2, SPTAG::DistCalcMethod::Cosine }) {
+            test_batch<float>(1, calc_method);
+            test_batch<std::int8_t>(127, calc_method);
+            test_batch<std::uint8_t>(255, calc_method);
+            test_batch<std::int16_t>(32767, calc_method);
+        }
+    }
+}
+
+BOOST_AUTO_TEST_CASE(TestFastScanDistanceComputation)
+{
+    auto scan = SPTAG::COMMON::FastScanCalcSelector();
+    for (int i = 0; i < 10; i++) {
+        SPTAG::DimensionType subvectors = random<SPTAG::DimensionType>(65, 1);
+        std::vector<std::uint8_t> table(subvectors * 16), codes(32 * subvectors), block(subvectors * 16, 0);
+        for (auto& t : table) t = random<std::uint8_t>(255);
+        for (auto& c : codes) c = random<std::uint8_t>(15);
+        for (int j = 0; j < 32; j++) {
+            for (int m = 0; m < subvectors; m++) block[m * 16 + (j & 15)] |= codes[j * subvectors + m] << (j < 16 ? 0 : 4);
+        }
+
+        std::uint16_t dist[32];
+        scan(table.data(), block.data(), subvectors, dist);
+        for (int j = 0; j < 32; j++) {
+            int expected = 0;
+            for (int m = 0; m < subvectors; m++) expected += table[m * 16 + codes[j * subvectors + m]];
+            BOOST_CHECK_EQUAL(expected, dist[j]);
+        }
+    }
+}
+
+BOOST_AUTO_TEST_CASE(TestDotProductTileComputation)
+{
+    auto tile = SPTAG::COMMON::DotProductTileCalcSelector();
+    for (int i = 0; i < 10; i++) {
+        SPTAG::DimensionType length = random<SPTAG::DimensionType>(130, 1);
+        int xCount = 8 * random<int>(4, 1), yCount = 16 * random<int>(4, 1), ldY = yCount + 16;
+        std::vector<float> x(xCount * length), yT(length * ldY), dot(xCount * yCount);
+        for (auto& v : x) v = random<float>(1, -1);
+        for (auto& v : yT) v = random<float>(1, -1);
+
+        tile(x.data(), xCount, yT.data(), yCount, ldY, length, dot.data());
+        for (int p = 0; p < xCount; p++) {
+            for (int j = 0; j < yCount; j++) {
+                float expected = 0;
+                for (SPTAG::DimensionType d = 0; d < length; d++) expected += x[p * length + d] * yT[d * ldY + j];
+                BOOST_CHECK_SMALL(expected - dot[p * yCount + j], 1e-4f * length);
+            }
+        }
+    }
+}
+
+BOOST_AUTO_TEST_CASE(TestPQDistanceTableComputation)
+{
+    for (int i = 0; i < 10; i++) {
+        test_pq_distance_table(random<int>(9, 1), 16, random<int>(5, 1));
+        test_pq_distance_table(random<int>(9, 1), 256, random<int>(5, 1));
+    }
+}
+
+BOOST_AUTO_TEST_CASE(TestPQFastScanComputation)
+{
+    for (int i = 0; i < 10; i++) {
+        test_pq_fast_scan(random<int>(17, 1), random<int>(5, 1), random<int>(33, 1));
+    }
+}
+
 BOOST_AUTO_TEST_CASE(TestDistanceComputationPerformance)
 {
     std::vector<SPTAG::DimensionType> dimensions{128, 256, 512, 1024};
@@ -4,9 +4,12 @@
 #include "inc/Test.h"
 #include "inc/Core/SPANN/ExtraRocksDBController.h"
 #include "inc/Core/SPANN/ExtraSPDKController.h"
+#include "inc/Core/SPANN/PostingCache.h"
+#include "inc/Core/SPANN/FullVectorStore.h"
 
 #include <memory>
 #include <chrono>
+#include <fstream>
 
 // enable rocksdb io_uring
 extern "C" bool RocksDbIOUringEnable() { return true; }
@@ -94,4 +97,416 @@ BOOST_AUTO_TEST_CASE(SPDKTest)
     Test("tmp_spdk", "SPDK", true);
 }
 
+BOOST_AUTO_TEST_CASE(UringTest)
+{
+    // 1024 postings of up to three pages, compaction rewrites them next to the old copies
+    UringImage image("tmp_uring.img", 16384);
+    std::remove("tmp_uring");
+
+    int totalNum = 1024;
+    int mergeIters = 3;
+    // every byte depends on the key and its position, so a page read from the wrong place does not compare equal
+    auto pattern = [](int key, size_t begin, size_t size) {
+        std::string val(size, '\0');
+        for (size_t k = 0; k < size; k++) val[k] = (char)((key * 131 + (begin + k) * 7) & 0xff);
+        return val;
+    };
+    std::vector<std::string> expected(totalNum);
+    std::vector<SizeType> keys(totalNum);
+    auto verify = [&](SPDKIO& db) {
+        std::vector<std::string> values;
+        BOOST_CHECK(db.MultiGet(keys, &values) == ErrorCode::Success);
+        for (int i = 0; i < totalNum; i++) {
+            std::string val;
+            BOOST_CHECK(db.Get(i, &val) == ErrorCode::Success);
+            BOOST_CHECK(val == expected[i]);
+            BOOST_CHECK(values[i] == expected[i]);
+        }
+    };
+    {
+        SPDKIO db("tmp_uring", 1024 * 1024, MaxSize, 64);
+        for (int i = 0; i < totalNum; i++) {
+            keys[i] = i;
+            expected[i] = pattern(i, 0, PageSize - i % 64);
+            BOOST_CHECK(db.Put(i, expected[i]) == ErrorCode::Success);
+        }
+        verify(db);
+
+        for (int j = 0; j < mergeIters; j++) {
+            for (int i = 0; i < totalNum; i++) {
+                std::string val = pattern(i, expected[i].size(), 200 + (i + j) % 300);
+                BOOST_CHECK(db.Merge(i, val) == ErrorCode::Success);
+                expected[i] += val;
+            }
+        }
+        verify(db);
+
+        db.ForceCompaction();
+        verify(db);
+        db.ShutDown();
+    }
+    {
+        SPDKIO db("tmp_uring", 1024 * 1024, MaxSize, 64);
+        verify(db);
+        db.ShutDown();
+    }
+    std::remove("tmp_uring");
+}
+
+BOOST_AUTO_TEST_CASE(CompactionTest)
+{
+    UringImage image("tmp_compaction.img", 4096);
+    std::remove("tmp_compaction");
+    {
+        int totalNum = 256;
+        int mergeIters = 3;
+        SPDKIO db("tmp_compaction", 1024 * 1024, MaxSize, 64);
+        std::vector<std::string> expected(totalNum);
+        for (int i = 0; i < totalNum; i++) {
+            expected[i] = std::string(PageSize - 1, 'a' + i % 26);
+            db.Put(i, expected[i]);
+        }
+        // interleaved merges spread every posting over non-adjacent pages
+        for (int j = 0; j < mergeIters; j++) {
+            for (int i = 0; i < totalNum; i++) {
+                std::string val(PageSize / 2, '0' + j);
+                db.Merge(i, val);
+                expected[i] += val;
+            }
+        }
+
+        db.ForceCompaction();
+
+        for (int i = 0; i < totalNum; i++) {
+            std::string val;
+            BOOST_CHECK(db.Get(i, &val) == ErrorCode::Success);
+            BOOST_CHECK(val == expected[i]);
+        }
+        db.ShutDown();
+    }
+}
+
+BOOST_AUTO_TEST_CASE(TailCacheTest)
+{
+    UringImage image("tmp_tail.img", 2048);
+    std::remove("tmp_tail");
+
+    int totalNum = 256;
+    std::vector<std::string> expected(totalNum);
+    {
+        SPDKIO db("tmp_tail", 1024 * 1024, MaxSize, 64, 1024, 64, 1, 0, false, 256, 1);
+        for (int i = 0; i < totalNum; i++) {
+            expected[i] = std::string(PageSize / 3, 'a' + i % 26);
+            db.Put(i, expected[i]);
+        }
+        // small appends stay in the tail cache until a page fills up
+        for (int j = 0; j < 16; j++) {
+            for (int i = 0; i < totalNum; i++) {
+                std::string val(100 + i, '0' + j % 10);
+                db.Merge(i, val);
+                expected[i] += val;
+            }
+        }
+
+        std::vector<SizeType> keys(totalNum);
+        for (int i = 0; i < totalNum; i++) keys[i] = i;
+        std::vector<std::string> values;
+        BOOST_CHECK(db.MultiGet(keys, &values) == ErrorCode::Success);
+        for (int i = 0; i < totalNum; i++) {
+            std::string val;
+            BOOST_CHECK(db.Get(i, &val) == ErrorCode::Success);
+            BOOST_CHECK(val == expected[i]);
+            BOOST_CHECK(values[i] == expected[i]);
+        }
+        db.ShutDown();
+    }
+    {
+        // unflushed tails are written out on shutdown
+        SPDKIO db("tmp_tail", 1024 * 1024, MaxSize, 64, 1024, 64, 1, 0, false, 256, 1);
+        for (int i = 0; i < totalNum; i++) {
+            std::string val;
+            BOOST_CHECK(db.Get(i, &val) == ErrorCode::Success);
+            BOOST_CHECK(val == expected[i]);
+        }
+        db.ShutDown();
+    }
+}
+
+static void CopyFile(const std::string& from, const std::string& to)
+{
+    std::ifstream in(from, std::ios::binary);
+    std::ofstream out(to, std::ios::binary | std::ios::trunc);
+    if (in.is_open()) out << in.rdbuf();
+}
+
+BOOST_AUTO_TEST_CASE(WALRecoveryTest)
+{
+    UringImage image("tmp_wal.img", 1024);
+    std::remove("tmp_wal");
+    std::remove("tmp_wal.wal");
+    std::remove("tmp_crash");
+    std::remove("tmp_crash.wal");
+
+    int totalNum = 128;
+    std::vector<std::string> expected(totalNum);
+    {
+        SPDKIO db("tmp_wal", 1024 * 1024, MaxSize, 64, 1024, 64, 1, 0, true);
+        for (int i = 0; i < totalNum; i++) {
+            expected[i] = std::string(PageSize - 1, 'a' + i % 26);
+            db.Put(i, expected[i]);
+        }
+        // checkpoint half way, the rest only lives in the log
+        db.ForceCompaction();
+        for (int i = 0; i < totalNum; i += 2) {
+            db.Merge(i, std::to_string(i));
+            expected[i] += std::to_string(i);
+        }
+        db.Delete(1);
+
+        // snapshot the on-disk state as a crash right now would leave it
+        CopyFile("tmp_wal", "tmp_crash");
+        CopyFile("tmp_wal.wal", "tmp_crash.wal");
+        db.ShutDown();
+    }
+    {
+        SPDKIO db("tmp_crash", 1024 * 1024, MaxSize, 64, 1024, 64, 1, 0, true);
+        for (int i = 0; i < totalNum; i++) {
+            if (i == 1) continue;
+            std::string val;
+            BOOST_CHECK(db.Get(i, &val) == ErrorCode::Success);
+            BOOST_CHECK(val == expected[i]);
+        }
+        db.ShutDown();
+    }
+}
+
+BOOST_AUTO_TEST_CASE(WALRetireOrderTest)
+{
+    UringImage image("tmp_walorder.img", 256);
+    for (const char* file : { "tmp_walorder", "tmp_walorder.wal", "tmp_walorder_crash", "tmp_walorder_crash.wal" }) std::remove(file);
+
+    std::string oldValue(PageSize - 1, 'a'), newValue(PageSize - 1, 'b'), otherValue(PageSize - 1, 'c');
+    {
+        SPDKIO db("tmp_walorder", 1024 * 1024, MaxSize, 64, 1024, 64, 1, 0, true);
+        db.Put(0, oldValue);
+        db.Put(1, otherValue);
+        db.ForceCompaction();
+
+        // crash after the new posting of key 0 is written but before its row reaches the log: by then a
+        // reclaim and another writer must not have been able to reuse the blocks the log still points at
+        bool crashed = false;
+        db.m_beforeLogMapping = [&](SizeType key) {
+            if (key != 0 || crashed) return;
+            crashed = true;
+            db.Compact();
+            db.Put(1, otherValue);
+            CopyFile("tmp_walorder", "tmp_walorder_crash");
+            CopyFile("tmp_walorder.wal", "tmp_walorder_crash.wal");
+        };
+        db.Put(0, newValue);
+        BOOST_CHECK(crashed);
+        db.m_beforeLogMapping = nullptr;
+        db.ShutDown();
+    }
+    {
+        SPDKIO db("tmp_walorder_crash", 1024 * 1024, MaxSize, 64, 1024, 64, 1, 0, true);
+        std::string val;
+        BOOST_CHECK(db.Get(0, &val) == ErrorCode::Success);
+        BOOST_CHECK(val == oldValue);
+        BOOST_CHECK(db.Get(1, &val) == ErrorCode::Success);
+        BOOST_CHECK(val == otherValue);
+        db.ShutDown();
+    }
+}
+
+BOOST_AUTO_TEST_CASE(ConcurrentReadTest)
+{
+    UringImage image("tmp_concurrent.img", 4096);
+    std::remove("tmp_concurrent");
+
+    int totalNum = 256;
+    int mergeIters = 16;
+    int chunk = 333;
+    auto expected = [&](int key, int iters) {
+        std::string val(PageSize / 4, 'A' + key % 26);
+        for (int j = 0; j < iters; j++) val += std::string(chunk, 'a' + (key + j) % 26);
+        return val;
+    };
+    for (int tailCacheSize : { 0, 1 }) {
+        SPDKIO db("tmp_concurrent", 1024 * 1024, MaxSize, 64, 1024, 64, 1, 0, false, 256, tailCacheSize);
+        for (int i = 0; i < totalNum; i++) db.Put(i, expected(i, 0));
+
+        // readers run against appends and compaction and must always see a whole number of appends
+        std::atomic_bool done(false);
+        std::atomic_int torn(0);
+        std::vector<std::thread> readers;
+        for (int t = 0; t < 2; t++) {
+            readers.emplace_back([&] {
+                db.Initialize();
+                std::vector<SizeType> keys(totalNum);
+                for (int i = 0; i < totalNum; i++) keys[i] = i;
+                std::vector<std::string> values;
+                while (!done) {
+                    db.MultiGet(keys, &values);
+                    for (int i = 0; i < totalNum; i++) {
+                        int iters = (int)(values[i].size() - PageSize / 4) / chunk;
+                        if (values[i] != expected(i, iters)) torn++;
+                    }
+                }
+                db.ExitBlockController();
+            });
+        }
+        for (int j = 0; j < mergeIters; j++) {
+            for (int i = 0; i < totalNum; i++) db.Merge(i, std::string(chunk, 'a' + (i + j) % 26));
+            if (j % 4 == 3) db.Compact();
+        }
+        done = true;
+        for (auto& reader : readers) reader.join();
+
+        BOOST_CHECK(torn == 0);
+        for (int i = 0; i < totalNum; i++) {
+            std::string val;
+            BOOST_CHECK(db.Get(i, &val) == ErrorCode::Success);
+            BOOST_CHECK(val == expected(i, mergeIters));
+        }
+        db.ShutDown();
+        std::remove("tmp_concurrent");
+    }
+}
+
+BOOST_AUTO_TEST_CASE(IncrementalMultiGetTest)
+{
+    UringImage image("tmp_incremental.img", 4096);
+    std::remove("tmp_incremental");
+    {
+        int totalNum = 256;
+        SPDKIO db("tmp_incremental", 1024 * 1024, MaxSize, 64);
+        std::vector<std::string> expected(totalNum);
+        std::vector<SizeType> keys(totalNum);
+        for (int i = 0; i < totalNum; i++) {
+            expected[i] = std::string(i * 97 % (PageSize * 5), 'a' + i % 26);
+            db.Put(i, expected[i]);
+            keys[i] = i;
+        }
+
+        // every posting is handed out once and complete
+        std::vector<std::string> values;
+        std::vector<int> delivered(totalNum, 0);
+        BOOST_CHECK(db.MultiGet(keys, &values, std::chrono::microseconds::max(), [&](size_t i) {
+            delivered[i]++;
+            BOOST_CHECK(values[i] == expected[i]);
+        }) == ErrorCode::Success);
+        for (int i = 0; i < totalNum; i++) BOOST_CHECK(delivered[i] == 1);
+
+        // under a tight budget only complete postings are handed out
+        values.clear();
+        db.MultiGet(keys, &values, std::chrono::microseconds(50), [&](size_t i) {
+            BOOST_CHECK(values[i] == expected[i]);
+        });
+
+        // p_skip is asked once per posting that needs I/O, and what it drops is never handed out
+        values.clear();
+        std::vector<int> asked(totalNum, 0);
+        std::fill(delivered.begin(), delivered.end(), 0);
+        BOOST_CHECK(db.MultiGet(keys, &values, std::chrono::microseconds::max(), [&](size_t i) {
+            delivered[i]++;
+            BOOST_CHECK(values[i] == expected[i]);
+        }, [&](size_t i) {
+            asked[i]++;
+            return i % 3 == 0;
+        }) == ErrorCode::Success);
+        for (int i = 0; i < totalNum; i++) {
+            if (expected[i].empty()) {
+                BOOST_CHECK(delivered[i] == 1);
+                continue;
+            }
+            BOOST_CHECK(asked[i] == 1);
+            BOOST_CHECK(delivered[i] == (i % 3 == 0 ? 0 : 1));
+        }
+        db.ShutDown();
+    }
+}
+
+BOOST_AUTO_TEST_CASE(PostingCacheTest)
+{
+    // one shard of 64KB holds a handful of 8KB postings
+    PostingCache cache(64 * 1024, 1);
+    COMMON::SequenceMutexes versions;
+    auto posting = [](int key) { return std::make_shared<std::string>(8 * 1024, 'a' + key % 26); };
+
+    BOOST_CHECK(cache.Get(0) == nullptr);
+    BOOST_CHECK(cache.Admit(0, posting(0), versions[0], versions[0].Version()));
+    BOOST_CHECK(*cache.Get(0) == *posting(0));
+
+    // a read that raced a writer is not cached
+    std::uint32_t seq = versions[1].Version();
+    versions[1].lock();
+    BOOST_CHECK(!versions[1].try_lock());
+    BOOST_CHECK(!cache.Admit(1, posting(1), versions[1], versions[1].Version()));
+    versions[1].unlock();
+    BOOST_CHECK(!cache.Admit(1, posting(1), versions[1], seq));
+    BOOST_CHECK(cache.Get(1) == nullptr);
+
+    // writers keep cached postings current
+    cache.Append(0, "xyz");
+    BOOST_CHECK(*cache.Get(0) == *posting(0) + "xyz");
+    cache.Update(0, "new");
+    BOOST_CHECK(*cache.Get(0) == "new");
+    cache.Invalidate(0);
+    BOOST_CHECK(cache.Get(0) == nullptr);
+
+    // fill the shard with postings asked for often, a one-off posting does not evict them
+    for (int key = 10; key < 17; key++) {
+        for (int i = 0; i < 4; i++) cache.Get(key);
+        BOOST_CHECK(cache.Admit(key, posting(key), versions[key], versions[key].Version()));
+    }
+    cache.Get(100);
+    BOOST_CHECK(!cache.Admit(100, posting(100), versions[100], versions[100].Version()));
+    for (int key = 10; key < 17; key++) BOOST_CHECK(cache.Get(key) != nullptr);
+
+    // a posting that became popular replaces the least recently used one
+    for (int i = 0; i < 8; i++) cache.Get(200);
+    BOOST_CHECK(cache.Admit(200, posting(200), versions[200], versions[200].Version()));
+    BOOST_CHECK(cache.Get(200) != nullptr);
+    BOOST_CHECK(cache.Get(10) == nullptr);
+}
+
+BOOST_AUTO_TEST_CASE(FullVectorStoreTest)
+{
+    const int dim = 16;
+    std::string path = "fullvectors_test.bin";
+    std::remove(path.c_str());
+    {
+        FullVectorStore store(path, dim * sizeof(float));
+        BOOST_REQUIRE(store.Available());
+        std::vector<float> vec(dim);
+        for (SizeType vid = 0; vid < 200; vid++) {
+            std::fill(vec.begin(), vec.end(), (float)vid);
+            BOOST_CHECK(store.Put(vid, vec.data()) == ErrorCode::Success);
+        }
+        BOOST_CHECK(store.Sync());
+
+        // unordered ids, neighbours, duplicates and a gap, each row gets its own vector
+        std::vector<SizeType> vids = { 57, 3, 4, 5, 199, 4, 100, 6, 58 };
+        std::vector<std::vector<float>> rows(vids.size(), std::vector<float>(dim));
+        std::vector<char*> ptrs;
+        for (auto& row : rows) ptrs.push_back((char*)row.data());
+        BOOST_CHECK(store.MultiGet(vids, ptrs) == ErrorCode::Success);
+        for (size_t i = 0; i < vids.size(); i++) BOOST_CHECK(rows[i] == std::vector<float>(dim, (float)vids[i]));
+
+        // past the end of the file
+        BOOST_CHECK(store.Get(1000, vec.data()) == ErrorCode::DiskIOFail);
+        BOOST_CHECK(store.Get(7, vec.data()) == ErrorCode::Success);
+        BOOST_CHECK(vec == std::vector<float>(dim, 7.0f));
+    }
+    {
+        // reopened store keeps its vectors
+        FullVectorStore store(path, dim * sizeof(float));
+        std::vector<float> vec(dim);
+        BOOST_CHECK(store.Get(123, vec.data()) == ErrorCode::Success);
+        BOOST_CHECK(vec == std::vector<float>(dim, 123.0f));
+    }
+    std::remove(path.c_str());
+}
+
 BOOST_AUTO_TEST_SUITE_END()
@@ -2,9 +2,14 @@
 // Licensed under the MIT License.
 
 // #include <bitset>
+#include <set>
 #include <vector>
+#include <atomic>
+#include <thread>
 #include "inc/Test.h"
 #include "inc/Core/Common/SIMDUtils.h"
+#include "inc/Core/Common/VersionLabel.h"
+#include "inc/Core/Common/WorkSpace.h"
 
 
 template<typename T>
@@ -55,5 +60,75 @@ BOOST_AUTO_TEST_CASE(TestDistanceComputation)
     test<std::int16_t>(32767);
 }
 
+BOOST_AUTO_TEST_CASE(TestPostingScanFilters)
+{
+    // the deleted bits span two bitmap blocks, one of them added by AddBatch
+    SPTAG::COMMON::VersionLabel labels;
+    SPTAG::SizeType size = (1 << 20) + 1000;
+    labels.Initialize(1 << 20, 1 << 20, 1 << 22);
+    BOOST_CHECK(labels.AddBatch(size - (1 << 20)) == SPTAG::ErrorCode::Success);
+    for (int i = 0; i < 5000; i++) labels.Delete(random<SPTAG::SizeType>(size));
+
+    std::vector<SPTAG::SizeType> ids(1003);
+    std::vector<std::uint8_t> keep(ids.size());
+    for (auto& id : ids) id = random<SPTAG::SizeType>(size);
+    ids[0] = size - 1;
+    int kept = labels.FilterDeleted(ids.data(), (int)ids.size(), keep.data());
+    int expected = 0;
+    for (size_t i = 0; i < ids.size(); i++) {
+        BOOST_CHECK(keep[i] == (labels.Deleted(ids[i]) ? 0 : 1));
+        expected += keep[i];
+    }
+    BOOST_CHECK(kept == expected);
+
+    // duplicates are dropped within a batch and across batches, deleted ids are left alone
+    SPTAG::COMMON::EpochHashSet deduper;
+    deduper.Reserve(8);
+    for (int round = 0; round < 2; round++) {
+        deduper.clear();
+        std::set<SPTAG::SizeType> seen;
+        for (size_t begin = 0; begin < ids.size(); begin += 100) {
+            int num = (int)std::min<size_t>(100, ids.size() - begin);
+            std::vector<std::uint8_t> batchKeep(keep.begin() + begin, keep.begin() + begin + num);
+            int dropped = deduper.CheckAndSetBatch(ids.data() + begin, num, batchKeep.data());
+            int expectedDropped = 0;
+            for (int k = 0; k < num; k++) {
+                if (!keep[begin + k]) {
+                    BOOST_CHECK(batchKeep[k] == 0);
+                    continue;
+                }
+                bool first = seen.insert(ids[begin + k]).second;
+                BOOST_CHECK(batchKeep[k] == (first ? 1 : 0));
+                if (!first) expectedDropped++;
+            }
+            BOOST_CHECK(dropped == expectedDropped);
+        }
+        for (SPTAG::SizeType id : seen) BOOST_CHECK(deduper.CheckAndSet(id));
+    }
+}
+
+BOOST_AUTO_TEST_CASE(TestDeleteDuringAppend)
+{
+    // appends start inside the bit word of ids being deleted at the same time, none of those deletes may be lost
+    SPTAG::COMMON::VersionLabel labels;
+    const SPTAG::SizeType base = 5, batch = 7, added = batch << 16;
+    labels.Initialize(base, 1024, base + added);
+    std::atomic_bool done(false);
+    std::thread appender([&]() {
+        for (SPTAG::SizeType i = 0; i < added; i += batch) labels.AddBatch(batch);
+        done = true;
+    });
+    SPTAG::SizeType next = 0;
+    while (!done || next < labels.GetVectorNum()) {
+        for (SPTAG::SizeType end = labels.GetVectorNum(); next < end; next++) labels.Delete(next);
+    }
+    appender.join();
+
+    std::vector<SPTAG::SizeType> ids(base + added);
+    std::vector<std::uint8_t> keep(ids.size());
+    for (SPTAG::SizeType i = 0; i < (SPTAG::SizeType)ids.size(); i++) ids[i] = i;
+    BOOST_CHECK(labels.FilterDeleted(ids.data(), (int)ids.size(), keep.data()) == 0);
+    BOOST_CHECK(labels.GetDeleteCount() == ids.size());
+}
 
 BOOST_AUTO_TEST_SUITE_END()